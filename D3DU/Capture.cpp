@@ -0,0 +1,430 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "Readback.hpp"
+#include "PixelUtils.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include <process.h>
+
+#define D3DU_CAPTURE_DEFAULT_DEPTH 4
+/// How long Drain waits for the writer thread, in milliseconds.
+#define D3DU_CAPTURE_DRAIN_TIMEOUT 5000
+#define D3DU_CAPTURE_WRITE_SIZE (4 * 1024 * 1024)
+#define D3DU_CAPTURE_WRITE_ALIGNMENT 4096
+
+static const CHAR frameTag[] = "FRAME\n";
+
+class D3DU_NOVTABLE CCaptureSink :
+  public ID3DUCaptureSink
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameSink)
+    INTERFACE_MAP_ENTRY(ID3DUCaptureSink)
+  END_INTERFACE_MAP
+
+  CCaptureSink()
+  {
+    _target = NULL;
+    _file = INVALID_HANDLE_VALUE;
+    _thread = NULL;
+    _wakeEvent = NULL;
+    _doneEvent = NULL;
+    _stop = FALSE;
+    _closed = TRUE;
+    _writeBuffer = NULL;
+    _writeCapacity = 0;
+    _writeUsed = 0;
+    _writeResult = S_OK;
+    _streamWidth = 0;
+    _streamHeight = 0;
+    _captured = 0;
+    _dropped = 0;
+    _rejected = 0;
+    _written = 0;
+    _bytesWritten = 0;
+  }
+
+  STDMETHOD(Construct)(LPCWSTR filename, const D3DU_CAPTURE_DESC *desc, ID3DUFrameSink *sink)
+  {
+    HRESULT hr;
+    switch(desc->Format)
+    {
+    case D3DU_CAPTURE_RAW_RGBA:
+    case D3DU_CAPTURE_RAW_BGRA:
+    case D3DU_CAPTURE_RAW_I420:
+    case D3DU_CAPTURE_Y4M_I420:
+    case D3DU_CAPTURE_Y4M_444:
+      break;
+    default:
+      return E_INVALIDARG;
+    }
+    _desc = *desc;
+    if(0 == _desc.QueueDepth)
+      _desc.QueueDepth = D3DU_CAPTURE_DEFAULT_DEPTH;
+    if(0 == _desc.FrameRateNumerator || 0 == _desc.FrameRateDenominator)
+    {
+      _desc.FrameRateNumerator = 60;
+      _desc.FrameRateDenominator = 1;
+    }
+    hr = _readback.Init(_desc.QueueDepth);
+    if(FAILED(hr))
+      return hr;
+    _queue.Init(_desc.QueueDepth);
+    _file = CreateFile(
+      filename,
+      GENERIC_WRITE,
+      FILE_SHARE_READ,
+      NULL,
+      CREATE_ALWAYS,
+      FILE_FLAG_SEQUENTIAL_SCAN,
+      NULL);
+    if(INVALID_HANDLE_VALUE == _file)
+      return HRESULT_FROM_WIN32(GetLastError());
+    _wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(!_wakeEvent)
+      return HRESULT_FROM_WIN32(GetLastError());
+    _doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(!_doneEvent)
+      return HRESULT_FROM_WIN32(GetLastError());
+    _thread = (HANDLE)_beginthreadex(NULL, 0, WriterProc, this, 0, NULL);
+    if(!_thread)
+      return E_FAIL;
+    _closed = FALSE;
+    _sink = sink;
+    return S_OK;
+  }
+
+  virtual ~CCaptureSink()
+  {
+    Close();
+    if(_wakeEvent)
+      CloseHandle(_wakeEvent);
+    if(_doneEvent)
+      CloseHandle(_doneEvent);
+    if(INVALID_HANDLE_VALUE != _file)
+      CloseHandle(_file);
+  }
+
+  STDMETHOD_(void, Attach)(ID3DUTarget *target)
+  {
+    _target = target;
+    if(_sink)
+      _sink->Attach(target);
+  }
+
+  STDMETHOD_(void, Detach)(ID3DUTarget *target)
+  {
+    Drain(target);
+    if(_sink)
+      _sink->Detach(target);
+    _target = NULL;
+  }
+
+  STDMETHOD_(void, RenderFrame)(ID3DUTarget *target)
+  {
+    HRESULT hr;
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> dc;
+    ComPtr<ID3D11RenderTargetView> rtv;
+    ComPtr<ID3D11Texture2D> frame;
+    if(_sink)
+      _sink->RenderFrame(target);
+    if(_closed)
+      return;
+    target->GetDevice(&device);
+    target->GetDC(&dc);
+    target->GetFrameRTV(&rtv);
+    if(!rtv)
+      return;
+    rtv->GetResource((ID3D11Resource**)&frame);
+    _readback.Reclaim(dc);
+    Pump(dc, FALSE);
+    hr = _readback.Push(device, dc, frame);
+    if(S_OK == hr)
+      ++_captured;
+    else
+      ++_dropped;
+  }
+
+  STDMETHOD_(void, Resize)(ID3DUTarget *target, UINT width, UINT height)
+  {
+    if(_sink)
+      _sink->Resize(target, width, height);
+  }
+
+  STDMETHOD(GetFrameSink)(ID3DUFrameSink **oSink)
+  {
+    if(!oSink)
+      return E_POINTER;
+    _sink.AddRef();
+    *oSink = _sink;
+    return S_OK;
+  }
+
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink)
+  {
+    if(_target && _sink)
+      _sink->Detach(_target);
+    _sink = sink;
+    if(_target && sink)
+      sink->Attach(_target);
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_CAPTURE_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    oStats->FramesCaptured = _captured;
+    oStats->FramesDropped = _dropped + LfLoadAcquire(&_rejected);
+    oStats->FramesWritten = LfLoadAcquire(&_written);
+    oStats->BytesWritten = (UINT64)InterlockedCompareExchange64(&_bytesWritten, 0, 0);
+    return S_OK;
+  }
+
+  STDMETHOD(Close)()
+  {
+    if(_closed)
+      return S_FALSE;
+    if(_target)
+      Drain(_target);
+    _closed = TRUE;
+    LfStoreRelease(&_stop, (LONG)TRUE);
+    SetEvent(_wakeEvent);
+    WaitForSingleObject(_thread, INFINITE);
+    CloseHandle(_thread);
+    _thread = NULL;
+    Flush();
+    if(_writeBuffer)
+    {
+      _aligned_free(_writeBuffer);
+      _writeBuffer = NULL;
+    }
+    CloseHandle(_file);
+    _file = INVALID_HANDLE_VALUE;
+    return _writeResult;
+  }
+
+private:
+  ID3DUTarget *_target;
+  ComPtr<ID3DUFrameSink> _sink;
+  D3DU_CAPTURE_DESC _desc;
+  CFrameReadback _readback;
+  CSpscQueue<CFrameReadback::Frame> _queue;
+  HANDLE _file;
+  HANDLE _thread;
+  HANDLE _wakeEvent;
+  HANDLE _doneEvent;
+  volatile LONG _stop;
+  BOOL _closed;
+  // Owned by the writer thread.
+  BYTE *_writeBuffer;
+  SIZE_T _writeCapacity;
+  SIZE_T _writeUsed;
+  HRESULT _writeResult;
+  UINT _streamWidth;
+  UINT _streamHeight;
+  // Statistics. Each counter has a single writer.
+  UINT64 _captured;
+  UINT64 _dropped;
+  volatile LONG _rejected;
+  volatile LONG _written;
+  /// 64 bit, so read and written with interlocked calls.
+  volatile LONGLONG _bytesWritten;
+
+  /// Maps finished copies and hands them over to the writer.
+  /// Copies which fail to map are counted as dropped.
+  void Pump(ID3D11DeviceContext *dc, BOOL wait)
+  {
+    HRESULT hr;
+    CFrameReadback::Frame frame;
+    BOOL pushed = FALSE;
+    for(;;)
+    {
+      hr = _readback.Map(dc, wait, &frame);
+      if(S_FALSE == hr)
+        break;
+      if(FAILED(hr))
+      {
+        ++_dropped;
+        continue;
+      }
+      _queue.Push(frame);
+      pushed = TRUE;
+    }
+    if(pushed)
+      SetEvent(_wakeEvent);
+  }
+
+  /// Waits until every copied frame reaches the writer, and unmaps all of them.
+  /// Gives up after D3DU_CAPTURE_DRAIN_TIMEOUT, leaving the frames the writer
+  /// still holds mapped until Close has stopped it.
+  void Drain(ID3DUTarget *target)
+  {
+    ComPtr<ID3D11DeviceContext> dc;
+    target->GetDC(&dc);
+    if(!_closed)
+    {
+      DWORD start = GetTickCount();
+      Pump(dc, TRUE);
+      for(;;)
+      {
+        _readback.Reclaim(dc);
+        if(_readback.IsIdle())
+          break;
+        DWORD elapsed = GetTickCount() - start;
+        if(elapsed >= D3DU_CAPTURE_DRAIN_TIMEOUT)
+        {
+          D3DU_LOG(D3DU_LOG_ERROR, "Capture writer did not catch up in %u ms.", D3DU_CAPTURE_DRAIN_TIMEOUT);
+          return;
+        }
+        WaitForSingleObject(_doneEvent, D3DU_CAPTURE_DRAIN_TIMEOUT - elapsed);
+      }
+    }
+    _readback.Reset(dc);
+  }
+
+  static unsigned int __stdcall WriterProc(void *param)
+  {
+    CCaptureSink *self = (CCaptureSink*)param;
+    CFrameReadback::Frame frame;
+    for(;;)
+    {
+      while(self->_queue.Pop(&frame))
+      {
+        self->WriteFrame(frame);
+        self->_readback.Release(frame.Slot);
+        SetEvent(self->_doneEvent);
+      }
+      if(LfLoadAcquire(&self->_stop) && 0 == self->_queue.Size())
+        break;
+      WaitForSingleObject(self->_wakeEvent, INFINITE);
+    }
+    return 0;
+  }
+
+  void WriteFrame(const CFrameReadback::Frame& frame)
+  {
+    D3DU_TRACE_ZONE("WriteCaptureFrame");
+    BOOL y4m = D3DU_CAPTURE_Y4M_I420 == _desc.Format || D3DU_CAPTURE_Y4M_444 == _desc.Format;
+    SIZE_T size = PixelFrameSize(_desc.Format, frame.Width, frame.Height);
+    SIZE_T total = size + (y4m ? sizeof(frameTag) - 1 : 0);
+    if(FAILED(_writeResult))
+    {
+      LfStoreRelease(&_rejected, _rejected + 1);
+      return;
+    }
+    if(0 == _streamWidth)
+    {
+      _streamWidth = frame.Width;
+      _streamHeight = frame.Height;
+      _writeCapacity = (total + D3DU_CAPTURE_WRITE_SIZE + D3DU_CAPTURE_WRITE_ALIGNMENT - 1)
+        & ~(SIZE_T)(D3DU_CAPTURE_WRITE_ALIGNMENT - 1);
+      _writeBuffer = (BYTE*)_aligned_malloc(_writeCapacity, D3DU_CAPTURE_WRITE_ALIGNMENT);
+      if(!_writeBuffer)
+      {
+        _writeResult = E_OUTOFMEMORY;
+        LfStoreRelease(&_rejected, _rejected + 1);
+        return;
+      }
+      if(y4m)
+      {
+        CHAR header[128];
+        int n = sprintf_s(
+          header,
+          sizeof(header),
+          "YUV4MPEG2 W%u H%u F%u:%u Ip A1:1 %s XCOLORRANGE=LIMITED\n",
+          _streamWidth,
+          _streamHeight,
+          _desc.FrameRateNumerator,
+          _desc.FrameRateDenominator,
+          D3DU_CAPTURE_Y4M_444 == _desc.Format ? "C444" : "C420");
+        memcpy(_writeBuffer, header, n);
+        _writeUsed = n;
+      }
+    }
+    if(frame.Width != _streamWidth || frame.Height != _streamHeight)
+    {
+      LfStoreRelease(&_rejected, _rejected + 1);
+      return;
+    }
+    if(_writeUsed + total > _writeCapacity)
+      Flush();
+    if(y4m)
+    {
+      memcpy(_writeBuffer + _writeUsed, frameTag, sizeof(frameTag) - 1);
+      _writeUsed += sizeof(frameTag) - 1;
+    }
+    PixelConvert(
+      _desc.Format,
+      _writeBuffer + _writeUsed,
+      frame.Data,
+      frame.RowPitch,
+      frame.Width,
+      frame.Height,
+      CFrameReadback::IsBgra(frame.Format));
+    _writeUsed += size;
+    if(_writeUsed >= D3DU_CAPTURE_WRITE_SIZE)
+      Flush();
+    LfStoreRelease(&_written, _written + 1);
+  }
+
+  void Flush()
+  {
+    DWORD written;
+    if(0 == _writeUsed || FAILED(_writeResult))
+      return;
+    if(!WriteFile(_file, _writeBuffer, (DWORD)_writeUsed, &written, NULL))
+      _writeResult = HRESULT_FROM_WIN32(GetLastError());
+    InterlockedExchangeAdd64(&_bytesWritten, (LONGLONG)written);
+    _writeUsed = 0;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateCaptureSink(
+  LPCWSTR filename,
+  const D3DU_CAPTURE_DESC *desc,
+  ID3DUFrameSink *sink,
+  ID3DUCaptureSink **oCapture)
+{
+  if(!oCapture)
+    return E_POINTER;
+  *oCapture = NULL;
+  if(!filename || !desc)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CCaptureSink> *capture = new ComObject<CCaptureSink>();
+  hr = capture->Construct(filename, desc, sink);
+  if(FAILED(hr))
+  {
+    delete capture;
+    return hr;
+  }
+  *oCapture = capture;
+  return S_OK;
+}
@@ -0,0 +1,179 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __CONSTANT_BUFFER_HPP__
+#define __CONSTANT_BUFFER_HPP__
+
+#include <stddef.h>
+#include <string.h>
+#include <d3d11.h>
+#include "ComUtils.hpp"
+
+/// HLSL packs constants into 16 byte registers, and never lets a value
+/// cross from one register into the next; a float3 following a float3
+/// starts at the next register, while C++ puts it right after the first.
+/// Check every member of a constant buffer struct with this, next to the
+/// struct, to have such mismatches fail to compile:
+///
+///   typedef struct { XMFLOAT3 a; FLOAT pad; XMFLOAT3 b; FLOAT pad2; } Colors;
+///   D3DU_CHECK_CONSTANT(Colors, a);
+///   D3DU_CHECK_CONSTANT(Colors, b);
+///
+/// HLSL arrays place every element at a register of its own, which no
+/// check of the C++ side can see; use arrays of 16 byte types.
+#define D3DU_CHECK_CONSTANT(type, member) \
+  static_assert(offsetof(type, member) % 16 == 0 \
+    || offsetof(type, member) % 16 + sizeof(((type*)0)->member) <= 16, \
+    #type "::" #member " crosses a 16 byte register boundary")
+
+/// Pins a member to the packoffset the shader declares, in bytes.
+#define D3DU_CHECK_CONSTANT_OFFSET(type, member, offset) \
+  static_assert(offsetof(type, member) == (offset), \
+    #type "::" #member " is not at offset " #offset)
+
+/// Constant buffer holding a T, and a copy of it on the CPU.
+/// Set compares new values with that copy register by register and marks
+/// only the registers that really change; Update uploads the buffer when
+/// any register is marked and does nothing otherwise. Constants that stay
+/// the same from frame to frame therefore cost no bandwidth at all.
+/// Direct3D 11.0 updates constant buffers as a whole, so a single marked
+/// register uploads everything.
+template<class T>
+class D3DUConstantBuffer
+{
+  static_assert(sizeof(T) % 16 == 0, "Constant buffer size must be a multiple of 16 bytes");
+  static_assert(sizeof(T) <= 65536, "Constant buffers hold at most 4096 registers");
+
+public:
+  enum { REGISTER_COUNT = sizeof(T) / 16 };
+
+  /// Contents start zeroed.
+  D3DUConstantBuffer()
+  {
+    memset(&_data, 0, sizeof(_data));
+    memset(_dirty, 0, sizeof(_dirty));
+    _uploads = 0;
+  }
+
+  HRESULT Create(ID3D11Device *device)
+  {
+    D3D11_BUFFER_DESC bd = {0};
+    D3D11_SUBRESOURCE_DATA sd = {0};
+    bd.ByteWidth = sizeof(T);
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    sd.pSysMem = &_data;
+    _buffer.Release();
+    memset(_dirty, 0, sizeof(_dirty));
+    return device->CreateBuffer(&bd, &sd, &_buffer);
+  }
+
+  void Release()
+  {
+    _buffer.Release();
+  }
+
+  /// Not referenced.
+  ID3D11Buffer *GetBuffer()
+  {
+    return _buffer;
+  }
+
+  const T &Get() const
+  {
+    return _data;
+  }
+
+  void Set(const T &value)
+  {
+    SetRange(0, &value, sizeof(T));
+  }
+
+  /// buffer.Set(&Colors::a, XMFLOAT3(1, 0, 0));
+  template<class M>
+  void Set(M T::*member, const M &value)
+  {
+    SetRange((UINT)((const BYTE*)&(_data.*member) - (const BYTE*)&_data), &value, sizeof(M));
+  }
+
+  BOOL IsDirty() const
+  {
+    for(UINT i = 0; i < ARRAYSIZE(_dirty); ++i)
+    {
+      if(_dirty[i])
+        return TRUE;
+    }
+    return FALSE;
+  }
+
+  BOOL IsRegisterDirty(UINT reg) const
+  {
+    return 0 != (_dirty[reg / 32] & (1u << (reg % 32)));
+  }
+
+  /// S_FALSE when nothing changed since the last upload.
+  HRESULT Update(ID3D11DeviceContext *context)
+  {
+    if(!_buffer)
+      return E_FAIL;
+    if(!IsDirty())
+      return S_FALSE;
+    context->UpdateSubresource(_buffer, 0, NULL, &_data, 0, 0);
+    memset(_dirty, 0, sizeof(_dirty));
+    ++_uploads;
+    return S_OK;
+  }
+
+  UINT64 GetUploadCount() const
+  {
+    return _uploads;
+  }
+
+private:
+  T _data;
+  UINT _dirty[(REGISTER_COUNT + 31) / 32];
+  ComPtr<ID3D11Buffer> _buffer;
+  UINT64 _uploads;
+
+  void SetRange(UINT offset, const void *data, UINT size)
+  {
+    const BYTE *src = (const BYTE*)data;
+    BYTE *dst = (BYTE*)&_data + offset;
+    while(size)
+    {
+      UINT reg = offset / 16;
+      UINT chunk = 16 - offset % 16;
+      if(chunk > size)
+        chunk = size;
+      if(0 != memcmp(dst, src, chunk))
+      {
+        memcpy(dst, src, chunk);
+        _dirty[reg / 32] |= 1u << (reg % 32);
+      }
+      src += chunk;
+      dst += chunk;
+      offset += chunk;
+      size -= chunk;
+    }
+  }
+};
+
+#endif // __CONSTANT_BUFFER_HPP__
@@ -0,0 +1,829 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __CONTEXT_PROXY_HPP__
+#define __CONTEXT_PROXY_HPP__
+
+/// Implements ID3D11DeviceContext, which `Base' derives from, by passing
+/// every call on to the wrapped context in `_context'. Wrappers derive
+/// from it and override the calls they care about.
+template<class Base>
+class D3DU_NOVTABLE CContextProxy :
+  public Base
+{
+public:
+  STDMETHOD_(void, GetDevice)(ID3D11Device **device)
+  {
+    _context->GetDevice(device);
+  }
+
+  STDMETHOD(GetPrivateData)(REFGUID guid, UINT *dataSize, void *data)
+  {
+    return _context->GetPrivateData(guid, dataSize, data);
+  }
+
+  STDMETHOD(SetPrivateData)(REFGUID guid, UINT dataSize, const void *data)
+  {
+    return _context->SetPrivateData(guid, dataSize, data);
+  }
+
+  STDMETHOD(SetPrivateDataInterface)(REFGUID guid, const IUnknown *data)
+  {
+    return _context->SetPrivateDataInterface(guid, data);
+  }
+
+  STDMETHOD_(void, VSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->VSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, PSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->PSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, PSSetShader)(
+    ID3D11PixelShader *pixelShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->PSSetShader(pixelShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->PSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, VSSetShader)(
+    ID3D11VertexShader *vertexShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->VSSetShader(vertexShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, DrawIndexed)(UINT indexCount, UINT startIndexLocation, INT baseVertexLocation)
+  {
+    _context->DrawIndexed(indexCount, startIndexLocation, baseVertexLocation);
+  }
+
+  STDMETHOD_(void, Draw)(UINT vertexCount, UINT startVertexLocation)
+  {
+    _context->Draw(vertexCount, startVertexLocation);
+  }
+
+  STDMETHOD(Map)(
+    ID3D11Resource *resource,
+    UINT subresource,
+    D3D11_MAP mapType,
+    UINT mapFlags,
+    D3D11_MAPPED_SUBRESOURCE *mappedResource)
+  {
+    return _context->Map(resource, subresource, mapType, mapFlags, mappedResource);
+  }
+
+  STDMETHOD_(void, Unmap)(ID3D11Resource *resource, UINT subresource)
+  {
+    _context->Unmap(resource, subresource);
+  }
+
+  STDMETHOD_(void, PSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->PSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, IASetInputLayout)(ID3D11InputLayout *inputLayout)
+  {
+    _context->IASetInputLayout(inputLayout);
+  }
+
+  STDMETHOD_(void, IASetVertexBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *vertexBuffers,
+    const UINT *strides,
+    const UINT *offsets)
+  {
+    _context->IASetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+  }
+
+  STDMETHOD_(void, IASetIndexBuffer)(ID3D11Buffer *indexBuffer, DXGI_FORMAT format, UINT offset)
+  {
+    _context->IASetIndexBuffer(indexBuffer, format, offset);
+  }
+
+  STDMETHOD_(void, DrawIndexedInstanced)(
+    UINT indexCountPerInstance,
+    UINT instanceCount,
+    UINT startIndexLocation,
+    INT baseVertexLocation,
+    UINT startInstanceLocation)
+  {
+    _context->DrawIndexedInstanced(indexCountPerInstance, instanceCount, startIndexLocation, baseVertexLocation, startInstanceLocation);
+  }
+
+  STDMETHOD_(void, DrawInstanced)(
+    UINT vertexCountPerInstance,
+    UINT instanceCount,
+    UINT startVertexLocation,
+    UINT startInstanceLocation)
+  {
+    _context->DrawInstanced(vertexCountPerInstance, instanceCount, startVertexLocation, startInstanceLocation);
+  }
+
+  STDMETHOD_(void, GSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->GSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, GSSetShader)(
+    ID3D11GeometryShader *shader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->GSSetShader(shader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, IASetPrimitiveTopology)(D3D11_PRIMITIVE_TOPOLOGY topology)
+  {
+    _context->IASetPrimitiveTopology(topology);
+  }
+
+  STDMETHOD_(void, VSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->VSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, VSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->VSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, Begin)(ID3D11Asynchronous *async)
+  {
+    _context->Begin(async);
+  }
+
+  STDMETHOD_(void, End)(ID3D11Asynchronous *async)
+  {
+    _context->End(async);
+  }
+
+  STDMETHOD(GetData)(ID3D11Asynchronous *async, void *data, UINT dataSize, UINT getDataFlags)
+  {
+    return _context->GetData(async, data, dataSize, getDataFlags);
+  }
+
+  STDMETHOD_(void, SetPredication)(ID3D11Predicate *predicate, BOOL predicateValue)
+  {
+    _context->SetPredication(predicate, predicateValue);
+  }
+
+  STDMETHOD_(void, GSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->GSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, GSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->GSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargets)(
+    UINT numViews,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView)
+  {
+    _context->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargetsAndUnorderedAccessViews)(
+    UINT numRTVs,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView,
+    UINT uavStartSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    _context->OMSetRenderTargetsAndUnorderedAccessViews(numRTVs, renderTargetViews, depthStencilView, uavStartSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+  }
+
+  STDMETHOD_(void, OMSetBlendState)(
+    ID3D11BlendState *blendState,
+    const FLOAT blendFactor[4],
+    UINT sampleMask)
+  {
+    _context->OMSetBlendState(blendState, blendFactor, sampleMask);
+  }
+
+  STDMETHOD_(void, OMSetDepthStencilState)(
+    ID3D11DepthStencilState *depthStencilState,
+    UINT stencilRef)
+  {
+    _context->OMSetDepthStencilState(depthStencilState, stencilRef);
+  }
+
+  STDMETHOD_(void, SOSetTargets)(
+    UINT numBuffers,
+    ID3D11Buffer *const *soTargets,
+    const UINT *offsets)
+  {
+    _context->SOSetTargets(numBuffers, soTargets, offsets);
+  }
+
+  STDMETHOD_(void, DrawAuto)()
+  {
+    _context->DrawAuto();
+  }
+
+  STDMETHOD_(void, DrawIndexedInstancedIndirect)(
+    ID3D11Buffer *bufferForArgs,
+    UINT alignedByteOffsetForArgs)
+  {
+    _context->DrawIndexedInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, DrawInstancedIndirect)(
+    ID3D11Buffer *bufferForArgs,
+    UINT alignedByteOffsetForArgs)
+  {
+    _context->DrawInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, Dispatch)(
+    UINT threadGroupCountX,
+    UINT threadGroupCountY,
+    UINT threadGroupCountZ)
+  {
+    _context->Dispatch(threadGroupCountX, threadGroupCountY, threadGroupCountZ);
+  }
+
+  STDMETHOD_(void, DispatchIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    _context->DispatchIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, RSSetState)(ID3D11RasterizerState *rasterizerState)
+  {
+    _context->RSSetState(rasterizerState);
+  }
+
+  STDMETHOD_(void, RSSetViewports)(UINT numViewports, const D3D11_VIEWPORT *viewports)
+  {
+    _context->RSSetViewports(numViewports, viewports);
+  }
+
+  STDMETHOD_(void, RSSetScissorRects)(UINT numRects, const D3D11_RECT *rects)
+  {
+    _context->RSSetScissorRects(numRects, rects);
+  }
+
+  STDMETHOD_(void, CopySubresourceRegion)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    UINT dstX,
+    UINT dstY,
+    UINT dstZ,
+    ID3D11Resource *srcResource,
+    UINT srcSubresource,
+    const D3D11_BOX *srcBox)
+  {
+    _context->CopySubresourceRegion(dstResource, dstSubresource, dstX, dstY, dstZ, srcResource, srcSubresource, srcBox);
+  }
+
+  STDMETHOD_(void, CopyResource)(ID3D11Resource *dstResource, ID3D11Resource *srcResource)
+  {
+    _context->CopyResource(dstResource, srcResource);
+  }
+
+  STDMETHOD_(void, UpdateSubresource)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    const D3D11_BOX *dstBox,
+    const void *srcData,
+    UINT srcRowPitch,
+    UINT srcDepthPitch)
+  {
+    _context->UpdateSubresource(dstResource, dstSubresource, dstBox, srcData, srcRowPitch, srcDepthPitch);
+  }
+
+  STDMETHOD_(void, CopyStructureCount)(
+    ID3D11Buffer *dstBuffer,
+    UINT dstAlignedByteOffset,
+    ID3D11UnorderedAccessView *srcView)
+  {
+    _context->CopyStructureCount(dstBuffer, dstAlignedByteOffset, srcView);
+  }
+
+  STDMETHOD_(void, ClearRenderTargetView)(
+    ID3D11RenderTargetView *renderTargetView,
+    const FLOAT colorRGBA[4])
+  {
+    _context->ClearRenderTargetView(renderTargetView, colorRGBA);
+  }
+
+  STDMETHOD_(void, ClearUnorderedAccessViewUint)(
+    ID3D11UnorderedAccessView *unorderedAccessView,
+    const UINT values[4])
+  {
+    _context->ClearUnorderedAccessViewUint(unorderedAccessView, values);
+  }
+
+  STDMETHOD_(void, ClearUnorderedAccessViewFloat)(
+    ID3D11UnorderedAccessView *unorderedAccessView,
+    const FLOAT values[4])
+  {
+    _context->ClearUnorderedAccessViewFloat(unorderedAccessView, values);
+  }
+
+  STDMETHOD_(void, ClearDepthStencilView)(
+    ID3D11DepthStencilView *depthStencilView,
+    UINT clearFlags,
+    FLOAT depth,
+    UINT8 stencil)
+  {
+    _context->ClearDepthStencilView(depthStencilView, clearFlags, depth, stencil);
+  }
+
+  STDMETHOD_(void, GenerateMips)(ID3D11ShaderResourceView *shaderResourceView)
+  {
+    _context->GenerateMips(shaderResourceView);
+  }
+
+  STDMETHOD_(void, SetResourceMinLOD)(ID3D11Resource *resource, FLOAT minLOD)
+  {
+    _context->SetResourceMinLOD(resource, minLOD);
+  }
+
+  STDMETHOD_(FLOAT, GetResourceMinLOD)(ID3D11Resource *resource)
+  {
+    return _context->GetResourceMinLOD(resource);
+  }
+
+  STDMETHOD_(void, ResolveSubresource)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    ID3D11Resource *srcResource,
+    UINT srcSubresource,
+    DXGI_FORMAT format)
+  {
+    _context->ResolveSubresource(dstResource, dstSubresource, srcResource, srcSubresource, format);
+  }
+
+  STDMETHOD_(void, ExecuteCommandList)(ID3D11CommandList *commandList, BOOL restoreContextState)
+  {
+    _context->ExecuteCommandList(commandList, restoreContextState);
+  }
+
+  STDMETHOD_(void, HSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->HSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, HSSetShader)(
+    ID3D11HullShader *hullShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->HSSetShader(hullShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, HSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->HSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, HSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->HSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, DSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->DSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, DSSetShader)(
+    ID3D11DomainShader *domainShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->DSSetShader(domainShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, DSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->DSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, DSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->DSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, CSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->CSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, CSSetUnorderedAccessViews)(
+    UINT startSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    _context->CSSetUnorderedAccessViews(startSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+  }
+
+  STDMETHOD_(void, CSSetShader)(
+    ID3D11ComputeShader *computeShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    _context->CSSetShader(computeShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, CSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    _context->CSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, CSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    _context->CSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, VSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->VSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, PSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->PSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, PSGetShader)(
+    ID3D11PixelShader **pixelShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->PSGetShader(pixelShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->PSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, VSGetShader)(
+    ID3D11VertexShader **vertexShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->VSGetShader(vertexShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->PSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, IAGetInputLayout)(ID3D11InputLayout **inputLayout)
+  {
+    _context->IAGetInputLayout(inputLayout);
+  }
+
+  STDMETHOD_(void, IAGetVertexBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **vertexBuffers,
+    UINT *strides,
+    UINT *offsets)
+  {
+    _context->IAGetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+  }
+
+  STDMETHOD_(void, IAGetIndexBuffer)(
+    ID3D11Buffer **indexBuffer,
+    DXGI_FORMAT *format,
+    UINT *offset)
+  {
+    _context->IAGetIndexBuffer(indexBuffer, format, offset);
+  }
+
+  STDMETHOD_(void, GSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->GSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, GSGetShader)(
+    ID3D11GeometryShader **geometryShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->GSGetShader(geometryShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, IAGetPrimitiveTopology)(D3D11_PRIMITIVE_TOPOLOGY *topology)
+  {
+    _context->IAGetPrimitiveTopology(topology);
+  }
+
+  STDMETHOD_(void, VSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->VSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, VSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->VSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, GetPredication)(ID3D11Predicate **predicate, BOOL *predicateValue)
+  {
+    _context->GetPredication(predicate, predicateValue);
+  }
+
+  STDMETHOD_(void, GSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->GSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, GSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->GSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, OMGetRenderTargets)(
+    UINT numViews,
+    ID3D11RenderTargetView **renderTargetViews,
+    ID3D11DepthStencilView **depthStencilView)
+  {
+    _context->OMGetRenderTargets(numViews, renderTargetViews, depthStencilView);
+  }
+
+  STDMETHOD_(void, OMGetRenderTargetsAndUnorderedAccessViews)(
+    UINT numRTVs,
+    ID3D11RenderTargetView **renderTargetViews,
+    ID3D11DepthStencilView **depthStencilView,
+    UINT uavStartSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView **unorderedAccessViews)
+  {
+    _context->OMGetRenderTargetsAndUnorderedAccessViews(numRTVs, renderTargetViews, depthStencilView, uavStartSlot, numUavs, unorderedAccessViews);
+  }
+
+  STDMETHOD_(void, OMGetBlendState)(
+    ID3D11BlendState **blendState,
+    FLOAT blendFactor[4],
+    UINT *sampleMask)
+  {
+    _context->OMGetBlendState(blendState, blendFactor, sampleMask);
+  }
+
+  STDMETHOD_(void, OMGetDepthStencilState)(
+    ID3D11DepthStencilState **depthStencilState,
+    UINT *stencilRef)
+  {
+    _context->OMGetDepthStencilState(depthStencilState, stencilRef);
+  }
+
+  STDMETHOD_(void, SOGetTargets)(UINT numBuffers, ID3D11Buffer **soTargets)
+  {
+    _context->SOGetTargets(numBuffers, soTargets);
+  }
+
+  STDMETHOD_(void, RSGetState)(ID3D11RasterizerState **rasterizerState)
+  {
+    _context->RSGetState(rasterizerState);
+  }
+
+  STDMETHOD_(void, RSGetViewports)(UINT *numViewports, D3D11_VIEWPORT *viewports)
+  {
+    _context->RSGetViewports(numViewports, viewports);
+  }
+
+  STDMETHOD_(void, RSGetScissorRects)(UINT *numRects, D3D11_RECT *rects)
+  {
+    _context->RSGetScissorRects(numRects, rects);
+  }
+
+  STDMETHOD_(void, HSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->HSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, HSGetShader)(
+    ID3D11HullShader **hullShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->HSGetShader(hullShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, HSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->HSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, HSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->HSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, DSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->DSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, DSGetShader)(
+    ID3D11DomainShader **domainShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->DSGetShader(domainShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, DSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->DSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, DSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->DSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, CSGetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView **shaderResourceViews)
+  {
+    _context->CSGetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, CSGetUnorderedAccessViews)(
+    UINT startSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView **unorderedAccessViews)
+  {
+    _context->CSGetUnorderedAccessViews(startSlot, numUavs, unorderedAccessViews);
+  }
+
+  STDMETHOD_(void, CSGetShader)(
+    ID3D11ComputeShader **computeShader,
+    ID3D11ClassInstance **classInstances,
+    UINT *numClassInstances)
+  {
+    _context->CSGetShader(computeShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, CSGetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState **samplers)
+  {
+    _context->CSGetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, CSGetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer **constantBuffers)
+  {
+    _context->CSGetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, ClearState)()
+  {
+    _context->ClearState();
+  }
+
+  STDMETHOD_(void, Flush)()
+  {
+    _context->Flush();
+  }
+
+  STDMETHOD_(D3D11_DEVICE_CONTEXT_TYPE, GetType)()
+  {
+    return _context->GetType();
+  }
+
+  STDMETHOD_(UINT, GetContextFlags)()
+  {
+    return _context->GetContextFlags();
+  }
+
+  STDMETHOD(FinishCommandList)(BOOL restoreDeferredContextState, ID3D11CommandList **commandList)
+  {
+    return _context->FinishCommandList(restoreDeferredContextState, commandList);
+  }
+
+protected:
+  ComPtr<ID3D11DeviceContext> _context;
+};
+
+#endif // __CONTEXT_PROXY_HPP__
@@ -22,6 +22,94 @@
 
 #include "StdAfx.h"
 #include "D3DU.h"
+#include "ResolutionController.hpp"
+#include "Upscaler.hpp"
+#include "Instrumentation.hpp"
+#include "ReleaseQueue.hpp"
+#include "InputQueue.hpp"
+#include "FrameStats.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include "ThreadUtils.hpp"
+
+/// A pending resize is applied once the window size has not changed
+/// for D3DU_RESIZE_SETTLE_MS, but no later than D3DU_RESIZE_MAX_DELAY_MS
+/// after the first change, so dragging a window edge reallocates buffers
+/// a few times per second at most.
+#define D3DU_RESIZE_SETTLE_MS 50
+#define D3DU_RESIZE_MAX_DELAY_MS 250
+
+/// Longer frames are taken for stalls (window drags, breakpoints)
+/// and restart frame time measurement instead of lowering the scale.
+#define D3DU_DYNAMIC_RESOLUTION_STALL_MS 1000
+
+/// Input events queued between two frames, and delivered to the mouse
+/// sink in one call.
+#define D3DU_INPUT_QUEUE_SIZE 1024
+#define D3DU_INPUT_BATCH_SIZE 256
+
+typedef CInputQueue<D3DU_INPUT_EVENT, D3DU_INPUT_MOUSE_MOVE> CWindowInputQueue;
+
+/// What animations read instead of QueryPerformanceCounter while
+/// D3DUSetFixedClock is in effect, and the ticks each frame adds to it;
+/// zero step is the wall clock.
+static volatile LONGLONG g_fixedClock = 0;
+static volatile LONGLONG g_fixedClockStep = 0;
+
+static void ClockNow(LARGE_INTEGER *oNow)
+{
+  if(InterlockedCompareExchange64(&g_fixedClockStep, 0, 0))
+    oNow->QuadPart = InterlockedCompareExchange64(&g_fixedClock, 0, 0);
+  else
+    QueryPerformanceCounter(oNow);
+}
+
+static void ClockAdvance()
+{
+  LONGLONG step = InterlockedCompareExchange64(&g_fixedClockStep, 0, 0);
+  if(step)
+    InterlockedExchangeAdd64(&g_fixedClock, step);
+}
+
+/// Devices whose targets D3DURenderTargets is drawing. Their targets
+/// leave the end of the frame to it, so that the resource pool and the
+/// recording of a device, and the fixed clock, step once per batch
+/// rather than once per target. Batches on other threads link their
+/// own entries; they are on the stack of D3DURenderTargets.
+typedef struct FrameBatch
+{
+  ID3DUDevice *Devices[D3DU_MAX_BATCH_TARGETS];
+  BOOL Drawn[D3DU_MAX_BATCH_TARGETS];
+  UINT Count;
+  struct FrameBatch *Next;
+} FrameBatch;
+
+static CLock g_batchLock;
+static FrameBatch *g_batches = NULL;
+
+static BOOL InBatch(ID3DUDevice *device)
+{
+  CAutoLock lock(g_batchLock);
+  for(FrameBatch *batch = g_batches; batch; batch = batch->Next)
+  {
+    for(UINT i = 0; i < batch->Count; ++i)
+    {
+      if(batch->Devices[i] == device)
+        return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/// Returns the frame textures of the pool of `device' and marks the end
+/// of the frame in its recording.
+static void EndDeviceFrame(ID3DUDevice *device)
+{
+  ComPtr<ID3DUResourcePool> pool;
+  if(SUCCEEDED(device->GetResourcePool(&pool)))
+    pool->EndFrame();
+  device->EndFrame();
+}
 
 class D3DU_NOVTABLE CFloatAnimation :
   public ID3DUFloatAnimation
@@ -52,7 +140,7 @@ public:
   {
     if(!_started)
     {
-      QueryPerformanceCounter(&_counter);
+      ClockNow(&_counter);
       _started = TRUE;
       Query(&_current);
       return S_OK;
@@ -89,7 +177,7 @@ public:
       return S_OK;
     }
     LARGE_INTEGER tmpCounter;
-    QueryPerformanceCounter(&tmpCounter);
+    ClockNow(&tmpCounter);
     FLOAT dt = (tmpCounter.QuadPart - _counter.QuadPart)
                / (FLOAT)_freq.QuadPart
                / _interval
@@ -202,116 +290,112 @@ private:
   LARGE_INTEGER _counter;
 };
 
-class D3DU_NOVTABLE CWindowTarget :
-  public ID3DUWindowTarget
+class D3DU_NOVTABLE CFrameStats :
+  public ID3DUFrameStats
 {
 public:
 
   BEGIN_INTERFACE_MAP
-    INTERFACE_MAP_ENTRY(ID3DUTarget)
-    INTERFACE_MAP_ENTRY(ID3DUWindowTarget)
+    INTERFACE_MAP_ENTRY(ID3DUFrameStats)
   END_INTERFACE_MAP
 
-  CWindowTarget() { }
+  CFrameStats()
+  {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    _freq = freq.QuadPart;
+  }
 
-  STDMETHOD(Construct)(
-    UINT x,
-    UINT y,
-    UINT width,
-    UINT height,
-    D3D_FEATURE_LEVEL fl,
-    BOOL acceptSw,
-    HWND parent)
+  virtual ~CFrameStats() { }
+
+  STDMETHOD(GetFrameTimes)(D3DU_FRAME_TIME time, D3DU_FRAME_TIME_STATISTICS *oStats)
   {
-    HRESULT hr;
-    _wState = D3DU_WINDOW_CLOSED;
-    hr = InitWindow(x, y, width, height, parent);
-    if(FAILED(hr))
-      return hr;
-    RECT rc;
-    GetClientRect(_hwnd, &rc);
-    width = rc.right - rc.left;
-    height = rc.bottom - rc.top;
-    hr = InitDevice(width, height, fl, acceptSw);
-    if(FAILED(hr))
-      return hr;
-    hr = InitTargets(width, height, fl);
-    if(FAILED(hr))
-      return hr;
-    _wState = D3DU_WINDOW_NORMALIZED;
+    CFrameTimeHistogram h;
+    if(!oStats)
+      return E_POINTER;
+    if((UINT)time >= D3DU_FRAME_TIME_COUNT)
+      return E_INVALIDARG;
+    _recorder.Snapshot(time, &h);
+    oStats->Samples = h.Count;
+    oStats->Min = Milliseconds(h.Min());
+    oStats->Mean = (FLOAT)(h.Mean() / 1000.0);
+    oStats->P50 = Milliseconds(h.Percentile(0.50));
+    oStats->P95 = Milliseconds(h.Percentile(0.95));
+    oStats->P99 = Milliseconds(h.Percentile(0.99));
+    oStats->Max = Milliseconds(h.Max());
     return S_OK;
   }
-  virtual ~CWindowTarget()
+
+  STDMETHOD(GetPercentile)(D3DU_FRAME_TIME time, FLOAT percentile, FLOAT *oMilliseconds)
   {
-    if(_hwnd)
-    {
-      DestroyWindow(_hwnd);
-      _hwnd = NULL;
-    }
+    CFrameTimeHistogram h;
+    if(!oMilliseconds)
+      return E_POINTER;
+    if((UINT)time >= D3DU_FRAME_TIME_COUNT || !(percentile >= 0.0f && percentile <= 100.0f))
+      return E_INVALIDARG;
+    _recorder.Snapshot(time, &h);
+    *oMilliseconds = Milliseconds(h.Percentile(percentile / 100.0));
+    return S_OK;
   }
-  STDMETHOD(Render)()
+
+  STDMETHOD(Reset)()
   {
-    switch(_wState)
-    {
-    case D3DU_WINDOW_CLOSED:
-      {
-#ifdef D3DU_DEBUG
-        OutputDebugString(L"Window is closed! Unable to render!\n");
-#endif
-        return E_FAIL;
-      }
-    case D3DU_WINDOW_MINIMIZED:
-    case D3DU_WINDOW_HIDDEN:
-      break;
-    case D3DU_WINDOW_RESIZING:
-      _swapChain->Present(0, 0);
-      break;
-    default:
-      if(_frameSink)
-        _frameSink->RenderFrame(this);
-      _swapChain->Present(0, 0);
-    }
+    _recorder.Reset();
     return S_OK;
-  }  
-  STDMETHOD(GetSize)(UINT *oWidth, UINT *oHeight)
+  }
+
+  /// Render thread only.
+  void Record(D3DU_FRAME_TIME time, LONGLONG ticks)
   {
-    if(D3DU_WINDOW_CLOSED == _wState)
-    {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Window is closed! Unable to obtain size!\n");
-#endif
-      return E_FAIL;
-    }
-    if(!oWidth || !oHeight)
-      return E_POINTER;
-    RECT rc;
-    GetClientRect(_hwnd, &rc);
-    *oWidth = rc.right - rc.left;
-    *oHeight = rc.bottom - rc.top;
-    return S_OK;
+    LONGLONG us = ticks * 1000000 / _freq;
+    if(us < 0)
+      us = 0;
+    else if(us > 0xFFFFFFFF)
+      us = 0xFFFFFFFF;
+    _recorder.Add(time, (unsigned)us);
   }
-  STDMETHOD(SetSize)(UINT width, UINT height)
+
+private:
+  LONGLONG _freq;
+  CFrameTimeRecorder<D3DU_FRAME_TIME_COUNT, D3DU_FRAME_TIME_WINDOW> _recorder;
+
+  static FLOAT Milliseconds(unsigned us)
   {
-    if(D3DU_WINDOW_CLOSED == _wState)
-    {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Window is closed! Unable to resize!\n");
-#endif
-      return E_FAIL;
-    }
-    RECT rw;
-    GetWindowRect(_hwnd, &rw);
-    if(!MoveWindow(
-          _hwnd,
-          rw.left,
-          rw.top,
-          width,
-          height,
-          TRUE))
-    {
-      return HRESULT_FROM_WIN32(GetLastError());
-    }
-    return S_OK;
+    return us / 1000.0f;
+  }
+};
+
+/// Implements ID3DUTarget methods common to all targets.
+/// Derived classes create _rtv, _ds and _dsv.
+template<class Base>
+class D3DU_NOVTABLE CTarget :
+  public Base
+{
+public:
+
+  CTarget()
+  {
+    memset(&_desc, 0, sizeof(_desc));
+    memset(&_stats, 0, sizeof(_stats));
+    memset(&_frameStart, 0, sizeof(_frameStart));
+    memset(&_statsSum, 0, sizeof(_statsSum));
+    _statsCount = 0;
+    _statsNext = 0;
+    _lastDraw = 0;
+    _frameStats.Attach(new ComObject<CFrameStats>());
+  }
+
+  virtual ~CTarget()
+  {
+    ReleaseDepth();
+  }
+
+  STDMETHOD(Render)()
+  {
+    HRESULT hr = Draw();
+    if(S_OK != hr)
+      return hr;
+    return Present();
   }
   STDMETHOD(GetFrameSink)(ID3DUFrameSink **oSink)
   {
@@ -329,7 +413,7 @@ public:
     if(sink)
       sink->Attach(this);
     return S_OK;
-  }  
+  }
   STDMETHOD(GetDevice)(ID3D11Device **oDevice)
   {
     if(!oDevice)
@@ -370,146 +454,644 @@ public:
     *oDSV = _dsv;
     return S_OK;
   }
-  STDMETHOD(GetKeySink)(ID3DUKeySink **oSink)
+  STDMETHOD(GetD3DUDevice)(ID3DUDevice **oDevice)
   {
-    if(!oSink)
+    if(!oDevice)
       return E_POINTER;
-    _keySink.AddRef();
-    *oSink = _keySink;
+    _d3du.AddRef();
+    *oDevice = _d3du;
     return S_OK;
   }
-  STDMETHOD(SetKeySink)(ID3DUKeySink *sink)
+  STDMETHOD(GetDesc)(D3DU_TARGET_DESC *oDesc)
   {
-    if(_keySink)
-      _keySink->Detach(this);
-    _keySink = sink;
-    if(sink)
-      sink->Attach(this);
+    if(!oDesc)
+      return E_POINTER;
+    *oDesc = _desc;
     return S_OK;
   }
-  STDMETHOD(GetMouseSink)(ID3DUMouseSink **oSink)
+  STDMETHOD(GetResourcePool)(ID3DUResourcePool **oPool)
   {
-    if(!oSink)
+    if(!oPool)
       return E_POINTER;
-    _mouseSink.AddRef();
-    *oSink = _mouseSink;
+    _pool.AddRef();
+    *oPool = _pool;
     return S_OK;
   }
-  STDMETHOD(SetMouseSink)(ID3DUMouseSink *sink)
+  STDMETHOD(GetStatistics)(D3DU_TARGET_STATISTICS *oStats)
   {
-    if(_mouseSink)
-      _mouseSink->Detach(this);
-    _mouseSink = sink;
-    if(sink)
-      sink->Attach(this);
+    if(!oStats)
+      return E_POINTER;
+    *oStats = _stats;
+    oStats->Average = _statsSum;
+    if(_statsCount)
+      WorkloadDivide(&oStats->Average, _statsCount);
     return S_OK;
   }
-  STDMETHOD(GetWindowState)(D3DU_WINDOW_STATE *oState)
+  STDMETHOD(GetUploadRing)(ID3DUUploadRing **oRing)
   {
-    if(!oState)
+    if(!oRing)
       return E_POINTER;
-    *oState = _wState;
+    _ring.AddRef();
+    *oRing = _ring;
     return S_OK;
   }
-  STDMETHOD(SetWindowState)(D3DU_WINDOW_STATE state)
+  STDMETHOD(DeferRelease)(IUnknown *object)
   {
-    if(_wState == state)
-      return S_OK;
-    if(!_hwnd)
-    {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Window is closed.\n");
-#endif
-      return E_FAIL;
-    }
-    switch(state)
-    {
-    case D3DU_WINDOW_CLOSED:
-      _swapChain->SetFullscreenState(FALSE, NULL);
-      DestroyWindow(_hwnd);
-      return S_OK;
-    case D3DU_WINDOW_NORMALIZED:
-      _swapChain->SetFullscreenState(FALSE, NULL);
-      ShowWindow(_hwnd, SW_SHOWNORMAL);
-      return S_OK;
-    case D3DU_WINDOW_HIDDEN:
-      _swapChain->SetFullscreenState(FALSE, NULL);
-      ShowWindow(_hwnd, SW_HIDE);
-      return S_OK;
-    case D3DU_WINDOW_MAXIMIZED:
-      _swapChain->SetFullscreenState(FALSE, NULL);
-      ShowWindow(_hwnd, SW_SHOWMAXIMIZED);
-      return S_OK;
-    case D3DU_WINDOW_MINIMIZED:
-      _swapChain->SetFullscreenState(FALSE, NULL);
-      ShowWindow(_hwnd, SW_SHOWMINNOACTIVE);
-      return S_OK;
-    case D3DU_WINDOW_RESIZING:
-      return E_INVALIDARG;
-    case D3DU_WINDOW_FULLSCREEN:
-      {
-        HRESULT hr = _swapChain->SetFullscreenState(TRUE, _output);
-        if(SUCCEEDED(hr))
-          _wState = D3DU_WINDOW_FULLSCREEN;
-        return hr;
-      }
-    default:
+    if(!object)
       return E_INVALIDARG;
-    }
+    _releases.Add(object);
+    return S_OK;
   }
-private:
-  static LPCWSTR className;
-  ULONG _ref;
-  HWND _hwnd;
-  D3DU_WINDOW_STATE _wState;
-  ComPtr<ID3DUFrameSink> _frameSink;
-  ComPtr<ID3DUKeySink> _keySink;
-  ComPtr<ID3DUMouseSink> _mouseSink;
-  ComPtr<IDXGIFactory> _factory;
-  ComPtr<IDXGIDevice> _dxgiDevice;
-  ComPtr<IDXGIAdapter> _adapter;
-  ComPtr<IDXGIOutput> _output;
-  ComPtr<IDXGISwapChain> _swapChain;
+  STDMETHOD(GetFrameStats)(ID3DUFrameStats **oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    _frameStats.AddRef();
+    *oStats = _frameStats;
+    return S_OK;
+  }
+
+protected:
+  D3DU_TARGET_DESC _desc;
+  ComPtr<ID3DUDevice> _d3du;
   ComPtr<ID3D11Device> _device;
   ComPtr<ID3D11DeviceContext> _dc;
   ComPtr<ID3D10Device1> _device10;
+  ComPtr<ID3DUFrameSink> _frameSink;
+  ComPtr<ID3DUResourcePool> _pool;
+  ComPtr<ID3DUUploadRing> _ring;
+  CQueryFence _fence;
+  CReleaseQueue _releases;
   ComPtr<ID3D11RenderTargetView> _rtv;
   ComPtr<ID3D11DepthStencilView> _dsv;
   ComPtr<ID3D11Texture2D> _ds;
+  D3DU_TARGET_STATISTICS _stats;
+  D3DU_WORKLOAD _frameStart;
+  D3DU_WORKLOAD _statsHistory[D3DU_STATISTICS_WINDOW];
+  D3DU_WORKLOAD _statsSum;
+  UINT _statsCount;
+  UINT _statsNext;
+  ComPtr<CFrameStats> _frameStats;
+  LONGLONG _lastDraw;
 
-  static LPCWSTR STDMETHODCALLTYPE InitClass()
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitDevice(ID3DUDevice *device)
   {
-    WNDCLASSEX wc;
-    memset(&wc, 0, sizeof(wc));
-    wc.cbSize = sizeof(wc);
-    wc.hCursor = LoadCursor(NULL, MAKEINTRESOURCE(IDC_ARROW));
-    wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
-    wc.hInstance = GetModuleHandle(NULL);
-    wc.lpfnWndProc = WindowProc;
-    wc.lpszClassName = L"CWindowTarget";
-    wc.style = CS_VREDRAW | CS_HREDRAW | CS_DBLCLKS;
-    if(INVALID_ATOM == RegisterClassEx(&wc))
-      throw HRESULT_FROM_WIN32(GetLastError());
-    return wc.lpszClassName;
+    HRESULT hr;
+    _d3du = device;
+    hr = device->GetDevice(&_device);
+    if(FAILED(hr))
+      return hr;
+    hr = device->GetDC(&_dc);
+    if(FAILED(hr))
+      return hr;
+    hr = device->GetResourcePool(&_pool);
+    if(FAILED(hr))
+      return hr;
+    hr = D3DUCreateUploadRing(_dc, 0, &_ring);
+    if(FAILED(hr))
+      return hr;
+    hr = _fence.Init(_device, _dc);
+    if(FAILED(hr))
+      return hr;
+    _releases.SetFence(&_fence);
+    return device->GetDevice10(&_device10);
   }
 
-  static LRESULT COM_DECLSPEC_NOTHROW CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+  /// Lets go of `object' once the GPU is done with the current frame.
+  template<class T>
+  void Retire(ComPtr<T> &object)
   {
-    if(WM_CREATE == msg)
+    _releases.Add(object);
+    object.Release();
+  }
+
+  /// Draw calls this after the frame sink, whether or not it drew
+  /// anything. The frame of the device ends here too, unless the target
+  /// is drawn by D3DURenderTargets, which ends it once for the batch.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE EndFrame()
+  {
+    _ring->EndFrame();
+    _releases.EndFrame();
+    if(!InBatch(_d3du))
     {
-      CWindowTarget *target = (CWindowTarget*)((LPCREATESTRUCT)lParam)->lpCreateParams;
-      SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)target);
-      return TRUE;
-    }
-    CWindowTarget* target = (CWindowTarget*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
-    if(!target)
-    {      
-      return DefWindowProc(hwnd, msg, wParam, lParam);
+      EndDeviceFrame(_d3du);
+      ClockAdvance();
     }
-    switch(msg)
-    {
-    case WM_DESTROY:
-      {
+  }
+
+  /// Draw calls these around everything it submits for a frame.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE BeginStatistics()
+  {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if(_lastDraw)
+      _frameStats->Record(D3DU_FRAME_TIME_INTERVAL, now.QuadPart - _lastDraw);
+    _lastDraw = now.QuadPart;
+    _d3du->GetWorkload(&_frameStart);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE RenderSink()
+  {
+    LARGE_INTEGER start, end;
+    if(!_frameSink)
+      return;
+    D3DU_TRACE_ZONE("RenderFrame");
+    QueryPerformanceCounter(&start);
+    _frameSink->RenderFrame(this);
+    QueryPerformanceCounter(&end);
+    _frameStats->Record(D3DU_FRAME_TIME_RENDER, end.QuadPart - start.QuadPart);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE EndStatistics()
+  {
+    D3DU_WORKLOAD frame;
+    _d3du->GetWorkload(&frame);
+    WorkloadSubtract(&frame, _frameStart);
+    if(_statsCount == D3DU_STATISTICS_WINDOW)
+      WorkloadSubtract(&_statsSum, _statsHistory[_statsNext]);
+    else
+      ++_statsCount;
+    _statsHistory[_statsNext] = frame;
+    WorkloadAdd(&_statsSum, frame);
+    _statsNext = (_statsNext + 1) % D3DU_STATISTICS_WINDOW;
+    _stats.LastFrame = frame;
+    ++_stats.FrameCount;
+  }
+
+  /// NULL `desc' selects what targets used before descriptors existed:
+  /// 32 bit float depth, and 4x MSAA above feature level 10.0.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitDesc(const D3DU_TARGET_DESC *desc)
+  {
+    HRESULT hr;
+    UINT levels;
+    D3D_FEATURE_LEVEL fl;
+    _d3du->GetFeatureLevel(&fl);
+    if(desc)
+    {
+      _desc = *desc;
+    }
+    else
+    {
+      memset(&_desc, 0, sizeof(_desc));
+      _desc.DepthFormat = DXGI_FORMAT_D32_FLOAT;
+      _desc.SampleCount = fl > D3D_FEATURE_LEVEL_10_0 ? 4 : 1;
+      _desc.SampleQuality = fl > D3D_FEATURE_LEVEL_10_0 ? D3D11_STANDARD_MULTISAMPLE_PATTERN : 0;
+    }
+    if(DXGI_FORMAT_UNKNOWN == _desc.Format)
+      _desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    if(0 == _desc.SampleCount)
+      _desc.SampleCount = 1;
+    if(0 == _desc.BufferCount)
+      _desc.BufferCount = 1;
+    hr = _device->CheckMultisampleQualityLevels(_desc.Format, _desc.SampleCount, &levels);
+    if(FAILED(hr))
+      return hr;
+    if(0 == levels
+      || (D3D11_STANDARD_MULTISAMPLE_PATTERN != _desc.SampleQuality && _desc.SampleQuality >= levels))
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Unsupported multisampling mode.");
+      return E_INVALIDARG;
+    }
+    return S_OK;
+  }
+
+  /// Depth buffers come from the device pool, so that returning
+  /// to a recent size, or another target of that size, reuses one.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitDepth(UINT width, UINT height)
+  {
+    HRESULT hr;
+    D3D11_TEXTURE2D_DESC td;
+    D3DU_POOLED_TEXTURE depth;
+    ReleaseDepth();
+    if(DXGI_FORMAT_UNKNOWN == _desc.DepthFormat)
+      return S_OK;
+    memset(&td, 0, sizeof(td));
+    td.ArraySize = 1;
+    td.BindFlags = D3D11_BIND_DEPTH_STENCIL;
+    td.Format = _desc.DepthFormat;
+    td.Width = width;
+    td.Height = height;
+    td.MipLevels = 1;
+    td.SampleDesc.Quality = _desc.SampleQuality;
+    td.SampleDesc.Count = _desc.SampleCount;
+    // Rounding lets nearby sizes share a buffer while a window is dragged;
+    // Direct3D clips to the smaller of the bound views.
+    hr = _pool->AcquireTexture(&td, D3DU_POOL_PERSISTENT | D3DU_POOL_ROUND_SIZE, &depth);
+    if(FAILED(hr))
+      return hr;
+    _ds = depth.Texture;
+    _dsv = depth.DSV;
+    return S_OK;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ReleaseDepth()
+  {
+    if(_ds && _pool)
+      _pool->ReleaseTexture(_ds);
+    _dsv.Release();
+    _ds.Release();
+  }
+};
+
+class D3DU_NOVTABLE CWindowTarget :
+  public CTarget<ID3DUWindowTarget>
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUTarget)
+    INTERFACE_MAP_ENTRY(ID3DUWindowTarget)
+  END_INTERFACE_MAP
+
+  CWindowTarget()
+  {
+    _width = 0;
+    _height = 0;
+    _pendingWidth = 0;
+    _pendingHeight = 0;
+    _resizePending = FALSE;
+    _resizeForced = FALSE;
+    _resizeFirst = 0;
+    _resizeLast = 0;
+    _dynamic = FALSE;
+    _renderWidth = 0;
+    _renderHeight = 0;
+    _lastFrame = 0;
+    _sks = 0;
+    _input.Init(D3DU_INPUT_QUEUE_SIZE);
+    QueryPerformanceFrequency(&_freq);
+  }
+
+  STDMETHOD(Construct)(
+    ID3DUDevice *device,
+    UINT x,
+    UINT y,
+    UINT width,
+    UINT height,
+    HWND parent,
+    const D3DU_TARGET_DESC *desc)
+  {
+    HRESULT hr;
+    _wState = D3DU_WINDOW_CLOSED;
+    hr = InitWindow(x, y, width, height, parent);
+    if(FAILED(hr))
+      return hr;
+    RECT rc;
+    GetClientRect(_hwnd, &rc);
+    width = rc.right - rc.left;
+    height = rc.bottom - rc.top;
+    hr = InitDevice(device);
+    if(FAILED(hr))
+      return hr;
+    hr = InitDesc(desc);
+    if(FAILED(hr))
+      return hr;
+    hr = InitSwapChain(width, height);
+    if(FAILED(hr))
+      return hr;
+    hr = InitTargets(width, height);
+    if(FAILED(hr))
+      return hr;
+    _width = width;
+    _height = height;
+    _renderWidth = width;
+    _renderHeight = height;
+    _wState = D3DU_WINDOW_NORMALIZED;
+    return S_OK;
+  }
+  virtual ~CWindowTarget()
+  {
+    if(_hwnd)
+    {
+      DestroyWindow(_hwnd);
+      _hwnd = NULL;
+    }
+  }
+  STDMETHOD(Draw)()
+  {
+    switch(_wState)
+    {
+    case D3DU_WINDOW_CLOSED:
+      {
+        D3DU_LOG(D3DU_LOG_WARNING, "Window is closed! Unable to render!");
+        return E_FAIL;
+      }
+    case D3DU_WINDOW_MINIMIZED:
+    case D3DU_WINDOW_HIDDEN:
+      DispatchInput();
+      return S_FALSE;
+    default:
+      {
+        D3DU_TRACE_ZONE("Draw");
+        BeginStatistics();
+        ApplyResize();
+        DispatchInput();
+        if(_dynamic)
+          UpdateScale();
+        RenderSink();
+        if(_dynamic)
+          Upscale();
+        EndFrame();
+        EndStatistics();
+      }
+      return S_OK;
+    }
+  }
+  /// Sinks attached while dynamic resolution is on learn the scaled size at once.
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink)
+  {
+    HRESULT hr = CTarget<ID3DUWindowTarget>::SetFrameSink(sink);
+    if(SUCCEEDED(hr) && sink && (_renderWidth != _width || _renderHeight != _height))
+      sink->Resize(this, _renderWidth, _renderHeight);
+    return hr;
+  }
+  STDMETHOD(Present)()
+  {
+    switch(_wState)
+    {
+    case D3DU_WINDOW_CLOSED:
+      return E_FAIL;
+    case D3DU_WINDOW_MINIMIZED:
+    case D3DU_WINDOW_HIDDEN:
+      return S_FALSE;
+    default:
+      {
+        D3DU_TRACE_ZONE("Present");
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        _swapChain->Present(0, 0);
+        QueryPerformanceCounter(&end);
+        _frameStats->Record(D3DU_FRAME_TIME_PRESENT, end.QuadPart - start.QuadPart);
+      }
+      return S_OK;
+    }
+  }
+  STDMETHOD(GetSize)(UINT *oWidth, UINT *oHeight)
+  {
+    if(D3DU_WINDOW_CLOSED == _wState)
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Window is closed! Unable to obtain size!");
+      return E_FAIL;
+    }
+    if(!oWidth || !oHeight)
+      return E_POINTER;
+    RECT rc;
+    GetClientRect(_hwnd, &rc);
+    *oWidth = rc.right - rc.left;
+    *oHeight = rc.bottom - rc.top;
+    return S_OK;
+  }
+  STDMETHOD(SetSize)(UINT width, UINT height)
+  {
+    if(D3DU_WINDOW_CLOSED == _wState)
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Window is closed! Unable to resize!");
+      return E_FAIL;
+    }
+    RECT rw;
+    GetWindowRect(_hwnd, &rw);
+    if(!MoveWindow(
+          _hwnd,
+          rw.left,
+          rw.top,
+          width,
+          height,
+          TRUE))
+    {
+      return HRESULT_FROM_WIN32(GetLastError());
+    }
+    return S_OK;
+  }
+  STDMETHOD(GetKeySink)(ID3DUKeySink **oSink)
+  {
+    if(!oSink)
+      return E_POINTER;
+    _keySink.AddRef();
+    *oSink = _keySink;
+    return S_OK;
+  }
+  STDMETHOD(SetKeySink)(ID3DUKeySink *sink)
+  {
+    if(_keySink)
+      _keySink->Detach(this);
+    _keySink = sink;
+    if(sink)
+      sink->Attach(this);
+    return S_OK;
+  }
+  STDMETHOD(GetMouseSink)(ID3DUMouseSink **oSink)
+  {
+    if(!oSink)
+      return E_POINTER;
+    _mouseSink.AddRef();
+    *oSink = _mouseSink;
+    return S_OK;
+  }
+  STDMETHOD(SetMouseSink)(ID3DUMouseSink *sink)
+  {
+    // Mouse sinks built against 0.0.1.0 have no InputEvents in their
+    // vtable. They only answer the old IID, so they are refused here.
+    ComPtr<ID3DUMouseSink> checked;
+    if(sink && FAILED(sink->QueryInterface(__uuidof(ID3DUMouseSink), (void**)&checked)))
+      return E_NOINTERFACE;
+    if(_mouseSink)
+      _mouseSink->Detach(this);
+    _mouseSink = sink;
+    if(sink)
+      sink->Attach(this);
+    return S_OK;
+  }
+  STDMETHOD(GetWindowState)(D3DU_WINDOW_STATE *oState)
+  {
+    if(!oState)
+      return E_POINTER;
+    *oState = _wState;
+    return S_OK;
+  }
+  STDMETHOD(SetWindowState)(D3DU_WINDOW_STATE state)
+  {
+    if(_wState == state)
+      return S_OK;
+    if(!_hwnd)
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Window is closed.");
+      return E_FAIL;
+    }
+    switch(state)
+    {
+    case D3DU_WINDOW_CLOSED:
+      _swapChain->SetFullscreenState(FALSE, NULL);
+      DestroyWindow(_hwnd);
+      return S_OK;
+    case D3DU_WINDOW_NORMALIZED:
+      _swapChain->SetFullscreenState(FALSE, NULL);
+      ShowWindow(_hwnd, SW_SHOWNORMAL);
+      return S_OK;
+    case D3DU_WINDOW_HIDDEN:
+      _swapChain->SetFullscreenState(FALSE, NULL);
+      ShowWindow(_hwnd, SW_HIDE);
+      return S_OK;
+    case D3DU_WINDOW_MAXIMIZED:
+      _swapChain->SetFullscreenState(FALSE, NULL);
+      ShowWindow(_hwnd, SW_SHOWMAXIMIZED);
+      return S_OK;
+    case D3DU_WINDOW_MINIMIZED:
+      _swapChain->SetFullscreenState(FALSE, NULL);
+      ShowWindow(_hwnd, SW_SHOWMINNOACTIVE);
+      return S_OK;
+    case D3DU_WINDOW_RESIZING:
+      return E_INVALIDARG;
+    case D3DU_WINDOW_FULLSCREEN:
+      {
+        HRESULT hr = _swapChain->SetFullscreenState(TRUE, _output);
+        if(SUCCEEDED(hr))
+          _wState = D3DU_WINDOW_FULLSCREEN;
+        return hr;
+      }
+    default:
+      return E_INVALIDARG;
+    }
+  }
+  STDMETHOD(SetDynamicResolution)(const D3DU_DYNAMIC_RESOLUTION_DESC *desc)
+  {
+    HRESULT hr;
+    D3D_FEATURE_LEVEL fl;
+    if(D3DU_WINDOW_CLOSED == _wState)
+      return E_FAIL;
+    if(!desc)
+    {
+      if(!_dynamic)
+        return S_OK;
+      _dynamic = FALSE;
+      _dc->ClearState();
+      _rtv = _backRTV;
+      _backRTV.Release();
+      ReleaseScene();
+      _upscaler.Release();
+      SetRenderSize(_width, _height);
+      return S_OK;
+    }
+    _d3du->GetFeatureLevel(&fl);
+    if(fl < D3D_FEATURE_LEVEL_10_0)
+      return DXGI_ERROR_UNSUPPORTED;
+    D3DU_DYNAMIC_RESOLUTION_DESC d = *desc;
+    if(0.0f == d.FrameBudget)
+      d.FrameBudget = 1.0f / 60.0f;
+    if(0.0f == d.MinScale)
+      d.MinScale = 0.5f;
+    if(0.0f == d.MaxScale)
+      d.MaxScale = 1.0f;
+    if(0 == d.FrameWindow)
+      d.FrameWindow = 8;
+    if(d.FrameBudget < 0.0f
+      || d.MinScale < 0.0f
+      || d.MinScale > d.MaxScale
+      || d.MaxScale > 1.0f)
+      return E_INVALIDARG;
+    if(!_dynamic)
+    {
+      hr = _upscaler.Init(_device);
+      if(FAILED(hr))
+        return hr;
+      _dc->ClearState();
+      _backRTV = _rtv;
+      hr = InitScene(_width, _height);
+      if(FAILED(hr))
+      {
+        _rtv = _backRTV;
+        _backRTV.Release();
+        ReleaseScene();
+        _upscaler.Release();
+        return hr;
+      }
+      _dynamic = TRUE;
+    }
+    _resolution.Init(d.FrameBudget, d.MinScale, d.MaxScale, d.FrameWindow);
+    _lastFrame = 0;
+    UpdateRenderSize();
+    return S_OK;
+  }
+  STDMETHOD(GetRenderScale)(FLOAT *oScale)
+  {
+    if(!oScale)
+      return E_POINTER;
+    *oScale = _dynamic ? _resolution.GetScale() : 1.0f;
+    return S_OK;
+  }
+  STDMETHOD(GetRenderSize)(UINT *oWidth, UINT *oHeight)
+  {
+    if(!oWidth || !oHeight)
+      return E_POINTER;
+    *oWidth = _renderWidth;
+    *oHeight = _renderHeight;
+    return S_OK;
+  }
+private:
+  static LPCWSTR className;
+  HWND _hwnd;
+  D3DU_WINDOW_STATE _wState;
+  ComPtr<ID3DUKeySink> _keySink;
+  ComPtr<ID3DUMouseSink> _mouseSink;
+  ComPtr<IDXGIOutput> _output;
+  ComPtr<IDXGISwapChain> _swapChain;
+  UINT _width;
+  UINT _height;
+  UINT _pendingWidth;
+  UINT _pendingHeight;
+  BOOL _resizePending;
+  BOOL _resizeForced;
+  LONGLONG _resizeFirst;
+  LONGLONG _resizeLast;
+  LARGE_INTEGER _freq;
+  BOOL _dynamic;
+  UINT _renderWidth;
+  UINT _renderHeight;
+  LONGLONG _lastFrame;
+  CResolutionController _resolution;
+  CUpscaler _upscaler;
+  /// With dynamic resolution on, _rtv is the scene buffer sinks draw into.
+  ComPtr<ID3D11RenderTargetView> _backRTV;
+  ComPtr<ID3D11Texture2D> _scene;
+  ComPtr<ID3D11Texture2D> _sceneResolved;
+  ComPtr<ID3D11ShaderResourceView> _sceneSRV;
+  /// Filled by the window procedure, emptied by Draw.
+  CWindowInputQueue _input;
+  D3DU_INPUT_EVENT _inputBatch[D3DU_INPUT_BATCH_SIZE];
+  DWORD _sks;
+
+  static LPCWSTR STDMETHODCALLTYPE InitClass()
+  {
+    WNDCLASSEX wc;
+    memset(&wc, 0, sizeof(wc));
+    wc.cbSize = sizeof(wc);
+    wc.hCursor = LoadCursor(NULL, MAKEINTRESOURCE(IDC_ARROW));
+    wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
+    wc.hInstance = GetModuleHandle(NULL);
+    wc.lpfnWndProc = WindowProc;
+    wc.lpszClassName = L"CWindowTarget";
+    wc.style = CS_VREDRAW | CS_HREDRAW | CS_DBLCLKS;
+    if(INVALID_ATOM == RegisterClassEx(&wc))
+      throw HRESULT_FROM_WIN32(GetLastError());
+    return wc.lpszClassName;
+  }
+
+  static LRESULT COM_DECLSPEC_NOTHROW CALLBACK WindowProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+  {
+    if(WM_CREATE == msg)
+    {
+      CWindowTarget *target = (CWindowTarget*)((LPCREATESTRUCT)lParam)->lpCreateParams;
+      SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)target);
+      return TRUE;
+    }
+    CWindowTarget* target = (CWindowTarget*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+    if(!target)
+    {      
+      return DefWindowProc(hwnd, msg, wParam, lParam);
+    }
+    switch(msg)
+    {
+    case WM_DESTROY:
+      {
         if(target->_frameSink)
           target->_frameSink->Detach(target);
         if(target->_keySink)
@@ -535,7 +1117,7 @@ private:
     case WM_EXITSIZEMOVE:
       {
         target->_wState = D3DU_WINDOW_NORMALIZED;
-        target->ResizeTargets();
+        target->RequestResize(TRUE);
       }
       break;
     case WM_SHOWWINDOW:
@@ -546,56 +1128,80 @@ private:
       switch(target->_wState)
       {
       case D3DU_WINDOW_CLOSED:
+        break;
       case D3DU_WINDOW_RESIZING:
+        target->RequestResize(FALSE);
         break;
       default:
         switch(wParam)
         {
         case SIZE_RESTORED:
           target->_wState = D3DU_WINDOW_NORMALIZED;
-          target->ResizeTargets();
+          target->RequestResize(TRUE);
           break;
         case SIZE_MINIMIZED:
           target->_wState = D3DU_WINDOW_HIDDEN;
           break;
         case SIZE_MAXIMIZED:
           target->_wState = D3DU_WINDOW_MAXIMIZED;
-          target->ResizeTargets();
+          target->RequestResize(TRUE);
           break;        
         }
         break;
       }
       break;
+    case WM_SETFOCUS:
+      target->_sks = ReadSks();
+      break;
     case WM_SYSKEYDOWN:
     case WM_KEYDOWN:
-      {
-        if(target->_keySink)
-        {
-          DWORD sks = 0;
-          if(0x80 & GetKeyState(VK_CONTROL))
-            sks |= D3DU_SKS_CTRL;
-          if(0x80 & GetKeyState(VK_MENU))
-            sks |= D3DU_SKS_ALT;
-          if(0x80 & GetKeyState(VK_SHIFT))
-            sks |= D3DU_SKS_SHIFT;
-          target->_keySink->KeyDown(target, (DWORD)wParam, sks);
-        }
-      }      
+      target->UpdateSks((DWORD)wParam, TRUE);
+      target->PushInput(D3DU_INPUT_KEY_DOWN, (DWORD)wParam, 0, 0, 0);
       break;
     case WM_SYSKEYUP:
     case WM_KEYUP:
+      target->UpdateSks((DWORD)wParam, FALSE);
+      target->PushInput(D3DU_INPUT_KEY_UP, (DWORD)wParam, 0, 0, 0);
+      break;
+    case WM_MOUSEMOVE:
+      target->PushMouse(D3DU_INPUT_MOUSE_MOVE, 0, lParam, 0);
+      break;
+    case WM_LBUTTONDOWN:
+    case WM_LBUTTONDBLCLK:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_DOWN, D3DU_BUTTON_LEFT, wParam, lParam);
+      break;
+    case WM_LBUTTONUP:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_UP, D3DU_BUTTON_LEFT, wParam, lParam);
+      break;
+    case WM_RBUTTONDOWN:
+    case WM_RBUTTONDBLCLK:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_DOWN, D3DU_BUTTON_RIGHT, wParam, lParam);
+      break;
+    case WM_RBUTTONUP:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_UP, D3DU_BUTTON_RIGHT, wParam, lParam);
+      break;
+    case WM_MBUTTONDOWN:
+    case WM_MBUTTONDBLCLK:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_DOWN, D3DU_BUTTON_MIDDLE, wParam, lParam);
+      break;
+    case WM_MBUTTONUP:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_UP, D3DU_BUTTON_MIDDLE, wParam, lParam);
+      break;
+    case WM_XBUTTONDOWN:
+    case WM_XBUTTONDBLCLK:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_DOWN,
+        XBUTTON1 == GET_XBUTTON_WPARAM(wParam) ? D3DU_BUTTON_X1 : D3DU_BUTTON_X2, wParam, lParam);
+      return TRUE;
+    case WM_XBUTTONUP:
+      target->PushButton(hwnd, D3DU_INPUT_BUTTON_UP,
+        XBUTTON1 == GET_XBUTTON_WPARAM(wParam) ? D3DU_BUTTON_X1 : D3DU_BUTTON_X2, wParam, lParam);
+      return TRUE;
+    case WM_MOUSEWHEEL:
       {
-        if(target->_keySink)
-        {
-          DWORD sks = 0;
-          if(0x80 & GetKeyState(VK_CONTROL))
-            sks |= D3DU_SKS_CTRL;
-          if(0x80 & GetKeyState(VK_MENU))
-            sks |= D3DU_SKS_ALT;
-          if(0x80 & GetKeyState(VK_SHIFT))
-            sks |= D3DU_SKS_SHIFT;
-          target->_keySink->KeyUp(target, (DWORD)wParam, sks);
-        }
+        // Wheel messages come in screen coordinates.
+        POINT pt = { (SHORT)LOWORD(lParam), (SHORT)HIWORD(lParam) };
+        ScreenToClient(hwnd, &pt);
+        target->PushInput(D3DU_INPUT_WHEEL, 0, pt.x, pt.y, GET_WHEEL_DELTA_WPARAM(wParam));
       }
       break;
     default:
@@ -604,6 +1210,107 @@ private:
     return 0;
   }
 
+  /// Modifier state follows key messages rather than being polled with
+  /// GetKeyState for every event; gaining focus resynchronizes it.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE UpdateSks(DWORD key, BOOL down)
+  {
+    DWORD flag = 0;
+    if(VK_CONTROL == key)
+      flag = D3DU_SKS_CTRL;
+    else if(VK_MENU == key)
+      flag = D3DU_SKS_ALT;
+    else if(VK_SHIFT == key)
+      flag = D3DU_SKS_SHIFT;
+    if(down)
+      _sks |= flag;
+    else
+      _sks &= ~flag;
+  }
+
+  static DWORD COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ReadSks()
+  {
+    DWORD sks = 0;
+    if(0x80 & GetKeyState(VK_CONTROL))
+      sks |= D3DU_SKS_CTRL;
+    if(0x80 & GetKeyState(VK_MENU))
+      sks |= D3DU_SKS_ALT;
+    if(0x80 & GetKeyState(VK_SHIFT))
+      sks |= D3DU_SKS_SHIFT;
+    return sks;
+  }
+
+  /// Events nobody listens to are not queued.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE PushInput(
+    D3DU_INPUT_EVENT_TYPE type,
+    DWORD key,
+    INT x,
+    INT y,
+    INT wheel)
+  {
+    D3DU_INPUT_EVENT e;
+    LARGE_INTEGER now;
+    BOOL keyEvent = D3DU_INPUT_KEY_DOWN == type || D3DU_INPUT_KEY_UP == type;
+    if(!_mouseSink && !(keyEvent && _keySink))
+      return;
+    QueryPerformanceCounter(&now);
+    e.Type = type;
+    e.Sks = _sks;
+    e.Time = (UINT64)now.QuadPart;
+    e.Key = key;
+    e.X = x;
+    e.Y = y;
+    e.Wheel = wheel;
+    e.Coalesced = 0;
+    _input.Push(e);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE PushMouse(D3DU_INPUT_EVENT_TYPE type, DWORD button, LPARAM lParam, INT wheel)
+  {
+    PushInput(type, button, (SHORT)LOWORD(lParam), (SHORT)HIWORD(lParam), wheel);
+  }
+
+  /// The mouse is captured while any button is held, so releases
+  /// outside the window are not lost.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE PushButton(
+    HWND hwnd,
+    D3DU_INPUT_EVENT_TYPE type,
+    D3DU_MOUSE_BUTTON button,
+    WPARAM wParam,
+    LPARAM lParam)
+  {
+    const WPARAM buttons = MK_LBUTTON | MK_RBUTTON | MK_MBUTTON | MK_XBUTTON1 | MK_XBUTTON2;
+    if(D3DU_INPUT_BUTTON_DOWN == type)
+      SetCapture(hwnd);
+    else if(!(wParam & buttons))
+      ReleaseCapture();
+    PushMouse(type, button, lParam, 0);
+  }
+
+  /// Key sink first, event by event, then the whole batch to the mouse
+  /// sink. Either may be replaced from inside its callbacks.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE DispatchInput()
+  {
+    UINT count;
+    ComPtr<ID3DUKeySink> keySink = _keySink;
+    ComPtr<ID3DUMouseSink> mouseSink = _mouseSink;
+    while(0 != (count = _input.Drain(_inputBatch, D3DU_INPUT_BATCH_SIZE)))
+    {
+      if(keySink)
+      {
+        for(UINT i = 0; i < count; ++i)
+        {
+          const D3DU_INPUT_EVENT &e = _inputBatch[i];
+          if(D3DU_INPUT_KEY_DOWN == e.Type)
+            keySink->KeyDown(this, e.Key, e.Sks);
+          else if(D3DU_INPUT_KEY_UP == e.Type)
+            keySink->KeyUp(this, e.Key, e.Sks);
+        }
+      }
+      if(mouseSink)
+        mouseSink->InputEvents(this, _inputBatch, count);
+    }
+  }
+
   HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitWindow(UINT x, UINT y, UINT width, UINT height, HWND parent)
   {    
     HRESULT hr = S_OK;
@@ -641,194 +1348,359 @@ private:
     return hr;
   }
 
-  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitDevice(UINT width, UINT height, D3D_FEATURE_LEVEL fl, BOOL acceptSw)
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitSwapChain(UINT width, UINT height)
   {
     HRESULT hr;
-    D3D_DRIVER_TYPE dTypes[] =
-    {
-      D3D_DRIVER_TYPE_HARDWARE,
-      acceptSw ? D3D_DRIVER_TYPE_WARP : D3D_DRIVER_TYPE_HARDWARE,
-      acceptSw ? D3D_DRIVER_TYPE_REFERENCE : D3D_DRIVER_TYPE_HARDWARE,
-    };
-    D3D_FEATURE_LEVEL fLevels[] = 
-    {
-      fl,
-    };
-    DWORD flags = 0;
-#ifdef D3DU_DEBUG
-    flags |= D3D11_CREATE_DEVICE_DEBUG | D3D11_CREATE_DEVICE_PREVENT_INTERNAL_THREADING_OPTIMIZATIONS;
-#endif
-    for(int i = 0; i < ARRAYSIZE(dTypes); ++i)
+    ComPtr<IDXGIDevice> dxgiDevice;
+    ComPtr<IDXGIFactory> factory;
+    hr = _d3du->GetDXGIDevice(&dxgiDevice);
+    if(FAILED(hr))
+      return hr;
+    hr = _d3du->GetFactory(&factory);
+    if(FAILED(hr))
+      return hr;
+    // Null devices have no DXGI objects to make a swap chain with.
+    if(!dxgiDevice || !factory)
+      return DXGI_ERROR_UNSUPPORTED;
+    _d3du->GetOutput(&_output);
+    DXGI_SWAP_CHAIN_DESC sd;
+    memset(&sd, 0, sizeof(sd));
+    sd.BufferCount = _desc.BufferCount;
+    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+    sd.Windowed = TRUE;
+    sd.OutputWindow = _hwnd;
+    sd.BufferDesc.Width = width;
+    sd.BufferDesc.Height = height;
+    sd.BufferDesc.Format = _desc.Format;
+    sd.SampleDesc.Count = _desc.SampleCount;
+    sd.SampleDesc.Quality = _desc.SampleQuality;
+    DEVMODE dm;
+    memset(&dm, 0, sizeof(dm));
+    dm.dmSize = sizeof(dm);
+    if(!EnumDisplaySettings(NULL, ENUM_CURRENT_SETTINGS, &dm))
     {
-      hr = D3D11CreateDevice(
-        NULL,
-        dTypes[i],
-        NULL,
-        flags,
-        fLevels,
-        ARRAYSIZE(fLevels),
-        D3D11_SDK_VERSION,
-        &_device,
-        &fl,
-        &_dc);
-      if(SUCCEEDED(hr))
-        break;
+      DWORD error = GetLastError();
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to obtain display settings (error %lu).", error);
+      return HRESULT_FROM_WIN32(error);
     }
+    sd.BufferDesc.RefreshRate.Numerator = dm.dmDisplayFrequency;
+    sd.BufferDesc.RefreshRate.Denominator = 1;
+    hr = factory->CreateSwapChain(dxgiDevice, &sd, &_swapChain);
     if(FAILED(hr))
     {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Unable to create device.\n");
-#endif
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to create swap chain (0x%08X).", hr);
       return hr;
     }
-    hr = _device->QueryInterface(
-      __uuidof(*_dxgiDevice),
-      (void**)(IDXGIDevice**)&_dxgiDevice);
-    if(FAILED(hr))
-      return hr;
-    hr = _dxgiDevice->GetAdapter(&_adapter);
+    return S_OK;
+  }
+
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitTargets(UINT width, UINT height)
+  {
+    HRESULT hr;
+    ComPtr<ID3D11Texture2D> backBuffer;
+    hr = _swapChain->GetBuffer(0, __uuidof(*backBuffer),(void**)(ID3D11Texture2D**)&backBuffer);
     if(FAILED(hr))
       return hr;
-    hr = _adapter->GetParent(
-      __uuidof(*_factory),
-      (void**)(IDXGIFactory**)&_factory);
+    TrackBackBuffer(backBuffer);
+    hr = _device->CreateRenderTargetView(backBuffer, NULL, &_rtv);
     if(FAILED(hr))
       return hr;
-    D3D10_DRIVER_TYPE dTypes10[] =
-    {
-      D3D10_DRIVER_TYPE_HARDWARE,
-      acceptSw ? D3D10_DRIVER_TYPE_WARP : D3D10_DRIVER_TYPE_HARDWARE,
-      acceptSw ? D3D10_DRIVER_TYPE_REFERENCE : D3D10_DRIVER_TYPE_REFERENCE,
-    };
-    DWORD flags10 = D3D10_CREATE_DEVICE_BGRA_SUPPORT;
-#ifdef D3DU_DEBUG
-    flags10 |= D3D10_CREATE_DEVICE_DEBUG | D3D10_CREATE_DEVICE_PREVENT_INTERNAL_THREADING_OPTIMIZATIONS;
-#endif
-    for(int i = 0; i < ARRAYSIZE(dTypes10); ++i)
+    return InitDepth(width, height);
+  }
+
+  /// The swap chain creates its buffers on its own, so the device does
+  /// not see them. Only the first buffer is accessible, and counted.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE TrackBackBuffer(ID3D11Texture2D *backBuffer)
+  {
+    ComPtr<ID3DUMemoryTracker> memory;
+    if(backBuffer && SUCCEEDED(_d3du->GetMemoryTracker(&memory)))
+      memory->Track(backBuffer, D3DU_MEMORY_TARGETS);
+  }
+
+  /// Only records the new client size. Buffers are reallocated by ApplyResize()
+  /// at the start of the next frame; `force' skips the settle delay and is
+  /// used for one-off changes like maximizing or the end of a drag.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE RequestResize(BOOL force)
+  {
+    RECT rc;
+    LARGE_INTEGER now;
+    GetClientRect(_hwnd, &rc);
+    if((rc.right - rc.left) <= 0
+      || (rc.bottom - rc.top) <= 0)
+      return;
+    QueryPerformanceCounter(&now);
+    if(!_resizePending)
+      _resizeFirst = now.QuadPart;
+    if(!_resizePending
+      || _pendingWidth != (UINT)(rc.right - rc.left)
+      || _pendingHeight != (UINT)(rc.bottom - rc.top))
+      _resizeLast = now.QuadPart;
+    _pendingWidth = rc.right - rc.left;
+    _pendingHeight = rc.bottom - rc.top;
+    _resizePending = TRUE;
+    _resizeForced |= force;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ApplyResize()
+  {
+    if(!_resizePending)
+      return;
+    if(!_resizeForced)
     {
-      hr = D3D10CreateDevice1(
-        _adapter,
-        dTypes10[i],
-        NULL,
-        flags10,
-        D3D10_FEATURE_LEVEL_10_0,
-        D3D10_1_SDK_VERSION,
-        &_device10);
-      if(SUCCEEDED(hr))
-        break;
+      LARGE_INTEGER now;
+      QueryPerformanceCounter(&now);
+      BOOL settled = (now.QuadPart - _resizeLast) * 1000 >= _freq.QuadPart * D3DU_RESIZE_SETTLE_MS;
+      BOOL overdue = (now.QuadPart - _resizeFirst) * 1000 >= _freq.QuadPart * D3DU_RESIZE_MAX_DELAY_MS;
+      if(!settled && !overdue)
+        return;
     }
-    if(FAILED(hr))
+    _resizePending = FALSE;
+    _resizeForced = FALSE;
+    if(_pendingWidth == _width && _pendingHeight == _height)
+      return;
+    ResizeTargets(_pendingWidth, _pendingHeight);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ResizeTargets(UINT width, UINT height)
+  {
+    D3DU_TRACE_ZONE("ResizeTargets");
+    DXGI_SWAP_CHAIN_DESC sd;
+    _swapChain->GetDesc(&sd);
+    _dc->ClearState();
+    _rtv.Release();
+    _backRTV.Release();
+    ReleaseScene();
+    ReleaseDepth();
+    _swapChain->ResizeBuffers(sd.BufferCount, width, height, sd.BufferDesc.Format, sd.Flags);
+    ComPtr<ID3D11Texture2D> backBuffer;
+    _swapChain->GetBuffer(0, __uuidof(*backBuffer), (void**)(ID3D11Texture2D**)&backBuffer);
+    TrackBackBuffer(backBuffer);
+    _device->CreateRenderTargetView(backBuffer, NULL, &_rtv);
+    InitDepth(width, height);
+    _width = width;
+    _height = height;
+    if(_dynamic)
     {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Unable to create 10.1 device.\n");
-#endif
-      return hr;
+      _backRTV = _rtv;
+      if(FAILED(InitScene(width, height)))
+      {
+        D3DU_LOG(D3DU_LOG_WARNING, "Unable to recreate scene buffer. Dynamic resolution is off.");
+        _rtv = _backRTV;
+        _backRTV.Release();
+        ReleaseScene();
+        _upscaler.Release();
+        _dynamic = FALSE;
+      }
     }
-    hr = _adapter->EnumOutputs(0, &_output);
-
-    if(FAILED(hr))
-      return hr;    
-    DXGI_SWAP_CHAIN_DESC sd;
-    memset(&sd, 0, sizeof(sd));
-    sd.BufferCount = 1;
-    sd.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-    sd.Windowed = TRUE;
-    sd.OutputWindow = _hwnd;
-    sd.BufferDesc.Width = width;
-    sd.BufferDesc.Height = height;
-    sd.BufferDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    sd.SampleDesc.Count = fl > D3D_FEATURE_LEVEL_10_0 ? 4 : 1 ;
-    sd.SampleDesc.Quality = fl > D3D_FEATURE_LEVEL_10_0 ? D3D11_STANDARD_MULTISAMPLE_PATTERN : 0;
-    DEVMODE dm;
-    memset(&dm, 0, sizeof(dm));
-    dm.dmSize = sizeof(dm);
-    if(!EnumDisplaySettings(NULL, ENUM_CURRENT_SETTINGS, &dm))
+    if(_dynamic)
     {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Unable to obtain display settings.\n");
-#endif
-      return HRESULT_FROM_WIN32(GetLastError());
+      _lastFrame = 0;
+      _resolution.Reset();
+      _renderWidth = 0;
+      _renderHeight = 0;
+      UpdateRenderSize();
     }
-    sd.BufferDesc.RefreshRate.Numerator = dm.dmDisplayFrequency;
-    sd.BufferDesc.RefreshRate.Denominator = 1;
-    hr = _factory->CreateSwapChain(_dxgiDevice, &sd, &_swapChain);
-    if(FAILED(hr))
+    else
     {
-#ifdef D3DU_DEBUG
-      OutputDebugString(L"Unable to create swap chain.\n");
-#endif
-      return hr;
+      _renderWidth = 0;
+      _renderHeight = 0;
+      SetRenderSize(width, height);
     }
-    return S_OK;
   }
 
-  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitTargets(UINT width, UINT height, D3D_FEATURE_LEVEL fl)
+  /// Scene buffer covers the whole window, scaling only changes the part
+  /// sinks draw to, so scale changes never reallocate anything.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitScene(UINT width, UINT height)
   {
     HRESULT hr;
-    ComPtr<ID3D11Texture2D> backBuffer;
-    hr = _swapChain->GetBuffer(0, __uuidof(*backBuffer),(void**)(ID3D11Texture2D**)&backBuffer);
-    if(FAILED(hr))
-      return hr;
-    hr = _device->CreateRenderTargetView(backBuffer, NULL, &_rtv);
-    if(FAILED(hr))
-      return hr;
     D3D11_TEXTURE2D_DESC td;
+    ReleaseScene();
+    _rtv.Release();
     memset(&td, 0, sizeof(td));
     td.ArraySize = 1;
-    td.BindFlags = D3D11_BIND_DEPTH_STENCIL;
-    td.Format = DXGI_FORMAT_D32_FLOAT;
+    td.BindFlags = D3D11_BIND_RENDER_TARGET;
+    td.Format = _desc.Format;
     td.Width = width;
     td.Height = height;
     td.MipLevels = 1;
-    td.SampleDesc.Quality = fl > D3D_FEATURE_LEVEL_10_0 ? D3D11_STANDARD_MULTISAMPLE_PATTERN : 0;
-    td.SampleDesc.Count = fl > D3D_FEATURE_LEVEL_10_0 ? 4 : 1;
-    hr = _device->CreateTexture2D(&td, NULL, &_ds);
+    td.SampleDesc.Quality = _desc.SampleQuality;
+    td.SampleDesc.Count = _desc.SampleCount;
+    if(1 == _desc.SampleCount)
+      td.BindFlags |= D3D11_BIND_SHADER_RESOURCE;
+    hr = _device->CreateTexture2D(&td, NULL, &_scene);
     if(FAILED(hr))
       return hr;
-    hr = _device->CreateDepthStencilView(_ds, NULL, &_dsv);
+    hr = _device->CreateRenderTargetView(_scene, NULL, &_rtv);
     if(FAILED(hr))
       return hr;
-    return S_OK;
+    if(1 == _desc.SampleCount)
+      return _device->CreateShaderResourceView(_scene, NULL, &_sceneSRV);
+    td.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    td.SampleDesc.Count = 1;
+    td.SampleDesc.Quality = 0;
+    hr = _device->CreateTexture2D(&td, NULL, &_sceneResolved);
+    if(FAILED(hr))
+      return hr;
+    return _device->CreateShaderResourceView(_sceneResolved, NULL, &_sceneSRV);
   }
 
-  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ResizeTargets()
+  /// The scene is not part of the swap chain, so unlike the back
+  /// buffer it need not be gone before ResizeBuffers.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ReleaseScene()
   {
-    switch(_wState)
+    Retire(_sceneSRV);
+    Retire(_sceneResolved);
+    Retire(_scene);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE UpdateScale()
+  {
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    if(_lastFrame)
     {
-      case D3DU_WINDOW_CLOSED:
-      case D3DU_WINDOW_HIDDEN:
-      case D3DU_WINDOW_MINIMIZED:
-      case D3DU_WINDOW_RESIZING:
-        return;
+      LONGLONG elapsed = now.QuadPart - _lastFrame;
+      if(elapsed * 1000 > _freq.QuadPart * D3DU_DYNAMIC_RESOLUTION_STALL_MS)
+        _resolution.Reset();
+      else if(_resolution.Update((double)elapsed / _freq.QuadPart))
+        UpdateRenderSize();
     }
-    RECT rc;
-    GetClientRect(_hwnd, &rc);
-    if((rc.right - rc.left) <= 0
-      || (rc.bottom - rc.top) <= 0)
+    _lastFrame = now.QuadPart;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE UpdateRenderSize()
+  {
+    FLOAT scale = _resolution.GetScale();
+    UINT width = (UINT)(_width * scale + 0.5f);
+    UINT height = (UINT)(_height * scale + 0.5f);
+    SetRenderSize(width ? width : 1, height ? height : 1);
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE SetRenderSize(UINT width, UINT height)
+  {
+    if(width == _renderWidth && height == _renderHeight)
       return;
-    DXGI_SWAP_CHAIN_DESC sd;
-    D3D11_TEXTURE2D_DESC td;
-    _swapChain->GetDesc(&sd);
-    _ds->GetDesc(&td);
-    td.Width = rc.right - rc.left;
-    td.Height = rc.bottom - rc.top;
-    _dc->ClearState();
-    _rtv.Release();
-    _dsv.Release();
-    _ds.Release();
-    _swapChain->ResizeBuffers(sd.BufferCount, td.Width, td.Height, sd.BufferDesc.Format, sd.Flags);
-    ComPtr<ID3D11Texture2D> backBuffer;
-    _swapChain->GetBuffer(0, __uuidof(*backBuffer), (void**)(ID3D11Texture2D**)&backBuffer);
-    _device->CreateRenderTargetView(backBuffer, NULL, &_rtv);
-    _device->CreateTexture2D(&td, NULL, &_ds);
-    _device->CreateDepthStencilView(_ds, NULL, &_dsv);
+    _renderWidth = width;
+    _renderHeight = height;
     if(_frameSink)
-      _frameSink->Resize(this, td.Width, td.Height);
+      _frameSink->Resize(this, width, height);
+  }
+
+  /// The upscaler leaves the pipeline as the sink left it, so sinks
+  /// that set their state only on Resize keep it.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Upscale()
+  {
+    D3DU_TRACE_ZONE("Upscale");
+    if(_sceneResolved)
+      _dc->ResolveSubresource(_sceneResolved, 0, _scene, 0, _desc.Format);
+    _upscaler.Draw(_dc, _sceneSRV, _backRTV, _width, _height, _renderWidth, _renderHeight);
   }
 };
 
 LPCWSTR CWindowTarget::className = CWindowTarget::InitClass();
 
+/// Renders into a texture. Present does nothing.
+class D3DU_NOVTABLE COffscreenTarget :
+  public CTarget<ID3DUTarget>
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUTarget)
+  END_INTERFACE_MAP
+
+  COffscreenTarget()
+  {
+    _width = 0;
+    _height = 0;
+  }
+
+  STDMETHOD(Construct)(ID3DUDevice *device, UINT width, UINT height, const D3DU_TARGET_DESC *desc)
+  {
+    HRESULT hr;
+    if(0 == width || 0 == height)
+      return E_INVALIDARG;
+    hr = InitDevice(device);
+    if(FAILED(hr))
+      return hr;
+    hr = InitDesc(desc);
+    if(FAILED(hr))
+      return hr;
+    return InitTargets(width, height);
+  }
+  virtual ~COffscreenTarget() { }
+  STDMETHOD(Draw)()
+  {
+    D3DU_TRACE_ZONE("Draw");
+    BeginStatistics();
+    RenderSink();
+    EndFrame();
+    EndStatistics();
+    return S_OK;
+  }
+  STDMETHOD(Present)()
+  {
+    return S_OK;
+  }
+  STDMETHOD(GetSize)(UINT *oWidth, UINT *oHeight)
+  {
+    if(!oWidth || !oHeight)
+      return E_POINTER;
+    *oWidth = _width;
+    *oHeight = _height;
+    return S_OK;
+  }
+  STDMETHOD(SetSize)(UINT width, UINT height)
+  {
+    HRESULT hr;
+    if(0 == width || 0 == height)
+      return E_INVALIDARG;
+    if(width == _width && height == _height)
+      return S_OK;
+    _dc->ClearState();
+    hr = InitTargets(width, height);
+    if(FAILED(hr))
+      return hr;
+    if(_frameSink)
+      _frameSink->Resize(this, width, height);
+    return S_OK;
+  }
+
+private:
+  UINT _width;
+  UINT _height;
+  ComPtr<ID3D11Texture2D> _color;
+
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitTargets(UINT width, UINT height)
+  {
+    HRESULT hr;
+    D3D11_TEXTURE2D_DESC td;
+    Retire(_rtv);
+    Retire(_color);
+    memset(&td, 0, sizeof(td));
+    td.ArraySize = 1;
+    td.BindFlags = D3D11_BIND_RENDER_TARGET;
+    td.Format = _desc.Format;
+    td.Width = width;
+    td.Height = height;
+    td.MipLevels = 1;
+    td.SampleDesc.Quality = _desc.SampleQuality;
+    td.SampleDesc.Count = _desc.SampleCount;
+    hr = _device->CreateTexture2D(&td, NULL, &_color);
+    if(FAILED(hr))
+      return hr;
+    hr = _device->CreateRenderTargetView(_color, NULL, &_rtv);
+    if(FAILED(hr))
+      return hr;
+    hr = InitDepth(width, height);
+    if(FAILED(hr))
+      return hr;
+    _width = width;
+    _height = height;
+    return S_OK;
+  }
+};
+
 D3DU_EXTERN HRESULT D3DU_API D3DUCreateFloatAnimation(
   FLOAT begin,
   FLOAT end,
@@ -848,6 +1720,22 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCreateFloatAnimation(
   return S_OK;
 }
 
+D3DU_EXTERN HRESULT D3DU_API D3DUSetFixedClock(FLOAT frameSeconds)
+{
+  LARGE_INTEGER freq, now;
+  if(frameSeconds < 0)
+    return E_INVALIDARG;
+  QueryPerformanceFrequency(&freq);
+  LONGLONG step = (LONGLONG)((double)frameSeconds * freq.QuadPart);
+  if(frameSeconds > 0 && step < 1)
+    step = 1;
+  // Starting from the wall clock keeps running animations from jumping.
+  QueryPerformanceCounter(&now);
+  InterlockedExchange64(&g_fixedClock, now.QuadPart);
+  InterlockedExchange64(&g_fixedClockStep, step);
+  return S_OK;
+}
+
 D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTarget(
   UINT x,
   UINT y,
@@ -862,8 +1750,67 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTarget(
     return E_POINTER;
   *oTarget = NULL;
   HRESULT hr;
+  ComPtr<ID3DUDevice> device;
+  hr = D3DUCreateDevice(featureLevel, acceptSoftwareDriver, &device);
+  if(FAILED(hr))
+    return hr;
+  return D3DUCreateWindowTargetEx(device, x, y, width, height, parent, NULL, oTarget);
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateDeviceWindowTarget(
+  ID3DUDevice *device,
+  UINT x,
+  UINT y,
+  UINT width,
+  UINT height,
+  HWND parent,
+  ID3DUWindowTarget **oTarget)
+{
+  return D3DUCreateWindowTargetEx(device, x, y, width, height, parent, NULL, oTarget);
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTargetEx(
+  ID3DUDevice *device,
+  UINT x,
+  UINT y,
+  UINT width,
+  UINT height,
+  HWND parent,
+  const D3DU_TARGET_DESC *desc,
+  ID3DUWindowTarget **oTarget)
+{
+  if(!oTarget)
+    return E_POINTER;
+  *oTarget = NULL;
+  if(!device)
+    return E_INVALIDARG;
+  HRESULT hr;
   ComObject<CWindowTarget> *target = new ComObject<CWindowTarget>();
-  hr = target->Construct(x, y, width, height, featureLevel, acceptSoftwareDriver, parent);
+  hr = target->Construct(device, x, y, width, height, parent, desc);
+  if(FAILED(hr))
+  {
+    delete target;
+    return hr;
+  }
+  *oTarget = target;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateOffscreenTarget(
+  ID3DUDevice *device,
+  UINT width,
+  UINT height,
+  const D3DU_TARGET_DESC *desc,
+  ID3DUTarget **oTarget)
+{
+  if(!oTarget)
+    return E_POINTER;
+  *oTarget = NULL;
+  if(!device)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<COffscreenTarget> *target = new ComObject<COffscreenTarget>();
+  hr = target->Construct(device, width, height, desc);
   if(FAILED(hr))
   {
     delete target;
@@ -873,6 +1820,133 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTarget(
   return S_OK;
 }
 
+D3DU_EXTERN HRESULT D3DU_API D3DURenderTargets(
+  UINT count,
+  ID3DUTarget *const *targets)
+{
+  if(count && !targets)
+    return E_POINTER;
+  HRESULT hr = S_OK;
+  HRESULT drawn[D3DU_MAX_BATCH_TARGETS];
+  UINT deviceOf[D3DU_MAX_BATCH_TARGETS];
+  FrameBatch batch;
+  BOOL anyDrawn = FALSE;
+  if(count > D3DU_MAX_BATCH_TARGETS)
+    return E_INVALIDARG;
+  batch.Count = 0;
+  for(UINT i = 0; i < count; ++i)
+  {
+    // Targets keep their device alive for the duration of the call.
+    ComPtr<ID3DUDevice> device;
+    deviceOf[i] = D3DU_MAX_BATCH_TARGETS;
+    if(FAILED(targets[i]->GetD3DUDevice(&device)) || !device)
+      continue;
+    UINT d = 0;
+    while(d < batch.Count && batch.Devices[d] != (ID3DUDevice*)device)
+      ++d;
+    if(d == batch.Count)
+    {
+      batch.Devices[d] = device;
+      batch.Drawn[d] = FALSE;
+      ++batch.Count;
+    }
+    deviceOf[i] = d;
+  }
+  {
+    CAutoLock lock(g_batchLock);
+    batch.Next = g_batches;
+    g_batches = &batch;
+  }
+  for(UINT i = 0; i < count; ++i)
+  {
+    drawn[i] = targets[i]->Draw();
+    if(S_OK == drawn[i] && deviceOf[i] < batch.Count)
+      batch.Drawn[deviceOf[i]] = TRUE;
+  }
+  {
+    CAutoLock lock(g_batchLock);
+    FrameBatch **link = &g_batches;
+    while(*link != &batch)
+      link = &(*link)->Next;
+    *link = batch.Next;
+  }
+  for(UINT d = 0; d < batch.Count; ++d)
+  {
+    if(batch.Drawn[d])
+    {
+      EndDeviceFrame(batch.Devices[d]);
+      anyDrawn = TRUE;
+    }
+  }
+  if(anyDrawn)
+    ClockAdvance();
+  for(UINT i = 0; i < count; ++i)
+  {
+    if(S_OK == drawn[i])
+      drawn[i] = targets[i]->Present();
+    if(FAILED(drawn[i]) && SUCCEEDED(hr))
+      hr = drawn[i];
+  }
+  return hr;
+}
+
+static CLock compilerLock;
+static ComPtr<ID3DUShaderCompiler> compiler;
+
+/// Runs D3DCompile, or the compiler set with D3DUSetShaderCompiler.
+static HRESULT CompileShader(
+  LPCVOID code,
+  SIZE_T size,
+  LPCSTR entry,
+  LPCSTR target,
+  DWORD shaderFlags,
+  ID3DBlob **oCodeBlob)
+{
+  HRESULT hr;
+  ComPtr<ID3DBlob> errors;
+  ComPtr<ID3DUShaderCompiler> replacement;
+  D3DU_TRACE_ZONE("Compile");
+  {
+    CAutoLock lock(compilerLock);
+    replacement = compiler;
+  }
+  if(replacement)
+  {
+    hr = replacement->Compile(code, size, entry, target, shaderFlags, oCodeBlob, &errors);
+  }
+  else
+  {
+    hr = D3DCompile(
+      code,
+      size,
+      NULL,
+      NULL,
+      NULL,
+      entry,
+      target,
+      shaderFlags,
+      0,
+      oCodeBlob,
+      &errors);
+  }
+  if(FAILED(hr))
+  {
+    D3DU_LOG(
+      D3DU_LOG_ERROR,
+      "Shader compilation failed (0x%08X). %s",
+      hr,
+      errors ? (LPCSTR)errors->GetBufferPointer() : "");
+  }
+  return hr;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUSetShaderCompiler(ID3DUShaderCompiler *replacement)
+{
+  CAutoLock lock(compilerLock);
+  compiler = replacement;
+  return S_OK;
+}
+
 D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromMemory(
   LPCSTR code,
   SIZE_T size,
@@ -883,31 +1957,8 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromMemory(
 {
   if(!oCodeBlob)
     return E_POINTER;
-  HRESULT hr;
-  ComPtr<ID3DBlob> errors;
   *oCodeBlob = NULL;
-  hr = D3DCompile(
-    code,
-    size,
-    NULL,
-    NULL,
-    NULL,
-    entry,
-    target,
-    shaderFlags,
-    0,
-    oCodeBlob,
-    &errors);  
-#ifdef D3DU_DEBUG
-  if(FAILED(hr))    
-  {
-    if(errors)
-      OutputDebugStringA((LPCSTR)errors->GetBufferPointer());
-    else
-      OutputDebugStringA("Shader compilation failed.");
-  }
-#endif
-  return hr;
+  return CompileShader(code, size, entry, target, shaderFlags, oCodeBlob);
 }
 
 D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromResource(
@@ -922,7 +1973,6 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromResource(
   if(!oCodeBlob)
     return E_POINTER;
   HRESULT hr;
-  ComPtr<ID3DBlob> errors;
   HGLOBAL res;
   HRSRC hres;
   LPVOID data;
@@ -936,27 +1986,7 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromResource(
   if(!res)
     return HRESULT_FROM_WIN32(GetLastError());
   data = LockResource(res);
-  hr = D3DCompile(
-    data,
-    size,
-    NULL,
-    NULL,
-    NULL,
-    entry,
-    target,
-    shaderFlags,
-    0,
-    oCodeBlob,
-    &errors);  
-#ifdef D3DU_DEBUG
-  if(FAILED(hr))    
-  {
-    if(errors)
-      OutputDebugStringA((LPCSTR)errors->GetBufferPointer());
-    else
-      OutputDebugStringA("Shader compilation failed.");
-  }
-#endif
+  hr = CompileShader(data, size, entry, target, shaderFlags, oCodeBlob);
   FreeResource(res);
   return hr;
 }
@@ -971,7 +2001,6 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromFile(
   if(!oCodeBlob)
     return E_POINTER;
   HRESULT hr;
-  ComPtr<ID3DBlob> errors;
   LPVOID data;
   SIZE_T size;
   HANDLE file;
@@ -1025,29 +2054,18 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromFile(
     CloseHandle(file);
     return HRESULT_FROM_WIN32(GetLastError());
   }  
-  hr = D3DCompile(
-    data,
-    size,
-    NULL,
-    NULL,
-    NULL,
-    entry,
-    target,
-    shaderFlags,
-    0,
-    oCodeBlob,
-    &errors);  
-#ifdef D3DU_DEBUG
-  if(FAILED(hr))    
-  {
-    if(errors)
-      OutputDebugStringA((LPCSTR)errors->GetBufferPointer());
-    else
-      OutputDebugStringA("Shader compilation failed.");
-  }
-#endif
+  hr = CompileShader(data, size, entry, target, shaderFlags, oCodeBlob);
   UnmapViewOfFile(data);
   CloseHandle(mapping);
   CloseHandle(file);
   return hr;
-}
\ No newline at end of file
+}
+
+/// Only thread exits matter to the library; everything else is set up
+/// and torn down by the constructors and destructors of its globals.
+BOOL APIENTRY DllMain(HMODULE module, DWORD reason, LPVOID reserved)
+{
+  if(DLL_THREAD_DETACH == reason)
+    TraceThreadDetach();
+  return TRUE;
+}
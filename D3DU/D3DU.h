@@ -43,13 +43,423 @@
 #endif
 #define D3DU_API __stdcall
 
+/// Maximum number of targets passed to D3DURenderTargets.
+#define D3DU_MAX_BATCH_TARGETS 64
+/// Maximum number of layers in a layer sink.
+#define D3DU_MAX_LAYERS 64
+/// Maximum number of log sinks.
+#define D3DU_MAX_LOG_SINKS 8
+/// Number of frames target statistics average over.
+#define D3DU_STATISTICS_WINDOW 60
+/// Number of frames frame time statistics cover.
+#define D3DU_FRAME_TIME_WINDOW 1024
+/// Slots a draw packet binds, starting at slot 0.
+#define D3DU_PACKET_VERTEX_BUFFERS 2
+#define D3DU_PACKET_CONSTANT_BUFFERS 2
+#define D3DU_PACKET_RESOURCES 4
+#define D3DU_PACKET_SAMPLERS 2
+/// Input slot of the per-instance stream of instance batches.
+#define D3DU_INSTANCE_SLOT 1
+
 typedef interface ID3DUFloatAnimation ID3DUFloatAnimation;
+typedef interface ID3DUDevice ID3DUDevice;
 typedef interface ID3DUTarget ID3DUTarget;
 typedef interface ID3DUWindowTarget ID3DUWindowTarget;
 typedef interface ID3DUSink ID3DUSink;
 typedef interface ID3DUFrameSink ID3DUFrameSink;
 typedef interface ID3DUKeySink ID3DUKeySink;
 typedef interface ID3DUMouseSink ID3DUMouseSink;
+typedef interface ID3DUCaptureSink ID3DUCaptureSink;
+typedef interface ID3DUFrameExporter ID3DUFrameExporter;
+typedef interface ID3DULayerSink ID3DULayerSink;
+typedef interface ID3DUResourcePool ID3DUResourcePool;
+typedef interface ID3DURenderGraph ID3DURenderGraph;
+typedef interface ID3DUStateCache ID3DUStateCache;
+typedef interface ID3DUUploadRing ID3DUUploadRing;
+typedef interface ID3DURenderQueue ID3DURenderQueue;
+typedef interface ID3DUInstanceBatch ID3DUInstanceBatch;
+typedef interface ID3DUMemoryTracker ID3DUMemoryTracker;
+typedef interface ID3DUMemorySink ID3DUMemorySink;
+typedef interface ID3DUFrameStats ID3DUFrameStats;
+typedef interface ID3DULogSink ID3DULogSink;
+typedef interface ID3DUShaderCompiler ID3DUShaderCompiler;
+
+/// Zero Format, SampleCount and BufferCount select R8G8B8A8_UNORM, 1 and 1.
+/// DXGI_FORMAT_UNKNOWN DepthFormat creates no depth buffer at all,
+/// GetFrameDSV returns NULL then. The depth buffer comes from the
+/// resource pool rounded up to a size class, so it may be larger than
+/// the target.
+typedef struct
+{
+  DXGI_FORMAT Format;
+  DXGI_FORMAT DepthFormat;
+  UINT SampleCount;
+  UINT SampleQuality;
+  UINT BufferCount;
+} D3DU_TARGET_DESC;
+
+/// Zero fields are replaced with defaults: 1/60 s budget, scales
+/// between 0.5 and 1, decisions taken over 8 frames.
+/// Scales apply to width and height and may not exceed 1.
+typedef struct
+{
+  FLOAT FrameBudget;
+  FLOAT MinScale;
+  FLOAT MaxScale;
+  UINT FrameWindow;
+} D3DU_DYNAMIC_RESOLUTION_DESC;
+
+typedef enum
+{
+  /// Texture goes back to the pool at the end of the frame.
+  D3DU_POOL_DEFAULT = 0,
+  /// Width and height are rounded up to a size class, so that nearby sizes
+  /// share textures. Users draw to the top left Width x Height part.
+  D3DU_POOL_ROUND_SIZE = 1,
+  /// Texture is kept across frames until ReleaseTexture.
+  D3DU_POOL_PERSISTENT = 2,
+} D3DU_POOL_FLAGS;
+
+/// Pointers are not referenced and stay valid until the texture is returned.
+/// Views are created for the bind flags of the texture.
+typedef struct
+{
+  ID3D11Texture2D *Texture;
+  ID3D11RenderTargetView *RTV;
+  ID3D11DepthStencilView *DSV;
+  ID3D11ShaderResourceView *SRV;
+  ID3D11UnorderedAccessView *UAV;
+  /// Size of the texture, larger than requested with D3DU_POOL_ROUND_SIZE.
+  UINT Width;
+  UINT Height;
+} D3DU_POOLED_TEXTURE;
+
+typedef struct
+{
+  UINT TextureCount;
+  UINT TexturesInUse;
+  UINT64 AllocatedBytes;
+  UINT64 PeakBytes;
+  UINT64 Hits;
+  UINT64 Misses;
+} D3DU_POOL_STATISTICS;
+
+/// Render graph resource standing for the frame RTV and DSV of the target.
+#define D3DU_GRAPH_BACK_BUFFER 0
+
+typedef enum
+{
+  D3DU_GRAPH_PASS_DEFAULT = 0,
+  /// Pass is never culled, e.g. because it reads data back to the CPU.
+  D3DU_GRAPH_PASS_KEEP = 1,
+} D3DU_GRAPH_PASS_FLAGS;
+
+typedef struct
+{
+  UINT PassCount;
+  UINT PassesCulled;
+  UINT ResourceCount;
+  /// Textures actually acquired per frame, after aliasing.
+  UINT TextureCount;
+} D3DU_GRAPH_STATISTICS;
+
+/// Hits count Set calls dropped as redundant, misses the ones passed on.
+/// Resets counts ClearState and command list execution, which leave
+/// the state known, and Invalidate, which does not.
+typedef struct
+{
+  UINT64 Hits;
+  UINT64 Misses;
+  UINT64 Resets;
+} D3DU_STATE_CACHE_STATISTICS;
+
+/// Work submitted to the driver. State changes are the Set calls left
+/// after the state cache, resources count every Create call for
+/// resources and views. Primitives of indirect draws and DrawAuto are
+/// unknown. Bytes uploaded count UpdateSubresource, and whole
+/// subresources mapped with WRITE, READ_WRITE or WRITE_DISCARD. Maps
+/// with WRITE_NO_OVERWRITE are left out, since what part the caller
+/// fills is not known; upload rings count theirs in
+/// D3DU_UPLOAD_STATISTICS.
+typedef struct
+{
+  UINT64 DrawCalls;
+  UINT64 Primitives;
+  UINT64 Dispatches;
+  UINT64 StateChanges;
+  UINT64 BytesUploaded;
+  UINT64 ResourcesCreated;
+} D3DU_WORKLOAD;
+
+/// Work done between the start and the end of target Draw.
+/// Average covers the last D3DU_STATISTICS_WINDOW frames,
+/// or all of them while there were fewer.
+typedef struct
+{
+  UINT64 FrameCount;
+  D3DU_WORKLOAD LastFrame;
+  D3DU_WORKLOAD Average;
+} D3DU_TARGET_STATISTICS;
+
+/// What GPU memory is spent on. Resources are sorted by their bind
+/// flags: render targets and depth buffers, then constant buffers, then
+/// vertex, index and stream output buffers; remaining textures are
+/// textures and remaining buffers user ones.
+/// D3DU_MEMORY_TOTAL stands for all categories together.
+typedef enum
+{
+  D3DU_MEMORY_TARGETS,
+  D3DU_MEMORY_GEOMETRY,
+  D3DU_MEMORY_CONSTANTS,
+  D3DU_MEMORY_TEXTURES,
+  D3DU_MEMORY_USER,
+  D3DU_MEMORY_TOTAL,
+} D3DU_MEMORY_CATEGORY;
+
+/// Bytes are estimated from resource descriptions; drivers add padding
+/// and alignment of their own. High water is the most Bytes ever were.
+/// Zero Budget means none.
+typedef struct
+{
+  UINT64 Bytes;
+  UINT64 HighWater;
+  UINT64 Budget;
+  UINT64 Allocations;
+} D3DU_MEMORY_USAGE;
+
+/// Indexed by D3DU_MEMORY_CATEGORY.
+typedef struct
+{
+  D3DU_MEMORY_USAGE Usage[D3DU_MEMORY_TOTAL + 1];
+} D3DU_MEMORY_STATISTICS;
+
+/// Times ID3DUFrameStats keeps: CPU time of the frame sink's
+/// RenderFrame, time spent in the swap chain's Present, and time from
+/// the start of one Draw to the start of the next.
+typedef enum
+{
+  D3DU_FRAME_TIME_RENDER,
+  D3DU_FRAME_TIME_PRESENT,
+  D3DU_FRAME_TIME_INTERVAL,
+  D3DU_FRAME_TIME_COUNT,
+} D3DU_FRAME_TIME;
+
+/// Milliseconds over the last D3DU_FRAME_TIME_WINDOW samples. Mean is
+/// exact; the others are accurate to about 3%, and rounded up.
+typedef struct
+{
+  UINT Samples;
+  FLOAT Min;
+  FLOAT Mean;
+  FLOAT P50;
+  FLOAT P95;
+  FLOAT P99;
+  FLOAT Max;
+} D3DU_FRAME_TIME_STATISTICS;
+
+/// Results of D3DUReplayRecording.
+typedef struct
+{
+  UINT64 Frames;
+  UINT64 Calls;
+  /// Calls left out because an object they use was not created.
+  UINT64 Skipped;
+  /// Wall time of all passes, waiting for the device included.
+  FLOAT Seconds;
+  /// From the end of one frame to the end of the next.
+  D3DU_FRAME_TIME_STATISTICS FrameTimes;
+} D3DU_REPLAY_STATISTICS;
+
+typedef enum
+{
+  /// Writes the golden image and the baseline instead of checking them.
+  D3DU_REGRESSION_UPDATE = 1,
+} D3DU_REGRESSION_FLAGS;
+
+/// Zero fields are replaced with defaults: 640 x 480, 120 frames of
+/// 1/60 s, feature level 10.0, 40 dB PSNR, a channel error of 16, and
+/// frame times up to 25% or 0.5 ms over the baseline, whichever is more.
+/// NULL GoldenImage or Baseline skips that check. NULL TargetDesc is
+/// the same as for D3DUCreateOffscreenTarget; formats other than 8 bit
+/// RGBA and BGRA cannot be compared.
+typedef struct
+{
+  UINT Width;
+  UINT Height;
+  UINT Frames;
+  FLOAT FrameSeconds;
+  D3D_FEATURE_LEVEL FeatureLevel;
+  const D3DU_TARGET_DESC *TargetDesc;
+  /// 32bpp BMP of the last frame.
+  LPCWSTR GoldenImage;
+  /// Frame times as text.
+  LPCWSTR Baseline;
+  /// Decibels.
+  FLOAT MinPsnr;
+  UINT MaxError;
+  /// Fraction of the baseline P50 and P95.
+  FLOAT TimeTolerance;
+  /// Milliseconds.
+  FLOAT TimeSlack;
+  /// D3DU_REGRESSION_FLAGS.
+  UINT Flags;
+} D3DU_REGRESSION_DESC;
+
+/// Results of D3DURunRegression. Alpha is left out of the image
+/// comparison; Psnr is FLT_MAX when the images are the same.
+typedef struct
+{
+  BOOL ImageMatches;
+  FLOAT Psnr;
+  UINT MaxError;
+  BOOL TimesMatch;
+  /// From the start of one frame to the device finishing it.
+  D3DU_FRAME_TIME_STATISTICS FrameTimes;
+  D3DU_FRAME_TIME_STATISTICS Baseline;
+} D3DU_REGRESSION_RESULT;
+
+typedef enum
+{
+  D3DU_STAGE_VS,
+  D3DU_STAGE_HS,
+  D3DU_STAGE_DS,
+  D3DU_STAGE_GS,
+  D3DU_STAGE_PS,
+  D3DU_STAGE_CS,
+} D3DU_SHADER_STAGE;
+
+/// Part of a buffer holding constants, in the units of
+/// VSSetConstantBuffers1 and friends. Buffer is not referenced.
+typedef struct
+{
+  ID3D11Buffer *Buffer;
+  UINT FirstConstant;
+  UINT NumConstants;
+} D3DU_CONSTANT_SLICE;
+
+/// Maps counts Map calls, wraps the times the ring started over.
+/// BufferCount is the number of buffers behind the ring,
+/// Offsets tells whether slices share one buffer.
+typedef struct
+{
+  UINT64 Uploads;
+  UINT64 BytesUploaded;
+  UINT64 Maps;
+  UINT64 Wraps;
+  UINT BufferCount;
+  BOOL Offsets;
+} D3DU_UPLOAD_STATISTICS;
+
+/// Everything one draw binds. Slots beyond those listed, and the output
+/// merger targets, are left as they are. NULL states select the defaults.
+/// Zero IndexCount draws VertexCount vertices from StartVertex on, without
+/// the index buffer; otherwise StartVertex is unused. Zero InstanceCount
+/// means one. Draws are instanced when InstanceCount is above one or
+/// StartInstance is not zero.
+/// Objects are not referenced.
+typedef struct
+{
+  ID3D11InputLayout *InputLayout;
+  D3D11_PRIMITIVE_TOPOLOGY Topology;
+  ID3D11Buffer *VertexBuffers[D3DU_PACKET_VERTEX_BUFFERS];
+  UINT Strides[D3DU_PACKET_VERTEX_BUFFERS];
+  UINT Offsets[D3DU_PACKET_VERTEX_BUFFERS];
+  ID3D11Buffer *IndexBuffer;
+  DXGI_FORMAT IndexFormat;
+  ID3D11VertexShader *VS;
+  ID3D11PixelShader *PS;
+  ID3D11Buffer *VSConstantBuffers[D3DU_PACKET_CONSTANT_BUFFERS];
+  ID3D11Buffer *PSConstantBuffers[D3DU_PACKET_CONSTANT_BUFFERS];
+  ID3D11ShaderResourceView *PSResources[D3DU_PACKET_RESOURCES];
+  ID3D11SamplerState *PSSamplers[D3DU_PACKET_SAMPLERS];
+  ID3D11RasterizerState *RasterizerState;
+  ID3D11BlendState *BlendState;
+  ID3D11DepthStencilState *DepthStencilState;
+  UINT StencilRef;
+  UINT IndexCount;
+  UINT VertexCount;
+  UINT StartIndex;
+  UINT StartVertex;
+  INT BaseVertex;
+  UINT InstanceCount;
+  UINT StartInstance;
+} D3DU_DRAW_PACKET;
+
+/// Of the last Submit. State changes are the Set calls the state cache
+/// passed on, filtered ones those it dropped.
+typedef struct
+{
+  UINT PacketCount;
+  UINT64 StateChanges;
+  UINT64 StateChangesFiltered;
+} D3DU_QUEUE_STATISTICS;
+
+/// Vertices, in input slot 0, and optionally indices of a mesh.
+/// NULL IndexBuffer draws VertexCount vertices without indices.
+typedef struct
+{
+  D3D11_PRIMITIVE_TOPOLOGY Topology;
+  ID3D11Buffer *VertexBuffer;
+  UINT VertexStride;
+  UINT VertexCount;
+  ID3D11Buffer *IndexBuffer;
+  DXGI_FORMAT IndexFormat;
+  UINT IndexCount;
+} D3DU_MESH;
+
+/// Per-instance input element. Count elements of Format take consecutive
+/// semantic indices from SemanticIndex on, so a float4x4 is four
+/// R32G32B32A32_FLOAT elements. Zero Count means one.
+typedef struct
+{
+  LPCSTR SemanticName;
+  UINT SemanticIndex;
+  DXGI_FORMAT Format;
+  UINT Count;
+} D3DU_INSTANCE_ELEMENT;
+
+/// Pixel format and container of a capture stream.
+typedef enum
+{
+  D3DU_CAPTURE_RAW_RGBA,
+  D3DU_CAPTURE_RAW_BGRA,
+  D3DU_CAPTURE_RAW_I420,
+  D3DU_CAPTURE_Y4M_I420,
+  D3DU_CAPTURE_Y4M_444,
+} D3DU_CAPTURE_FORMAT;
+
+/// Zero fields are replaced with defaults: 60/1 fps, 4 frames in flight.
+typedef struct
+{
+  D3DU_CAPTURE_FORMAT Format;
+  UINT FrameRateNumerator;
+  UINT FrameRateDenominator;
+  UINT QueueDepth;
+} D3DU_CAPTURE_DESC;
+
+typedef struct
+{
+  UINT64 FramesCaptured;
+  UINT64 FramesDropped;
+  UINT64 FramesWritten;
+  UINT64 BytesWritten;
+} D3DU_CAPTURE_STATISTICS;
+
+/// Slots are sized for MaxWidth x MaxHeight 32bpp frames; larger frames are dropped.
+/// Zero SlotCount and ReadbackDepth default to 4 and 3.
+typedef struct
+{
+  UINT SlotCount;
+  UINT MaxWidth;
+  UINT MaxHeight;
+  UINT ReadbackDepth;
+} D3DU_EXPORT_DESC;
+
+typedef struct
+{
+  UINT64 FramesExported;
+  UINT64 FramesDropped;
+} D3DU_EXPORT_STATISTICS;
 
 /// Well, function and argument names are self-explanatory.
 
@@ -61,6 +471,26 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCreateFloatAnimation(
   BOOL autoReverse,
   /* [out] */ ID3DUFloatAnimation **oFloatAnimation);
 
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  BOOL acceptSoftwareDriver,
+  /* [out] */ ID3DUDevice **oDevice);
+
+/// Creates a device on the null driver, which takes every call and
+/// draws nothing, for measuring what the library costs the CPU.
+/// It has neither DXGI objects nor a 10.1 device; their getters return
+/// NULL, and window targets cannot be created on it.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateNullDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  /* [out] */ ID3DUDevice **oDevice);
+
+/// Creates a device on WARP only, whose output does not depend on
+/// the GPU of the machine.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateSoftwareDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  /* [out] */ ID3DUDevice **oDevice);
+
+/// Creates a target with its own device.
 D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTarget(
   UINT x,
   UINT y,
@@ -71,6 +501,110 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTarget(
   BOOL acceptSoftwareDriver,
   /* [out] */ ID3DUWindowTarget **oTarget);
 
+/// Creates a target on a shared device. It only adds a swap chain
+/// and a depth buffer to what the device already has.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateDeviceWindowTarget(
+  ID3DUDevice *device,
+  UINT x,
+  UINT y,
+  UINT width,
+  UINT height,
+  HWND parent,
+  /* [out] */ ID3DUWindowTarget **oTarget);
+
+/// NULL `desc' keeps the defaults of D3DUCreateDeviceWindowTarget:
+/// D32_FLOAT depth, and 4x MSAA above feature level 10.0.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateWindowTargetEx(
+  ID3DUDevice *device,
+  UINT x,
+  UINT y,
+  UINT width,
+  UINT height,
+  HWND parent,
+  const D3DU_TARGET_DESC *desc,
+  /* [out] */ ID3DUWindowTarget **oTarget);
+
+/// `desc' may be NULL, see D3DUCreateWindowTargetEx.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateOffscreenTarget(
+  ID3DUDevice *device,
+  UINT width,
+  UINT height,
+  const D3DU_TARGET_DESC *desc,
+  /* [out] */ ID3DUTarget **oTarget);
+
+/// Draws every target first and then presents them all. The frame of
+/// each device, and the fixed clock, end once after all targets are
+/// drawn, so frame textures of the pool stay taken until then.
+/// Returns the first error, but still renders the remaining targets.
+D3DU_EXTERN HRESULT D3DU_API D3DURenderTargets(
+  UINT count,
+  ID3DUTarget *const *targets);
+
+/// `sink' may be NULL and set later.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateCaptureSink(
+  LPCWSTR filename,
+  const D3DU_CAPTURE_DESC *desc,
+  ID3DUFrameSink *sink,
+  /* [out] */ ID3DUCaptureSink **oCapture);
+
+/// `name' is the shared memory name consumers pass to CFrameRingReader::Open.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateFrameExporter(
+  LPCSTR name,
+  const D3DU_EXPORT_DESC *desc,
+  ID3DUFrameSink *sink,
+  /* [out] */ ID3DUFrameExporter **oExporter);
+
+/// Every ID3DUDevice has a pool already, see GetResourcePool.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateResourcePool(
+  ID3D11Device *device,
+  /* [out] */ ID3DUResourcePool **oPool);
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateRenderGraph(
+  /* [out] */ ID3DURenderGraph **oGraph);
+
+/// Every ID3DUDevice wraps its immediate context in one already,
+/// see GetStateCache.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateStateCache(
+  ID3D11DeviceContext *context,
+  /* [out] */ ID3DUStateCache **oCache);
+
+/// Every target has a ring already, see GetUploadRing.
+/// Zero `size' selects 1 MB.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateUploadRing(
+  ID3D11DeviceContext *context,
+  UINT size,
+  /* [out] */ ID3DUUploadRing **oRing);
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateRenderQueue(
+  /* [out] */ ID3DURenderQueue **oQueue);
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateInstanceBatch(
+  ID3D11Device *device,
+  /* [out] */ ID3DUInstanceBatch **oBatch);
+
+/// Creates a layout of `vertexElements', which must read slot 0, followed
+/// by `instanceElements' packed in order into D3DU_INSTANCE_SLOT with one
+/// step per instance.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateInstanceInputLayout(
+  ID3D11Device *device,
+  const D3D11_INPUT_ELEMENT_DESC *vertexElements,
+  UINT vertexElementCount,
+  const D3DU_INSTANCE_ELEMENT *instanceElements,
+  UINT instanceElementCount,
+  const void *shaderBytecode,
+  SIZE_T bytecodeLength,
+  /* [out] */ ID3D11InputLayout **oLayout);
+
+/// Zero `threadCount' starts one worker thread per processor
+/// besides the render thread.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateLayerSink(
+  UINT threadCount,
+  /* [out] */ ID3DULayerSink **oSink);
+
+/// Makes the D3DUCompileFrom functions use `compiler' instead of
+/// D3DCompile; NULL goes back to D3DCompile.
+D3DU_EXTERN HRESULT D3DU_API D3DUSetShaderCompiler(ID3DUShaderCompiler *compiler);
+
 D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromMemory(
   LPCSTR code,
   SIZE_T size,
@@ -95,6 +629,121 @@ D3DU_EXTERN HRESULT D3DU_API D3DUCompileFromFile(
   DWORD shaderFlags,
   /* [out] */ ID3DBlob **oCodeBlob);
 
+// Tracing
+
+/// Starts or stops recording trace zones on all threads.
+/// Starting again drops the zones recorded so far.
+D3DU_EXTERN HRESULT D3DU_API D3DUTraceEnable(BOOL enable);
+
+/// Opens a zone on the calling thread; use D3DU_TRACE_ZONE from
+/// Trace.hpp rather than calling this directly. `name' is kept by pointer.
+/// FALSE when nothing is recorded, and the zone must not be closed then.
+D3DU_EXTERN BOOL D3DU_API D3DUTraceBegin(LPCSTR name);
+
+/// Closes the innermost zone of the calling thread.
+D3DU_EXTERN void D3DU_API D3DUTraceEnd();
+
+/// Writes the zones recorded since tracing was last enabled
+/// as Chrome trace event JSON. Recording may go on meanwhile. Zones of
+/// threads that have exited are kept until another thread starts
+/// recording and takes over their buffer.
+D3DU_EXTERN HRESULT D3DU_API D3DUTraceWrite(LPCWSTR filename);
+
+// Recording
+
+/// Issues the calls of a log written through ID3DUDevice::StartRecording
+/// on `device' as fast as it takes them, `passes' times over. Objects
+/// are created anew for every pass; the time spent creating the ones
+/// that existed before the recording is left out of frame times. Each
+/// frame is flushed. The device may be a null one, see
+/// D3DUCreateNullDevice.
+D3DU_EXTERN HRESULT D3DU_API D3DUReplayRecording(
+  ID3D11Device *device,
+  LPCWSTR filename,
+  UINT passes,
+  /* [out] */ D3DU_REPLAY_STATISTICS *oStats);
+
+// Regression
+
+/// Makes animations see time move by `frameSeconds' with every frame
+/// a target draws, or once for a whole D3DURenderTargets batch, rather
+/// than with the wall clock, so that frames come out the same on every
+/// run. Zero goes back to the wall clock.
+/// Frame statistics keep using the wall clock.
+D3DU_EXTERN HRESULT D3DU_API D3DUSetFixedClock(FLOAT frameSeconds);
+
+/// Attaches `sink' to an offscreen target on a software device, draws
+/// Frames frames with the clock fixed and waits for each, then checks
+/// the last frame against GoldenImage and frame times against Baseline.
+/// S_FALSE when a check fails; the outcome is logged as well.
+/// `oResult' may be NULL.
+D3DU_EXTERN HRESULT D3DU_API D3DURunRegression(
+  ID3DUFrameSink *sink,
+  const D3DU_REGRESSION_DESC *desc,
+  /* [out] */ D3DU_REGRESSION_RESULT *oResult);
+
+// Logging
+
+typedef enum
+{
+  D3DU_LOG_DEBUG,
+  D3DU_LOG_INFO,
+  D3DU_LOG_WARNING,
+  D3DU_LOG_ERROR,
+  D3DU_LOG_NONE,
+} D3DU_LOG_LEVEL;
+
+typedef enum
+{
+  D3DU_LOG_SINK_DEBUGGER,
+  D3DU_LOG_SINK_STDERR,
+  D3DU_LOG_SINK_FILE,
+} D3DU_LOG_SINK_TYPE;
+
+/// Text is UTF-8, without a trailing newline, and only valid during
+/// the call. Time is a QueryPerformanceCounter value taken when the
+/// message was queued.
+typedef struct
+{
+  D3DU_LOG_LEVEL Level;
+  DWORD ThreadId;
+  LARGE_INTEGER Time;
+  LPCSTR Text;
+} D3DU_LOG_MESSAGE;
+
+/// Receives log messages, one at a time and in the order they were
+/// queued, on a background thread of the library.
+MIDL_INTERFACE("18A1246C-DC8B-4AA7-AA9D-A5A5834B1DCE")
+ID3DULogSink : public IUnknown
+{
+public:
+  STDMETHOD_(void, Write)(const D3DU_LOG_MESSAGE *message) = 0;
+};
+
+/// Messages below `level' are dropped before anything is copied or
+/// formatted. The default is D3DU_LOG_DEBUG in debug builds of the
+/// library and D3DU_LOG_WARNING otherwise.
+D3DU_EXTERN HRESULT D3DU_API D3DUSetLogLevel(D3DU_LOG_LEVEL level);
+
+/// Sinks start out with one writing to the debugger.
+D3DU_EXTERN HRESULT D3DU_API D3DUAddLogSink(ID3DULogSink *sink);
+
+/// NULL `sink' removes every sink, the default one included.
+D3DU_EXTERN HRESULT D3DU_API D3DURemoveLogSink(ID3DULogSink *sink);
+
+/// `filename' is only used by D3DU_LOG_SINK_FILE.
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateLogSink(
+  D3DU_LOG_SINK_TYPE type,
+  LPCWSTR filename,
+  /* [out] */ ID3DULogSink **oSink);
+
+/// Queues `text' for the sinks, like the library's own messages.
+D3DU_EXTERN HRESULT D3DU_API D3DULogWrite(D3DU_LOG_LEVEL level, LPCSTR text);
+
+/// Waits until every message queued so far has reached the sinks.
+/// Must not be called from a sink.
+D3DU_EXTERN HRESULT D3DU_API D3DUFlushLog();
+
 // Animation
 MIDL_INTERFACE("9D1DA4B4-1DDE-479C-BE3C-A652CAA71540")
 ID3DUFloatAnimation : public IUnknown
@@ -114,8 +763,41 @@ public:
   STDMETHOD(SetAutoReverse)(BOOL autoReverse) = 0;
 };
 
+/// Direct3D device, its immediate context and the DXGI objects behind them.
+/// Targets created on the same device share all of these, so they
+/// must be rendered from one thread.
+MIDL_INTERFACE("15E74A9F-8716-48A7-854B-758E3A2637AB")
+ID3DUDevice : public IUnknown
+{
+public:
+  STDMETHOD(GetDevice)(/* [out] */ ID3D11Device **oDevice) = 0;
+  STDMETHOD(GetDevice10)(/* [out] */ ID3D10Device1 **oDevice) = 0;
+  /// Returns the state cache over the immediate context.
+  STDMETHOD(GetDC)(/* [out] */ ID3D11DeviceContext **oDC) = 0;
+  STDMETHOD(GetDXGIDevice)(/* [out] */ IDXGIDevice **oDevice) = 0;
+  STDMETHOD(GetFactory)(/* [out] */ IDXGIFactory **oFactory) = 0;
+  STDMETHOD(GetAdapter)(/* [out] */ IDXGIAdapter **oAdapter) = 0;
+  /// May return NULL when the adapter has no outputs.
+  STDMETHOD(GetOutput)(/* [out] */ IDXGIOutput **oOutput) = 0;
+  STDMETHOD(GetFeatureLevel)(/* [out] */ D3D_FEATURE_LEVEL *oLevel) = 0;
+  STDMETHOD(GetResourcePool)(/* [out] */ ID3DUResourcePool **oPool) = 0;
+  STDMETHOD(GetStateCache)(/* [out] */ ID3DUStateCache **oCache) = 0;
+  /// Totals since the device was created, from all of its contexts.
+  STDMETHOD(GetWorkload)(/* [out] */ D3DU_WORKLOAD *oWorkload) = 0;
+  /// Counts buffers and textures created through GetDevice.
+  STDMETHOD(GetMemoryTracker)(/* [out] */ ID3DUMemoryTracker **oTracker) = 0;
+  /// Starts logging what is done through GetDevice, GetDC and deferred
+  /// contexts of the device, for D3DUReplayRecording. Call between frames.
+  STDMETHOD(StartRecording)(LPCWSTR filename) = 0;
+  /// S_FALSE when nothing was being recorded.
+  STDMETHOD(StopRecording)() = 0;
+  /// Ends a frame of the recording; targets call it after each Draw,
+  /// D3DURenderTargets once for all targets of the device.
+  STDMETHOD(EndFrame)() = 0;
+};
+
 /// Generic renderer interface.
-MIDL_INTERFACE("A368DF08-C45B-4FA2-9188-EA5482BF5DC1")
+MIDL_INTERFACE("23A55746-B592-4A5D-A8F4-2D463E5051CF")
 ID3DUTarget : public IUnknown
 {
 public:  
@@ -129,6 +811,25 @@ public:
   STDMETHOD(GetDC)(ID3D11DeviceContext **oDC) = 0;
   STDMETHOD(GetFrameRTV)(/* [out] */ ID3D11RenderTargetView **oRTV) = 0;
   STDMETHOD(GetFrameDSV)(/* [out] */ ID3D11DepthStencilView **oDSV) = 0;
+  /// Render is Draw followed by Present.
+  /// Draw returns S_FALSE when there was nothing to draw to.
+  STDMETHOD(Draw)() = 0;
+  STDMETHOD(Present)() = 0;
+  STDMETHOD(GetD3DUDevice)(/* [out] */ ID3DUDevice **oDevice) = 0;
+  STDMETHOD(GetDesc)(/* [out] */ D3DU_TARGET_DESC *oDesc) = 0;
+  /// Pool of the device. Targets call its EndFrame after every Draw,
+  /// D3DURenderTargets once for all targets of the device.
+  STDMETHOD(GetResourcePool)(/* [out] */ ID3DUResourcePool **oPool) = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_TARGET_STATISTICS *oStats) = 0;
+  /// Ring over the context GetDC returns. Targets call its EndFrame
+  /// after every Draw.
+  STDMETHOD(GetUploadRing)(/* [out] */ ID3DUUploadRing **oRing) = 0;
+  /// Keeps a reference to `object' until the GPU has finished the
+  /// current frame, then releases it. Sinks hand their resources here
+  /// in Detach, so that rebuilding them does not stall the pipeline.
+  /// Render thread only.
+  STDMETHOD(DeferRelease)(IUnknown *object) = 0;
+  STDMETHOD(GetFrameStats)(/* [out] */ ID3DUFrameStats **oStats) = 0;
 };
 
 /// ID3DUWindowTarget window state.
@@ -144,7 +845,7 @@ typedef enum
 } D3DU_WINDOW_STATE;
 
 /// Renders into HWND.
-MIDL_INTERFACE("5A55CF7E-C7C1-432D-9CDE-E10C8E8E9D59")
+MIDL_INTERFACE("722CB725-A382-4977-91D8-0B4273CA2AA1")
 ID3DUWindowTarget : public ID3DUTarget
 {
 public:
@@ -154,6 +855,18 @@ public:
   STDMETHOD(SetMouseSink)(ID3DUMouseSink *sink) = 0;  
   STDMETHOD(GetWindowState)(/* [out] */ D3DU_WINDOW_STATE *oState) = 0;
   STDMETHOD(SetWindowState)(D3DU_WINDOW_STATE state) = 0;
+  /// Makes frame sinks draw into an internal buffer, whose used part is
+  /// scaled to keep frame times within budget and stretched over the back
+  /// buffer after RenderFrame. Frame sinks are told the scaled size through
+  /// Resize and must draw into the top left part of GetFrameRTV of that size.
+  /// The upscaled image exists only in the back buffer: capture sinks and
+  /// frame exporters copy GetFrameRTV, so they record the internal buffer
+  /// before upscaling, whole, with only that part drawn.
+  /// Needs feature level 10.0. NULL `desc' turns it off.
+  STDMETHOD(SetDynamicResolution)(const D3DU_DYNAMIC_RESOLUTION_DESC *desc) = 0;
+  /// 1 when dynamic resolution is off.
+  STDMETHOD(GetRenderScale)(/* [out] */ FLOAT *oScale) = 0;
+  STDMETHOD(GetRenderSize)(/* [out] */ UINT *oWidth, /* [out] */ UINT *oHeight) = 0;
 };
 
 /// `Sink' interfaces are actually callbacks.
@@ -183,6 +896,44 @@ typedef enum
   D3DU_SKS_SHIFT = 4,
 } D3DU_SYSTEM_KEY_STATE;
 
+typedef enum
+{
+  D3DU_INPUT_KEY_DOWN,
+  D3DU_INPUT_KEY_UP,
+  D3DU_INPUT_MOUSE_MOVE,
+  D3DU_INPUT_BUTTON_DOWN,
+  D3DU_INPUT_BUTTON_UP,
+  D3DU_INPUT_WHEEL,
+} D3DU_INPUT_EVENT_TYPE;
+
+typedef enum
+{
+  D3DU_BUTTON_LEFT,
+  D3DU_BUTTON_RIGHT,
+  D3DU_BUTTON_MIDDLE,
+  D3DU_BUTTON_X1,
+  D3DU_BUTTON_X2,
+} D3DU_MOUSE_BUTTON;
+
+/// Time is in QueryPerformanceCounter ticks, taken when the window
+/// received the message. Key is a virtual key code for key events and
+/// a D3DU_MOUSE_BUTTON for button events. X and Y are client
+/// coordinates of the cursor for mouse events. Wheel is the rotation,
+/// WHEEL_DELTA to a notch, positive away from the user. Coalesced counts
+/// the mouse moves merged into this one, which carries the latest
+/// position.
+typedef struct
+{
+  D3DU_INPUT_EVENT_TYPE Type;
+  DWORD Sks;
+  UINT64 Time;
+  DWORD Key;
+  INT X;
+  INT Y;
+  INT Wheel;
+  UINT Coalesced;
+} D3DU_INPUT_EVENT;
+
 /// Handles keyboard events.
 MIDL_INTERFACE("5BA81E41-014B-4238-81AB-F3763DBDF071")
 ID3DUKeySink : public ID3DUSink
@@ -192,9 +943,307 @@ ID3DUKeySink : public ID3DUSink
 };
 
 /// Handles mouse events.
-MIDL_INTERFACE("B4BD8521-7E41-488F-8296-8EBC34E69C8E")
+/// Input is queued as it arrives and delivered at the start of every
+/// frame, before RenderFrame: first key events to the key sink, one by
+/// one, then everything in a single batch here.
+MIDL_INTERFACE("AFA422DB-2E64-430D-8B56-BDC3EAAAF6BE")
 ID3DUMouseSink : public ID3DUSink
 {
+  /// `events' holds key, button, wheel and move events in the order
+  /// they happened, with moves in a row merged into one.
+  STDMETHOD_(void, InputEvents)(
+    ID3DUWindowTarget *target,
+    const D3DU_INPUT_EVENT *events,
+    UINT count) = 0;
+};
+
+/// Records frames rendered by the wrapped frame sink into a file.
+/// Back buffer is copied on the render thread; conversion and
+/// file output happen on a background writer thread. Frames which
+/// do not fit into the queue, or differ in size from the first
+/// captured one, are dropped instead of stalling the renderer.
+MIDL_INTERFACE("768C0E3C-C63B-4E7F-B0A6-E62DCEE24DB7")
+ID3DUCaptureSink : public ID3DUFrameSink
+{
+public:
+  STDMETHOD(GetFrameSink)(/* [out] */ ID3DUFrameSink **oSink) = 0;
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink) = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_CAPTURE_STATISTICS *oStats) = 0;
+  /// Writes out pending frames and closes the file.
+  STDMETHOD(Close)() = 0;
+};
+
+/// Publishes frames rendered by the wrapped frame sink into a shared
+/// memory ring (see FrameRing.hpp) for other processes to read.
+MIDL_INTERFACE("A36DF76A-D4A2-4C01-BD95-58E136CC6032")
+ID3DUFrameExporter : public ID3DUFrameSink
+{
+public:
+  STDMETHOD(GetFrameSink)(/* [out] */ ID3DUFrameSink **oSink) = 0;
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink) = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_EXPORT_STATISTICS *oStats) = 0;
+};
+
+/// Transient textures for intermediate passes, keyed by their descriptor.
+/// A texture returned with ReleaseTexture, or at EndFrame, is handed out
+/// again for the next matching request, so passes whose lifetimes do not
+/// overlap share memory. Textures idle for a number of frames are freed,
+/// and returned textures are not kept while the pool is over budget.
+/// May be called from several threads.
+MIDL_INTERFACE("47EF6D65-F180-4AB6-A369-50928FDFA499")
+ID3DUResourcePool : public IUnknown
+{
+public:
+  /// `flags' is a combination of D3DU_POOL_FLAGS.
+  STDMETHOD(AcquireTexture)(
+    const D3D11_TEXTURE2D_DESC *desc,
+    UINT flags,
+    /* [out] */ D3DU_POOLED_TEXTURE *oTexture) = 0;
+  STDMETHOD(ReleaseTexture)(ID3D11Texture2D *texture) = 0;
+  /// Returns every non-persistent texture and frees idle ones.
+  STDMETHOD(EndFrame)() = 0;
+  /// Zero means no budget.
+  STDMETHOD(SetBudget)(UINT64 bytes) = 0;
+  /// Frees every texture not in use.
+  STDMETHOD(Trim)() = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_POOL_STATISTICS *oStats) = 0;
+};
+
+/// Frame sink running passes declared with their reads and writes.
+/// Passes are frame sinks themselves: they get Attach, Detach and Resize
+/// like any other, and RenderFrame in the order they were added, which
+/// is the order their reads and writes take effect in. Passes whose
+/// writes nothing reads are culled, and transient textures with disjoint
+/// lifetimes share memory. See RenderGraph.hpp for the exact rules.
+MIDL_INTERFACE("139E2D2F-C982-450B-AB2D-C4B2CA1A1B90")
+ID3DURenderGraph : public ID3DUFrameSink
+{
+public:
+  /// Zero Width and Height follow the size the graph was last resized to.
+  /// Textures come from the target resource pool every frame, so their
+  /// contents do not survive from one frame to the next.
+  STDMETHOD(CreateTexture)(const D3D11_TEXTURE2D_DESC *desc, /* [out] */ UINT *oResource) = 0;
+  /// `flags' is a combination of D3DU_GRAPH_PASS_FLAGS.
+  STDMETHOD(AddPass)(
+    ID3DUFrameSink *pass,
+    UINT readCount,
+    const UINT *reads,
+    UINT writeCount,
+    const UINT *writes,
+    UINT flags) = 0;
+  /// Done before the next frame after any change. Fails when a pass
+  /// that is not culled reads a texture no earlier pass writes.
+  STDMETHOD(Compile)() = 0;
+  /// Valid inside pass RenderFrame only.
+  STDMETHOD(GetTexture)(UINT resource, /* [out] */ D3DU_POOLED_TEXTURE *oTexture) = 0;
+  /// Removes every pass and resource.
+  STDMETHOD(Clear)() = 0;
+  /// Compiles first after a change, and fails when that fails.
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_GRAPH_STATISTICS *oStats) = 0;
+};
+
+/// Draws several frame sinks into one target. Each layer records into
+/// its own deferred context on a worker thread; the command lists are
+/// then executed on the immediate context in ascending layer order.
+/// Layer sinks get a target whose GetDC returns the deferred context,
+/// with frame RTV, DSV and a full-size viewport already bound.
+/// Layers may only be changed on the render thread, outside RenderFrame.
+MIDL_INTERFACE("0CDA72BF-C832-4281-8627-70629655054F")
+ID3DULayerSink : public ID3DUFrameSink
+{
+public:
+  /// Layers of equal order are drawn in the order they were added.
+  STDMETHOD(AddLayer)(ID3DUFrameSink *sink, INT order) = 0;
+  /// Returns S_FALSE when `sink' is not a layer.
+  STDMETHOD(RemoveLayer)(ID3DUFrameSink *sink) = 0;
+  STDMETHOD(GetLayerCount)(/* [out] */ UINT *oCount) = 0;
+  /// `oOrder' may be NULL.
+  STDMETHOD(GetLayer)(UINT index, /* [out] */ ID3DUFrameSink **oSink, /* [out] */ INT *oOrder) = 0;
+  /// Number of threads recording layers, the render thread included.
+  STDMETHOD(GetThreadCount)(/* [out] */ UINT *oCount) = 0;
+};
+
+/// Device context dropping redundant state changes. Every Set call is
+/// compared, slot by slot, with what the previous calls bound, and only
+/// the slots that change are passed on to the wrapped context. All other
+/// calls are passed on as they are. ClearState and command list execution
+/// reset the remembered state along with the real one.
+/// State changed on the wrapped context directly goes unnoticed, call
+/// Invalidate after doing that.
+MIDL_INTERFACE("B47C7221-3124-4A0E-9C6F-1BE25C00F269")
+ID3DUStateCache : public ID3D11DeviceContext
+{
+public:
+  STDMETHOD(GetContext)(/* [out] */ ID3D11DeviceContext **oContext) = 0;
+  /// Forgets what is bound, so that the next Set calls all go through.
+  STDMETHOD(Invalidate)() = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_STATE_CACHE_STATISTICS *oStats) = 0;
+  STDMETHOD(ResetStatistics)() = 0;
+};
+
+/// Per-draw constants without per-draw buffers. Uploads are carved out of
+/// one large dynamic buffer and bound with constant buffer offsets, so
+/// that any number of uploads between two binds cost a single Map.
+/// Offsets need Direct3D 11.1, so this mode is only compiled in with
+/// D3DU_D3D11_1 defined, and used when the driver supports it. Otherwise,
+/// and always on deferred contexts, each upload gets a dynamic buffer of
+/// its own, taken from a pool of size classes and mapped with DISCARD:
+/// one Map per upload, no fewer than plain dynamic buffers need.
+/// Slices stay valid until EndFrame, provided the uploads of one frame
+/// fit in the ring: a wrap discards what earlier slices point to, so
+/// size the ring to keep Wraps well below the frame count. Data written
+/// by Allocate reaches the GPU at the next SetConstantBuffers or EndFrame,
+/// so bind before drawing. To map once a frame with offsets, allocate
+/// the slices of every draw before binding any of them.
+///
+/// Without offsets, per-draw data mapped once a frame goes through the
+/// instance stream instead: AllocateInstances carves records out of a
+/// dynamic vertex buffer, which Direct3D 11.0 maps with NO_OVERWRITE,
+/// and SetInstanceBuffer binds it to D3DU_INSTANCE_SLOT. A draw of one
+/// instance from the returned StartInstanceLocation reads its record as
+/// per-instance data, see D3DUCreateInstanceInputLayout. Records follow
+/// the same rules as slices. Render thread only.
+MIDL_INTERFACE("2489EC55-0F72-4162-AAA9-7DA42DC2A61F")
+ID3DUUploadRing : public IUnknown
+{
+public:
+  /// `size' is at most 65536 bytes. `oData' is writable until the next call.
+  STDMETHOD(Allocate)(
+    UINT size,
+    /* [out] */ void **oData,
+    /* [out] */ D3DU_CONSTANT_SLICE *oSlice) = 0;
+  STDMETHOD(Upload)(
+    const void *data,
+    UINT size,
+    /* [out] */ D3DU_CONSTANT_SLICE *oSlice) = 0;
+  /// Binds `count' slices to consecutive slots of `stage'.
+  STDMETHOD(SetConstantBuffers)(
+    D3DU_SHADER_STAGE stage,
+    UINT startSlot,
+    UINT count,
+    const D3DU_CONSTANT_SLICE *slices) = 0;
+  /// Pool buffers are handed out again from the next frame on.
+  STDMETHOD(EndFrame)() = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_UPLOAD_STATISTICS *oStats) = 0;
+  /// `count' records of `stride' bytes, at most 2048, for the instance
+  /// stream. `oData' is writable until SetInstanceBuffer or EndFrame.
+  STDMETHOD(AllocateInstances)(
+    UINT stride,
+    UINT count,
+    /* [out] */ void **oData,
+    /* [out] */ UINT *oFirstInstance) = 0;
+  /// Unmaps the instance stream and binds it with `stride'.
+  STDMETHOD(SetInstanceBuffer)(UINT stride) = 0;
+};
+
+/// Collects draw packets over a frame and submits them sorted by key,
+/// so that draws sharing a shader or material run back to back and the
+/// state cache drops most of their Set calls. See RenderQueue.hpp for
+/// the key layout. Render thread only.
+MIDL_INTERFACE("ABF3011E-A9FB-4F16-AAE4-72620144B8A4")
+ID3DURenderQueue : public IUnknown
+{
+public:
+  /// Pass below 16, shader below 4096, material below 65536, instance
+  /// below 256; depth between 0 and 1, nearer first. Pass 1 - depth for
+  /// back to front order.
+  STDMETHOD_(UINT64, MakeKey)(UINT pass, UINT shader, UINT material, FLOAT depth, UINT instance) = 0;
+  /// Packets with equal keys are drawn in the order they were added.
+  STDMETHOD(Add)(UINT64 key, const D3DU_DRAW_PACKET *packet) = 0;
+  /// Draws every packet and empties the queue. Contexts other than a
+  /// state cache get a cache of the queue's own, which starts from
+  /// unknown state on every Submit.
+  STDMETHOD(Submit)(ID3D11DeviceContext *context) = 0;
+  /// Empties the queue without drawing.
+  STDMETHOD(Clear)() = 0;
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_QUEUE_STATISTICS *oStats) = 0;
+};
+
+/// Draws many copies of a mesh with one call. Instance data is copied
+/// into a dynamic vertex buffer, suballocated like the upload ring so
+/// that each Draw costs one NO_OVERWRITE map, and bound to
+/// D3DU_INSTANCE_SLOT next to the mesh. Input layout, shaders and
+/// constants are left to the caller; see D3DUCreateInstanceInputLayout.
+MIDL_INTERFACE("07FB7A1B-7836-451A-8E34-243EBC3BFFBD")
+ID3DUInstanceBatch : public IUnknown
+{
+public:
+  /// `instances' holds `count' elements of `stride' bytes.
+  STDMETHOD(Draw)(
+    ID3D11DeviceContext *context,
+    const D3DU_MESH *mesh,
+    const void *instances,
+    UINT stride,
+    UINT count) = 0;
+};
+
+/// GPU memory held by the buffers and textures of a device, by category.
+/// Every resource is counted from its creation until its last reference
+/// is gone, whichever thread that happens on. Crossing a budget is only
+/// reported, allocations are never refused.
+MIDL_INTERFACE("0E5E992D-D1CA-4B34-89E8-510C949DA0A2")
+ID3DUMemoryTracker : public IUnknown
+{
+public:
+  STDMETHOD(GetStatistics)(/* [out] */ D3DU_MEMORY_STATISTICS *oStats) = 0;
+  /// Zero `bytes' removes the budget.
+  STDMETHOD(SetBudget)(D3DU_MEMORY_CATEGORY category, UINT64 bytes) = 0;
+  /// NULL `sink' stops notifications.
+  STDMETHOD(SetMemorySink)(ID3DUMemorySink *sink) = 0;
+  /// Counts a resource the device did not create, such as a swap chain
+  /// buffer, or moves a counted one to another category.
+  STDMETHOD(Track)(ID3D11Resource *resource, D3DU_MEMORY_CATEGORY category) = 0;
+  /// Starts high water marks over from the current usage.
+  STDMETHOD(ResetHighWater)() = 0;
+};
+
+/// Told about allocations that take a category over its budget.
+/// Called on the thread which created the resource, once per crossing;
+/// the category has to drop back within its budget to be reported again.
+MIDL_INTERFACE("3E2E8540-C5EE-455F-9CBC-4E32BAF13808")
+ID3DUMemorySink : public IUnknown
+{
+public:
+  STDMETHOD_(void, BudgetExceeded)(
+    ID3DUMemoryTracker *tracker,
+    D3DU_MEMORY_CATEGORY category,
+    const D3DU_MEMORY_USAGE *usage) = 0;
+};
+
+/// Frame times of a target, in a histogram over a sliding window.
+/// Recording never waits for readers, and any thread may read at any
+/// time, so dashboards can poll it from a thread of their own.
+MIDL_INTERFACE("8558154E-FED6-4C65-9307-108CCBF1BC06")
+ID3DUFrameStats : public IUnknown
+{
+public:
+  STDMETHOD(GetFrameTimes)(
+    D3DU_FRAME_TIME time,
+    /* [out] */ D3DU_FRAME_TIME_STATISTICS *oStats) = 0;
+  /// `percentile' between 0 and 100.
+  STDMETHOD(GetPercentile)(
+    D3DU_FRAME_TIME time,
+    FLOAT percentile,
+    /* [out] */ FLOAT *oMilliseconds) = 0;
+  /// Forgets every sample once the next one comes in.
+  STDMETHOD(Reset)() = 0;
+};
+
+/// Compiles shaders for the D3DUCompileFrom functions, see
+/// D3DUSetShaderCompiler. Arguments are those of D3DCompile; the
+/// functions log `oErrorBlob' when compilation fails.
+MIDL_INTERFACE("6E1F652B-BC2F-48BE-AAD3-3E0E4F301C32")
+ID3DUShaderCompiler : public IUnknown
+{
+public:
+  STDMETHOD(Compile)(
+    LPCVOID code,
+    SIZE_T size,
+    LPCSTR entry,
+    LPCSTR target,
+    DWORD shaderFlags,
+    /* [out] */ ID3DBlob **oCodeBlob,
+    /* [out] */ ID3DBlob **oErrorBlob) = 0;
 };
 
 #endif // __D3DU_H__
\ No newline at end of file
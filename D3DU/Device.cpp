@@ -0,0 +1,373 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "Instrumentation.hpp"
+#include "Recording.hpp"
+#include "Log.hpp"
+
+class D3DU_NOVTABLE CDevice :
+  public ID3DUDevice
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUDevice)
+  END_INTERFACE_MAP
+
+  CDevice()
+  {
+    _fl = D3D_FEATURE_LEVEL_9_1;
+  }
+
+  virtual ~CDevice()
+  {
+    if(_instrumented)
+      _instrumented->SetImmediateContext(NULL);
+  }
+
+  /// Driver types other than D3D_DRIVER_TYPE_UNKNOWN are tried alone.
+  /// The null driver skips DXGI and the 10.1 device.
+  STDMETHOD(Construct)(D3D_FEATURE_LEVEL fl, BOOL acceptSw, D3D_DRIVER_TYPE only)
+  {
+    HRESULT hr;
+    BOOL nullDriver = D3D_DRIVER_TYPE_NULL == only;
+    D3D_DRIVER_TYPE dTypes[] =
+    {
+      D3D_DRIVER_TYPE_UNKNOWN != only ? only : D3D_DRIVER_TYPE_HARDWARE,
+      acceptSw ? D3D_DRIVER_TYPE_WARP : D3D_DRIVER_TYPE_HARDWARE,
+      acceptSw ? D3D_DRIVER_TYPE_REFERENCE : D3D_DRIVER_TYPE_HARDWARE,
+    };
+    D3D_FEATURE_LEVEL fLevels[] =
+    {
+      fl,
+    };
+    DWORD flags = 0;
+#ifdef D3DU_DEBUG
+    flags |= D3D11_CREATE_DEVICE_DEBUG | D3D11_CREATE_DEVICE_PREVENT_INTERNAL_THREADING_OPTIMIZATIONS;
+#endif
+    for(int i = 0; i < (D3D_DRIVER_TYPE_UNKNOWN != only ? 1 : ARRAYSIZE(dTypes)); ++i)
+    {
+      hr = D3D11CreateDevice(
+        NULL,
+        dTypes[i],
+        NULL,
+        flags,
+        fLevels,
+        ARRAYSIZE(fLevels),
+        D3D11_SDK_VERSION,
+        &_device,
+        &_fl,
+        &_context);
+      if(SUCCEEDED(hr))
+        break;
+    }
+    if(FAILED(hr))
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to create device (0x%08X).", hr);
+      return hr;
+    }
+    if(nullDriver)
+      return Init();
+    hr = _device->QueryInterface(
+      __uuidof(*_dxgiDevice),
+      (void**)(IDXGIDevice**)&_dxgiDevice);
+    if(FAILED(hr))
+      return hr;
+    hr = _dxgiDevice->GetAdapter(&_adapter);
+    if(FAILED(hr))
+      return hr;
+    hr = _adapter->GetParent(
+      __uuidof(*_factory),
+      (void**)(IDXGIFactory**)&_factory);
+    if(FAILED(hr))
+      return hr;
+    D3D10_DRIVER_TYPE dTypes10[] =
+    {
+      D3D10_DRIVER_TYPE_HARDWARE,
+      acceptSw ? D3D10_DRIVER_TYPE_WARP : D3D10_DRIVER_TYPE_HARDWARE,
+      acceptSw ? D3D10_DRIVER_TYPE_REFERENCE : D3D10_DRIVER_TYPE_REFERENCE,
+    };
+    DWORD flags10 = D3D10_CREATE_DEVICE_BGRA_SUPPORT;
+#ifdef D3DU_DEBUG
+    flags10 |= D3D10_CREATE_DEVICE_DEBUG | D3D10_CREATE_DEVICE_PREVENT_INTERNAL_THREADING_OPTIMIZATIONS;
+#endif
+    for(int i = 0; i < ARRAYSIZE(dTypes10); ++i)
+    {
+      hr = D3D10CreateDevice1(
+        _adapter,
+        dTypes10[i],
+        NULL,
+        flags10,
+        D3D10_FEATURE_LEVEL_10_0,
+        D3D10_1_SDK_VERSION,
+        &_device10);
+      if(SUCCEEDED(hr))
+        break;
+    }
+    if(FAILED(hr))
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to create 10.1 device (0x%08X).", hr);
+      return hr;
+    }
+    // Software adapters have no outputs. Offscreen targets do not need
+    // one, and window targets let DXGI pick it when going fullscreen.
+    _adapter->EnumOutputs(0, &_output);
+    return Init();
+  }
+
+  STDMETHOD(GetDevice)(ID3D11Device **oDevice)
+  {
+    if(!oDevice)
+      return E_POINTER;
+    _device.AddRef();
+    *oDevice = _device;
+    return S_OK;
+  }
+
+  STDMETHOD(GetDevice10)(ID3D10Device1 **oDevice)
+  {
+    if(!oDevice)
+      return E_POINTER;
+    _device10.AddRef();
+    *oDevice = _device10;
+    return S_OK;
+  }
+
+  STDMETHOD(GetDC)(ID3D11DeviceContext **oDC)
+  {
+    if(!oDC)
+      return E_POINTER;
+    _dc.AddRef();
+    *oDC = _dc;
+    return S_OK;
+  }
+
+  STDMETHOD(GetDXGIDevice)(IDXGIDevice **oDevice)
+  {
+    if(!oDevice)
+      return E_POINTER;
+    _dxgiDevice.AddRef();
+    *oDevice = _dxgiDevice;
+    return S_OK;
+  }
+
+  STDMETHOD(GetFactory)(IDXGIFactory **oFactory)
+  {
+    if(!oFactory)
+      return E_POINTER;
+    _factory.AddRef();
+    *oFactory = _factory;
+    return S_OK;
+  }
+
+  STDMETHOD(GetAdapter)(IDXGIAdapter **oAdapter)
+  {
+    if(!oAdapter)
+      return E_POINTER;
+    _adapter.AddRef();
+    *oAdapter = _adapter;
+    return S_OK;
+  }
+
+  STDMETHOD(GetOutput)(IDXGIOutput **oOutput)
+  {
+    if(!oOutput)
+      return E_POINTER;
+    _output.AddRef();
+    *oOutput = _output;
+    return S_OK;
+  }
+
+  STDMETHOD(GetFeatureLevel)(D3D_FEATURE_LEVEL *oLevel)
+  {
+    if(!oLevel)
+      return E_POINTER;
+    *oLevel = _fl;
+    return S_OK;
+  }
+
+  STDMETHOD(GetResourcePool)(ID3DUResourcePool **oPool)
+  {
+    if(!oPool)
+      return E_POINTER;
+    _pool.AddRef();
+    *oPool = _pool;
+    return S_OK;
+  }
+
+  STDMETHOD(GetStateCache)(ID3DUStateCache **oCache)
+  {
+    if(!oCache)
+      return E_POINTER;
+    _dc.AddRef();
+    *oCache = _dc;
+    return S_OK;
+  }
+
+  STDMETHOD(GetWorkload)(D3DU_WORKLOAD *oWorkload)
+  {
+    if(!oWorkload)
+      return E_POINTER;
+    _instrumented->GetWorkload(oWorkload);
+    return S_OK;
+  }
+
+  STDMETHOD(GetMemoryTracker)(ID3DUMemoryTracker **oTracker)
+  {
+    if(!oTracker)
+      return E_POINTER;
+    _instrumented->GetMemoryTracker(oTracker);
+    return S_OK;
+  }
+
+  STDMETHOD(StartRecording)(LPCWSTR filename)
+  {
+    if(!filename)
+      return E_INVALIDARG;
+    return _recording->StartRecording(filename);
+  }
+
+  STDMETHOD(StopRecording)()
+  {
+    return _recording->StopRecording();
+  }
+
+  STDMETHOD(EndFrame)()
+  {
+    _recording->EndFrame();
+    return S_OK;
+  }
+
+private:
+  D3D_FEATURE_LEVEL _fl;
+  ComPtr<ID3D11Device> _device;
+  ComPtr<ID3D11DeviceContext> _context;
+  ComPtr<ID3DUStateCache> _dc;
+  ComPtr<ID3D10Device1> _device10;
+  ComPtr<IDXGIDevice> _dxgiDevice;
+  ComPtr<IDXGIAdapter> _adapter;
+  ComPtr<IDXGIFactory> _factory;
+  ComPtr<IDXGIOutput> _output;
+  ComPtr<ID3DUResourcePool> _pool;
+  ComPtr<CInstrumentedDevice> _instrumented;
+  ComPtr<CRecordingDevice> _recording;
+
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Init()
+  {
+    HRESULT hr;
+    hr = InitInstrumentation();
+    if(FAILED(hr))
+      return hr;
+    return D3DUCreateResourcePool(_device, &_pool);
+  }
+
+  /// Replaces the device and the immediate context with instrumented
+  /// ones, the latter behind the state cache, over recording ones.
+  /// Everything created from here on, the pool included, counts towards
+  /// the workload.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitInstrumentation()
+  {
+    HRESULT hr;
+    ComPtr<ID3D11DeviceContext> recording;
+    ComPtr<ID3D11DeviceContext> context;
+    _recording.Attach(new ComObject<CRecordingDevice>());
+    hr = _recording->Construct(_device);
+    if(FAILED(hr))
+      return hr;
+    hr = _recording->CreateImmediateContext(_context, &recording);
+    if(FAILED(hr))
+      return hr;
+    _instrumented.Attach(new ComObject<CInstrumentedDevice>());
+    hr = _instrumented->Construct(_recording);
+    if(FAILED(hr))
+      return hr;
+    hr = _instrumented->CreateImmediateContext(recording, &context);
+    if(FAILED(hr))
+      return hr;
+    hr = D3DUCreateStateCache(context, &_dc);
+    if(FAILED(hr))
+      return hr;
+    _instrumented->SetImmediateContext(_dc);
+    _device = _instrumented;
+    return S_OK;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  BOOL acceptSoftwareDriver,
+  ID3DUDevice **oDevice)
+{
+  if(!oDevice)
+    return E_POINTER;
+  *oDevice = NULL;
+  HRESULT hr;
+  ComObject<CDevice> *device = new ComObject<CDevice>();
+  hr = device->Construct(featureLevel, acceptSoftwareDriver, D3D_DRIVER_TYPE_UNKNOWN);
+  if(FAILED(hr))
+  {
+    delete device;
+    return hr;
+  }
+  *oDevice = device;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateNullDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  ID3DUDevice **oDevice)
+{
+  if(!oDevice)
+    return E_POINTER;
+  *oDevice = NULL;
+  HRESULT hr;
+  ComObject<CDevice> *device = new ComObject<CDevice>();
+  hr = device->Construct(featureLevel, FALSE, D3D_DRIVER_TYPE_NULL);
+  if(FAILED(hr))
+  {
+    delete device;
+    return hr;
+  }
+  *oDevice = device;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateSoftwareDevice(
+  D3D_FEATURE_LEVEL featureLevel,
+  ID3DUDevice **oDevice)
+{
+  if(!oDevice)
+    return E_POINTER;
+  *oDevice = NULL;
+  HRESULT hr;
+  ComObject<CDevice> *device = new ComObject<CDevice>();
+  hr = device->Construct(featureLevel, TRUE, D3D_DRIVER_TYPE_WARP);
+  if(FAILED(hr))
+  {
+    delete device;
+    return hr;
+  }
+  *oDevice = device;
+  return S_OK;
+}
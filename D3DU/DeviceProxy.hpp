@@ -0,0 +1,322 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __DEVICE_PROXY_HPP__
+#define __DEVICE_PROXY_HPP__
+
+/// Implements ID3D11Device, which `Base' derives from, by passing every
+/// call on to the wrapped device in `_device'. See ContextProxy.hpp.
+template<class Base>
+class D3DU_NOVTABLE CDeviceProxy :
+  public Base
+{
+public:
+  STDMETHOD(CreateBuffer)(
+    const D3D11_BUFFER_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Buffer **buffer)
+  {
+    return _device->CreateBuffer(desc, initialData, buffer);
+  }
+
+  STDMETHOD(CreateTexture1D)(
+    const D3D11_TEXTURE1D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture1D **texture1D)
+  {
+    return _device->CreateTexture1D(desc, initialData, texture1D);
+  }
+
+  STDMETHOD(CreateTexture2D)(
+    const D3D11_TEXTURE2D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture2D **texture2D)
+  {
+    return _device->CreateTexture2D(desc, initialData, texture2D);
+  }
+
+  STDMETHOD(CreateTexture3D)(
+    const D3D11_TEXTURE3D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture3D **texture3D)
+  {
+    return _device->CreateTexture3D(desc, initialData, texture3D);
+  }
+
+  STDMETHOD(CreateShaderResourceView)(
+    ID3D11Resource *resource,
+    const D3D11_SHADER_RESOURCE_VIEW_DESC *desc,
+    ID3D11ShaderResourceView **sRView)
+  {
+    return _device->CreateShaderResourceView(resource, desc, sRView);
+  }
+
+  STDMETHOD(CreateUnorderedAccessView)(
+    ID3D11Resource *resource,
+    const D3D11_UNORDERED_ACCESS_VIEW_DESC *desc,
+    ID3D11UnorderedAccessView **uaview)
+  {
+    return _device->CreateUnorderedAccessView(resource, desc, uaview);
+  }
+
+  STDMETHOD(CreateRenderTargetView)(
+    ID3D11Resource *resource,
+    const D3D11_RENDER_TARGET_VIEW_DESC *desc,
+    ID3D11RenderTargetView **rTView)
+  {
+    return _device->CreateRenderTargetView(resource, desc, rTView);
+  }
+
+  STDMETHOD(CreateDepthStencilView)(
+    ID3D11Resource *resource,
+    const D3D11_DEPTH_STENCIL_VIEW_DESC *desc,
+    ID3D11DepthStencilView **depthStencilView)
+  {
+    return _device->CreateDepthStencilView(resource, desc, depthStencilView);
+  }
+
+  STDMETHOD(CreateInputLayout)(
+    const D3D11_INPUT_ELEMENT_DESC *inputElementDescs,
+    UINT numElements,
+    const void *shaderBytecodeWithInputSignature,
+    SIZE_T bytecodeLength,
+    ID3D11InputLayout **inputLayout)
+  {
+    return _device->CreateInputLayout(inputElementDescs, numElements, shaderBytecodeWithInputSignature, bytecodeLength, inputLayout);
+  }
+
+  STDMETHOD(CreateVertexShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11VertexShader **vertexShader)
+  {
+    return _device->CreateVertexShader(shaderBytecode, bytecodeLength, classLinkage, vertexShader);
+  }
+
+  STDMETHOD(CreateGeometryShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11GeometryShader **geometryShader)
+  {
+    return _device->CreateGeometryShader(shaderBytecode, bytecodeLength, classLinkage, geometryShader);
+  }
+
+  STDMETHOD(CreateGeometryShaderWithStreamOutput)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    const D3D11_SO_DECLARATION_ENTRY *sODeclaration,
+    UINT numEntries,
+    const UINT *bufferStrides,
+    UINT numStrides,
+    UINT rasterizedStream,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11GeometryShader **geometryShader)
+  {
+    return _device->CreateGeometryShaderWithStreamOutput(shaderBytecode, bytecodeLength, sODeclaration, numEntries, bufferStrides, numStrides, rasterizedStream, classLinkage, geometryShader);
+  }
+
+  STDMETHOD(CreatePixelShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11PixelShader **pixelShader)
+  {
+    return _device->CreatePixelShader(shaderBytecode, bytecodeLength, classLinkage, pixelShader);
+  }
+
+  STDMETHOD(CreateHullShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11HullShader **hullShader)
+  {
+    return _device->CreateHullShader(shaderBytecode, bytecodeLength, classLinkage, hullShader);
+  }
+
+  STDMETHOD(CreateDomainShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11DomainShader **domainShader)
+  {
+    return _device->CreateDomainShader(shaderBytecode, bytecodeLength, classLinkage, domainShader);
+  }
+
+  STDMETHOD(CreateComputeShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11ComputeShader **computeShader)
+  {
+    return _device->CreateComputeShader(shaderBytecode, bytecodeLength, classLinkage, computeShader);
+  }
+
+  STDMETHOD(CreateClassLinkage)(ID3D11ClassLinkage **linkage)
+  {
+    return _device->CreateClassLinkage(linkage);
+  }
+
+  STDMETHOD(CreateBlendState)(
+    const D3D11_BLEND_DESC *blendStateDesc,
+    ID3D11BlendState **blendState)
+  {
+    return _device->CreateBlendState(blendStateDesc, blendState);
+  }
+
+  STDMETHOD(CreateDepthStencilState)(
+    const D3D11_DEPTH_STENCIL_DESC *depthStencilDesc,
+    ID3D11DepthStencilState **depthStencilState)
+  {
+    return _device->CreateDepthStencilState(depthStencilDesc, depthStencilState);
+  }
+
+  STDMETHOD(CreateRasterizerState)(
+    const D3D11_RASTERIZER_DESC *rasterizerDesc,
+    ID3D11RasterizerState **rasterizerState)
+  {
+    return _device->CreateRasterizerState(rasterizerDesc, rasterizerState);
+  }
+
+  STDMETHOD(CreateSamplerState)(
+    const D3D11_SAMPLER_DESC *samplerDesc,
+    ID3D11SamplerState **samplerState)
+  {
+    return _device->CreateSamplerState(samplerDesc, samplerState);
+  }
+
+  STDMETHOD(CreateQuery)(const D3D11_QUERY_DESC *queryDesc, ID3D11Query **query)
+  {
+    return _device->CreateQuery(queryDesc, query);
+  }
+
+  STDMETHOD(CreatePredicate)(const D3D11_QUERY_DESC *predicateDesc, ID3D11Predicate **predicate)
+  {
+    return _device->CreatePredicate(predicateDesc, predicate);
+  }
+
+  STDMETHOD(CreateCounter)(const D3D11_COUNTER_DESC *counterDesc, ID3D11Counter **counter)
+  {
+    return _device->CreateCounter(counterDesc, counter);
+  }
+
+  STDMETHOD(CreateDeferredContext)(UINT contextFlags, ID3D11DeviceContext **deferredContext)
+  {
+    return _device->CreateDeferredContext(contextFlags, deferredContext);
+  }
+
+  STDMETHOD(OpenSharedResource)(HANDLE hResource, REFIID returnedInterface, void **resource)
+  {
+    return _device->OpenSharedResource(hResource, returnedInterface, resource);
+  }
+
+  STDMETHOD(CheckFormatSupport)(DXGI_FORMAT format, UINT *formatSupport)
+  {
+    return _device->CheckFormatSupport(format, formatSupport);
+  }
+
+  STDMETHOD(CheckMultisampleQualityLevels)(
+    DXGI_FORMAT format,
+    UINT sampleCount,
+    UINT *numQualityLevels)
+  {
+    return _device->CheckMultisampleQualityLevels(format, sampleCount, numQualityLevels);
+  }
+
+  STDMETHOD_(void, CheckCounterInfo)(D3D11_COUNTER_INFO *counterInfo)
+  {
+    _device->CheckCounterInfo(counterInfo);
+  }
+
+  STDMETHOD(CheckCounter)(
+    const D3D11_COUNTER_DESC *desc,
+    D3D11_COUNTER_TYPE *type,
+    UINT *activeCounters,
+    LPSTR szName,
+    UINT *nameLength,
+    LPSTR szUnits,
+    UINT *unitsLength,
+    LPSTR szDescription,
+    UINT *descriptionLength)
+  {
+    return _device->CheckCounter(desc, type, activeCounters, szName, nameLength, szUnits, unitsLength, szDescription, descriptionLength);
+  }
+
+  STDMETHOD(CheckFeatureSupport)(
+    D3D11_FEATURE feature,
+    void *featureSupportData,
+    UINT featureSupportDataSize)
+  {
+    return _device->CheckFeatureSupport(feature, featureSupportData, featureSupportDataSize);
+  }
+
+  STDMETHOD(GetPrivateData)(REFGUID guid, UINT *dataSize, void *data)
+  {
+    return _device->GetPrivateData(guid, dataSize, data);
+  }
+
+  STDMETHOD(SetPrivateData)(REFGUID guid, UINT dataSize, const void *data)
+  {
+    return _device->SetPrivateData(guid, dataSize, data);
+  }
+
+  STDMETHOD(SetPrivateDataInterface)(REFGUID guid, const IUnknown *data)
+  {
+    return _device->SetPrivateDataInterface(guid, data);
+  }
+
+  STDMETHOD_(D3D_FEATURE_LEVEL, GetFeatureLevel)()
+  {
+    return _device->GetFeatureLevel();
+  }
+
+  STDMETHOD_(UINT, GetCreationFlags)()
+  {
+    return _device->GetCreationFlags();
+  }
+
+  STDMETHOD(GetDeviceRemovedReason)()
+  {
+    return _device->GetDeviceRemovedReason();
+  }
+
+  STDMETHOD_(void, GetImmediateContext)(ID3D11DeviceContext **immediateContext)
+  {
+    _device->GetImmediateContext(immediateContext);
+  }
+
+  STDMETHOD(SetExceptionMode)(UINT raiseFlags)
+  {
+    return _device->SetExceptionMode(raiseFlags);
+  }
+
+  STDMETHOD_(UINT, GetExceptionMode)()
+  {
+    return _device->GetExceptionMode();
+  }
+
+protected:
+  ComPtr<ID3D11Device> _device;
+};
+
+#endif // __DEVICE_PROXY_HPP__
@@ -0,0 +1,232 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "Readback.hpp"
+#include "FrameRing.hpp"
+
+#define D3DU_EXPORT_DEFAULT_SLOTS 4
+#define D3DU_EXPORT_DEFAULT_DEPTH 3
+
+class D3DU_NOVTABLE CFrameExporter :
+  public ID3DUFrameExporter
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameExporter)
+  END_INTERFACE_MAP
+
+  CFrameExporter()
+  {
+    _target = NULL;
+    _exported = 0;
+    _dropped = 0;
+  }
+
+  STDMETHOD(Construct)(LPCSTR name, const D3DU_EXPORT_DESC *desc, ID3DUFrameSink *sink)
+  {
+    HRESULT hr;
+    LARGE_INTEGER frequency;
+    D3DU_EXPORT_DESC d = *desc;
+    if(0 == d.SlotCount)
+      d.SlotCount = D3DU_EXPORT_DEFAULT_SLOTS;
+    if(0 == d.ReadbackDepth)
+      d.ReadbackDepth = D3DU_EXPORT_DEFAULT_DEPTH;
+    if(d.SlotCount < 2
+      || 0 == d.MaxWidth
+      || 0 == d.MaxHeight
+      || (UINT64)d.MaxWidth * d.MaxHeight * 4 > 0xFFFFFFFF)
+      return E_INVALIDARG;
+    hr = _readback.Init(d.ReadbackDepth);
+    if(FAILED(hr))
+      return hr;
+    QueryPerformanceFrequency(&frequency);
+    SetLastError(ERROR_SUCCESS);
+    if(!_ring.Create(name, d.SlotCount, d.MaxWidth * d.MaxHeight * 4, frequency.QuadPart))
+    {
+      // Not every failure in Create sets an error code.
+      DWORD error = GetLastError();
+      return error ? HRESULT_FROM_WIN32(error) : E_FAIL;
+    }
+    _sink = sink;
+    return S_OK;
+  }
+
+  virtual ~CFrameExporter()
+  {
+    _ring.Close();
+  }
+
+  STDMETHOD_(void, Attach)(ID3DUTarget *target)
+  {
+    _target = target;
+    if(_sink)
+      _sink->Attach(target);
+  }
+
+  STDMETHOD_(void, Detach)(ID3DUTarget *target)
+  {
+    ComPtr<ID3D11DeviceContext> dc;
+    target->GetDC(&dc);
+    Publish(dc, TRUE);
+    _readback.Reset(dc);
+    if(_sink)
+      _sink->Detach(target);
+    _target = NULL;
+  }
+
+  STDMETHOD_(void, RenderFrame)(ID3DUTarget *target)
+  {
+    HRESULT hr;
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> dc;
+    ComPtr<ID3D11RenderTargetView> rtv;
+    ComPtr<ID3D11Texture2D> frame;
+    if(_sink)
+      _sink->RenderFrame(target);
+    target->GetDevice(&device);
+    target->GetDC(&dc);
+    target->GetFrameRTV(&rtv);
+    if(!rtv)
+      return;
+    rtv->GetResource((ID3D11Resource**)&frame);
+    Publish(dc, FALSE);
+    hr = _readback.Push(device, dc, frame);
+    if(S_OK != hr)
+      ++_dropped;
+  }
+
+  STDMETHOD_(void, Resize)(ID3DUTarget *target, UINT width, UINT height)
+  {
+    if(_sink)
+      _sink->Resize(target, width, height);
+  }
+
+  STDMETHOD(GetFrameSink)(ID3DUFrameSink **oSink)
+  {
+    if(!oSink)
+      return E_POINTER;
+    _sink.AddRef();
+    *oSink = _sink;
+    return S_OK;
+  }
+
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink)
+  {
+    if(_target && _sink)
+      _sink->Detach(_target);
+    _sink = sink;
+    if(_target && sink)
+      sink->Attach(_target);
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_EXPORT_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    oStats->FramesExported = _exported;
+    oStats->FramesDropped = _dropped;
+    return S_OK;
+  }
+
+private:
+  ID3DUTarget *_target;
+  ComPtr<ID3DUFrameSink> _sink;
+  CFrameReadback _readback;
+  CFrameRingWriter _ring;
+  UINT64 _exported;
+  UINT64 _dropped;
+
+  /// Copies every finished readback into the ring. Mapping never waits
+  /// on the GPU unless `wait' is set, so frames lag a few behind rendering.
+  /// Copies which fail to map are counted as dropped.
+  void Publish(ID3D11DeviceContext *dc, BOOL wait)
+  {
+    HRESULT hr;
+    CFrameReadback::Frame frame;
+    LARGE_INTEGER now;
+    for(;;)
+    {
+      hr = _readback.Map(dc, wait, &frame);
+      if(S_FALSE == hr)
+        break;
+      if(FAILED(hr))
+      {
+        ++_dropped;
+        continue;
+      }
+      UINT stride = frame.Width * 4;
+      BYTE *dst = _ring.BeginWrite(
+        frame.Width,
+        frame.Height,
+        stride,
+        CFrameReadback::IsBgra(frame.Format) ? FRAME_RING_FORMAT_BGRA8 : FRAME_RING_FORMAT_RGBA8);
+      if(dst)
+      {
+        const BYTE *src = frame.Data;
+        for(UINT y = 0; y < frame.Height; ++y)
+        {
+          memcpy(dst, src, stride);
+          dst += stride;
+          src += frame.RowPitch;
+        }
+        QueryPerformanceCounter(&now);
+        _ring.EndWrite(now.QuadPart);
+        ++_exported;
+      }
+      else
+      {
+        ++_dropped;
+      }
+      _readback.Release(frame.Slot);
+    }
+    _readback.Reclaim(dc);
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateFrameExporter(
+  LPCSTR name,
+  const D3DU_EXPORT_DESC *desc,
+  ID3DUFrameSink *sink,
+  ID3DUFrameExporter **oExporter)
+{
+  if(!oExporter)
+    return E_POINTER;
+  *oExporter = NULL;
+  if(!name || !desc)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CFrameExporter> *exporter = new ComObject<CFrameExporter>();
+  hr = exporter->Construct(name, desc, sink);
+  if(FAILED(hr))
+  {
+    delete exporter;
+    return hr;
+  }
+  *oExporter = exporter;
+  return S_OK;
+}
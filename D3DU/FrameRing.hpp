@@ -0,0 +1,540 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __FRAME_RING_HPP__
+#define __FRAME_RING_HPP__
+
+/// Shared-memory frame ring.
+///
+/// One producer publishes frames into a fixed number of slots, any number
+/// of consumers map the same memory and read frames in place. No locks are
+/// taken on either side: every slot is guarded by a sequence lock, so a
+/// consumer which falls behind notices that its slot was overwritten and
+/// skips ahead instead of blocking the producer.
+///
+/// Memory layout:
+///   FrameRingHeader       at offset 0
+///   FrameRingSlot[i]      at DataOffset + i * SlotStride
+///   pixels of slot i      right after its FrameRingSlot
+///
+/// This header does not depend on the rest of the library and builds
+/// with either Win32 named file mappings or POSIX shared memory.
+
+#include "LockFree.hpp"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define FRAME_RING_MAGIC 0x52443344u // "D3DR"
+#define FRAME_RING_VERSION 1u
+#define FRAME_RING_ALIGNMENT 64u
+#define FRAME_RING_MAX_NAME 128
+
+typedef enum
+{
+  FRAME_RING_FORMAT_UNKNOWN = 0,
+  FRAME_RING_FORMAT_RGBA8 = 1,
+  FRAME_RING_FORMAT_BGRA8 = 2,
+} FrameRingFormat;
+
+typedef enum
+{
+  FRAME_RING_OK = 0,
+  /// No frame newer than the last acquired one.
+  FRAME_RING_EMPTY,
+  /// Producer has closed the ring.
+  FRAME_RING_CLOSED,
+} FrameRingStatus;
+
+/// Fields are laid out explicitly so that 32 and 64 bit processes agree.
+typedef struct
+{
+  uint32_t Magic;
+  uint32_t Version;
+  uint32_t SlotCount;
+  /// Capacity of a slot in bytes, not counting its FrameRingSlot.
+  uint32_t SlotSize;
+  uint32_t SlotStride;
+  uint32_t DataOffset;
+  /// Ticks per second of FrameRingSlot::Timestamp.
+  uint64_t TimestampFrequency;
+  uint8_t _pad0[FRAME_RING_ALIGNMENT - 32];
+  /// Sequence number of the last published frame, 0 when there is none yet.
+  volatile uint32_t Published;
+  volatile uint32_t Closed;
+  uint8_t _pad1[FRAME_RING_ALIGNMENT - 8];
+} FrameRingHeader;
+
+typedef struct
+{
+  /// Sequence lock: odd while the producer writes the slot.
+  /// The slot holds a complete frame when the value is even and non-zero.
+  volatile uint32_t Lock;
+  /// Frames are numbered from 1; frame n lives in slot (n - 1) % SlotCount.
+  uint32_t Sequence;
+  uint32_t Width;
+  uint32_t Height;
+  /// Distance between rows in bytes.
+  uint32_t Stride;
+  uint32_t Format;
+  uint64_t Timestamp;
+  uint8_t _pad[FRAME_RING_ALIGNMENT - 32];
+} FrameRingSlot;
+
+/// A frame acquired by a consumer. `Data' points straight into the shared
+/// memory and stays valid until CFrameRingReader::Validate() says otherwise.
+typedef struct
+{
+  const uint8_t *Data;
+  uint32_t Sequence;
+  uint32_t Width;
+  uint32_t Height;
+  uint32_t Stride;
+  FrameRingFormat Format;
+  uint64_t Timestamp;
+  uint32_t Slot;
+  uint32_t Lock;
+} FrameRingFrame;
+
+inline uint32_t FrameRingSlotStride(uint32_t slotSize)
+{
+  return (uint32_t)((sizeof(FrameRingSlot) + slotSize + FRAME_RING_ALIGNMENT - 1)
+    & ~(FRAME_RING_ALIGNMENT - 1));
+}
+
+inline uint64_t FrameRingTotalSize(uint32_t slotCount, uint32_t slotSize)
+{
+  return sizeof(FrameRingHeader) + (uint64_t)slotCount * FrameRingSlotStride(slotSize);
+}
+
+/// Named shared memory region.
+class CFrameRingMemory
+{
+public:
+  CFrameRingMemory()
+  {
+    _data = NULL;
+    _size = 0;
+    _owner = false;
+#ifdef _WIN32
+    _mapping = NULL;
+#else
+    _name[0] = 0;
+#endif
+  }
+  ~CFrameRingMemory()
+  {
+    Close();
+  }
+
+  /// Creates a new region. On POSIX systems an existing one with the same
+  /// name is replaced; on Windows, where a live mapping cannot be replaced,
+  /// this fails with ERROR_ALREADY_EXISTS instead of attaching to it.
+  bool Create(const char *name, uint64_t size)
+  {
+    Close();
+#ifdef _WIN32
+    _mapping = CreateFileMappingA(
+      INVALID_HANDLE_VALUE,
+      NULL,
+      PAGE_READWRITE,
+      (DWORD)(size >> 32),
+      (DWORD)size,
+      name);
+    if(!_mapping)
+      return false;
+    if(ERROR_ALREADY_EXISTS == GetLastError())
+    {
+      CloseHandle(_mapping);
+      _mapping = NULL;
+      SetLastError(ERROR_ALREADY_EXISTS);
+      return false;
+    }
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size);
+#else
+    if(!SetName(name))
+      return false;
+    shm_unlink(_name);
+    int fd = shm_open(_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0)
+      return false;
+    if(0 != ftruncate(fd, (off_t)size))
+    {
+      close(fd);
+      shm_unlink(_name);
+      return false;
+    }
+    void *p = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    _data = MAP_FAILED == p ? NULL : (uint8_t*)p;
+    if(!_data)
+      shm_unlink(_name);
+#endif
+    if(!_data)
+    {
+      Close();
+      return false;
+    }
+    _size = size;
+    _owner = true;
+    return true;
+  }
+
+  /// Maps an existing region read-only.
+  bool Open(const char *name)
+  {
+    Close();
+#ifdef _WIN32
+    MEMORY_BASIC_INFORMATION mbi;
+    _mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if(!_mapping)
+      return false;
+    _data = (uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if(_data && VirtualQuery(_data, &mbi, sizeof(mbi)))
+      _size = mbi.RegionSize;
+#else
+    struct stat st;
+    if(!SetName(name))
+      return false;
+    int fd = shm_open(_name, O_RDONLY, 0);
+    if(fd < 0)
+      return false;
+    if(0 == fstat(fd, &st) && st.st_size > 0)
+    {
+      void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(MAP_FAILED != p)
+      {
+        _data = (uint8_t*)p;
+        _size = (uint64_t)st.st_size;
+      }
+    }
+    close(fd);
+#endif
+    if(!_data)
+    {
+      Close();
+      return false;
+    }
+    return true;
+  }
+
+  void Close()
+  {
+#ifdef _WIN32
+    if(_data)
+      UnmapViewOfFile(_data);
+    if(_mapping)
+      CloseHandle(_mapping);
+    _mapping = NULL;
+#else
+    if(_data)
+      munmap(_data, (size_t)_size);
+    if(_owner)
+      shm_unlink(_name);
+    _name[0] = 0;
+#endif
+    _data = NULL;
+    _size = 0;
+    _owner = false;
+  }
+
+  uint8_t* Data() const
+  {
+    return _data;
+  }
+  uint64_t Size() const
+  {
+    return _size;
+  }
+
+private:
+  CFrameRingMemory(const CFrameRingMemory&);
+  CFrameRingMemory& operator=(const CFrameRingMemory&);
+
+#ifndef _WIN32
+  /// POSIX names must start with a slash.
+  bool SetName(const char *name)
+  {
+    size_t len = strlen(name);
+    size_t skip = '/' == name[0] ? 0 : 1;
+    if(0 == len || len + skip >= sizeof(_name))
+      return false;
+    _name[0] = '/';
+    memcpy(_name + skip, name, len + 1);
+    return true;
+  }
+  char _name[FRAME_RING_MAX_NAME];
+#else
+  HANDLE _mapping;
+#endif
+  uint8_t *_data;
+  uint64_t _size;
+  bool _owner;
+};
+
+/// Producer side.
+class CFrameRingWriter
+{
+public:
+  CFrameRingWriter()
+  {
+    _header = NULL;
+    _sequence = 0;
+  }
+  ~CFrameRingWriter()
+  {
+    Close();
+  }
+
+  bool Create(const char *name, uint32_t slotCount, uint32_t slotSize, uint64_t timestampFrequency)
+  {
+    Close();
+    if(slotCount < 2)
+      return false;
+    if(!_memory.Create(name, FrameRingTotalSize(slotCount, slotSize)))
+      return false;
+    _header = (FrameRingHeader*)_memory.Data();
+    memset(_header, 0, sizeof(FrameRingHeader));
+    _header->SlotCount = slotCount;
+    _header->SlotSize = slotSize;
+    _header->SlotStride = FrameRingSlotStride(slotSize);
+    _header->DataOffset = sizeof(FrameRingHeader);
+    _header->TimestampFrequency = timestampFrequency;
+    _header->Version = FRAME_RING_VERSION;
+    for(uint32_t i = 0; i < slotCount; ++i)
+      memset(GetSlot(i), 0, sizeof(FrameRingSlot));
+    _sequence = 0;
+    // Consumers check the magic value last, so it goes in last.
+    LfStoreRelease(&_header->Published, 0u);
+    LfStoreRelease((volatile uint32_t*)&_header->Magic, FRAME_RING_MAGIC);
+    return true;
+  }
+
+  /// Marks the ring closed so that consumers stop waiting, and unmaps it.
+  void Close()
+  {
+    if(_header)
+      LfStoreRelease(&_header->Closed, 1u);
+    _header = NULL;
+    _memory.Close();
+  }
+
+  bool IsOpen() const
+  {
+    return NULL != _header;
+  }
+
+  uint32_t SlotSize() const
+  {
+    return _header ? _header->SlotSize : 0;
+  }
+
+  /// Starts writing the next frame and returns the memory to write it to,
+  /// or NULL when the frame does not fit into a slot.
+  /// Every successful call must be followed by EndWrite().
+  uint8_t* BeginWrite(uint32_t width, uint32_t height, uint32_t stride, FrameRingFormat format)
+  {
+    if(!_header || (uint64_t)stride * height > _header->SlotSize)
+      return NULL;
+    uint32_t sequence = _sequence + 1;
+    FrameRingSlot *slot = GetSlot((sequence - 1) % _header->SlotCount);
+    LfStoreRelease(&slot->Lock, slot->Lock + 1);
+    // Readers must not see new pixels without seeing the odd lock first.
+    LfFenceRelease();
+    slot->Sequence = sequence;
+    slot->Width = width;
+    slot->Height = height;
+    slot->Stride = stride;
+    slot->Format = format;
+    return (uint8_t*)(slot + 1);
+  }
+
+  /// Publishes the frame started by BeginWrite().
+  void EndWrite(uint64_t timestamp)
+  {
+    uint32_t sequence = _sequence + 1;
+    FrameRingSlot *slot = GetSlot((sequence - 1) % _header->SlotCount);
+    slot->Timestamp = timestamp;
+    LfStoreRelease(&slot->Lock, slot->Lock + 1);
+    LfStoreRelease(&_header->Published, sequence);
+    _sequence = sequence;
+  }
+
+private:
+  CFrameRingWriter(const CFrameRingWriter&);
+  CFrameRingWriter& operator=(const CFrameRingWriter&);
+
+  FrameRingSlot* GetSlot(uint32_t i) const
+  {
+    return (FrameRingSlot*)((uint8_t*)_header + _header->DataOffset + (uint64_t)i * _header->SlotStride);
+  }
+
+  CFrameRingMemory _memory;
+  FrameRingHeader *_header;
+  uint32_t _sequence;
+};
+
+/// Consumer side. A reader is meant to be used by a single thread.
+class CFrameRingReader
+{
+public:
+  CFrameRingReader()
+  {
+    _header = NULL;
+    _next = 0;
+    _lost = 0;
+  }
+
+  /// Fails when the ring does not exist yet or was created by
+  /// an incompatible producer.
+  bool Open(const char *name)
+  {
+    Close();
+    if(!_memory.Open(name) || _memory.Size() < sizeof(FrameRingHeader))
+      return Fail();
+    _header = (const FrameRingHeader*)_memory.Data();
+    if(FRAME_RING_MAGIC != LfLoadAcquire((const volatile uint32_t*)&_header->Magic)
+      || FRAME_RING_VERSION != _header->Version
+      || _header->SlotCount < 2
+      || FrameRingTotalSize(_header->SlotCount, _header->SlotSize) > _memory.Size())
+      return Fail();
+    // Start with the most recent frame.
+    _next = LfLoadAcquire(&_header->Published);
+    if(0 == _next)
+      _next = 1;
+    _lost = 0;
+    return true;
+  }
+
+  void Close()
+  {
+    _header = NULL;
+    _memory.Close();
+  }
+
+  /// Takes the next unread frame. When the producer has lapped the reader,
+  /// skipped frames are added to Lost() and the oldest intact frame is returned.
+  FrameRingStatus Acquire(FrameRingFrame *oFrame)
+  {
+    if(!_header)
+      return FRAME_RING_CLOSED;
+    for(;;)
+    {
+      uint32_t published = LfLoadAcquire(&_header->Published);
+      if((int32_t)(published - _next) < 0)
+      {
+        if(!LfLoadAcquire(&_header->Closed))
+          return FRAME_RING_EMPTY;
+        // The producer may have published more frames between the two
+        // loads and closed the ring after them.
+        if((int32_t)(LfLoadAcquire(&_header->Published) - _next) < 0)
+          return FRAME_RING_CLOSED;
+        continue;
+      }
+      // The slot after the newest frame may already be rewritten.
+      uint32_t behind = published - _next;
+      if(behind >= _header->SlotCount - 1)
+      {
+        uint32_t skip = behind - (_header->SlotCount - 2);
+        _lost += skip;
+        _next += skip;
+      }
+      uint32_t index = (_next - 1) % _header->SlotCount;
+      const FrameRingSlot *slot = GetSlot(index);
+      uint32_t lock = LfLoadAcquire(&slot->Lock);
+      LfFenceAcquire();
+      if((lock & 1) || slot->Sequence != _next)
+      {
+        // Overwritten while we were looking at it.
+        ++_lost;
+        ++_next;
+        continue;
+      }
+      oFrame->Data = (const uint8_t*)(slot + 1);
+      oFrame->Sequence = slot->Sequence;
+      oFrame->Width = slot->Width;
+      oFrame->Height = slot->Height;
+      oFrame->Stride = slot->Stride;
+      oFrame->Format = (FrameRingFormat)slot->Format;
+      oFrame->Timestamp = slot->Timestamp;
+      oFrame->Slot = index;
+      oFrame->Lock = lock;
+      if(!Validate(*oFrame))
+      {
+        ++_lost;
+        ++_next;
+        continue;
+      }
+      ++_next;
+      return FRAME_RING_OK;
+    }
+  }
+
+  /// Returns true when the producer has not touched the frame since it was
+  /// acquired. Call it after reading the pixels; on false, discard what was read.
+  bool Validate(const FrameRingFrame& frame) const
+  {
+    LfFenceAcquire();
+    return LfLoadAcquire(&GetSlot(frame.Slot)->Lock) == frame.Lock;
+  }
+
+  /// Number of frames the reader missed because the producer overran it.
+  uint64_t Lost() const
+  {
+    return _lost;
+  }
+
+  const FrameRingHeader* Header() const
+  {
+    return _header;
+  }
+
+private:
+  CFrameRingReader(const CFrameRingReader&);
+  CFrameRingReader& operator=(const CFrameRingReader&);
+
+  bool Fail()
+  {
+    Close();
+    return false;
+  }
+
+  const FrameRingSlot* GetSlot(uint32_t i) const
+  {
+    return (const FrameRingSlot*)((const uint8_t*)_header + _header->DataOffset + (uint64_t)i * _header->SlotStride);
+  }
+
+  CFrameRingMemory _memory;
+  const FrameRingHeader *_header;
+  uint32_t _next;
+  uint64_t _lost;
+};
+
+#endif // __FRAME_RING_HPP__
@@ -0,0 +1,241 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __FRAME_STATS_HPP__
+#define __FRAME_STATS_HPP__
+
+#include <string.h>
+#include "LockFree.hpp"
+
+/// Frame time histograms behind ID3DUFrameStats.
+///
+/// Times are whole microseconds. Buckets are log-linear, like HDR
+/// histograms: values below 64 get a bucket each, and every power of two
+/// above is split into 32 buckets, so a bucket is never wider than 1/32
+/// of the values in it. 896 buckets cover all 32 bit values, and
+/// percentiles come out within about 3% of the exact ones, whatever the
+/// spread of frame times.
+///
+/// Each series keeps its last samples in a ring, so that the histogram
+/// covers a sliding window: a new sample adds to its bucket and takes
+/// the one it pushes out of the ring away from its own.
+///
+/// This header does not depend on Direct3D.
+
+#define FRAME_TIME_SUB_BITS 5
+#define FRAME_TIME_SUB_BUCKETS (1u << FRAME_TIME_SUB_BITS)
+#define FRAME_TIME_BUCKETS ((32 - FRAME_TIME_SUB_BITS + 1) * FRAME_TIME_SUB_BUCKETS)
+
+class CFrameTimeHistogram
+{
+public:
+  CFrameTimeHistogram()
+  {
+    Clear();
+  }
+
+  static unsigned Bucket(unsigned value)
+  {
+    unsigned shift = 0;
+    while((value >> shift) >= 2 * FRAME_TIME_SUB_BUCKETS)
+      ++shift;
+    return shift * FRAME_TIME_SUB_BUCKETS + (value >> shift);
+  }
+
+  /// Smallest value in bucket `index'.
+  static unsigned BucketLow(unsigned index)
+  {
+    unsigned shift = index < 2 * FRAME_TIME_SUB_BUCKETS ? 0 : index / FRAME_TIME_SUB_BUCKETS - 1;
+    return (index - shift * FRAME_TIME_SUB_BUCKETS) << shift;
+  }
+
+  /// Largest value in bucket `index'.
+  static unsigned BucketHigh(unsigned index)
+  {
+    unsigned shift = index < 2 * FRAME_TIME_SUB_BUCKETS ? 0 : index / FRAME_TIME_SUB_BUCKETS - 1;
+    return BucketLow(index) + ((1u << shift) - 1);
+  }
+
+  void Clear()
+  {
+    memset(Counts, 0, sizeof(Counts));
+    Count = 0;
+    Sum = 0;
+  }
+
+  void Add(unsigned value)
+  {
+    ++Counts[Bucket(value)];
+    ++Count;
+    Sum += value;
+  }
+
+  void Remove(unsigned value)
+  {
+    --Counts[Bucket(value)];
+    --Count;
+    Sum -= value;
+  }
+
+  /// Largest value of the bucket holding the sample that `fraction' of
+  /// all samples do not exceed; 0.5 is the median. Zero when empty.
+  unsigned Percentile(double fraction) const
+  {
+    if(!Count)
+      return 0;
+    unsigned long long rank = (unsigned long long)(fraction * Count + 0.5);
+    if(rank < 1)
+      rank = 1;
+    if(rank > Count)
+      rank = Count;
+    unsigned long long seen = 0;
+    for(unsigned i = 0; i < FRAME_TIME_BUCKETS; ++i)
+    {
+      seen += Counts[i];
+      if(seen >= rank)
+        return BucketHigh(i);
+    }
+    return BucketHigh(FRAME_TIME_BUCKETS - 1);
+  }
+
+  /// Smallest value of the lowest bucket in use.
+  unsigned Min() const
+  {
+    for(unsigned i = 0; i < FRAME_TIME_BUCKETS; ++i)
+    {
+      if(Counts[i])
+        return BucketLow(i);
+    }
+    return 0;
+  }
+
+  unsigned Max() const
+  {
+    return Percentile(1.0);
+  }
+
+  double Mean() const
+  {
+    return Count ? (double)Sum / Count : 0.0;
+  }
+
+  unsigned Counts[FRAME_TIME_BUCKETS];
+  unsigned Count;
+  unsigned long long Sum;
+};
+
+/// `Window' last samples of one kind of time.
+template<unsigned Window>
+class CFrameTimeSeries
+{
+public:
+  CFrameTimeSeries()
+  {
+    Clear();
+  }
+
+  void Clear()
+  {
+    _histogram.Clear();
+    _next = 0;
+  }
+
+  void Add(unsigned value)
+  {
+    if(_histogram.Count == Window)
+      _histogram.Remove(_ring[_next]);
+    _ring[_next] = value;
+    _next = (_next + 1) % Window;
+    _histogram.Add(value);
+  }
+
+  const CFrameTimeHistogram &GetHistogram() const
+  {
+    return _histogram;
+  }
+
+private:
+  unsigned _ring[Window];
+  unsigned _next;
+  CFrameTimeHistogram _histogram;
+};
+
+/// `Series' kinds of time written by one thread and read by any.
+/// Writes go under a sequence counter, odd while a write is under way;
+/// readers copy a histogram and start over when the counter was odd or
+/// moved meanwhile. The writer never waits, and a reader retries at most
+/// when a frame ends right while it copies.
+template<unsigned Series, unsigned Window>
+class CFrameTimeRecorder
+{
+public:
+  CFrameTimeRecorder()
+  {
+    _sequence = 0;
+    _reset = 0;
+  }
+
+  /// Writer only.
+  void Add(unsigned series, unsigned value)
+  {
+    unsigned sequence = _sequence;
+    LfStoreRelease(&_sequence, sequence + 1);
+    LfFenceRelease();
+    if(LfLoadAcquire(&_reset))
+    {
+      LfStoreRelease(&_reset, 0u);
+      for(unsigned i = 0; i < Series; ++i)
+        _series[i].Clear();
+    }
+    _series[series].Add(value);
+    LfStoreRelease(&_sequence, sequence + 2);
+  }
+
+  /// Any thread.
+  void Snapshot(unsigned series, CFrameTimeHistogram *oHistogram) const
+  {
+    for(;;)
+    {
+      unsigned before = LfLoadAcquire(&_sequence);
+      if(0 == (before & 1))
+      {
+        memcpy(oHistogram, &_series[series].GetHistogram(), sizeof(CFrameTimeHistogram));
+        LfFenceAcquire();
+        if(before == LfLoadAcquire(&_sequence))
+          return;
+      }
+    }
+  }
+
+  /// Any thread. Takes effect with the next sample.
+  void Reset()
+  {
+    LfStoreRelease(&_reset, 1u);
+  }
+
+private:
+  CFrameTimeSeries<Window> _series[Series];
+  volatile unsigned _sequence;
+  volatile unsigned _reset;
+};
+
+#endif // __FRAME_STATS_HPP__
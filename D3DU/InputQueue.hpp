@@ -0,0 +1,170 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __INPUT_QUEUE_HPP__
+#define __INPUT_QUEUE_HPP__
+
+#include "LockFree.hpp"
+
+/// Input events on their way from the window procedure to the frame.
+///
+/// The window procedure pushes, Draw drains everything once per frame
+/// into a batch. Mouse moves in a row are merged while draining, so a
+/// sink sees at most one move between two other events however fast the
+/// mouse reports. Past three quarters of the capacity moves no longer
+/// take slots of their own: a move is written over the move at the tail
+/// if there is one, and dropped otherwise, so a flood of moves between
+/// two frames never pushes out a key or button release, and the sink
+/// still gets the latest position.
+///
+/// The move at the tail stays open for the producer to write over until
+/// the consumer seals it, which it does with a compare-exchange on
+/// `_open' before reading any event. A move being written over is left
+/// for the next Drain.
+///
+/// `T' needs a `Type' field compared against `MoveType', and a
+/// `Coalesced' counter which merging increments for every merged move.
+/// This header does not depend on Direct3D.
+template<typename T, int MoveType>
+class CInputQueue
+{
+public:
+  CInputQueue()
+  {
+    _open = 0;
+    _dropped = 0;
+  }
+
+  bool Init(unsigned int capacity)
+  {
+    _open = 0;
+    _dropped = 0;
+    return _queue.Init(capacity);
+  }
+
+  /// Producer side only. False when the event was dropped; a move
+  /// written over the one at the tail counts as pushed.
+  bool Push(const T &e)
+  {
+    if(MoveType == e.Type && _queue.Size() >= _queue.Capacity() / 4 * 3)
+    {
+      long open = OpenTag(_queue.Pushed() - 1);
+      if(open == LfCompareExchange(&_open, open | INPUT_QUEUE_WRITING, open))
+      {
+        T *last = _queue.Back();
+        unsigned int coalesced = last->Coalesced + e.Coalesced + 1;
+        *last = e;
+        last->Coalesced = coalesced;
+        LfStoreRelease(&_open, open);
+        return true;
+      }
+      ++_dropped;
+      return false;
+    }
+    // The slot is opened before it is published, so that the consumer
+    // cannot read it without sealing it first.
+    LfStoreRelease(&_open, MoveType == e.Type ? OpenTag(_queue.Pushed()) : 0L);
+    if(!_queue.Push(e))
+    {
+      LfStoreRelease(&_open, 0L);
+      ++_dropped;
+      return false;
+    }
+    return true;
+  }
+
+  /// Consumer side only. Copies up to `max' events into `batch', oldest
+  /// first, and returns how many; moves merged into the previous one
+  /// do not take up room.
+  unsigned int Drain(T *batch, unsigned int max)
+  {
+    unsigned int n = 0;
+    for(;;)
+    {
+      T *e = _queue.Peek();
+      if(!e || !Seal(_queue.Popped()))
+        break;
+      if(MoveType == e->Type && n && MoveType == batch[n - 1].Type)
+      {
+        unsigned int coalesced = batch[n - 1].Coalesced + e->Coalesced + 1;
+        batch[n - 1] = *e;
+        batch[n - 1].Coalesced = coalesced;
+      }
+      else if(n < max)
+      {
+        batch[n++] = *e;
+      }
+      else
+      {
+        break;
+      }
+      T skipped;
+      _queue.Pop(&skipped);
+    }
+    return n;
+  }
+
+  /// Producer side only.
+  unsigned int GetDropped() const
+  {
+    return _dropped;
+  }
+
+private:
+  enum
+  {
+    INPUT_QUEUE_OPEN = 1,
+    INPUT_QUEUE_WRITING = 2,
+  };
+
+  /// Names the slot of the `index'th push. Only the low bits of the
+  /// index are kept, which is plenty to tell apart the slots in the queue.
+  static long OpenTag(unsigned int index)
+  {
+    return (long)((index & 0x3FFFFFFF) << 2) | INPUT_QUEUE_OPEN;
+  }
+
+  /// Consumer side only. Keeps the producer from writing over the event
+  /// of the `index'th push from now on. False while it is doing so.
+  bool Seal(unsigned int index)
+  {
+    long open = OpenTag(index);
+    for(;;)
+    {
+      long seen = LfLoadAcquire(&_open);
+      if(seen == (open | INPUT_QUEUE_WRITING))
+        return false;
+      if(seen != open)
+        return true;
+      if(open == LfCompareExchange(&_open, 0L, open))
+        return true;
+    }
+  }
+
+  CSpscQueue<T> _queue;
+  /// OpenTag of the move the producer may still write over, with
+  /// INPUT_QUEUE_WRITING while it does; 0 when there is none.
+  volatile long _open;
+  unsigned int _dropped;
+};
+
+#endif // __INPUT_QUEUE_HPP__
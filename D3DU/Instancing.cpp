@@ -0,0 +1,194 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "UploadRing.hpp"
+
+/// Large enough for a thousand matrices.
+#define INSTANCE_BATCH_MIN_SIZE (64*1024)
+
+class D3DU_NOVTABLE CInstanceBatch :
+  public ID3DUInstanceBatch
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUInstanceBatch)
+  END_INTERFACE_MAP
+
+  CInstanceBatch() { }
+
+  virtual ~CInstanceBatch() { }
+
+  STDMETHOD(Construct)(ID3D11Device *device)
+  {
+    _device = device;
+    return S_OK;
+  }
+
+  /// Deferred contexts may only map with DISCARD, so there every
+  /// Draw starts over at the beginning of a renamed buffer.
+  STDMETHOD(Draw)(
+    ID3D11DeviceContext *context,
+    const D3DU_MESH *mesh,
+    const void *instances,
+    UINT stride,
+    UINT count)
+  {
+    HRESULT hr;
+    D3D11_MAPPED_SUBRESOURCE ms;
+    bool wrapped;
+    if(!context || !mesh || !instances || 0 == stride)
+      return E_INVALIDARG;
+    if(0 == count)
+      return S_FALSE;
+    if((UINT64)stride * count > 0x7FFFFFFF)
+      return E_INVALIDARG;
+    UINT size = CUploadRingAllocator::Align(stride * count);
+    if(size > _allocator.GetCapacity())
+    {
+      hr = Reserve(size);
+      if(FAILED(hr))
+        return hr;
+    }
+    if(D3D11_DEVICE_CONTEXT_DEFERRED == context->GetType())
+      _allocator.Reset(_allocator.GetCapacity());
+    UINT offset = _allocator.Allocate(size, wrapped);
+    hr = context->Map(_buffer, 0, wrapped ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &ms);
+    if(FAILED(hr))
+    {
+      _allocator.Reset(_allocator.GetCapacity());
+      return hr;
+    }
+    memcpy((BYTE*)ms.pData + offset, instances, stride * count);
+    context->Unmap(_buffer, 0);
+
+    ID3D11Buffer *buffers[2] = { mesh->VertexBuffer, _buffer };
+    UINT strides[2] = { mesh->VertexStride, stride };
+    UINT offsets[2] = { 0, offset };
+    context->IASetPrimitiveTopology(mesh->Topology);
+    context->IASetVertexBuffers(0, 2, buffers, strides, offsets);
+    if(mesh->IndexBuffer)
+    {
+      context->IASetIndexBuffer(mesh->IndexBuffer, mesh->IndexFormat, 0);
+      context->DrawIndexedInstanced(mesh->IndexCount, count, 0, 0, 0);
+    }
+    else
+    {
+      context->DrawInstanced(mesh->VertexCount, count, 0, 0);
+    }
+    return S_OK;
+  }
+
+private:
+  ComPtr<ID3D11Device> _device;
+  ComPtr<ID3D11Buffer> _buffer;
+  CUploadRingAllocator _allocator;
+
+  /// Grows by powers of two, so that a slowly growing
+  /// instance count does not recreate the buffer every frame.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Reserve(UINT size)
+  {
+    HRESULT hr;
+    D3D11_BUFFER_DESC bd = {0};
+    UINT capacity = INSTANCE_BATCH_MIN_SIZE;
+    while(capacity < size)
+      capacity *= 2;
+    bd.ByteWidth = capacity;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    _buffer.Release();
+    _allocator.Reset(0);
+    hr = _device->CreateBuffer(&bd, NULL, &_buffer);
+    if(FAILED(hr))
+      return hr;
+    _allocator.Reset(capacity);
+    return S_OK;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateInstanceBatch(
+  ID3D11Device *device,
+  ID3DUInstanceBatch **oBatch)
+{
+  if(!oBatch)
+    return E_POINTER;
+  *oBatch = NULL;
+  if(!device)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CInstanceBatch> *batch = new ComObject<CInstanceBatch>();
+  hr = batch->Construct(device);
+  if(FAILED(hr))
+  {
+    delete batch;
+    return hr;
+  }
+  *oBatch = batch;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateInstanceInputLayout(
+  ID3D11Device *device,
+  const D3D11_INPUT_ELEMENT_DESC *vertexElements,
+  UINT vertexElementCount,
+  const D3DU_INSTANCE_ELEMENT *instanceElements,
+  UINT instanceElementCount,
+  const void *shaderBytecode,
+  SIZE_T bytecodeLength,
+  ID3D11InputLayout **oLayout)
+{
+  D3D11_INPUT_ELEMENT_DESC elements[D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT];
+  UINT count = 0;
+  if(!oLayout)
+    return E_POINTER;
+  *oLayout = NULL;
+  if(!device
+    || (vertexElementCount && !vertexElements)
+    || (instanceElementCount && !instanceElements)
+    || !shaderBytecode
+    || vertexElementCount > D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT)
+    return E_INVALIDARG;
+  for(UINT i = 0; i < vertexElementCount; ++i)
+    elements[count++] = vertexElements[i];
+  for(UINT i = 0; i < instanceElementCount; ++i)
+  {
+    const D3DU_INSTANCE_ELEMENT &e = instanceElements[i];
+    UINT n = e.Count ? e.Count : 1;
+    if(n > D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT - count)
+      return E_INVALIDARG;
+    for(UINT j = 0; j < n; ++j)
+    {
+      D3D11_INPUT_ELEMENT_DESC &d = elements[count++];
+      d.SemanticName = e.SemanticName;
+      d.SemanticIndex = e.SemanticIndex + j;
+      d.Format = e.Format;
+      d.InputSlot = D3DU_INSTANCE_SLOT;
+      d.AlignedByteOffset = D3D11_APPEND_ALIGNED_ELEMENT;
+      d.InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+      d.InstanceDataStepRate = 1;
+    }
+  }
+  return device->CreateInputLayout(elements, count, shaderBytecode, bytecodeLength, oLayout);
+}
@@ -0,0 +1,909 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __INSTRUMENTATION_HPP__
+#define __INSTRUMENTATION_HPP__
+
+/// Device and context wrappers counting the work submitted through them.
+///
+/// The immediate context counts straight into the device totals, from
+/// the render thread only. Deferred contexts count on their own and add
+/// their counts to the totals when their command list is finished, so
+/// layers recorded on worker threads show up in the frame they were
+/// recorded for. Resources may be created from any thread and are
+/// counted with interlocked operations. Buffers and textures are
+/// handed to the memory tracker as well.
+
+#include "ContextProxy.hpp"
+#include "DeviceProxy.hpp"
+#include "MemoryTracker.hpp"
+
+#define WORKLOAD_FIELDS (sizeof(D3DU_WORKLOAD) / sizeof(UINT64))
+
+/// D3DU_WORKLOAD is nothing but UINT64 counters, so these work on all of them.
+inline void WorkloadAdd(D3DU_WORKLOAD *sum, const D3DU_WORKLOAD &value)
+{
+  UINT64 *s = (UINT64*)sum;
+  const UINT64 *v = (const UINT64*)&value;
+  for(UINT i = 0; i < WORKLOAD_FIELDS; ++i)
+    s[i] += v[i];
+}
+
+inline void WorkloadSubtract(D3DU_WORKLOAD *difference, const D3DU_WORKLOAD &value)
+{
+  UINT64 *d = (UINT64*)difference;
+  const UINT64 *v = (const UINT64*)&value;
+  for(UINT i = 0; i < WORKLOAD_FIELDS; ++i)
+    d[i] -= v[i];
+}
+
+inline void WorkloadDivide(D3DU_WORKLOAD *quotient, UINT64 divisor)
+{
+  UINT64 *q = (UINT64*)quotient;
+  for(UINT i = 0; i < WORKLOAD_FIELDS; ++i)
+    q[i] /= divisor;
+}
+
+class CWorkload
+{
+public:
+  CWorkload()
+  {
+    memset(&Immediate, 0, sizeof(Immediate));
+    memset((void*)_deferred, 0, sizeof(_deferred));
+  }
+
+  /// Render thread only.
+  D3DU_WORKLOAD Immediate;
+
+  /// Any thread.
+  void AddDeferred(const D3DU_WORKLOAD &counts)
+  {
+    const UINT64 *c = (const UINT64*)&counts;
+    for(UINT i = 0; i < WORKLOAD_FIELDS; ++i)
+    {
+      if(c[i])
+        InterlockedExchangeAdd64(&_deferred[i], (LONGLONG)c[i]);
+    }
+  }
+
+  /// Render thread only.
+  void Get(D3DU_WORKLOAD *oCounts)
+  {
+    *oCounts = Immediate;
+    UINT64 *c = (UINT64*)oCounts;
+    for(UINT i = 0; i < WORKLOAD_FIELDS; ++i)
+      c[i] += (UINT64)InterlockedCompareExchange64(&_deferred[i], 0, 0);
+  }
+
+private:
+  volatile LONGLONG _deferred[WORKLOAD_FIELDS];
+};
+
+class D3DU_NOVTABLE CInstrumentedContext :
+  public CContextProxy<ID3D11DeviceContext>
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3D11DeviceChild)
+    INTERFACE_MAP_ENTRY(ID3D11DeviceContext)
+#ifdef D3DU_D3D11_1
+    // Calls made through it are not counted.
+    if(__uuidof(ID3D11DeviceContext1) == riid)
+      return _context->QueryInterface(riid, oObject);
+#endif
+  END_INTERFACE_MAP
+
+  CInstrumentedContext()
+  {
+    _workload = NULL;
+    _counts = NULL;
+    _topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    memset(&_local, 0, sizeof(_local));
+  }
+
+  virtual ~CInstrumentedContext()
+  {
+    if(_counts == &_local)
+      _workload->AddDeferred(_local);
+  }
+
+  /// `device' is the instrumented device owning `workload'.
+  STDMETHOD(Construct)(ID3D11DeviceContext *context, ID3D11Device *device, CWorkload *workload)
+  {
+    _context = context;
+    _device = device;
+    _workload = workload;
+    _counts = D3D11_DEVICE_CONTEXT_IMMEDIATE == context->GetType()
+      ? &workload->Immediate
+      : &_local;
+    return S_OK;
+  }
+
+  STDMETHOD_(void, GetDevice)(ID3D11Device **device)
+  {
+    _device.AddRef();
+    *device = _device;
+  }
+
+  // Draws
+
+  STDMETHOD_(void, Draw)(UINT vertexCount, UINT startVertexLocation)
+  {
+    ++_counts->DrawCalls;
+    _counts->Primitives += Primitives(vertexCount);
+    _context->Draw(vertexCount, startVertexLocation);
+  }
+
+  STDMETHOD_(void, DrawIndexed)(UINT indexCount, UINT startIndexLocation, INT baseVertexLocation)
+  {
+    ++_counts->DrawCalls;
+    _counts->Primitives += Primitives(indexCount);
+    _context->DrawIndexed(indexCount, startIndexLocation, baseVertexLocation);
+  }
+
+  STDMETHOD_(void, DrawInstanced)(
+    UINT vertexCountPerInstance,
+    UINT instanceCount,
+    UINT startVertexLocation,
+    UINT startInstanceLocation)
+  {
+    ++_counts->DrawCalls;
+    _counts->Primitives += Primitives(vertexCountPerInstance) * instanceCount;
+    _context->DrawInstanced(vertexCountPerInstance, instanceCount, startVertexLocation, startInstanceLocation);
+  }
+
+  STDMETHOD_(void, DrawIndexedInstanced)(
+    UINT indexCountPerInstance,
+    UINT instanceCount,
+    UINT startIndexLocation,
+    INT baseVertexLocation,
+    UINT startInstanceLocation)
+  {
+    ++_counts->DrawCalls;
+    _counts->Primitives += Primitives(indexCountPerInstance) * instanceCount;
+    _context->DrawIndexedInstanced(
+      indexCountPerInstance,
+      instanceCount,
+      startIndexLocation,
+      baseVertexLocation,
+      startInstanceLocation);
+  }
+
+  // Vertex counts of these draws are known to the GPU only.
+
+  STDMETHOD_(void, DrawAuto)()
+  {
+    ++_counts->DrawCalls;
+    _context->DrawAuto();
+  }
+
+  STDMETHOD_(void, DrawIndexedInstancedIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    ++_counts->DrawCalls;
+    _context->DrawIndexedInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, DrawInstancedIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    ++_counts->DrawCalls;
+    _context->DrawInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, Dispatch)(UINT threadGroupCountX, UINT threadGroupCountY, UINT threadGroupCountZ)
+  {
+    ++_counts->Dispatches;
+    _context->Dispatch(threadGroupCountX, threadGroupCountY, threadGroupCountZ);
+  }
+
+  STDMETHOD_(void, DispatchIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    ++_counts->Dispatches;
+    _context->DispatchIndirect(bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  // Uploads
+
+  STDMETHOD(Map)(
+    ID3D11Resource *resource,
+    UINT subresource,
+    D3D11_MAP mapType,
+    UINT mapFlags,
+    D3D11_MAPPED_SUBRESOURCE *mappedResource)
+  {
+    HRESULT hr = _context->Map(resource, subresource, mapType, mapFlags, mappedResource);
+    // Appending maps would count the whole buffer for a few bytes.
+    if(SUCCEEDED(hr)
+      && mappedResource
+      && D3D11_MAP_READ != mapType
+      && D3D11_MAP_WRITE_NO_OVERWRITE != mapType)
+      _counts->BytesUploaded += MappedBytes(resource, subresource, *mappedResource);
+    return hr;
+  }
+
+  STDMETHOD_(void, UpdateSubresource)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    const D3D11_BOX *dstBox,
+    const void *srcData,
+    UINT srcRowPitch,
+    UINT srcDepthPitch)
+  {
+    _counts->BytesUploaded += UpdatedBytes(dstResource, dstSubresource, dstBox, srcRowPitch, srcDepthPitch);
+    _context->UpdateSubresource(dstResource, dstSubresource, dstBox, srcData, srcRowPitch, srcDepthPitch);
+  }
+
+  // State
+
+  STDMETHOD_(void, IASetPrimitiveTopology)(D3D11_PRIMITIVE_TOPOLOGY topology)
+  {
+    ++_counts->StateChanges;
+    _topology = topology;
+    _context->IASetPrimitiveTopology(topology);
+  }
+
+  STDMETHOD_(void, VSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->VSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, PSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->PSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, PSSetShader)(
+    ID3D11PixelShader *pixelShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->PSSetShader(pixelShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->PSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, VSSetShader)(
+    ID3D11VertexShader *vertexShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->VSSetShader(vertexShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->PSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, IASetInputLayout)(ID3D11InputLayout *inputLayout)
+  {
+    ++_counts->StateChanges;
+    _context->IASetInputLayout(inputLayout);
+  }
+
+  STDMETHOD_(void, IASetVertexBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *vertexBuffers,
+    const UINT *strides,
+    const UINT *offsets)
+  {
+    ++_counts->StateChanges;
+    _context->IASetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+  }
+
+  STDMETHOD_(void, IASetIndexBuffer)(ID3D11Buffer *indexBuffer, DXGI_FORMAT format, UINT offset)
+  {
+    ++_counts->StateChanges;
+    _context->IASetIndexBuffer(indexBuffer, format, offset);
+  }
+
+  STDMETHOD_(void, GSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->GSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, GSSetShader)(
+    ID3D11GeometryShader *shader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->GSSetShader(shader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, VSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->VSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, VSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->VSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, SetPredication)(ID3D11Predicate *predicate, BOOL predicateValue)
+  {
+    ++_counts->StateChanges;
+    _context->SetPredication(predicate, predicateValue);
+  }
+
+  STDMETHOD_(void, GSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->GSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, GSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->GSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargets)(
+    UINT numViews,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView)
+  {
+    ++_counts->StateChanges;
+    _context->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargetsAndUnorderedAccessViews)(
+    UINT numRTVs,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView,
+    UINT uavStartSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    ++_counts->StateChanges;
+    _context->OMSetRenderTargetsAndUnorderedAccessViews(numRTVs, renderTargetViews, depthStencilView, uavStartSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+  }
+
+  STDMETHOD_(void, OMSetBlendState)(
+    ID3D11BlendState *blendState,
+    const FLOAT blendFactor[4],
+    UINT sampleMask)
+  {
+    ++_counts->StateChanges;
+    _context->OMSetBlendState(blendState, blendFactor, sampleMask);
+  }
+
+  STDMETHOD_(void, OMSetDepthStencilState)(
+    ID3D11DepthStencilState *depthStencilState,
+    UINT stencilRef)
+  {
+    ++_counts->StateChanges;
+    _context->OMSetDepthStencilState(depthStencilState, stencilRef);
+  }
+
+  STDMETHOD_(void, SOSetTargets)(
+    UINT numBuffers,
+    ID3D11Buffer *const *sOTargets,
+    const UINT *offsets)
+  {
+    ++_counts->StateChanges;
+    _context->SOSetTargets(numBuffers, sOTargets, offsets);
+  }
+
+  STDMETHOD_(void, RSSetState)(ID3D11RasterizerState *rasterizerState)
+  {
+    ++_counts->StateChanges;
+    _context->RSSetState(rasterizerState);
+  }
+
+  STDMETHOD_(void, RSSetViewports)(UINT numViewports, const D3D11_VIEWPORT *viewports)
+  {
+    ++_counts->StateChanges;
+    _context->RSSetViewports(numViewports, viewports);
+  }
+
+  STDMETHOD_(void, RSSetScissorRects)(UINT numRects, const D3D11_RECT *rects)
+  {
+    ++_counts->StateChanges;
+    _context->RSSetScissorRects(numRects, rects);
+  }
+
+  STDMETHOD_(void, HSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->HSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, HSSetShader)(
+    ID3D11HullShader *hullShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->HSSetShader(hullShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, HSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->HSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, HSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->HSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, DSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->DSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, DSSetShader)(
+    ID3D11DomainShader *domainShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->DSSetShader(domainShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, DSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->DSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, DSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->DSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, CSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    ++_counts->StateChanges;
+    _context->CSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, CSSetUnorderedAccessViews)(
+    UINT startSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    ++_counts->StateChanges;
+    _context->CSSetUnorderedAccessViews(startSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+  }
+
+  STDMETHOD_(void, CSSetShader)(
+    ID3D11ComputeShader *computeShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    ++_counts->StateChanges;
+    _context->CSSetShader(computeShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, CSSetSamplers)(
+    UINT startSlot,
+    UINT numSamplers,
+    ID3D11SamplerState *const *samplers)
+  {
+    ++_counts->StateChanges;
+    _context->CSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, CSSetConstantBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *constantBuffers)
+  {
+    ++_counts->StateChanges;
+    _context->CSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, ClearState)()
+  {
+    ++_counts->StateChanges;
+    _topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    _context->ClearState();
+  }
+
+  STDMETHOD_(void, ExecuteCommandList)(ID3D11CommandList *commandList, BOOL restoreContextState)
+  {
+    if(!restoreContextState)
+      _topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    _context->ExecuteCommandList(commandList, restoreContextState);
+  }
+
+  STDMETHOD(FinishCommandList)(BOOL restoreDeferredContextState, ID3D11CommandList **commandList)
+  {
+    if(!restoreDeferredContextState)
+      _topology = D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED;
+    if(_counts == &_local)
+    {
+      _workload->AddDeferred(_local);
+      memset(&_local, 0, sizeof(_local));
+    }
+    return _context->FinishCommandList(restoreDeferredContextState, commandList);
+  }
+
+private:
+  ComPtr<ID3D11Device> _device;
+  CWorkload *_workload;
+  D3DU_WORKLOAD *_counts;
+  D3DU_WORKLOAD _local;
+  D3D11_PRIMITIVE_TOPOLOGY _topology;
+
+  UINT64 Primitives(UINT vertexCount) const
+  {
+    switch(_topology)
+    {
+    case D3D11_PRIMITIVE_TOPOLOGY_POINTLIST:
+      return vertexCount;
+    case D3D11_PRIMITIVE_TOPOLOGY_LINELIST:
+      return vertexCount / 2;
+    case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP:
+      return vertexCount > 1 ? vertexCount - 1 : 0;
+    case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST:
+      return vertexCount / 3;
+    case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP:
+      return vertexCount > 2 ? vertexCount - 2 : 0;
+    case D3D11_PRIMITIVE_TOPOLOGY_LINELIST_ADJ:
+      return vertexCount / 4;
+    case D3D11_PRIMITIVE_TOPOLOGY_LINESTRIP_ADJ:
+      return vertexCount > 3 ? vertexCount - 3 : 0;
+    case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST_ADJ:
+      return vertexCount / 6;
+    case D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP_ADJ:
+      return vertexCount > 5 ? vertexCount / 2 - 2 : 0;
+    default:
+      if(_topology >= D3D11_PRIMITIVE_TOPOLOGY_1_CONTROL_POINT_PATCHLIST
+        && _topology <= D3D11_PRIMITIVE_TOPOLOGY_32_CONTROL_POINT_PATCHLIST)
+        return vertexCount / (_topology - D3D11_PRIMITIVE_TOPOLOGY_1_CONTROL_POINT_PATCHLIST + 1);
+      return 0;
+    }
+  }
+
+  /// Whole subresource: buffers by their size, textures by the pitches
+  /// the runtime returned.
+  static UINT64 MappedBytes(ID3D11Resource *resource, UINT subresource, const D3D11_MAPPED_SUBRESOURCE &mapped)
+  {
+    D3D11_RESOURCE_DIMENSION dimension;
+    resource->GetType(&dimension);
+    switch(dimension)
+    {
+    case D3D11_RESOURCE_DIMENSION_BUFFER:
+      {
+        D3D11_BUFFER_DESC desc;
+        static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+        return desc.ByteWidth;
+      }
+    case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+      {
+        D3D11_TEXTURE3D_DESC desc;
+        static_cast<ID3D11Texture3D*>(resource)->GetDesc(&desc);
+        return (UINT64)mapped.DepthPitch * MipSize(desc.Depth, subresource % desc.MipLevels);
+      }
+    default:
+      return mapped.DepthPitch;
+    }
+  }
+
+  static UINT64 UpdatedBytes(
+    ID3D11Resource *resource,
+    UINT subresource,
+    const D3D11_BOX *box,
+    UINT rowPitch,
+    UINT depthPitch)
+  {
+    D3D11_RESOURCE_DIMENSION dimension;
+    resource->GetType(&dimension);
+    switch(dimension)
+    {
+    case D3D11_RESOURCE_DIMENSION_BUFFER:
+      {
+        if(box)
+          return box->right - box->left;
+        D3D11_BUFFER_DESC desc;
+        static_cast<ID3D11Buffer*>(resource)->GetDesc(&desc);
+        return desc.ByteWidth;
+      }
+    case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+      return rowPitch;
+    case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+      {
+        D3D11_TEXTURE2D_DESC desc;
+        static_cast<ID3D11Texture2D*>(resource)->GetDesc(&desc);
+        UINT rows = box ? box->bottom - box->top : MipSize(desc.Height, subresource % desc.MipLevels);
+        if(FormatIsBlockCompressed(desc.Format))
+          rows = (rows + 3) / 4;
+        return (UINT64)rowPitch * rows;
+      }
+    case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+      {
+        D3D11_TEXTURE3D_DESC desc;
+        static_cast<ID3D11Texture3D*>(resource)->GetDesc(&desc);
+        UINT slices = box ? box->back - box->front : MipSize(desc.Depth, subresource % desc.MipLevels);
+        return (UINT64)depthPitch * slices;
+      }
+    default:
+      return 0;
+    }
+  }
+};
+
+/// GetImmediateContext returns whatever SetImmediateContext was given,
+/// so that callers going through the device still end up on the state
+/// cache. Deferred contexts are instrumented too.
+class D3DU_NOVTABLE CInstrumentedDevice :
+  public CDeviceProxy<ID3D11Device>
+{
+public:
+
+  /// Interfaces not listed here, DXGI ones included, are the real
+  /// device's. DXGI finds the real device through them.
+  STDMETHOD(QueryInterface)(REFIID riid, LPVOID *oObject)
+  {
+    if(__uuidof(IUnknown) == riid || __uuidof(ID3D11Device) == riid)
+    {
+      *oObject = (ID3D11Device*)this;
+      AddRef();
+      return S_OK;
+    }
+    return _device->QueryInterface(riid, oObject);
+  }
+
+  CInstrumentedDevice()
+  {
+    _created = 0;
+    _memory.Attach(new ComObject<CMemoryTracker>());
+  }
+
+  virtual ~CInstrumentedDevice() { }
+
+  STDMETHOD(Construct)(ID3D11Device *device)
+  {
+    _device = device;
+    return S_OK;
+  }
+
+  /// Creates the instrumented immediate context. It references the
+  /// device, and the device will reference whatever is passed to
+  /// SetImmediateContext, so the owner has to break that cycle with
+  /// SetImmediateContext(NULL).
+  STDMETHOD(CreateImmediateContext)(ID3D11DeviceContext *context, ID3D11DeviceContext **oContext)
+  {
+    return Wrap(context, oContext);
+  }
+
+  STDMETHOD_(void, SetImmediateContext)(ID3D11DeviceContext *context)
+  {
+    _immediate = context;
+  }
+
+  /// Totals since creation. Render thread only.
+  STDMETHOD_(void, GetWorkload)(D3DU_WORKLOAD *oWorkload)
+  {
+    _workload.Get(oWorkload);
+    oWorkload->ResourcesCreated += (UINT64)InterlockedCompareExchange64(&_created, 0, 0);
+  }
+
+  STDMETHOD_(void, GetMemoryTracker)(ID3DUMemoryTracker **oTracker)
+  {
+    _memory.AddRef();
+    *oTracker = _memory;
+  }
+
+  STDMETHOD_(void, GetImmediateContext)(ID3D11DeviceContext **immediateContext)
+  {
+    if(!_immediate)
+    {
+      _device->GetImmediateContext(immediateContext);
+      return;
+    }
+    _immediate.AddRef();
+    *immediateContext = _immediate;
+  }
+
+  STDMETHOD(CreateDeferredContext)(UINT contextFlags, ID3D11DeviceContext **deferredContext)
+  {
+    HRESULT hr;
+    ComPtr<ID3D11DeviceContext> context;
+    hr = _device->CreateDeferredContext(contextFlags, &context);
+    if(FAILED(hr))
+      return hr;
+    if(!deferredContext)
+      return hr;
+    return Wrap(context, deferredContext);
+  }
+
+  // Resource creation
+
+  STDMETHOD(CreateBuffer)(
+    const D3D11_BUFFER_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Buffer **buffer)
+  {
+    return Allocated(_device->CreateBuffer(desc, initialData, buffer), buffer);
+  }
+
+  STDMETHOD(CreateTexture1D)(
+    const D3D11_TEXTURE1D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture1D **texture1D)
+  {
+    return Allocated(_device->CreateTexture1D(desc, initialData, texture1D), texture1D);
+  }
+
+  STDMETHOD(CreateTexture2D)(
+    const D3D11_TEXTURE2D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture2D **texture2D)
+  {
+    return Allocated(_device->CreateTexture2D(desc, initialData, texture2D), texture2D);
+  }
+
+  STDMETHOD(CreateTexture3D)(
+    const D3D11_TEXTURE3D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture3D **texture3D)
+  {
+    return Allocated(_device->CreateTexture3D(desc, initialData, texture3D), texture3D);
+  }
+
+  STDMETHOD(CreateShaderResourceView)(
+    ID3D11Resource *resource,
+    const D3D11_SHADER_RESOURCE_VIEW_DESC *desc,
+    ID3D11ShaderResourceView **srv)
+  {
+    return Created(_device->CreateShaderResourceView(resource, desc, srv), srv);
+  }
+
+  STDMETHOD(CreateUnorderedAccessView)(
+    ID3D11Resource *resource,
+    const D3D11_UNORDERED_ACCESS_VIEW_DESC *desc,
+    ID3D11UnorderedAccessView **uav)
+  {
+    return Created(_device->CreateUnorderedAccessView(resource, desc, uav), uav);
+  }
+
+  STDMETHOD(CreateRenderTargetView)(
+    ID3D11Resource *resource,
+    const D3D11_RENDER_TARGET_VIEW_DESC *desc,
+    ID3D11RenderTargetView **rtv)
+  {
+    return Created(_device->CreateRenderTargetView(resource, desc, rtv), rtv);
+  }
+
+  STDMETHOD(CreateDepthStencilView)(
+    ID3D11Resource *resource,
+    const D3D11_DEPTH_STENCIL_VIEW_DESC *desc,
+    ID3D11DepthStencilView **depthStencilView)
+  {
+    return Created(_device->CreateDepthStencilView(resource, desc, depthStencilView), depthStencilView);
+  }
+
+private:
+  CWorkload _workload;
+  volatile LONGLONG _created;
+  ComPtr<ID3D11DeviceContext> _immediate;
+  ComPtr<CMemoryTracker> _memory;
+
+  /// Output pointers are NULL when only validating parameters.
+  template<class T>
+  HRESULT Created(HRESULT hr, T **object)
+  {
+    if(S_OK == hr && object)
+      InterlockedIncrement64(&_created);
+    return hr;
+  }
+
+  template<class T>
+  HRESULT Allocated(HRESULT hr, T **resource)
+  {
+    if(S_OK == hr && resource)
+    {
+      InterlockedIncrement64(&_created);
+      _memory->Created(*resource);
+    }
+    return hr;
+  }
+
+  HRESULT Wrap(ID3D11DeviceContext *context, ID3D11DeviceContext **oContext)
+  {
+    HRESULT hr;
+    ComObject<CInstrumentedContext> *instrumented = new ComObject<CInstrumentedContext>();
+    hr = instrumented->Construct(context, this, &_workload);
+    if(FAILED(hr))
+    {
+      delete instrumented;
+      return hr;
+    }
+    *oContext = instrumented;
+    return S_OK;
+  }
+};
+
+#endif // __INSTRUMENTATION_HPP__
@@ -0,0 +1,470 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "Layers.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+
+/// Target handed to layer sinks. Everything but the context comes
+/// from the real target; the frame itself is driven by CLayerSink.
+class D3DU_NOVTABLE CLayerTarget :
+  public ID3DUTarget
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUTarget)
+  END_INTERFACE_MAP
+
+  CLayerTarget()
+  {
+    _target = NULL;
+    _sink = NULL;
+  }
+
+  virtual ~CLayerTarget() { }
+
+  void Bind(ID3DUTarget *target, ID3DUFrameSink *sink, ID3D11DeviceContext *dc)
+  {
+    _target = target;
+    _sink = sink;
+    _dc = dc;
+    _ring.Release();
+  }
+
+  /// Called before the deferred context is finished,
+  /// which must not happen with the ring mapped.
+  void EndFrame()
+  {
+    if(_ring)
+      _ring->EndFrame();
+  }
+
+  STDMETHOD(Render)()
+  {
+    return E_NOTIMPL;
+  }
+  STDMETHOD(GetSize)(UINT *oWidth, UINT *oHeight)
+  {
+    return _target->GetSize(oWidth, oHeight);
+  }
+  STDMETHOD(SetSize)(UINT width, UINT height)
+  {
+    return E_NOTIMPL;
+  }
+  STDMETHOD(GetFrameSink)(ID3DUFrameSink **oSink)
+  {
+    if(!oSink)
+      return E_POINTER;
+    _sink->AddRef();
+    *oSink = _sink;
+    return S_OK;
+  }
+  STDMETHOD(SetFrameSink)(ID3DUFrameSink *sink)
+  {
+    return E_NOTIMPL;
+  }
+  STDMETHOD(GetDevice)(ID3D11Device **oDevice)
+  {
+    return _target->GetDevice(oDevice);
+  }
+  STDMETHOD(GetDevice10)(ID3D10Device1 **oDevice)
+  {
+    return _target->GetDevice10(oDevice);
+  }
+  STDMETHOD(GetDC)(ID3D11DeviceContext **oDC)
+  {
+    if(!oDC)
+      return E_POINTER;
+    _dc.AddRef();
+    *oDC = _dc;
+    return S_OK;
+  }
+  STDMETHOD(GetFrameRTV)(ID3D11RenderTargetView **oRTV)
+  {
+    return _target->GetFrameRTV(oRTV);
+  }
+  STDMETHOD(GetFrameDSV)(ID3D11DepthStencilView **oDSV)
+  {
+    return _target->GetFrameDSV(oDSV);
+  }
+  STDMETHOD(Draw)()
+  {
+    return E_NOTIMPL;
+  }
+  STDMETHOD(Present)()
+  {
+    return E_NOTIMPL;
+  }
+  STDMETHOD(GetD3DUDevice)(ID3DUDevice **oDevice)
+  {
+    return _target->GetD3DUDevice(oDevice);
+  }
+  STDMETHOD(GetDesc)(D3DU_TARGET_DESC *oDesc)
+  {
+    return _target->GetDesc(oDesc);
+  }
+  STDMETHOD(GetResourcePool)(ID3DUResourcePool **oPool)
+  {
+    return _target->GetResourcePool(oPool);
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_TARGET_STATISTICS *oStats)
+  {
+    return _target->GetStatistics(oStats);
+  }
+
+  /// Layers drawn on the immediate context share the target ring,
+  /// deferred ones get a ring of their own on first use.
+  STDMETHOD(GetUploadRing)(ID3DUUploadRing **oRing)
+  {
+    HRESULT hr;
+    if(!oRing)
+      return E_POINTER;
+    if(D3D11_DEVICE_CONTEXT_DEFERRED != _dc->GetType())
+      return _target->GetUploadRing(oRing);
+    if(!_ring)
+    {
+      hr = D3DUCreateUploadRing(_dc, 0, &_ring);
+      if(FAILED(hr))
+      {
+        *oRing = NULL;
+        return hr;
+      }
+    }
+    _ring.AddRef();
+    *oRing = _ring;
+    return S_OK;
+  }
+  STDMETHOD(DeferRelease)(IUnknown *object)
+  {
+    return _target->DeferRelease(object);
+  }
+  STDMETHOD(GetFrameStats)(ID3DUFrameStats **oStats)
+  {
+    return _target->GetFrameStats(oStats);
+  }
+
+private:
+  ID3DUTarget *_target;
+  ID3DUFrameSink *_sink;
+  ComPtr<ID3D11DeviceContext> _dc;
+  ComPtr<ID3DUUploadRing> _ring;
+};
+
+class D3DU_NOVTABLE CLayerSink :
+  public ID3DULayerSink,
+  private ILayerBackend
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameSink)
+    INTERFACE_MAP_ENTRY(ID3DULayerSink)
+  END_INTERFACE_MAP
+
+  CLayerSink()
+  {
+    _target = NULL;
+    _count = 0;
+    _width = 0;
+    _height = 0;
+    _rendering = FALSE;
+    memset(&_viewport, 0, sizeof(_viewport));
+  }
+
+  STDMETHOD(Construct)(UINT threadCount)
+  {
+    return _scheduler.Init(threadCount);
+  }
+
+  virtual ~CLayerSink()
+  {
+    _scheduler.Shutdown();
+    if(_target)
+      Detach(_target);
+    for(UINT i = 0; i < _count; ++i)
+      _layers[i].Clear();
+  }
+
+  STDMETHOD_(void, Attach)(ID3DUTarget *target)
+  {
+    _target = target;
+    target->GetSize(&_width, &_height);
+    for(UINT i = 0; i < _count; ++i)
+      AttachLayer(_layers[i]);
+  }
+
+  STDMETHOD_(void, Detach)(ID3DUTarget *target)
+  {
+    for(UINT i = 0; i < _count; ++i)
+      DetachLayer(_layers[i]);
+    _target = NULL;
+  }
+
+  STDMETHOD_(void, RenderFrame)(ID3DUTarget *target)
+  {
+    if(0 == _count || !_target)
+      return;
+    _rendering = TRUE;
+    _scheduler.Run(this, _count);
+    _rendering = FALSE;
+  }
+
+  STDMETHOD_(void, Resize)(ID3DUTarget *target, UINT width, UINT height)
+  {
+    _width = width;
+    _height = height;
+    for(UINT i = 0; i < _count; ++i)
+      _layers[i].Sink->Resize(_layers[i].Proxy, width, height);
+  }
+
+  STDMETHOD(AddLayer)(ID3DUFrameSink *sink, INT order)
+  {
+    if(!sink)
+      return E_INVALIDARG;
+    if(_rendering)
+      return E_FAIL;
+    if(_count >= D3DU_MAX_LAYERS)
+      return E_OUTOFMEMORY;
+    UINT pos = _count;
+    while(pos > 0 && _layers[pos - 1].Order > order)
+    {
+      _layers[pos] = _layers[pos - 1];
+      --pos;
+    }
+    Layer &layer = _layers[pos];
+    layer.Init(sink, order);
+    ++_count;
+    if(_target)
+      AttachLayer(layer);
+    return S_OK;
+  }
+
+  STDMETHOD(RemoveLayer)(ID3DUFrameSink *sink)
+  {
+    if(_rendering)
+      return E_FAIL;
+    for(UINT i = 0; i < _count; ++i)
+    {
+      if(_layers[i].Sink == sink)
+      {
+        if(_target)
+          DetachLayer(_layers[i]);
+        _layers[i].Clear();
+        for(UINT j = i + 1; j < _count; ++j)
+          _layers[j - 1] = _layers[j];
+        --_count;
+        return S_OK;
+      }
+    }
+    return S_FALSE;
+  }
+
+  STDMETHOD(GetLayerCount)(UINT *oCount)
+  {
+    if(!oCount)
+      return E_POINTER;
+    *oCount = _count;
+    return S_OK;
+  }
+
+  STDMETHOD(GetLayer)(UINT index, ID3DUFrameSink **oSink, INT *oOrder)
+  {
+    if(!oSink)
+      return E_POINTER;
+    *oSink = NULL;
+    if(index >= _count)
+      return E_INVALIDARG;
+    _layers[index].Sink->AddRef();
+    *oSink = _layers[index].Sink;
+    if(oOrder)
+      *oOrder = _layers[index].Order;
+    return S_OK;
+  }
+
+  STDMETHOD(GetThreadCount)(UINT *oCount)
+  {
+    if(!oCount)
+      return E_POINTER;
+    *oCount = _scheduler.GetThreadCount() + 1;
+    return S_OK;
+  }
+
+private:
+  /// Plain struct moved around by value while sorting;
+  /// references are released explicitly by Clear.
+  struct Layer
+  {
+    ID3DUFrameSink *Sink;
+    INT Order;
+    ComObject<CLayerTarget> *Proxy;
+    ID3D11DeviceContext *DC;
+    ID3D11CommandList *List;
+
+    void Init(ID3DUFrameSink *sink, INT order)
+    {
+      sink->AddRef();
+      Sink = sink;
+      Order = order;
+      Proxy = new ComObject<CLayerTarget>();
+      DC = NULL;
+      List = NULL;
+    }
+
+    void Clear()
+    {
+      if(List)
+        List->Release();
+      if(DC)
+        DC->Release();
+      Proxy->Release();
+      Sink->Release();
+      List = NULL;
+      DC = NULL;
+    }
+  };
+
+  ID3DUTarget *_target;
+  Layer _layers[D3DU_MAX_LAYERS];
+  UINT _count;
+  UINT _width;
+  UINT _height;
+  BOOL _rendering;
+  CLayerScheduler _scheduler;
+  ComPtr<ID3D11DeviceContext> _immediate;
+  ComPtr<ID3D11RenderTargetView> _rtv;
+  ComPtr<ID3D11DepthStencilView> _dsv;
+  D3D11_VIEWPORT _viewport;
+
+  /// Layers whose deferred context could not be created
+  /// are drawn on the immediate context during Submit.
+  void AttachLayer(Layer &layer)
+  {
+    ComPtr<ID3D11Device> device;
+    ComPtr<ID3D11DeviceContext> immediate;
+    _target->GetDevice(&device);
+    _target->GetDC(&immediate);
+    if(!layer.DC && FAILED(device->CreateDeferredContext(0, &layer.DC)))
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Unable to create deferred context. Layer will be drawn serially.");
+      layer.DC = NULL;
+    }
+    layer.Proxy->Bind(_target, layer.Sink, layer.DC ? layer.DC : (ID3D11DeviceContext*)immediate);
+    layer.Sink->Attach(layer.Proxy);
+  }
+
+  void DetachLayer(Layer &layer)
+  {
+    layer.Sink->Detach(layer.Proxy);
+    if(layer.List)
+      layer.List->Release();
+    if(layer.DC)
+      layer.DC->Release();
+    layer.List = NULL;
+    layer.DC = NULL;
+  }
+
+  void BindTarget(ID3D11DeviceContext *dc)
+  {
+    ID3D11RenderTargetView *rtv = _rtv;
+    dc->OMSetRenderTargets(1, &rtv, _dsv);
+    dc->RSSetViewports(1, &_viewport);
+  }
+
+  /// Size comes from Resize rather than GetSize, so that
+  /// layers follow the scaled size under dynamic resolution.
+  HRESULT BeginFrame(UINT count)
+  {
+    _target->GetDC(&_immediate);
+    _target->GetFrameRTV(&_rtv);
+    _target->GetFrameDSV(&_dsv);
+    _viewport.TopLeftX = 0.0f;
+    _viewport.TopLeftY = 0.0f;
+    _viewport.Width = (FLOAT)_width;
+    _viewport.Height = (FLOAT)_height;
+    _viewport.MinDepth = 0.0f;
+    _viewport.MaxDepth = 1.0f;
+    return S_OK;
+  }
+
+  void Record(UINT index)
+  {
+    Layer &layer = _layers[index];
+    if(!layer.DC)
+      return;
+    D3DU_TRACE_ZONE("RecordLayer");
+    BindTarget(layer.DC);
+    layer.Sink->RenderFrame(layer.Proxy);
+    layer.Proxy->EndFrame();
+    if(FAILED(layer.DC->FinishCommandList(FALSE, &layer.List)))
+      layer.List = NULL;
+  }
+
+  void Submit(UINT index)
+  {
+    D3DU_TRACE_ZONE("SubmitLayer");
+    Layer &layer = _layers[index];
+    if(!layer.DC)
+    {
+      BindTarget(_immediate);
+      layer.Sink->RenderFrame(layer.Proxy);
+      return;
+    }
+    if(layer.List)
+    {
+      _immediate->ExecuteCommandList(layer.List, FALSE);
+      layer.List->Release();
+      layer.List = NULL;
+    }
+  }
+
+  /// Views are released so that the target can resize its buffers.
+  void EndFrame()
+  {
+    _rtv.Release();
+    _dsv.Release();
+    _immediate.Release();
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateLayerSink(
+  UINT threadCount,
+  ID3DULayerSink **oSink)
+{
+  if(!oSink)
+    return E_POINTER;
+  *oSink = NULL;
+  HRESULT hr;
+  ComObject<CLayerSink> *sink = new ComObject<CLayerSink>();
+  hr = sink->Construct(threadCount);
+  if(FAILED(hr))
+  {
+    delete sink;
+    return hr;
+  }
+  *oSink = sink;
+  return S_OK;
+}
@@ -0,0 +1,84 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __LAYERS_HPP__
+#define __LAYERS_HPP__
+
+#include "ThreadUtils.hpp"
+
+/// What CLayerScheduler drives each frame. The Direct3D implementation
+/// records layers into deferred contexts; LayersTest.cpp in D3DUTest
+/// checks the ordering below with one that only takes notes.
+class ILayerBackend
+{
+public:
+  virtual ~ILayerBackend() { }
+  /// Render thread. Failure skips the frame.
+  virtual HRESULT BeginFrame(UINT count) = 0;
+  /// Worker threads, each index exactly once, in no particular order.
+  virtual void Record(UINT index) = 0;
+  /// Render thread, in index order, after every Record has returned.
+  virtual void Submit(UINT index) = 0;
+  /// Render thread, after the last Submit.
+  virtual void EndFrame() = 0;
+};
+
+class CLayerScheduler
+{
+public:
+  HRESULT Init(UINT threadCount)
+  {
+    return _pool.Init(threadCount);
+  }
+
+  void Shutdown()
+  {
+    _pool.Shutdown();
+  }
+
+  UINT GetThreadCount() const
+  {
+    return _pool.GetThreadCount();
+  }
+
+  HRESULT Run(ILayerBackend *backend, UINT count)
+  {
+    HRESULT hr = backend->BeginFrame(count);
+    if(FAILED(hr))
+      return hr;
+    _pool.ParallelFor(count, RecordTask, backend);
+    for(UINT i = 0; i < count; ++i)
+      backend->Submit(i);
+    backend->EndFrame();
+    return S_OK;
+  }
+
+private:
+  CThreadPool _pool;
+
+  static void RecordTask(void *context, UINT index)
+  {
+    ((ILayerBackend*)context)->Record(index);
+  }
+};
+
+#endif // __LAYERS_HPP__
@@ -0,0 +1,326 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __LOCK_FREE_HPP__
+#define __LOCK_FREE_HPP__
+
+/// Portable lock-free primitives. This header does not depend on windows.h,
+/// so queues defined here may be used outside of the library as well.
+
+#include <cstddef>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(_ReadWriteBarrier)
+#endif
+
+#define LF_CACHE_LINE 64
+
+/// Plain loads and stores on x86 are already acquire/release,
+/// so only the compiler has to be kept from reordering them.
+template<typename T>
+inline T LfLoadAcquire(const volatile T *p)
+{
+#ifdef _MSC_VER
+  T v = *p;
+  _ReadWriteBarrier();
+  return v;
+#else
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+template<typename T>
+inline void LfStoreRelease(volatile T *p, T v)
+{
+#ifdef _MSC_VER
+  _ReadWriteBarrier();
+  *p = v;
+#else
+  __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+/// Keeps loads issued before the fence from being moved past loads after it.
+inline void LfFenceAcquire()
+{
+#ifdef _MSC_VER
+  _ReadWriteBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+/// Keeps stores issued before the fence from being moved past stores after it.
+inline void LfFenceRelease()
+{
+#ifdef _MSC_VER
+  _ReadWriteBarrier();
+#else
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+/// Stores `v' into `*p' when it holds `expected', and returns what it
+/// held before. Also a full fence.
+inline long LfCompareExchange(volatile long *p, long v, long expected)
+{
+#ifdef _MSC_VER
+  return _InterlockedCompareExchange(p, v, expected);
+#else
+  return __sync_val_compare_and_swap(p, expected, v);
+#endif
+}
+
+/// Stores `v' into `*p' and returns what it held before. Also a full fence,
+/// so loads after it are not moved before the store.
+inline long LfExchange(volatile long *p, long v)
+{
+#ifdef _MSC_VER
+  return _InterlockedExchange(p, v);
+#else
+  return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+inline unsigned int LfRoundUpPow2(unsigned int v)
+{
+  unsigned int r = 1;
+  while(r < v)
+    r <<= 1;
+  return r;
+}
+
+/// Bounded single-producer/single-consumer queue.
+/// Push must only be called by one thread and Pop by another one.
+template<typename T>
+class CSpscQueue
+{
+public:
+  CSpscQueue()
+  {
+    _items = NULL;
+    _mask = 0;
+    _head = 0;
+    _tail = 0;
+  }
+  ~CSpscQueue()
+  {
+    delete[] _items;
+  }
+  /// Capacity is rounded up to a power of two.
+  bool Init(unsigned int capacity)
+  {
+    delete[] _items;
+    capacity = LfRoundUpPow2(capacity ? capacity : 1);
+    _items = new T[capacity];
+    _mask = capacity - 1;
+    _head = 0;
+    _tail = 0;
+    return true;
+  }
+  bool Push(const T& item)
+  {
+    unsigned int tail = _tail;
+    if(tail - LfLoadAcquire(&_head) > _mask)
+      return false;
+    _items[tail & _mask] = item;
+    LfStoreRelease(&_tail, tail + 1);
+    return true;
+  }
+  bool Pop(T *oItem)
+  {
+    unsigned int head = _head;
+    if(head == LfLoadAcquire(&_tail))
+      return false;
+    *oItem = _items[head & _mask];
+    LfStoreRelease(&_head, head + 1);
+    return true;
+  }
+  /// Consumer side only. Returns NULL when the queue is empty.
+  T* Peek()
+  {
+    unsigned int head = _head;
+    if(head == LfLoadAcquire(&_tail))
+      return NULL;
+    return &_items[head & _mask];
+  }
+  /// Producer side only. The slot of the last item pushed, whether or not
+  /// the consumer has got to it yet; meaningless before the first push.
+  /// It is up to the caller to agree with the consumer on who may touch it.
+  T* Back()
+  {
+    return &_items[(_tail - 1) & _mask];
+  }
+  /// Number of pushes so far, wrapping around.
+  unsigned int Pushed() const
+  {
+    return LfLoadAcquire(&_tail);
+  }
+  /// Number of pops so far, wrapping around.
+  unsigned int Popped() const
+  {
+    return LfLoadAcquire(&_head);
+  }
+  unsigned int Size() const
+  {
+    return LfLoadAcquire(&_tail) - LfLoadAcquire(&_head);
+  }
+  unsigned int Capacity() const
+  {
+    return _mask + 1;
+  }
+private:
+  CSpscQueue(const CSpscQueue&);
+  CSpscQueue& operator=(const CSpscQueue&);
+
+  T *_items;
+  unsigned int _mask;
+  char _pad0[LF_CACHE_LINE];
+  volatile unsigned int _head;
+  char _pad1[LF_CACHE_LINE];
+  volatile unsigned int _tail;
+  char _pad2[LF_CACHE_LINE];
+};
+
+/// Bounded multi-producer/single-consumer queue.
+/// Push may be called by any thread, Pop, Peek and Remove by one only.
+/// Every slot carries a sequence number telling whose turn it is: a
+/// producer claims the tail with a compare-exchange and publishes the
+/// item through the sequence of its slot, so producers never wait for
+/// each other, and the consumer never waits at all.
+template<typename T>
+class CMpscQueue
+{
+public:
+  CMpscQueue()
+  {
+    _cells = NULL;
+    _mask = 0;
+    _head = 0;
+    _tail = 0;
+  }
+  ~CMpscQueue()
+  {
+    delete[] _cells;
+  }
+  /// Capacity is rounded up to a power of two.
+  bool Init(unsigned int capacity)
+  {
+    delete[] _cells;
+    capacity = LfRoundUpPow2(capacity ? capacity : 1);
+    _cells = new Cell[capacity];
+    for(unsigned int i = 0; i < capacity; ++i)
+      _cells[i].Sequence = (long)i;
+    _mask = capacity - 1;
+    _head = 0;
+    _tail = 0;
+    return true;
+  }
+  /// False when the queue is full.
+  bool Push(const T& item)
+  {
+    long tail = LfLoadAcquire(&_tail);
+    for(;;)
+    {
+      Cell &cell = _cells[tail & _mask];
+      long diff = (long)((unsigned long)LfLoadAcquire(&cell.Sequence) - (unsigned long)tail);
+      if(0 == diff)
+      {
+        long seen = LfCompareExchange(&_tail, (long)((unsigned long)tail + 1), tail);
+        if(seen == tail)
+        {
+          cell.Item = item;
+          LfStoreRelease(&cell.Sequence, (long)((unsigned long)tail + 1));
+          return true;
+        }
+        tail = seen;
+      }
+      else if(diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        tail = LfLoadAcquire(&_tail);
+      }
+    }
+  }
+  /// Consumer side only. Returns NULL when the queue is empty, or the
+  /// next item has been claimed but not yet written.
+  T* Peek()
+  {
+    Cell &cell = _cells[_head & _mask];
+    if(LfLoadAcquire(&cell.Sequence) != (long)((unsigned long)_head + 1))
+      return NULL;
+    return &cell.Item;
+  }
+  /// Consumer side only. Frees the slot of the item Peek returned.
+  void Remove()
+  {
+    Cell &cell = _cells[_head & _mask];
+    LfStoreRelease(&cell.Sequence, (long)((unsigned long)_head + _mask + 1));
+    LfStoreRelease(&_head, (long)((unsigned long)_head + 1));
+  }
+  bool Pop(T *oItem)
+  {
+    T *item = Peek();
+    if(!item)
+      return false;
+    *oItem = *item;
+    Remove();
+    return true;
+  }
+  /// Number of pushes so far, wrapping around.
+  unsigned long Pushed() const
+  {
+    return (unsigned long)LfLoadAcquire(&_tail);
+  }
+  /// Number of removals so far, wrapping around.
+  unsigned long Removed() const
+  {
+    return (unsigned long)LfLoadAcquire(&_head);
+  }
+  unsigned int Capacity() const
+  {
+    return _mask + 1;
+  }
+private:
+  CMpscQueue(const CMpscQueue&);
+  CMpscQueue& operator=(const CMpscQueue&);
+
+  struct Cell
+  {
+    volatile long Sequence;
+    T Item;
+  };
+
+  Cell *_cells;
+  unsigned int _mask;
+  char _pad0[LF_CACHE_LINE];
+  volatile long _head;
+  char _pad1[LF_CACHE_LINE];
+  volatile long _tail;
+  char _pad2[LF_CACHE_LINE];
+};
+
+#endif // __LOCK_FREE_HPP__
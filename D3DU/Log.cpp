@@ -0,0 +1,687 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "LockFree.hpp"
+#include "ThreadUtils.hpp"
+#include "Log.hpp"
+
+#define LOG_QUEUE_SIZE 1024
+/// The log thread ends after this long without messages, and starts
+/// again with the next one; while it runs, it keeps the library loaded.
+#define LOG_IDLE_MS 1000
+#define LOG_FLUSH_POLL_MS 10
+#define LOG_INITIAL_LINE_SIZE 256
+
+#ifdef D3DU_DEBUG
+volatile LONG g_logLevel = D3DU_LOG_DEBUG;
+#else
+volatile LONG g_logLevel = D3DU_LOG_WARNING;
+#endif
+
+static const LPCSTR logLevelNames[] = { "debug", "info", "warning", "error" };
+
+/// Growable text, always terminated.
+class CLogText
+{
+public:
+  CLogText()
+  {
+    _data = NULL;
+    _size = 0;
+    _capacity = 0;
+    Clear();
+  }
+
+  ~CLogText()
+  {
+    delete[] _data;
+  }
+
+  void Clear()
+  {
+    _size = 0;
+    Reserve(1);
+    _data[0] = 0;
+  }
+
+  void Append(LPCSTR s, SIZE_T length)
+  {
+    Reserve(_size + length + 1);
+    memcpy(_data + _size, s, length);
+    _size += length;
+    _data[_size] = 0;
+  }
+
+  void Append(LPCSTR s)
+  {
+    Append(s, strlen(s));
+  }
+
+  LPCSTR Get() const
+  {
+    return _data;
+  }
+
+  SIZE_T GetSize() const
+  {
+    return _size;
+  }
+
+private:
+  CLogText(const CLogText&);
+  CLogText& operator=(const CLogText&);
+
+  CHAR *_data;
+  SIZE_T _size;
+  SIZE_T _capacity;
+
+  void Reserve(SIZE_T capacity)
+  {
+    if(capacity <= _capacity)
+      return;
+    SIZE_T grown = _capacity ? _capacity : LOG_INITIAL_LINE_SIZE;
+    while(grown < capacity)
+      grown *= 2;
+    CHAR *data = new CHAR[grown];
+    if(_data)
+      memcpy(data, _data, _size + 1);
+    delete[] _data;
+    _data = data;
+    _capacity = grown;
+  }
+};
+
+/// Room for `size' bytes of a string argument, in the record while it
+/// has space, on the heap otherwise.
+static CHAR *LogAllocText(LogRecord &r, SIZE_T size, LogArg &a)
+{
+  if(size <= LOG_TEXT_SIZE - r.TextUsed)
+  {
+    a.Type = LOG_ARG_TEXT;
+    a.Size = 0;
+    a.Offset = r.TextUsed;
+    r.TextUsed += (UINT)size;
+    return r.Text + a.Offset;
+  }
+  a.Type = LOG_ARG_HEAP_TEXT;
+  a.Size = 0;
+  a.HeapText = new CHAR[size];
+  return a.HeapText;
+}
+
+static void LogFree(LogRecord &r)
+{
+  for(UINT i = 0; i < r.ArgCount; ++i)
+  {
+    if(LOG_ARG_HEAP_TEXT == r.Args[i].Type)
+      delete[] r.Args[i].HeapText;
+  }
+  r.ArgCount = 0;
+}
+
+void LogBegin(LogRecord &r, D3DU_LOG_LEVEL level, LPCSTR format)
+{
+  r.Level = level;
+  r.ThreadId = GetCurrentThreadId();
+  QueryPerformanceCounter(&r.Time);
+  r.Format = format;
+  r.ArgCount = 0;
+  r.TextUsed = 0;
+}
+
+void LogAdd(LogRecord &r, LPCSTR s)
+{
+  LogArg a;
+  if(LOG_MAX_ARGS == r.ArgCount)
+    return;
+  if(!s)
+    s = "(null)";
+  SIZE_T size = strlen(s) + 1;
+  memcpy(LogAllocText(r, size, a), s, size);
+  LogAddArg(r, a);
+}
+
+void LogAdd(LogRecord &r, LPCWSTR s)
+{
+  LogArg a;
+  if(LOG_MAX_ARGS == r.ArgCount)
+    return;
+  if(!s)
+  {
+    LogAdd(r, "(null)");
+    return;
+  }
+  int size = WideCharToMultiByte(CP_UTF8, 0, s, -1, NULL, 0, NULL, NULL);
+  if(size <= 0)
+  {
+    LogAdd(r, "?");
+    return;
+  }
+  WideCharToMultiByte(CP_UTF8, 0, s, -1, LogAllocText(r, size, a), size, NULL, NULL);
+  LogAddArg(r, a);
+}
+
+static long long LogArgInt(const LogArg &a)
+{
+  switch(a.Type)
+  {
+  case LOG_ARG_INT: return a.Int;
+  case LOG_ARG_UINT: return (long long)a.UInt;
+  case LOG_ARG_DOUBLE: return (long long)a.Double;
+  default: return (long long)(INT_PTR)a.Pointer;
+  }
+}
+
+/// Negative 32 bit integers stay 32 bits wide in hex.
+static unsigned long long LogArgUInt(const LogArg &a)
+{
+  if(LOG_ARG_INT == a.Type && a.Size < sizeof(long long))
+    return (unsigned long long)(unsigned int)a.Int;
+  return (unsigned long long)LogArgInt(a);
+}
+
+static double LogArgDouble(const LogArg &a)
+{
+  switch(a.Type)
+  {
+  case LOG_ARG_INT: return (double)a.Int;
+  case LOG_ARG_UINT: return (double)a.UInt;
+  case LOG_ARG_DOUBLE: return a.Double;
+  default: return 0.0;
+  }
+}
+
+/// Runs printf over the captured arguments, one conversion at a time,
+/// picking the length of integer conversions from the argument type.
+/// Conversions that do not fit an argument print it the way its type
+/// would, and strings print whatever the conversion.
+static void LogFormat(const LogRecord &r, CLogText &out)
+{
+  UINT next = 0;
+  out.Clear();
+  for(LPCSTR p = r.Format; *p; )
+  {
+    if('%' != *p)
+    {
+      LPCSTR end = p;
+      while(*end && '%' != *end)
+        ++end;
+      out.Append(p, end - p);
+      p = end;
+      continue;
+    }
+    if('%' == p[1])
+    {
+      out.Append("%", 1);
+      p += 2;
+      continue;
+    }
+    CHAR spec[32];
+    UINT n = 0;
+    spec[n++] = *p++;
+    while(*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4)
+      spec[n++] = *p++;
+    while(*p && strchr("hlLjztI", *p))
+      ++p;
+    while(*p >= '0' && *p <= '9')
+      ++p;
+    CHAR conversion = *p ? *p++ : 's';
+    if(next == r.ArgCount)
+    {
+      out.Append("(missing)");
+      continue;
+    }
+    const LogArg &a = r.Args[next++];
+    if(LOG_ARG_TEXT == a.Type)
+    {
+      out.Append(r.Text + a.Offset);
+      continue;
+    }
+    if(LOG_ARG_HEAP_TEXT == a.Type)
+    {
+      out.Append(a.HeapText);
+      continue;
+    }
+    if(!strchr("diuoxXcfFeEgGaAp", conversion))
+    {
+      n = 1;
+      conversion = LOG_ARG_INT == a.Type ? 'd'
+        : LOG_ARG_UINT == a.Type ? 'u'
+        : LOG_ARG_DOUBLE == a.Type ? 'g'
+        : 'p';
+    }
+    CHAR value[64];
+    if(strchr("di", conversion))
+    {
+      spec[n++] = 'l';
+      spec[n++] = 'l';
+      spec[n++] = conversion;
+      spec[n] = 0;
+      sprintf_s(value, sizeof(value), spec, LogArgInt(a));
+    }
+    else if(strchr("uoxX", conversion))
+    {
+      spec[n++] = 'l';
+      spec[n++] = 'l';
+      spec[n++] = conversion;
+      spec[n] = 0;
+      sprintf_s(value, sizeof(value), spec, LogArgUInt(a));
+    }
+    else if('c' == conversion)
+    {
+      spec[n++] = 'c';
+      spec[n] = 0;
+      sprintf_s(value, sizeof(value), spec, (int)LogArgInt(a));
+    }
+    else if('p' == conversion)
+    {
+      spec[n++] = 'p';
+      spec[n] = 0;
+      sprintf_s(value, sizeof(value), spec, LOG_ARG_POINTER == a.Type ? a.Pointer : (const void*)(INT_PTR)LogArgInt(a));
+    }
+    else
+    {
+      spec[n++] = conversion;
+      spec[n] = 0;
+      sprintf_s(value, sizeof(value), spec, LogArgDouble(a));
+    }
+    out.Append(value);
+  }
+}
+
+class D3DU_NOVTABLE CLogSink :
+  public ID3DULogSink
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DULogSink)
+  END_INTERFACE_MAP
+
+  CLogSink()
+  {
+    _file = INVALID_HANDLE_VALUE;
+  }
+
+  virtual ~CLogSink()
+  {
+    if(D3DU_LOG_SINK_FILE == _type && INVALID_HANDLE_VALUE != _file)
+      CloseHandle(_file);
+  }
+
+  STDMETHOD(Construct)(D3DU_LOG_SINK_TYPE type, LPCWSTR filename)
+  {
+    _type = type;
+    QueryPerformanceFrequency(&_freq);
+    QueryPerformanceCounter(&_start);
+    switch(type)
+    {
+    case D3DU_LOG_SINK_DEBUGGER:
+      return S_OK;
+    case D3DU_LOG_SINK_STDERR:
+      _file = GetStdHandle(STD_ERROR_HANDLE);
+      return S_OK;
+    case D3DU_LOG_SINK_FILE:
+      if(!filename)
+        return E_INVALIDARG;
+      _file = CreateFile(
+        filename,
+        GENERIC_WRITE,
+        FILE_SHARE_READ,
+        NULL,
+        CREATE_ALWAYS,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        NULL);
+      if(INVALID_HANDLE_VALUE == _file)
+        return HRESULT_FROM_WIN32(GetLastError());
+      return S_OK;
+    default:
+      return E_INVALIDARG;
+    }
+  }
+
+  /// The debugger gets the level and the text, streams also get the
+  /// seconds since the sink was created and the thread.
+  STDMETHOD_(void, Write)(const D3DU_LOG_MESSAGE *message)
+  {
+    CHAR prefix[96];
+    LPCSTR level = logLevelNames[message->Level < D3DU_LOG_NONE ? message->Level : D3DU_LOG_ERROR];
+    if(D3DU_LOG_SINK_DEBUGGER == _type)
+    {
+      sprintf_s(prefix, sizeof(prefix), "D3DU %s: ", level);
+    }
+    else
+    {
+      sprintf_s(
+        prefix,
+        sizeof(prefix),
+        "%.6f [%s] %lu: ",
+        (double)(message->Time.QuadPart - _start.QuadPart) / _freq.QuadPart,
+        level,
+        message->ThreadId);
+    }
+    _line.Clear();
+    _line.Append(prefix);
+    _line.Append(message->Text);
+    _line.Append("\n", 1);
+    if(D3DU_LOG_SINK_DEBUGGER == _type)
+    {
+      int size = MultiByteToWideChar(CP_UTF8, 0, _line.Get(), -1, NULL, 0);
+      if(size <= 0)
+        return;
+      WCHAR *wide = new WCHAR[size];
+      MultiByteToWideChar(CP_UTF8, 0, _line.Get(), -1, wide, size);
+      OutputDebugStringW(wide);
+      delete[] wide;
+    }
+    else if(_file && INVALID_HANDLE_VALUE != _file)
+    {
+      DWORD written;
+      WriteFile(_file, _line.Get(), (DWORD)_line.GetSize(), &written, NULL);
+    }
+  }
+
+private:
+  D3DU_LOG_SINK_TYPE _type;
+  HANDLE _file;
+  LARGE_INTEGER _freq;
+  LARGE_INTEGER _start;
+  CLogText _line;
+};
+
+/// Owns the queue, the sinks and the log thread.
+///
+/// The thread sleeps on an event only after announcing it in `_sleeping'
+/// and finding the queue empty once more, and producers look at the flag
+/// after queueing, so most messages never touch the event at all. An
+/// idle thread unloads its reference to the library as it ends, so the
+/// library can still be freed.
+class CLogger
+{
+public:
+  CLogger()
+  {
+    ComPtr<ID3DULogSink> sink;
+    _queue.Init(LOG_QUEUE_SIZE);
+    _wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    _drained = CreateEvent(NULL, FALSE, FALSE, NULL);
+    _running = 0;
+    _sleeping = 0;
+    _dropped = 0;
+    _reported = 0;
+    _threadId = 0;
+    _module = NULL;
+    _sinkCount = 0;
+    if(SUCCEEDED(D3DUCreateLogSink(D3DU_LOG_SINK_DEBUGGER, NULL, &sink)))
+      AddSink(sink);
+  }
+
+  /// Runs as the library unloads, when the log thread is gone.
+  ~CLogger()
+  {
+    Drain();
+    RemoveSink(NULL);
+    CloseHandle(_wake);
+    CloseHandle(_drained);
+  }
+
+  /// Any thread. Takes over the heap copies of `r'.
+  void Push(LogRecord &r)
+  {
+    if(!_queue.Push(r))
+    {
+      LogFree(r);
+      InterlockedIncrement(&_dropped);
+      return;
+    }
+    if(!LfLoadAcquire(&_running))
+      Start();
+    else if(LfLoadAcquire(&_sleeping))
+      SetEvent(_wake);
+  }
+
+  HRESULT Flush()
+  {
+    if(LfLoadAcquire(&_running) && GetCurrentThreadId() == LfLoadAcquire(&_threadId))
+      return E_FAIL;
+    unsigned long target = _queue.Pushed();
+    while((long)(_queue.Removed() - target) < 0)
+    {
+      if(!LfLoadAcquire(&_running))
+      {
+        if(!Start())
+          return HRESULT_FROM_WIN32(GetLastError());
+      }
+      else
+      {
+        SetEvent(_wake);
+      }
+      WaitForSingleObject(_drained, LOG_FLUSH_POLL_MS);
+    }
+    return S_OK;
+  }
+
+  HRESULT AddSink(ID3DULogSink *sink)
+  {
+    CAutoLock lock(_sinkLock);
+    if(D3DU_MAX_LOG_SINKS == _sinkCount)
+      return E_OUTOFMEMORY;
+    _sinks[_sinkCount++] = sink;
+    return S_OK;
+  }
+
+  HRESULT RemoveSink(ID3DULogSink *sink)
+  {
+    CAutoLock lock(_sinkLock);
+    if(!sink)
+    {
+      while(_sinkCount)
+        _sinks[--_sinkCount].Release();
+      return S_OK;
+    }
+    for(UINT i = 0; i < _sinkCount; ++i)
+    {
+      if(_sinks[i] == sink)
+      {
+        for(; i + 1 < _sinkCount; ++i)
+          _sinks[i] = _sinks[i + 1];
+        _sinks[--_sinkCount].Release();
+        return S_OK;
+      }
+    }
+    return S_FALSE;
+  }
+
+private:
+  CMpscQueue<LogRecord> _queue;
+  HANDLE _wake;
+  HANDLE _drained;
+  volatile long _running;
+  volatile long _sleeping;
+  volatile LONG _dropped;
+  LONG _reported;
+  volatile DWORD _threadId;
+  HMODULE _module;
+  CLock _startLock;
+  CLock _sinkLock;
+  ComPtr<ID3DULogSink> _sinks[D3DU_MAX_LOG_SINKS];
+  UINT _sinkCount;
+  CLogText _text;
+
+  bool Pending() const
+  {
+    return _queue.Pushed() != _queue.Removed();
+  }
+
+  bool Start()
+  {
+    CAutoLock lock(_startLock);
+    if(LfLoadAcquire(&_running))
+      return true;
+    HMODULE module;
+    if(!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCWSTR)&ThreadProc, &module))
+      return false;
+    _module = module;
+    LfExchange(&_running, 1);
+    HANDLE thread = CreateThread(NULL, 0, ThreadProc, this, 0, NULL);
+    if(!thread)
+    {
+      LfExchange(&_running, 0);
+      FreeLibrary(module);
+      return false;
+    }
+    CloseHandle(thread);
+    return true;
+  }
+
+  /// Gives up when a message came in after all.
+  bool TryStop()
+  {
+    CAutoLock lock(_startLock);
+    LfExchange(&_running, 0);
+    if(Pending())
+    {
+      LfExchange(&_running, 1);
+      return false;
+    }
+    return true;
+  }
+
+  void Drain()
+  {
+    LogRecord *r;
+    while(NULL != (r = _queue.Peek()))
+    {
+      Deliver(*r);
+      LogFree(*r);
+      _queue.Remove();
+    }
+    LONG dropped = LfLoadAcquire(&_dropped);
+    if(dropped != _reported)
+    {
+      LogRecord lost;
+      LogBegin(lost, D3DU_LOG_WARNING, "%u log messages dropped, the queue was full.");
+      LogAdd(lost, (unsigned long)(dropped - _reported));
+      Deliver(lost);
+      _reported = dropped;
+    }
+  }
+
+  void Deliver(const LogRecord &r)
+  {
+    D3DU_LOG_MESSAGE message;
+    LogFormat(r, _text);
+    message.Level = r.Level;
+    message.ThreadId = r.ThreadId;
+    message.Time = r.Time;
+    message.Text = _text.Get();
+    CAutoLock lock(_sinkLock);
+    for(UINT i = 0; i < _sinkCount; ++i)
+      _sinks[i]->Write(&message);
+  }
+
+  static DWORD WINAPI ThreadProc(LPVOID param)
+  {
+    CLogger *self = (CLogger*)param;
+    HMODULE module = self->_module;
+    LfStoreRelease(&self->_threadId, GetCurrentThreadId());
+    for(;;)
+    {
+      self->Drain();
+      SetEvent(self->_drained);
+      LfExchange(&self->_sleeping, 1);
+      if(self->Pending())
+      {
+        LfExchange(&self->_sleeping, 0);
+        continue;
+      }
+      DWORD wait = WaitForSingleObject(self->_wake, LOG_IDLE_MS);
+      LfExchange(&self->_sleeping, 0);
+      if(WAIT_TIMEOUT == wait && self->TryStop())
+        break;
+    }
+    FreeLibraryAndExitThread(module, 0);
+    return 0;
+  }
+};
+
+static CLogger g_logger;
+
+void LogPush(LogRecord &r)
+{
+  g_logger.Push(r);
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUSetLogLevel(D3DU_LOG_LEVEL level)
+{
+  if(level < D3DU_LOG_DEBUG || level > D3DU_LOG_NONE)
+    return E_INVALIDARG;
+  InterlockedExchange(&g_logLevel, level);
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUAddLogSink(ID3DULogSink *sink)
+{
+  if(!sink)
+    return E_INVALIDARG;
+  return g_logger.AddSink(sink);
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DURemoveLogSink(ID3DULogSink *sink)
+{
+  return g_logger.RemoveSink(sink);
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateLogSink(
+  D3DU_LOG_SINK_TYPE type,
+  LPCWSTR filename,
+  ID3DULogSink **oSink)
+{
+  if(!oSink)
+    return E_POINTER;
+  *oSink = NULL;
+  HRESULT hr;
+  ComObject<CLogSink> *sink = new ComObject<CLogSink>();
+  hr = sink->Construct(type, filename);
+  if(FAILED(hr))
+  {
+    delete sink;
+    return hr;
+  }
+  *oSink = sink;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DULogWrite(D3DU_LOG_LEVEL level, LPCSTR text)
+{
+  if(!text || level < D3DU_LOG_DEBUG || level >= D3DU_LOG_NONE)
+    return E_INVALIDARG;
+  D3DU_LOG(level, "%s", text);
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUFlushLog()
+{
+  return g_logger.Flush();
+}
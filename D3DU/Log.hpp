@@ -0,0 +1,202 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __LOG_HPP__
+#define __LOG_HPP__
+
+#include "D3DU.h"
+
+/// Diagnostics of the library.
+///
+/// D3DU_LOG(level, format, args...) checks the level first, and only
+/// then copies the format pointer and the arguments into a record of a
+/// lock-free queue. A background thread formats records and hands them
+/// to the sinks, so a message costs the caller about as much as copying
+/// a few hundred bytes, whichever sinks are attached.
+///
+/// Formats must be string literals, as they are kept by pointer.
+/// Strings passed as arguments are copied, wide ones converted to UTF-8.
+/// Conversions are printf ones; the size of integers comes from the
+/// arguments, so length modifiers are not needed.
+
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_SIZE 160
+
+typedef enum
+{
+  LOG_ARG_INT,
+  LOG_ARG_UINT,
+  LOG_ARG_DOUBLE,
+  LOG_ARG_POINTER,
+  /// Offset into the text of the record.
+  LOG_ARG_TEXT,
+  /// Copy on the heap, freed by the log thread.
+  LOG_ARG_HEAP_TEXT,
+} LOG_ARG_TYPE;
+
+typedef struct
+{
+  LOG_ARG_TYPE Type;
+  /// Bytes the caller passed an integer in.
+  UINT Size;
+  union
+  {
+    long long Int;
+    unsigned long long UInt;
+    double Double;
+    const void *Pointer;
+    UINT Offset;
+    CHAR *HeapText;
+  };
+} LogArg;
+
+typedef struct
+{
+  D3DU_LOG_LEVEL Level;
+  DWORD ThreadId;
+  LARGE_INTEGER Time;
+  LPCSTR Format;
+  UINT ArgCount;
+  UINT TextUsed;
+  LogArg Args[LOG_MAX_ARGS];
+  CHAR Text[LOG_TEXT_SIZE];
+} LogRecord;
+
+extern volatile LONG g_logLevel;
+
+inline bool LogEnabled(D3DU_LOG_LEVEL level)
+{
+  return level >= g_logLevel && level < D3DU_LOG_NONE;
+}
+
+void LogBegin(LogRecord &r, D3DU_LOG_LEVEL level, LPCSTR format);
+void LogAdd(LogRecord &r, LPCSTR s);
+void LogAdd(LogRecord &r, LPCWSTR s);
+void LogPush(LogRecord &r);
+
+inline void LogAddArg(LogRecord &r, const LogArg &arg)
+{
+  if(r.ArgCount < LOG_MAX_ARGS)
+    r.Args[r.ArgCount++] = arg;
+}
+
+inline void LogAddInt(LogRecord &r, long long v, UINT size)
+{
+  LogArg a;
+  a.Type = LOG_ARG_INT;
+  a.Size = size;
+  a.Int = v;
+  LogAddArg(r, a);
+}
+
+inline void LogAddUInt(LogRecord &r, unsigned long long v, UINT size)
+{
+  LogArg a;
+  a.Type = LOG_ARG_UINT;
+  a.Size = size;
+  a.UInt = v;
+  LogAddArg(r, a);
+}
+
+inline void LogAdd(LogRecord &r, int v) { LogAddInt(r, v, sizeof(v)); }
+inline void LogAdd(LogRecord &r, long v) { LogAddInt(r, v, sizeof(v)); }
+inline void LogAdd(LogRecord &r, long long v) { LogAddInt(r, v, sizeof(v)); }
+inline void LogAdd(LogRecord &r, unsigned int v) { LogAddUInt(r, v, sizeof(v)); }
+inline void LogAdd(LogRecord &r, unsigned long v) { LogAddUInt(r, v, sizeof(v)); }
+inline void LogAdd(LogRecord &r, unsigned long long v) { LogAddUInt(r, v, sizeof(v)); }
+
+inline void LogAdd(LogRecord &r, double v)
+{
+  LogArg a;
+  a.Type = LOG_ARG_DOUBLE;
+  a.Size = sizeof(v);
+  a.Double = v;
+  LogAddArg(r, a);
+}
+
+inline void LogAdd(LogRecord &r, const void *p)
+{
+  LogArg a;
+  a.Type = LOG_ARG_POINTER;
+  a.Size = sizeof(p);
+  a.Pointer = p;
+  LogAddArg(r, a);
+}
+
+inline void LogWrite(D3DU_LOG_LEVEL level, LPCSTR format)
+{
+  LogRecord r;
+  LogBegin(r, level, format);
+  LogPush(r);
+}
+
+template<class A1>
+void LogWrite(D3DU_LOG_LEVEL level, LPCSTR format, const A1 &a1)
+{
+  LogRecord r;
+  LogBegin(r, level, format);
+  LogAdd(r, a1);
+  LogPush(r);
+}
+
+template<class A1, class A2>
+void LogWrite(D3DU_LOG_LEVEL level, LPCSTR format, const A1 &a1, const A2 &a2)
+{
+  LogRecord r;
+  LogBegin(r, level, format);
+  LogAdd(r, a1);
+  LogAdd(r, a2);
+  LogPush(r);
+}
+
+template<class A1, class A2, class A3>
+void LogWrite(D3DU_LOG_LEVEL level, LPCSTR format, const A1 &a1, const A2 &a2, const A3 &a3)
+{
+  LogRecord r;
+  LogBegin(r, level, format);
+  LogAdd(r, a1);
+  LogAdd(r, a2);
+  LogAdd(r, a3);
+  LogPush(r);
+}
+
+template<class A1, class A2, class A3, class A4>
+void LogWrite(D3DU_LOG_LEVEL level, LPCSTR format, const A1 &a1, const A2 &a2, const A3 &a3, const A4 &a4)
+{
+  LogRecord r;
+  LogBegin(r, level, format);
+  LogAdd(r, a1);
+  LogAdd(r, a2);
+  LogAdd(r, a3);
+  LogAdd(r, a4);
+  LogPush(r);
+}
+
+#define D3DU_LOG(level, ...) \
+  do \
+  { \
+    if(LogEnabled(level)) \
+      LogWrite(level, __VA_ARGS__); \
+  } \
+  while(0)
+
+#endif // __LOG_HPP__
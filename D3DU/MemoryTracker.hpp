@@ -0,0 +1,442 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __MEMORY_TRACKER_HPP__
+#define __MEMORY_TRACKER_HPP__
+
+/// ID3DUMemoryTracker, and the size estimates it shares with the pool.
+///
+/// Each counted resource carries a small COM object as private data.
+/// The runtime releases private data together with the resource, so the
+/// object's destructor is where the bytes come off the books, without
+/// wrapping resources or hooking their Release.
+
+#include "ThreadUtils.hpp"
+
+/// Private data key of CMemoryAllocation.
+static const GUID MEMORY_ALLOCATION_KEY =
+  { 0x37C85647, 0x3AEC, 0x4C90, { 0xAE, 0x73, 0xE9, 0xB1, 0x04, 0xAF, 0x66, 0xEC } };
+
+/// Bits per texel; block compressed formats give the bits of a 4x4
+/// block divided by 16. Zero for formats it does not know, which have
+/// no size that could be trusted.
+inline UINT FormatBitsPerPixel(DXGI_FORMAT format)
+{
+  switch(format)
+  {
+  case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+  case DXGI_FORMAT_R32G32B32A32_FLOAT:
+  case DXGI_FORMAT_R32G32B32A32_UINT:
+  case DXGI_FORMAT_R32G32B32A32_SINT:
+    return 128;
+  case DXGI_FORMAT_R32G32B32_TYPELESS:
+  case DXGI_FORMAT_R32G32B32_FLOAT:
+  case DXGI_FORMAT_R32G32B32_UINT:
+  case DXGI_FORMAT_R32G32B32_SINT:
+    return 96;
+  case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+  case DXGI_FORMAT_R16G16B16A16_FLOAT:
+  case DXGI_FORMAT_R16G16B16A16_UNORM:
+  case DXGI_FORMAT_R16G16B16A16_UINT:
+  case DXGI_FORMAT_R16G16B16A16_SNORM:
+  case DXGI_FORMAT_R16G16B16A16_SINT:
+  case DXGI_FORMAT_R32G32_TYPELESS:
+  case DXGI_FORMAT_R32G32_FLOAT:
+  case DXGI_FORMAT_R32G32_UINT:
+  case DXGI_FORMAT_R32G32_SINT:
+  case DXGI_FORMAT_R32G8X24_TYPELESS:
+  case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+  case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
+  case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
+    return 64;
+  case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+  case DXGI_FORMAT_R10G10B10A2_UNORM:
+  case DXGI_FORMAT_R10G10B10A2_UINT:
+  case DXGI_FORMAT_R11G11B10_FLOAT:
+  case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+  case DXGI_FORMAT_R8G8B8A8_UNORM:
+  case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+  case DXGI_FORMAT_R8G8B8A8_UINT:
+  case DXGI_FORMAT_R8G8B8A8_SNORM:
+  case DXGI_FORMAT_R8G8B8A8_SINT:
+  case DXGI_FORMAT_R16G16_TYPELESS:
+  case DXGI_FORMAT_R16G16_FLOAT:
+  case DXGI_FORMAT_R16G16_UNORM:
+  case DXGI_FORMAT_R16G16_UINT:
+  case DXGI_FORMAT_R16G16_SNORM:
+  case DXGI_FORMAT_R16G16_SINT:
+  case DXGI_FORMAT_R32_TYPELESS:
+  case DXGI_FORMAT_D32_FLOAT:
+  case DXGI_FORMAT_R32_FLOAT:
+  case DXGI_FORMAT_R32_UINT:
+  case DXGI_FORMAT_R32_SINT:
+  case DXGI_FORMAT_R24G8_TYPELESS:
+  case DXGI_FORMAT_D24_UNORM_S8_UINT:
+  case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
+  case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
+  case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+  case DXGI_FORMAT_B8G8R8X8_UNORM:
+  case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
+  case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+  case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+  case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+  case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+    return 32;
+  case DXGI_FORMAT_R8G8_TYPELESS:
+  case DXGI_FORMAT_R8G8_UNORM:
+  case DXGI_FORMAT_R8G8_UINT:
+  case DXGI_FORMAT_R8G8_SNORM:
+  case DXGI_FORMAT_R8G8_SINT:
+  case DXGI_FORMAT_R16_TYPELESS:
+  case DXGI_FORMAT_R16_FLOAT:
+  case DXGI_FORMAT_D16_UNORM:
+  case DXGI_FORMAT_R16_UNORM:
+  case DXGI_FORMAT_R16_UINT:
+  case DXGI_FORMAT_R16_SNORM:
+  case DXGI_FORMAT_R16_SINT:
+  case DXGI_FORMAT_B5G6R5_UNORM:
+  case DXGI_FORMAT_B5G5R5A1_UNORM:
+  // Two texels share 32 bits.
+  case DXGI_FORMAT_R8G8_B8G8_UNORM:
+  case DXGI_FORMAT_G8R8_G8B8_UNORM:
+    return 16;
+  case DXGI_FORMAT_R8_TYPELESS:
+  case DXGI_FORMAT_R8_UNORM:
+  case DXGI_FORMAT_R8_UINT:
+  case DXGI_FORMAT_R8_SNORM:
+  case DXGI_FORMAT_R8_SINT:
+  case DXGI_FORMAT_A8_UNORM:
+  case DXGI_FORMAT_BC2_TYPELESS:
+  case DXGI_FORMAT_BC2_UNORM:
+  case DXGI_FORMAT_BC2_UNORM_SRGB:
+  case DXGI_FORMAT_BC3_TYPELESS:
+  case DXGI_FORMAT_BC3_UNORM:
+  case DXGI_FORMAT_BC3_UNORM_SRGB:
+  case DXGI_FORMAT_BC5_TYPELESS:
+  case DXGI_FORMAT_BC5_UNORM:
+  case DXGI_FORMAT_BC5_SNORM:
+  case DXGI_FORMAT_BC6H_TYPELESS:
+  case DXGI_FORMAT_BC6H_UF16:
+  case DXGI_FORMAT_BC6H_SF16:
+  case DXGI_FORMAT_BC7_TYPELESS:
+  case DXGI_FORMAT_BC7_UNORM:
+  case DXGI_FORMAT_BC7_UNORM_SRGB:
+    return 8;
+  case DXGI_FORMAT_BC1_TYPELESS:
+  case DXGI_FORMAT_BC1_UNORM:
+  case DXGI_FORMAT_BC1_UNORM_SRGB:
+  case DXGI_FORMAT_BC4_TYPELESS:
+  case DXGI_FORMAT_BC4_UNORM:
+  case DXGI_FORMAT_BC4_SNORM:
+    return 4;
+  case DXGI_FORMAT_R1_UNORM:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+inline bool FormatIsBlockCompressed(DXGI_FORMAT format)
+{
+  return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM)
+    || (format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+}
+
+inline UINT MipSize(UINT size, UINT mip)
+{
+  size >>= mip;
+  return size ? size : 1;
+}
+
+/// Whole mip chain, every array slice and every sample. Zero
+/// `mipLevels' is the full chain. Mips of block compressed formats take
+/// whole blocks, so the smallest still take 4x4 texels. Formats
+/// FormatBitsPerPixel does not know count as nothing.
+inline UINT64 EstimateTextureBytes(
+  DXGI_FORMAT format,
+  UINT width,
+  UINT height,
+  UINT depth,
+  UINT mipLevels,
+  UINT arraySize,
+  UINT sampleCount)
+{
+  UINT64 texels = 0;
+  bool blocks = FormatIsBlockCompressed(format);
+  for(UINT i = 0; 0 == mipLevels || i < mipLevels; ++i)
+  {
+    if(blocks)
+      texels += (UINT64)((width + 3) & ~3u) * ((height + 3) & ~3u) * depth;
+    else
+      texels += (UINT64)width * height * depth;
+    if(1 == width && 1 == height && 1 == depth)
+      break;
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    depth = depth > 1 ? depth / 2 : 1;
+  }
+  return texels * arraySize * sampleCount * FormatBitsPerPixel(format) / 8;
+}
+
+inline UINT64 EstimateTextureBytes(const D3D11_TEXTURE2D_DESC &d)
+{
+  return EstimateTextureBytes(d.Format, d.Width, d.Height, 1, d.MipLevels, d.ArraySize, d.SampleDesc.Count);
+}
+
+inline D3DU_MEMORY_CATEGORY MemoryCategory(UINT bindFlags, bool texture)
+{
+  if(bindFlags & (D3D11_BIND_RENDER_TARGET | D3D11_BIND_DEPTH_STENCIL))
+    return D3DU_MEMORY_TARGETS;
+  if(bindFlags & D3D11_BIND_CONSTANT_BUFFER)
+    return D3DU_MEMORY_CONSTANTS;
+  if(bindFlags & (D3D11_BIND_VERTEX_BUFFER | D3D11_BIND_INDEX_BUFFER | D3D11_BIND_STREAM_OUTPUT))
+    return D3DU_MEMORY_GEOMETRY;
+  return texture ? D3DU_MEMORY_TEXTURES : D3DU_MEMORY_USER;
+}
+
+/// Size and category of any buffer or texture, from its description.
+inline UINT64 EstimateResourceBytes(ID3D11Resource *resource, D3DU_MEMORY_CATEGORY *oCategory)
+{
+  D3D11_RESOURCE_DIMENSION dimension;
+  resource->GetType(&dimension);
+  switch(dimension)
+  {
+  case D3D11_RESOURCE_DIMENSION_BUFFER:
+    {
+      D3D11_BUFFER_DESC d;
+      static_cast<ID3D11Buffer*>(resource)->GetDesc(&d);
+      *oCategory = MemoryCategory(d.BindFlags, false);
+      return d.ByteWidth;
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+    {
+      D3D11_TEXTURE1D_DESC d;
+      static_cast<ID3D11Texture1D*>(resource)->GetDesc(&d);
+      *oCategory = MemoryCategory(d.BindFlags, true);
+      return EstimateTextureBytes(d.Format, d.Width, 1, 1, d.MipLevels, d.ArraySize, 1);
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+    {
+      D3D11_TEXTURE2D_DESC d;
+      static_cast<ID3D11Texture2D*>(resource)->GetDesc(&d);
+      *oCategory = MemoryCategory(d.BindFlags, true);
+      return EstimateTextureBytes(d);
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+    {
+      D3D11_TEXTURE3D_DESC d;
+      static_cast<ID3D11Texture3D*>(resource)->GetDesc(&d);
+      *oCategory = MemoryCategory(d.BindFlags, true);
+      return EstimateTextureBytes(d.Format, d.Width, d.Height, d.Depth, d.MipLevels, 1, 1);
+    }
+  default:
+    *oCategory = D3DU_MEMORY_USER;
+    return 0;
+  }
+}
+
+class D3DU_NOVTABLE CMemoryTracker :
+  public ID3DUMemoryTracker
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUMemoryTracker)
+  END_INTERFACE_MAP
+
+  CMemoryTracker()
+  {
+    memset((void*)_usage, 0, sizeof(_usage));
+  }
+
+  virtual ~CMemoryTracker() { }
+
+  STDMETHOD(GetStatistics)(D3DU_MEMORY_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    for(UINT i = 0; i <= D3DU_MEMORY_TOTAL; ++i)
+    {
+      const volatile LONGLONG *u = _usage[i];
+      D3DU_MEMORY_USAGE &o = oStats->Usage[i];
+      o.Bytes = (UINT64)Read(u[USAGE_BYTES]);
+      o.HighWater = (UINT64)Read(u[USAGE_HIGH_WATER]);
+      o.Budget = (UINT64)Read(u[USAGE_BUDGET]);
+      o.Allocations = (UINT64)Read(u[USAGE_ALLOCATIONS]);
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(SetBudget)(D3DU_MEMORY_CATEGORY category, UINT64 bytes)
+  {
+    if((UINT)category > D3DU_MEMORY_TOTAL)
+      return E_INVALIDARG;
+    InterlockedExchange64(&_usage[category][USAGE_BUDGET], (LONGLONG)bytes);
+    return S_OK;
+  }
+
+  STDMETHOD(SetMemorySink)(ID3DUMemorySink *sink)
+  {
+    CAutoLock lock(_lock);
+    _sink = sink;
+    return S_OK;
+  }
+
+  STDMETHOD(Track)(ID3D11Resource *resource, D3DU_MEMORY_CATEGORY category)
+  {
+    D3DU_MEMORY_CATEGORY estimated;
+    if(!resource || (UINT)category >= D3DU_MEMORY_TOTAL)
+      return E_INVALIDARG;
+    return Attach(resource, EstimateResourceBytes(resource, &estimated), category);
+  }
+
+  STDMETHOD(ResetHighWater)()
+  {
+    for(UINT i = 0; i <= D3DU_MEMORY_TOTAL; ++i)
+      InterlockedExchange64(&_usage[i][USAGE_HIGH_WATER], Read(_usage[i][USAGE_BYTES]));
+    return S_OK;
+  }
+
+  /// Counts a resource just created through the device, in the
+  /// category its bind flags select. Any thread.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Created(ID3D11Resource *resource)
+  {
+    D3DU_MEMORY_CATEGORY category;
+    UINT64 bytes = EstimateResourceBytes(resource, &category);
+    Attach(resource, bytes, category);
+  }
+
+private:
+  enum
+  {
+    USAGE_BYTES,
+    USAGE_HIGH_WATER,
+    USAGE_BUDGET,
+    USAGE_ALLOCATIONS,
+    USAGE_FIELDS,
+  };
+
+  /// Lives exactly as long as the resource it was attached to.
+  class D3DU_NOVTABLE CMemoryAllocation :
+    public IUnknown
+  {
+  public:
+
+    BEGIN_INTERFACE_MAP
+    END_INTERFACE_MAP
+
+    CMemoryAllocation()
+    {
+      _bytes = 0;
+      _category = D3DU_MEMORY_USER;
+    }
+
+    virtual ~CMemoryAllocation()
+    {
+      if(_tracker)
+        _tracker->Remove(_bytes, _category);
+    }
+
+    void Construct(CMemoryTracker *tracker, UINT64 bytes, D3DU_MEMORY_CATEGORY category)
+    {
+      _tracker = tracker;
+      _bytes = bytes;
+      _category = category;
+      _tracker->Add(_bytes, _category);
+    }
+
+  private:
+    ComPtr<CMemoryTracker> _tracker;
+    UINT64 _bytes;
+    D3DU_MEMORY_CATEGORY _category;
+  };
+
+  volatile LONGLONG _usage[D3DU_MEMORY_TOTAL + 1][USAGE_FIELDS];
+  CLock _lock;
+  ComPtr<ID3DUMemorySink> _sink;
+
+  static LONGLONG Read(const volatile LONGLONG &value)
+  {
+    return InterlockedCompareExchange64((volatile LONGLONG*)&value, 0, 0);
+  }
+
+  /// The private data holds the only reference to the allocation, and
+  /// replacing it frees whatever was counted for the resource before.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Attach(
+    ID3D11Resource *resource,
+    UINT64 bytes,
+    D3DU_MEMORY_CATEGORY category)
+  {
+    ComPtr<ComObject<CMemoryAllocation> > allocation = new ComObject<CMemoryAllocation>();
+    allocation->Construct(this, bytes, category);
+    return resource->SetPrivateDataInterface(MEMORY_ALLOCATION_KEY, allocation);
+  }
+
+  void Add(UINT64 bytes, D3DU_MEMORY_CATEGORY category)
+  {
+    Account(category, bytes);
+    Account(D3DU_MEMORY_TOTAL, bytes);
+  }
+
+  void Remove(UINT64 bytes, D3DU_MEMORY_CATEGORY category)
+  {
+    InterlockedExchangeAdd64(&_usage[category][USAGE_BYTES], -(LONGLONG)bytes);
+    InterlockedDecrement64(&_usage[category][USAGE_ALLOCATIONS]);
+    InterlockedExchangeAdd64(&_usage[D3DU_MEMORY_TOTAL][USAGE_BYTES], -(LONGLONG)bytes);
+    InterlockedDecrement64(&_usage[D3DU_MEMORY_TOTAL][USAGE_ALLOCATIONS]);
+  }
+
+  void Account(D3DU_MEMORY_CATEGORY category, UINT64 bytes)
+  {
+    volatile LONGLONG *u = _usage[category];
+    LONGLONG after = InterlockedExchangeAdd64(&u[USAGE_BYTES], (LONGLONG)bytes) + (LONGLONG)bytes;
+    InterlockedIncrement64(&u[USAGE_ALLOCATIONS]);
+    LONGLONG high = Read(u[USAGE_HIGH_WATER]);
+    while(after > high)
+    {
+      LONGLONG seen = InterlockedCompareExchange64(&u[USAGE_HIGH_WATER], after, high);
+      if(seen == high)
+        break;
+      high = seen;
+    }
+    LONGLONG budget = Read(u[USAGE_BUDGET]);
+    if(budget && after > budget && after - (LONGLONG)bytes <= budget)
+      Exceeded(category);
+  }
+
+  void Exceeded(D3DU_MEMORY_CATEGORY category)
+  {
+    ComPtr<ID3DUMemorySink> sink;
+    D3DU_MEMORY_STATISTICS stats;
+    {
+      CAutoLock lock(_lock);
+      sink = _sink;
+    }
+    if(!sink)
+      return;
+    GetStatistics(&stats);
+    sink->BudgetExceeded(this, category, &stats.Usage[category]);
+  }
+};
+
+#endif // __MEMORY_TRACKER_HPP__
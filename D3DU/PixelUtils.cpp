@@ -0,0 +1,344 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "PixelUtils.hpp"
+#include <emmintrin.h>
+
+// BT.601 coefficients in 8.8 fixed point.
+#define Y_R 66
+#define Y_G 129
+#define Y_B 25
+#define U_R -38
+#define U_G -74
+#define U_B 112
+#define V_R 112
+#define V_G -94
+#define V_B -18
+
+/// Pixels PixelCompare sums in 32-bit lanes before widening.
+#define PIXEL_COMPARE_CHUNK 4096
+
+static inline BYTE LumaOf(INT r, INT g, INT b)
+{
+  return (BYTE)(((Y_R*r + Y_G*g + Y_B*b + 128) >> 8) + 16);
+}
+
+static inline BYTE BlueDiffOf(INT r, INT g, INT b)
+{
+  return (BYTE)(((U_R*r + U_G*g + U_B*b + 128) >> 8) + 128);
+}
+
+static inline BYTE RedDiffOf(INT r, INT g, INT b)
+{
+  return (BYTE)(((V_R*r + V_G*g + V_B*b + 128) >> 8) + 128);
+}
+
+static inline __m128i Coefficients(INT r, INT g, INT b, BOOL bgra)
+{
+  return bgra
+    ? _mm_setr_epi16((SHORT)b, (SHORT)g, (SHORT)r, 0, (SHORT)b, (SHORT)g, (SHORT)r, 0)
+    : _mm_setr_epi16((SHORT)r, (SHORT)g, (SHORT)b, 0, (SHORT)r, (SHORT)g, (SHORT)b, 0);
+}
+
+/// Dot product of four pixels with coefficients,
+/// rounded and biased, as four 32-bit integers.
+static inline __m128i Dot4(__m128i px, __m128i k, __m128i bias)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), k);
+  __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), k);
+  lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+  hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+  lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+  hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+  __m128i v = _mm_unpacklo_epi64(lo, hi);
+  v = _mm_srai_epi32(_mm_add_epi32(v, _mm_set1_epi32(128)), 8);
+  return _mm_add_epi32(v, bias);
+}
+
+/// Sixteen pixels into sixteen bytes of one channel.
+static inline __m128i Dot16(const BYTE *src, __m128i k, __m128i bias)
+{
+  const __m128i *p = (const __m128i*)src;
+  __m128i a = _mm_packs_epi32(
+    Dot4(_mm_loadu_si128(p), k, bias),
+    Dot4(_mm_loadu_si128(p + 1), k, bias));
+  __m128i b = _mm_packs_epi32(
+    Dot4(_mm_loadu_si128(p + 2), k, bias),
+    Dot4(_mm_loadu_si128(p + 3), k, bias));
+  return _mm_packus_epi16(a, b);
+}
+
+/// Averages 2x2 blocks of eight pixels from two rows into four pixels.
+static inline __m128i Average2x2(const BYTE *row0, const BYTE *row1)
+{
+  __m128i v0 = _mm_avg_epu8(
+    _mm_loadu_si128((const __m128i*)row0),
+    _mm_loadu_si128((const __m128i*)row1));
+  __m128i v1 = _mm_avg_epu8(
+    _mm_loadu_si128((const __m128i*)row0 + 1),
+    _mm_loadu_si128((const __m128i*)row1 + 1));
+  __m128i h0 = _mm_avg_epu8(
+    _mm_shuffle_epi32(v0, _MM_SHUFFLE(2, 0, 2, 0)),
+    _mm_shuffle_epi32(v0, _MM_SHUFFLE(3, 1, 3, 1)));
+  __m128i h1 = _mm_avg_epu8(
+    _mm_shuffle_epi32(v1, _MM_SHUFFLE(2, 0, 2, 0)),
+    _mm_shuffle_epi32(v1, _MM_SHUFFLE(3, 1, 3, 1)));
+  return _mm_unpacklo_epi64(h0, h1);
+}
+
+static inline void Unpack(const BYTE *px, BOOL bgra, INT *r, INT *g, INT *b)
+{
+  *r = bgra ? px[2] : px[0];
+  *g = px[1];
+  *b = bgra ? px[0] : px[2];
+}
+
+SIZE_T PixelFrameSize(D3DU_CAPTURE_FORMAT format, UINT width, UINT height)
+{
+  SIZE_T size = (SIZE_T)width * height;
+  switch(format)
+  {
+  case D3DU_CAPTURE_RAW_RGBA:
+  case D3DU_CAPTURE_RAW_BGRA:
+    return size * 4;
+  case D3DU_CAPTURE_RAW_I420:
+  case D3DU_CAPTURE_Y4M_I420:
+    return size + 2 * (SIZE_T)((width + 1) / 2) * ((height + 1) / 2);
+  case D3DU_CAPTURE_Y4M_444:
+    return size * 3;
+  default:
+    return 0;
+  }
+}
+
+void PixelCopyRgba(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra)
+{
+  if(bgra)
+  {
+    PixelCopyBgra(dst, src, srcPitch, width, height, FALSE);
+    return;
+  }
+  for(UINT y = 0; y < height; ++y)
+  {
+    memcpy(dst, src, width * 4);
+    dst += width * 4;
+    src += srcPitch;
+  }
+}
+
+void PixelCopyBgra(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra)
+{
+  if(bgra)
+  {
+    PixelCopyRgba(dst, src, srcPitch, width, height, FALSE);
+    return;
+  }
+  __m128i ag = _mm_set1_epi32(0xFF00FF00);
+  __m128i lo = _mm_set1_epi32(0x000000FF);
+  for(UINT y = 0; y < height; ++y)
+  {
+    UINT x = 0;
+    for(; x + 4 <= width; x += 4)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src + x * 4));
+      __m128i r = _mm_or_si128(
+        _mm_and_si128(v, ag),
+        _mm_or_si128(
+          _mm_and_si128(_mm_srli_epi32(v, 16), lo),
+          _mm_slli_epi32(_mm_and_si128(v, lo), 16)));
+      _mm_storeu_si128((__m128i*)(dst + x * 4), r);
+    }
+    for(; x < width; ++x)
+    {
+      dst[x * 4 + 0] = src[x * 4 + 2];
+      dst[x * 4 + 1] = src[x * 4 + 1];
+      dst[x * 4 + 2] = src[x * 4 + 0];
+      dst[x * 4 + 3] = src[x * 4 + 3];
+    }
+    dst += width * 4;
+    src += srcPitch;
+  }
+}
+
+void PixelConvertI420(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra)
+{
+  UINT cw = (width + 1) / 2;
+  UINT ch = (height + 1) / 2;
+  BYTE *py = dst;
+  BYTE *pu = py + (SIZE_T)width * height;
+  BYTE *pv = pu + (SIZE_T)cw * ch;
+  __m128i ky = Coefficients(Y_R, Y_G, Y_B, bgra);
+  __m128i ku = Coefficients(U_R, U_G, U_B, bgra);
+  __m128i kv = Coefficients(V_R, V_G, V_B, bgra);
+  __m128i lumaBias = _mm_set1_epi32(16);
+  __m128i chromaBias = _mm_set1_epi32(128);
+  INT r, g, b;
+  for(UINT y = 0; y < height; ++y)
+  {
+    const BYTE *row = src + (SIZE_T)y * srcPitch;
+    BYTE *out = py + (SIZE_T)y * width;
+    UINT x = 0;
+    for(; x + 16 <= width; x += 16)
+      _mm_storeu_si128((__m128i*)(out + x), Dot16(row + x * 4, ky, lumaBias));
+    for(; x < width; ++x)
+    {
+      Unpack(row + x * 4, bgra, &r, &g, &b);
+      out[x] = LumaOf(r, g, b);
+    }
+  }
+  for(UINT y = 0; y < ch; ++y)
+  {
+    const BYTE *row0 = src + (SIZE_T)(2 * y) * srcPitch;
+    const BYTE *row1 = 2 * y + 1 < height ? row0 + srcPitch : row0;
+    BYTE *outU = pu + (SIZE_T)y * cw;
+    BYTE *outV = pv + (SIZE_T)y * cw;
+    UINT x = 0;
+    for(; 2 * x + 16 <= width; x += 8)
+    {
+      __m128i q0 = Average2x2(row0 + x * 8, row1 + x * 8);
+      __m128i q1 = Average2x2(row0 + x * 8 + 32, row1 + x * 8 + 32);
+      __m128i u = _mm_packs_epi32(Dot4(q0, ku, chromaBias), Dot4(q1, ku, chromaBias));
+      __m128i v = _mm_packs_epi32(Dot4(q0, kv, chromaBias), Dot4(q1, kv, chromaBias));
+      _mm_storel_epi64((__m128i*)(outU + x), _mm_packus_epi16(u, u));
+      _mm_storel_epi64((__m128i*)(outV + x), _mm_packus_epi16(v, v));
+    }
+    for(; x < cw; ++x)
+    {
+      UINT x0 = 2 * x;
+      UINT x1 = x0 + 1 < width ? x0 + 1 : x0;
+      INT sr = 0, sg = 0, sb = 0;
+      Unpack(row0 + x0 * 4, bgra, &r, &g, &b); sr += r; sg += g; sb += b;
+      Unpack(row0 + x1 * 4, bgra, &r, &g, &b); sr += r; sg += g; sb += b;
+      Unpack(row1 + x0 * 4, bgra, &r, &g, &b); sr += r; sg += g; sb += b;
+      Unpack(row1 + x1 * 4, bgra, &r, &g, &b); sr += r; sg += g; sb += b;
+      sr = (sr + 2) / 4;
+      sg = (sg + 2) / 4;
+      sb = (sb + 2) / 4;
+      outU[x] = BlueDiffOf(sr, sg, sb);
+      outV[x] = RedDiffOf(sr, sg, sb);
+    }
+  }
+}
+
+void PixelConvertYuv444(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra)
+{
+  SIZE_T plane = (SIZE_T)width * height;
+  __m128i ky = Coefficients(Y_R, Y_G, Y_B, bgra);
+  __m128i ku = Coefficients(U_R, U_G, U_B, bgra);
+  __m128i kv = Coefficients(V_R, V_G, V_B, bgra);
+  __m128i lumaBias = _mm_set1_epi32(16);
+  __m128i chromaBias = _mm_set1_epi32(128);
+  INT r, g, b;
+  for(UINT y = 0; y < height; ++y)
+  {
+    const BYTE *row = src + (SIZE_T)y * srcPitch;
+    BYTE *outY = dst + (SIZE_T)y * width;
+    BYTE *outU = outY + plane;
+    BYTE *outV = outU + plane;
+    UINT x = 0;
+    for(; x + 16 <= width; x += 16)
+    {
+      _mm_storeu_si128((__m128i*)(outY + x), Dot16(row + x * 4, ky, lumaBias));
+      _mm_storeu_si128((__m128i*)(outU + x), Dot16(row + x * 4, ku, chromaBias));
+      _mm_storeu_si128((__m128i*)(outV + x), Dot16(row + x * 4, kv, chromaBias));
+    }
+    for(; x < width; ++x)
+    {
+      Unpack(row + x * 4, bgra, &r, &g, &b);
+      outY[x] = LumaOf(r, g, b);
+      outU[x] = BlueDiffOf(r, g, b);
+      outV[x] = RedDiffOf(r, g, b);
+    }
+  }
+}
+
+void PixelConvert(D3DU_CAPTURE_FORMAT format, BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra)
+{
+  switch(format)
+  {
+  case D3DU_CAPTURE_RAW_RGBA:
+    PixelCopyRgba(dst, src, srcPitch, width, height, bgra);
+    break;
+  case D3DU_CAPTURE_RAW_BGRA:
+    PixelCopyBgra(dst, src, srcPitch, width, height, bgra);
+    break;
+  case D3DU_CAPTURE_RAW_I420:
+  case D3DU_CAPTURE_Y4M_I420:
+    PixelConvertI420(dst, src, srcPitch, width, height, bgra);
+    break;
+  case D3DU_CAPTURE_Y4M_444:
+    PixelConvertYuv444(dst, src, srcPitch, width, height, bgra);
+    break;
+  }
+}
+
+void PixelCompare(const BYTE *a, const BYTE *b, SIZE_T count, UINT64 *oSquares, UINT *oMaxError)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i mask = _mm_set1_epi32(0x00FFFFFF);
+  __m128i peak = zero;
+  UINT64 squares = 0;
+  UINT maxError = 0;
+  SIZE_T i = 0;
+  while(count - i >= 4)
+  {
+    // Each step adds at most 4 * 255^2 to a lane, which keeps
+    // a whole chunk within 32 bits.
+    SIZE_T end = count - i > PIXEL_COMPARE_CHUNK ? i + PIXEL_COMPARE_CHUNK : count;
+    __m128i sum = zero;
+    for(; end - i >= 4; i += 4)
+    {
+      __m128i pa = _mm_and_si128(_mm_loadu_si128((const __m128i*)(a + i * 4)), mask);
+      __m128i pb = _mm_and_si128(_mm_loadu_si128((const __m128i*)(b + i * 4)), mask);
+      __m128i d = _mm_or_si128(_mm_subs_epu8(pa, pb), _mm_subs_epu8(pb, pa));
+      __m128i lo = _mm_unpacklo_epi8(d, zero);
+      __m128i hi = _mm_unpackhi_epi8(d, zero);
+      peak = _mm_max_epu8(peak, d);
+      sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+    UINT lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, sum);
+    squares += (UINT64)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  }
+  BYTE peaks[16];
+  _mm_storeu_si128((__m128i*)peaks, peak);
+  for(UINT k = 0; k < 16; ++k)
+  {
+    if(peaks[k] > maxError)
+      maxError = peaks[k];
+  }
+  for(; i < count; ++i)
+  {
+    for(UINT c = 0; c < 3; ++c)
+    {
+      INT d = abs((INT)a[i * 4 + c] - (INT)b[i * 4 + c]);
+      squares += (UINT64)(d * d);
+      if((UINT)d > maxError)
+        maxError = (UINT)d;
+    }
+  }
+  *oSquares = squares;
+  *oMaxError = maxError;
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __PIXEL_UTILS_HPP__
+#define __PIXEL_UTILS_HPP__
+
+/// Pixel format conversions used by frame readback.
+/// Source is always 32bpp RGBA (or BGRA, when `bgra' is set),
+/// destination rows are tightly packed.
+
+/// Returns size of a converted frame in bytes.
+SIZE_T PixelFrameSize(D3DU_CAPTURE_FORMAT format, UINT width, UINT height);
+
+void PixelCopyRgba(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra);
+void PixelCopyBgra(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra);
+/// BT.601 studio swing, chroma sited at the center of 2x2 block.
+void PixelConvertI420(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra);
+/// BT.601 studio swing, planar Y, U, V.
+void PixelConvertYuv444(BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra);
+
+/// Converts a frame according to capture format.
+void PixelConvert(D3DU_CAPTURE_FORMAT format, BYTE *dst, const BYTE *src, UINT srcPitch, UINT width, UINT height, BOOL bgra);
+
+/// Sum of squared channel differences between two tightly packed
+/// 32bpp frames of `count' pixels, and the largest difference.
+/// The fourth channel, alpha in both layouts, is left out.
+void PixelCompare(const BYTE *a, const BYTE *b, SIZE_T count, UINT64 *oSquares, UINT *oMaxError);
+
+#endif // __PIXEL_UTILS_HPP__
@@ -0,0 +1,271 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __READBACK_HPP__
+#define __READBACK_HPP__
+
+#include "LockFree.hpp"
+
+#define D3DU_READBACK_MAX_SLOTS 16
+
+/// Pipelined GPU->CPU frame copy.
+/// Frames are copied into a ring of staging textures and mapped only
+/// after the GPU is done with them, so the render thread never waits
+/// for the copy it has just issued. A mapped frame may be handed to
+/// another thread, which calls Release() when it no longer needs it.
+class CFrameReadback
+{
+public:
+  typedef struct
+  {
+    UINT Slot;
+    const BYTE *Data;
+    UINT RowPitch;
+    UINT Width;
+    UINT Height;
+    DXGI_FORMAT Format;
+    UINT64 Sequence;
+  } Frame;
+
+  CFrameReadback()
+  {
+    _slotCount = 0;
+    _next = 0;
+    _mapNext = 0;
+    _sequence = 0;
+    memset(&_desc, 0, sizeof(_desc));
+  }
+
+  HRESULT Init(UINT slotCount)
+  {
+    if(slotCount < 2 || slotCount > D3DU_READBACK_MAX_SLOTS)
+      return E_INVALIDARG;
+    _slotCount = slotCount;
+    for(UINT i = 0; i < _slotCount; ++i)
+    {
+      _slots[i].State = SLOT_FREE;
+      _slots[i].Sequence = 0;
+    }
+    return S_OK;
+  }
+
+  static BOOL IsSupportedFormat(DXGI_FORMAT format)
+  {
+    switch(format)
+    {
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+  }
+
+  static BOOL IsBgra(DXGI_FORMAT format)
+  {
+    return DXGI_FORMAT_B8G8R8A8_UNORM == format
+      || DXGI_FORMAT_B8G8R8A8_UNORM_SRGB == format;
+  }
+
+  /// Issues a copy of `source' into the next staging slot.
+  /// Returns S_FALSE when the frame was dropped because the slot is still in use.
+  HRESULT Push(ID3D11Device *device, ID3D11DeviceContext *dc, ID3D11Texture2D *source)
+  {
+    HRESULT hr;
+    D3D11_TEXTURE2D_DESC td;
+    source->GetDesc(&td);
+    if(!IsSupportedFormat(td.Format))
+      return E_INVALIDARG;
+    if(td.Width != _desc.Width
+      || td.Height != _desc.Height
+      || td.Format != _desc.Format
+      || td.SampleDesc.Count != _desc.SampleDesc.Count)
+    {
+      if(!IsIdle())
+        return S_FALSE;
+      hr = Recreate(device, td);
+      if(FAILED(hr))
+        return hr;
+    }
+    Slot& slot = _slots[_next];
+    if(SLOT_FREE != LfLoadAcquire(&slot.State))
+      return S_FALSE;
+    if(td.SampleDesc.Count > 1)
+    {
+      dc->ResolveSubresource(_resolve, 0, source, 0, td.Format);
+      dc->CopyResource(slot.Texture, _resolve);
+    }
+    else
+    {
+      dc->CopyResource(slot.Texture, source);
+    }
+    slot.Sequence = _sequence++;
+    slot.State = SLOT_COPIED;
+    _next = (_next + 1) % _slotCount;
+    return S_OK;
+  }
+
+  /// Maps the oldest copied frame.
+  /// Returns S_FALSE when there is nothing to map or, unless `wait' is set,
+  /// when the GPU has not finished the copy yet. A copy which fails to map
+  /// is dropped, so that the next call moves on to the one after it.
+  HRESULT Map(ID3D11DeviceContext *dc, BOOL wait, Frame *oFrame)
+  {
+    HRESULT hr;
+    Slot& slot = _slots[_mapNext];
+    if(SLOT_COPIED != slot.State)
+      return S_FALSE;
+    hr = dc->Map(slot.Texture, 0, D3D11_MAP_READ, wait ? 0 : D3D11_MAP_FLAG_DO_NOT_WAIT, &slot.Mapped);
+    if(DXGI_ERROR_WAS_STILL_DRAWING == hr)
+      return S_FALSE;
+    if(FAILED(hr))
+    {
+      slot.State = SLOT_FREE;
+      _mapNext = (_mapNext + 1) % _slotCount;
+      return hr;
+    }
+    slot.State = SLOT_MAPPED;
+    oFrame->Slot = _mapNext;
+    oFrame->Data = (const BYTE*)slot.Mapped.pData;
+    oFrame->RowPitch = slot.Mapped.RowPitch;
+    oFrame->Width = _desc.Width;
+    oFrame->Height = _desc.Height;
+    oFrame->Format = _desc.Format;
+    oFrame->Sequence = slot.Sequence;
+    _mapNext = (_mapNext + 1) % _slotCount;
+    return S_OK;
+  }
+
+  /// May be called from any thread.
+  void Release(UINT slot)
+  {
+    LfStoreRelease(&_slots[slot].State, (LONG)SLOT_DONE);
+  }
+
+  /// Unmaps released frames. Must be called on the thread owning `dc'.
+  void Reclaim(ID3D11DeviceContext *dc)
+  {
+    for(UINT i = 0; i < _slotCount; ++i)
+    {
+      if(SLOT_DONE == LfLoadAcquire(&_slots[i].State))
+      {
+        dc->Unmap(_slots[i].Texture, 0);
+        _slots[i].State = SLOT_FREE;
+      }
+    }
+  }
+
+  BOOL HasCopies() const
+  {
+    return SLOT_COPIED == _slots[_mapNext].State;
+  }
+
+  BOOL IsIdle() const
+  {
+    for(UINT i = 0; i < _slotCount; ++i)
+      if(SLOT_FREE != LfLoadAcquire(&_slots[i].State))
+        return FALSE;
+    return TRUE;
+  }
+
+  /// Drops copies which were not mapped yet and frees the staging ring.
+  /// Every mapped frame must have been released before.
+  void Reset(ID3D11DeviceContext *dc)
+  {
+    Reclaim(dc);
+    for(UINT i = 0; i < _slotCount; ++i)
+    {
+      _slots[i].State = SLOT_FREE;
+      _slots[i].Texture.Release();
+    }
+    _resolve.Release();
+    _next = 0;
+    _mapNext = 0;
+    memset(&_desc, 0, sizeof(_desc));
+  }
+
+private:
+  enum
+  {
+    SLOT_FREE,
+    SLOT_COPIED,
+    SLOT_MAPPED,
+    SLOT_DONE,
+  };
+
+  typedef struct
+  {
+    ComPtr<ID3D11Texture2D> Texture;
+    volatile LONG State;
+    UINT64 Sequence;
+    D3D11_MAPPED_SUBRESOURCE Mapped;
+  } Slot;
+
+  HRESULT Recreate(ID3D11Device *device, const D3D11_TEXTURE2D_DESC& source)
+  {
+    HRESULT hr;
+    D3D11_TEXTURE2D_DESC td;
+    memset(&td, 0, sizeof(td));
+    td.Width = source.Width;
+    td.Height = source.Height;
+    td.Format = source.Format;
+    td.MipLevels = 1;
+    td.ArraySize = 1;
+    td.SampleDesc.Count = 1;
+    _resolve.Release();
+    if(source.SampleDesc.Count > 1)
+    {
+      td.Usage = D3D11_USAGE_DEFAULT;
+      hr = device->CreateTexture2D(&td, NULL, &_resolve);
+      if(FAILED(hr))
+        return hr;
+    }
+    td.Usage = D3D11_USAGE_STAGING;
+    td.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    for(UINT i = 0; i < _slotCount; ++i)
+    {
+      _slots[i].Texture.Release();
+      hr = device->CreateTexture2D(&td, NULL, &_slots[i].Texture);
+      if(FAILED(hr))
+      {
+        memset(&_desc, 0, sizeof(_desc));
+        return hr;
+      }
+    }
+    _desc = source;
+    _next = 0;
+    _mapNext = 0;
+    return S_OK;
+  }
+
+  Slot _slots[D3DU_READBACK_MAX_SLOTS];
+  UINT _slotCount;
+  UINT _next;
+  UINT _mapNext;
+  UINT64 _sequence;
+  D3D11_TEXTURE2D_DESC _desc;
+  ComPtr<ID3D11Texture2D> _resolve;
+};
+
+#endif // __READBACK_HPP__
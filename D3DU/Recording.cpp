@@ -0,0 +1,1938 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "Recording.hpp"
+#include "FrameStats.hpp"
+#include "Log.hpp"
+
+/// Largest object or context number a replay accepts.
+#define REPLAY_MAX_ID (1u << 24)
+/// Frames the replay lets the device fall behind, as a swap chain would.
+#define REPLAY_FRAME_LATENCY 3
+#define REPLAY_MAX_SEMANTIC 64
+
+/// What the log says of a buffer or texture. Buffers have a width in
+/// bytes and an unknown format.
+typedef struct
+{
+  DXGI_FORMAT Format;
+  UINT Width;
+  UINT Height;
+  UINT Depth;
+  UINT MipLevels;
+  UINT ArraySize;
+  UINT SampleCount;
+  UINT BindFlags;
+  D3D11_USAGE Usage;
+} RecordResourceDesc;
+
+static void DescOf(const D3D11_BUFFER_DESC &d, RecordResourceDesc *oDesc)
+{
+  oDesc->Format = DXGI_FORMAT_UNKNOWN;
+  oDesc->Width = d.ByteWidth;
+  oDesc->Height = 1;
+  oDesc->Depth = 1;
+  oDesc->MipLevels = 1;
+  oDesc->ArraySize = 1;
+  oDesc->SampleCount = 1;
+  oDesc->BindFlags = d.BindFlags;
+  oDesc->Usage = d.Usage;
+}
+
+static void DescOf(const D3D11_TEXTURE1D_DESC &d, RecordResourceDesc *oDesc)
+{
+  oDesc->Format = d.Format;
+  oDesc->Width = d.Width;
+  oDesc->Height = 1;
+  oDesc->Depth = 1;
+  oDesc->MipLevels = d.MipLevels;
+  oDesc->ArraySize = d.ArraySize;
+  oDesc->SampleCount = 1;
+  oDesc->BindFlags = d.BindFlags;
+  oDesc->Usage = d.Usage;
+}
+
+static void DescOf(const D3D11_TEXTURE2D_DESC &d, RecordResourceDesc *oDesc)
+{
+  oDesc->Format = d.Format;
+  oDesc->Width = d.Width;
+  oDesc->Height = d.Height;
+  oDesc->Depth = 1;
+  oDesc->MipLevels = d.MipLevels;
+  oDesc->ArraySize = d.ArraySize;
+  oDesc->SampleCount = d.SampleDesc.Count;
+  oDesc->BindFlags = d.BindFlags;
+  oDesc->Usage = d.Usage;
+}
+
+static void DescOf(const D3D11_TEXTURE3D_DESC &d, RecordResourceDesc *oDesc)
+{
+  oDesc->Format = d.Format;
+  oDesc->Width = d.Width;
+  oDesc->Height = d.Height;
+  oDesc->Depth = d.Depth;
+  oDesc->MipLevels = d.MipLevels;
+  oDesc->ArraySize = 1;
+  oDesc->SampleCount = 1;
+  oDesc->BindFlags = d.BindFlags;
+  oDesc->Usage = d.Usage;
+}
+
+static bool ResourceDesc(ID3D11Resource *resource, RecordResourceDesc *oDesc)
+{
+  D3D11_RESOURCE_DIMENSION dimension;
+  resource->GetType(&dimension);
+  switch(dimension)
+  {
+  case D3D11_RESOURCE_DIMENSION_BUFFER:
+    {
+      D3D11_BUFFER_DESC d;
+      static_cast<ID3D11Buffer*>(resource)->GetDesc(&d);
+      DescOf(d, oDesc);
+    }
+    return true;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+    {
+      D3D11_TEXTURE1D_DESC d;
+      static_cast<ID3D11Texture1D*>(resource)->GetDesc(&d);
+      DescOf(d, oDesc);
+    }
+    return true;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+    {
+      D3D11_TEXTURE2D_DESC d;
+      static_cast<ID3D11Texture2D*>(resource)->GetDesc(&d);
+      DescOf(d, oDesc);
+    }
+    return true;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+    {
+      D3D11_TEXTURE3D_DESC d;
+      static_cast<ID3D11Texture3D*>(resource)->GetDesc(&d);
+      DescOf(d, oDesc);
+    }
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// False for subresources or boxes out of range.
+static bool SubresourceLayout(const RecordResourceDesc &desc, UINT subresource, const D3D11_BOX *box, RecordLayout *oLayout)
+{
+  if(!desc.MipLevels || subresource >= desc.MipLevels * desc.ArraySize)
+    return false;
+  if(box && (box->right < box->left || box->bottom < box->top || box->back < box->front))
+    return false;
+  UINT mip = subresource % desc.MipLevels;
+  UINT width = box ? box->right - box->left : MipSize(desc.Width, mip);
+  UINT height = box ? box->bottom - box->top : MipSize(desc.Height, mip);
+  UINT depth = box ? box->back - box->front : MipSize(desc.Depth, mip);
+  if(DXGI_FORMAT_UNKNOWN == desc.Format)
+  {
+    oLayout->RowBytes = width;
+    oLayout->Rows = 1;
+    oLayout->Slices = 1;
+    return true;
+  }
+  return RecordLayoutOf(desc.Format, width, height, depth, oLayout);
+}
+
+bool RecordSubresourceLayout(ID3D11Resource *resource, UINT subresource, const D3D11_BOX *box, RecordLayout *oLayout)
+{
+  RecordResourceDesc desc;
+  return ResourceDesc(resource, &desc) && SubresourceLayout(desc, subresource, box, oLayout);
+}
+
+UINT RecordSubresourceCount(ID3D11Resource *resource)
+{
+  RecordResourceDesc desc;
+  return ResourceDesc(resource, &desc) ? desc.MipLevels * desc.ArraySize : 0;
+}
+
+/// False for formats whose rows RecordLayoutOf cannot size.
+static bool HasLayout(const RecordResourceDesc &desc)
+{
+  return DXGI_FORMAT_UNKNOWN == desc.Format || FormatBitsPerPixel(desc.Format);
+}
+
+/// Contents of resources the replay cannot write, or the recorder
+/// cannot copy or lay out, are left out.
+static bool HasContents(const RecordResourceDesc &desc)
+{
+  return 1 == desc.SampleCount && !(desc.BindFlags & D3D11_BIND_DEPTH_STENCIL) && HasLayout(desc);
+}
+
+template<class D>
+static void MakeStaging(D *desc)
+{
+  desc->Usage = D3D11_USAGE_STAGING;
+  desc->BindFlags = 0;
+  desc->CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  desc->MiscFlags = 0;
+}
+
+/// An empty resource like `resource' the CPU can read.
+static HRESULT CreateStaging(ID3D11Device *device, ID3D11Resource *resource, ID3D11Resource **oStaging)
+{
+  D3D11_RESOURCE_DIMENSION dimension;
+  resource->GetType(&dimension);
+  switch(dimension)
+  {
+  case D3D11_RESOURCE_DIMENSION_BUFFER:
+    {
+      D3D11_BUFFER_DESC d;
+      static_cast<ID3D11Buffer*>(resource)->GetDesc(&d);
+      MakeStaging(&d);
+      d.StructureByteStride = 0;
+      return device->CreateBuffer(&d, NULL, (ID3D11Buffer**)oStaging);
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+    {
+      D3D11_TEXTURE1D_DESC d;
+      static_cast<ID3D11Texture1D*>(resource)->GetDesc(&d);
+      MakeStaging(&d);
+      return device->CreateTexture1D(&d, NULL, (ID3D11Texture1D**)oStaging);
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+    {
+      D3D11_TEXTURE2D_DESC d;
+      static_cast<ID3D11Texture2D*>(resource)->GetDesc(&d);
+      MakeStaging(&d);
+      return device->CreateTexture2D(&d, NULL, (ID3D11Texture2D**)oStaging);
+    }
+  case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+    {
+      D3D11_TEXTURE3D_DESC d;
+      static_cast<ID3D11Texture3D*>(resource)->GetDesc(&d);
+      MakeStaging(&d);
+      return device->CreateTexture3D(&d, NULL, (ID3D11Texture3D**)oStaging);
+    }
+  default:
+    return E_INVALIDARG;
+  }
+}
+
+template<class T>
+static bool Implements(IUnknown *object)
+{
+  ComPtr<T> p;
+  return SUCCEEDED(object->QueryInterface(__uuidof(T), (void**)&p));
+}
+
+/// Puts the description of `object' if it is a T.
+template<class T, class D>
+static bool PutDesc(ID3D11DeviceChild *object, CRecordBuffer &buffer)
+{
+  ComPtr<T> p;
+  if(FAILED(object->QueryInterface(__uuidof(T), (void**)&p)))
+    return false;
+  D desc;
+  p->GetDesc(&desc);
+  buffer.Put(desc);
+  return true;
+}
+
+static bool ShaderStage(ID3D11DeviceChild *object, UINT *oStage)
+{
+  if(Implements<ID3D11VertexShader>(object))
+    *oStage = D3DU_STAGE_VS;
+  else if(Implements<ID3D11HullShader>(object))
+    *oStage = D3DU_STAGE_HS;
+  else if(Implements<ID3D11DomainShader>(object))
+    *oStage = D3DU_STAGE_DS;
+  else if(Implements<ID3D11GeometryShader>(object))
+    *oStage = D3DU_STAGE_GS;
+  else if(Implements<ID3D11PixelShader>(object))
+    *oStage = D3DU_STAGE_PS;
+  else if(Implements<ID3D11ComputeShader>(object))
+    *oStage = D3DU_STAGE_CS;
+  else
+    return false;
+  return true;
+}
+
+CCommandRecorder::CCommandRecorder()
+{
+  _active = 0;
+  _file = INVALID_HANDLE_VALUE;
+  _buffer = NULL;
+  _used = 0;
+  _result = S_OK;
+  _session = 0;
+  _objects = 0;
+  _contexts = 0;
+  _op = 0;
+  _context = 0;
+}
+
+CCommandRecorder::~CCommandRecorder()
+{
+  Stop();
+}
+
+HRESULT CCommandRecorder::Start(LPCWSTR filename, D3D_FEATURE_LEVEL featureLevel)
+{
+  CAutoLock lock(_lock);
+  if(IsOpen())
+    return HRESULT_FROM_WIN32(ERROR_BUSY);
+  _file = CreateFile(
+    filename,
+    GENERIC_WRITE,
+    FILE_SHARE_READ,
+    NULL,
+    CREATE_ALWAYS,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    NULL);
+  if(!IsOpen())
+    return HRESULT_FROM_WIN32(GetLastError());
+  _buffer = new BYTE[RECORD_WRITE_SIZE];
+  _used = 0;
+  _result = S_OK;
+  // Numbers given by earlier recordings no longer count.
+  ++_session;
+  _objects = 0;
+  _contexts = 0;
+  RecordFileHeader header;
+  header.Magic = RECORD_MAGIC;
+  header.Version = RECORD_VERSION;
+  header.FeatureLevel = featureLevel;
+  Write(&header, sizeof(header));
+  LfStoreRelease(&_active, (LONG)1);
+  D3DU_LOG(D3DU_LOG_INFO, "Recording to %s.", filename);
+  return S_OK;
+}
+
+HRESULT CCommandRecorder::Stop()
+{
+  CAutoLock lock(_lock);
+  if(!IsOpen())
+    return S_FALSE;
+  LfStoreRelease(&_active, (LONG)0);
+  Flush();
+  CloseHandle(_file);
+  _file = INVALID_HANDLE_VALUE;
+  delete[] _buffer;
+  _buffer = NULL;
+  return _result;
+}
+
+void CCommandRecorder::EndFrame()
+{
+  if(!Active())
+    return;
+  CAutoLock lock(_lock);
+  if(!IsOpen())
+    return;
+  _declaration.Clear();
+  WriteRecord(RECORD_FRAME, 0, _declaration);
+}
+
+bool CCommandRecorder::Begin(UINT op, RecordContext &context)
+{
+  if(!IsOpen())
+    return false;
+  if(!context.Immediate && _session != context.Session)
+  {
+    context.Id = ++_contexts;
+    context.Session = _session;
+    _declaration.Clear();
+    _declaration.Put(context.Flags);
+    WriteRecord(RECORD_CREATE_DEFERRED_CONTEXT, context.Id, _declaration);
+  }
+  _op = op;
+  _context = context.Id;
+  _args.Clear();
+  return true;
+}
+
+void CCommandRecorder::End()
+{
+  WriteRecord(_op, _context, _args);
+}
+
+UINT CCommandRecorder::Resolve(ID3D11DeviceChild *object, ID3D11DeviceContext *immediate, bool declared)
+{
+  RecordTag tag;
+  UINT size = sizeof(tag);
+  if(!IsOpen())
+    return 0;
+  if(FAILED(object->GetPrivateData(RECORD_TAG_KEY, &size, &tag)) || sizeof(tag) != size || _session != tag.Session)
+    return Declare(object, immediate, declared ? RECORD_DECLARED : 0);
+  if(tag.Pending && immediate)
+  {
+    ComPtr<ID3D11Resource> resource;
+    ComPtr<ID3D11View> view;
+    if(SUCCEEDED(object->QueryInterface(__uuidof(ID3D11Resource), (void**)&resource)))
+    {
+      PutContents(resource, tag.Id, immediate);
+    }
+    else if(SUCCEEDED(object->QueryInterface(__uuidof(ID3D11View), (void**)&view)))
+    {
+      view->GetResource(&resource);
+      Resolve(resource, immediate);
+    }
+    tag.Pending = FALSE;
+    object->SetPrivateData(RECORD_TAG_KEY, sizeof(tag), &tag);
+  }
+  return tag.Id;
+}
+
+void CCommandRecorder::Created(ID3D11Resource *resource, const D3D11_SUBRESOURCE_DATA *initialData)
+{
+  if(IsOpen())
+    DeclareResource(resource, Tag(resource, false), 0, initialData);
+}
+
+UINT CCommandRecorder::Finished(ID3D11CommandList *commandList)
+{
+  return IsOpen() ? Tag(commandList, false) : 0;
+}
+
+void CCommandRecorder::Write(const void *data, SIZE_T size)
+{
+  const BYTE *p = (const BYTE*)data;
+  while(size)
+  {
+    if(RECORD_WRITE_SIZE == _used)
+      Flush();
+    SIZE_T n = RECORD_WRITE_SIZE - _used;
+    if(n > size)
+      n = size;
+    memcpy(_buffer + _used, p, n);
+    _used += (UINT)n;
+    p += n;
+    size -= n;
+  }
+}
+
+void CCommandRecorder::WriteRecord(UINT op, UINT context, const CRecordBuffer &args)
+{
+  RecordHeader header;
+  header.Op = (UINT16)op;
+  header.Context = (UINT16)context;
+  header.Size = (UINT32)args.GetSize();
+  Write(&header, sizeof(header));
+  Write(args.GetData(), args.GetSize());
+}
+
+/// A failed write ends the recording, though the file stays open
+/// until Stop, which returns the error.
+void CCommandRecorder::Flush()
+{
+  DWORD written;
+  if(_used && SUCCEEDED(_result) && !WriteFile(_file, _buffer, _used, &written, NULL))
+  {
+    _result = HRESULT_FROM_WIN32(GetLastError());
+    LfStoreRelease(&_active, (LONG)0);
+    D3DU_LOG(D3DU_LOG_ERROR, "Unable to write recording (0x%08X).", _result);
+  }
+  _used = 0;
+}
+
+UINT CCommandRecorder::Tag(ID3D11DeviceChild *object, bool pending)
+{
+  RecordTag tag;
+  tag.Session = _session;
+  tag.Id = ++_objects;
+  tag.Pending = pending ? TRUE : FALSE;
+  object->SetPrivateData(RECORD_TAG_KEY, sizeof(tag), &tag);
+  return tag.Id;
+}
+
+/// Objects a declaration refers to are declared before it is built,
+/// as they use the same buffer.
+UINT CCommandRecorder::Declare(ID3D11DeviceChild *object, ID3D11DeviceContext *immediate, UINT flags)
+{
+  ComPtr<ID3D11Resource> resource;
+  ComPtr<ID3D11View> view;
+  UINT op = 0;
+  UINT viewed = 0;
+  UINT stage;
+  if(SUCCEEDED(object->QueryInterface(__uuidof(ID3D11Resource), (void**)&resource)))
+  {
+    RecordResourceDesc desc;
+    bool contents = flags && ResourceDesc(resource, &desc) && HasContents(desc);
+    UINT id = Tag(object, contents && !immediate);
+    DeclareResource(resource, id, flags, NULL);
+    if(contents && immediate)
+      PutContents(resource, id, immediate);
+    return id;
+  }
+  if(SUCCEEDED(object->QueryInterface(__uuidof(ID3D11View), (void**)&view)))
+  {
+    view->GetResource(&resource);
+    viewed = Resolve(resource, immediate);
+  }
+  UINT id = Tag(object, view && !immediate);
+  _declaration.Clear();
+  _declaration.Put(id);
+  if(view)
+  {
+    _declaration.Put(viewed);
+    if(PutDesc<ID3D11ShaderResourceView, D3D11_SHADER_RESOURCE_VIEW_DESC>(object, _declaration))
+      op = RECORD_CREATE_SHADER_RESOURCE_VIEW;
+    else if(PutDesc<ID3D11RenderTargetView, D3D11_RENDER_TARGET_VIEW_DESC>(object, _declaration))
+      op = RECORD_CREATE_RENDER_TARGET_VIEW;
+    else if(PutDesc<ID3D11DepthStencilView, D3D11_DEPTH_STENCIL_VIEW_DESC>(object, _declaration))
+      op = RECORD_CREATE_DEPTH_STENCIL_VIEW;
+    else if(PutDesc<ID3D11UnorderedAccessView, D3D11_UNORDERED_ACCESS_VIEW_DESC>(object, _declaration))
+      op = RECORD_CREATE_UNORDERED_ACCESS_VIEW;
+  }
+  else if(PutDesc<ID3D11BlendState, D3D11_BLEND_DESC>(object, _declaration))
+    op = RECORD_CREATE_BLEND_STATE;
+  else if(PutDesc<ID3D11DepthStencilState, D3D11_DEPTH_STENCIL_DESC>(object, _declaration))
+    op = RECORD_CREATE_DEPTH_STENCIL_STATE;
+  else if(PutDesc<ID3D11RasterizerState, D3D11_RASTERIZER_DESC>(object, _declaration))
+    op = RECORD_CREATE_RASTERIZER_STATE;
+  else if(PutDesc<ID3D11SamplerState, D3D11_SAMPLER_DESC>(object, _declaration))
+    op = RECORD_CREATE_SAMPLER_STATE;
+  else if(PutDesc<ID3D11Predicate, D3D11_QUERY_DESC>(object, _declaration))
+    op = RECORD_CREATE_PREDICATE;
+  else if(PutDesc<ID3D11Query, D3D11_QUERY_DESC>(object, _declaration))
+    op = RECORD_CREATE_QUERY;
+  else if(PutDesc<ID3D11Counter, D3D11_COUNTER_DESC>(object, _declaration))
+    op = RECORD_CREATE_COUNTER;
+  else if(Implements<ID3D11InputLayout>(object))
+  {
+    if(PutPrivateData(object, RECORD_LAYOUT_KEY))
+      op = RECORD_CREATE_INPUT_LAYOUT;
+  }
+  else if(ShaderStage(object, &stage))
+  {
+    _declaration.Put(stage);
+    if(PutPrivateData(object, RECORD_BYTECODE_KEY))
+      op = RECORD_CREATE_SHADER;
+  }
+  if(!op)
+  {
+    // Calls using it are skipped by replays.
+    D3DU_LOG(D3DU_LOG_WARNING, "Unable to declare %p in the recording.", (const void*)object);
+    return id;
+  }
+  WriteRecord(op | flags, 0, _declaration);
+  return id;
+}
+
+void CCommandRecorder::DeclareResource(ID3D11Resource *resource, UINT id, UINT flags, const D3D11_SUBRESOURCE_DATA *initialData)
+{
+  D3D11_RESOURCE_DIMENSION dimension;
+  UINT op;
+  resource->GetType(&dimension);
+  _declaration.Clear();
+  _declaration.Put(id);
+  switch(dimension)
+  {
+  case D3D11_RESOURCE_DIMENSION_BUFFER:
+    {
+      D3D11_BUFFER_DESC d;
+      static_cast<ID3D11Buffer*>(resource)->GetDesc(&d);
+      _declaration.Put(d);
+      op = RECORD_CREATE_BUFFER;
+    }
+    break;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+    {
+      D3D11_TEXTURE1D_DESC d;
+      static_cast<ID3D11Texture1D*>(resource)->GetDesc(&d);
+      _declaration.Put(d);
+      op = RECORD_CREATE_TEXTURE1D;
+    }
+    break;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+    {
+      D3D11_TEXTURE2D_DESC d;
+      static_cast<ID3D11Texture2D*>(resource)->GetDesc(&d);
+      _declaration.Put(d);
+      op = RECORD_CREATE_TEXTURE2D;
+    }
+    break;
+  case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+    {
+      D3D11_TEXTURE3D_DESC d;
+      static_cast<ID3D11Texture3D*>(resource)->GetDesc(&d);
+      _declaration.Put(d);
+      op = RECORD_CREATE_TEXTURE3D;
+    }
+    break;
+  default:
+    return;
+  }
+  RecordResourceDesc desc;
+  if(initialData && !(ResourceDesc(resource, &desc) && HasLayout(desc)))
+  {
+    D3DU_LOG(D3DU_LOG_WARNING, "Initial data of %p not recorded, its format has no known size.", (const void*)resource);
+    initialData = NULL;
+  }
+  _declaration.Put((UINT)(initialData ? 1 : 0));
+  if(initialData)
+  {
+    RecordLayout layout;
+    for(UINT i = 0; i < desc.MipLevels * desc.ArraySize; ++i)
+    {
+      SubresourceLayout(desc, i, NULL, &layout);
+      _declaration.PutRows(initialData[i].pSysMem, initialData[i].SysMemPitch, initialData[i].SysMemSlicePitch, layout);
+    }
+  }
+  WriteRecord(op | flags, 0, _declaration);
+}
+
+/// Copies the resource through a staging one, waiting for the device,
+/// and writes each subresource as an update.
+void CCommandRecorder::PutContents(ID3D11Resource *resource, UINT id, ID3D11DeviceContext *immediate)
+{
+  HRESULT hr;
+  ComPtr<ID3D11Device> device;
+  ComPtr<ID3D11Resource> staging;
+  RecordResourceDesc desc;
+  if(!ResourceDesc(resource, &desc))
+    return;
+  immediate->GetDevice(&device);
+  hr = CreateStaging(device, resource, &staging);
+  if(FAILED(hr))
+  {
+    D3DU_LOG(D3DU_LOG_WARNING, "Unable to record contents of %p (0x%08X).", (const void*)resource, hr);
+    return;
+  }
+  immediate->CopyResource(staging, resource);
+  for(UINT i = 0; i < desc.MipLevels * desc.ArraySize; ++i)
+  {
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    RecordLayout layout;
+    SubresourceLayout(desc, i, NULL, &layout);
+    if(FAILED(immediate->Map(staging, i, D3D11_MAP_READ, 0, &mapped)))
+      continue;
+    _declaration.Clear();
+    _declaration.Put(id);
+    _declaration.Put(i);
+    _declaration.Put(0u);
+    _declaration.PutRows(mapped.pData, mapped.RowPitch, mapped.DepthPitch, layout);
+    immediate->Unmap(staging, i);
+    WriteRecord(RECORD_UPDATE_SUBRESOURCE | RECORD_DECLARED, 0, _declaration);
+  }
+}
+
+/// Puts the size of the data and the data, or a zero size and false
+/// when there is none.
+bool CCommandRecorder::PutPrivateData(ID3D11DeviceChild *object, REFGUID key)
+{
+  UINT size = 0;
+  SIZE_T mark = _declaration.GetSize();
+  if(SUCCEEDED(object->GetPrivateData(key, &size, NULL)) && size)
+  {
+    _declaration.Put(size);
+    if(SUCCEEDED(object->GetPrivateData(key, &size, _declaration.Reserve(size))))
+      return true;
+    _declaration.Truncate(mark);
+  }
+  _declaration.Put(0u);
+  return false;
+}
+
+/// Bounds checked reads from a recording in memory. Reads past the
+/// end give zeros and NULL, and mark the reader failed.
+class CRecordReader
+{
+public:
+  CRecordReader(const BYTE *data, SIZE_T size)
+  {
+    _data = data;
+    _left = size;
+    _failed = false;
+  }
+
+  const BYTE *Read(UINT64 size)
+  {
+    if(size > _left)
+    {
+      _failed = true;
+      _left = 0;
+      return NULL;
+    }
+    const BYTE *p = _data;
+    _data += (SIZE_T)size;
+    _left -= (SIZE_T)size;
+    return p;
+  }
+
+  template<class T>
+  T Get()
+  {
+    T value;
+    const BYTE *p = Read(sizeof(value));
+    if(p)
+      memcpy(&value, p, sizeof(value));
+    else
+      memset(&value, 0, sizeof(value));
+    return value;
+  }
+
+  template<class T>
+  const T *GetArray(UINT count)
+  {
+    return (const T*)Read((UINT64)sizeof(T) * count);
+  }
+
+  /// NULL when not given.
+  template<class T>
+  const T *GetOptional(UINT count)
+  {
+    return Get<UINT>() ? GetArray<T>(count) : NULL;
+  }
+
+  bool Failed() const
+  {
+    return _failed;
+  }
+
+  SIZE_T Left() const
+  {
+    return _left;
+  }
+
+private:
+  const BYTE *_data;
+  SIZE_T _left;
+  bool _failed;
+};
+
+#define REPLAY_BUFFER 0x1u
+#define REPLAY_TEXTURE 0x2u
+#define REPLAY_RESOURCE (REPLAY_BUFFER | REPLAY_TEXTURE)
+#define REPLAY_SRV 0x4u
+#define REPLAY_RTV 0x8u
+#define REPLAY_DSV 0x10u
+#define REPLAY_UAV 0x20u
+#define REPLAY_SHADER(stage) (0x40u << (stage))
+#define REPLAY_INPUT_LAYOUT 0x1000u
+#define REPLAY_BLEND_STATE 0x2000u
+#define REPLAY_DEPTH_STENCIL_STATE 0x4000u
+#define REPLAY_RASTERIZER_STATE 0x8000u
+#define REPLAY_SAMPLER_STATE 0x10000u
+#define REPLAY_QUERY 0x20000u
+#define REPLAY_PREDICATE 0x40000u
+#define REPLAY_COUNTER 0x80000u
+#define REPLAY_ASYNCHRONOUS (REPLAY_QUERY | REPLAY_PREDICATE | REPLAY_COUNTER)
+#define REPLAY_COMMAND_LIST 0x100000u
+#define REPLAY_CONTEXT 0x200000u
+
+/// Objects of a pass by their numbers, with the kind each was created
+/// as, so that a bad log cannot pass one kind of object for another.
+class CReplayTable
+{
+public:
+  CReplayTable()
+  {
+    _entries = NULL;
+    _count = 0;
+  }
+
+  ~CReplayTable()
+  {
+    Clear();
+    delete[] _entries;
+  }
+
+  /// Takes over the reference to `object', which may be NULL when it
+  /// could not be created. False for numbers out of range.
+  bool Set(UINT id, ID3D11DeviceChild *object, UINT kind)
+  {
+    if((!id && REPLAY_CONTEXT != kind) || id >= REPLAY_MAX_ID)
+    {
+      if(object)
+        object->Release();
+      return false;
+    }
+    if(id >= _count)
+    {
+      UINT count = _count ? _count : 256;
+      while(count <= id)
+        count *= 2;
+      Entry *entries = new Entry[count];
+      memset(entries, 0, sizeof(Entry) * count);
+      if(_count)
+        memcpy(entries, _entries, sizeof(Entry) * _count);
+      delete[] _entries;
+      _entries = entries;
+      _count = count;
+    }
+    if(_entries[id].Object)
+      _entries[id].Object->Release();
+    _entries[id].Object = object;
+    _entries[id].Kind = kind;
+    return true;
+  }
+
+  /// NULL unless `id' is an object of one of `kinds'.
+  ID3D11DeviceChild *Get(UINT id, UINT kinds) const
+  {
+    if(id >= _count || !(_entries[id].Kind & kinds))
+      return NULL;
+    return _entries[id].Object;
+  }
+
+  void Clear()
+  {
+    for(UINT i = 0; i < _count; ++i)
+    {
+      if(_entries[i].Object)
+        _entries[i].Object->Release();
+      _entries[i].Object = NULL;
+      _entries[i].Kind = 0;
+    }
+  }
+
+private:
+  typedef struct
+  {
+    ID3D11DeviceChild *Object;
+    UINT Kind;
+  } Entry;
+
+  CReplayTable(const CReplayTable&);
+  CReplayTable& operator=(const CReplayTable&);
+
+  Entry *_entries;
+  UINT _count;
+};
+
+typedef enum
+{
+  REPLAY_ISSUED,
+  /// An object or context the call needs was not created.
+  REPLAY_SKIPPED,
+  REPLAY_INVALID,
+} REPLAY_RESULT;
+
+/// Copies packed rows to memory with the given pitches.
+static void UnpackRows(const BYTE *data, const RecordLayout &layout, void *dst, UINT rowPitch, UINT depthPitch)
+{
+  for(UINT z = 0; z < layout.Slices; ++z)
+  {
+    BYTE *slice = (BYTE*)dst + (SIZE_T)depthPitch * z;
+    for(UINT y = 0; y < layout.Rows; ++y)
+    {
+      memcpy(slice + (SIZE_T)rowPitch * y, data, layout.RowBytes);
+      data += layout.RowBytes;
+    }
+  }
+}
+
+static HRESULT CreateShader(ID3D11Device *device, UINT stage, const void *code, SIZE_T size, ID3D11DeviceChild **oShader)
+{
+  switch(stage)
+  {
+  case D3DU_STAGE_VS:
+    return device->CreateVertexShader(code, size, NULL, (ID3D11VertexShader**)oShader);
+  case D3DU_STAGE_HS:
+    return device->CreateHullShader(code, size, NULL, (ID3D11HullShader**)oShader);
+  case D3DU_STAGE_DS:
+    return device->CreateDomainShader(code, size, NULL, (ID3D11DomainShader**)oShader);
+  case D3DU_STAGE_GS:
+    return device->CreateGeometryShader(code, size, NULL, (ID3D11GeometryShader**)oShader);
+  case D3DU_STAGE_PS:
+    return device->CreatePixelShader(code, size, NULL, (ID3D11PixelShader**)oShader);
+  case D3DU_STAGE_CS:
+    return device->CreateComputeShader(code, size, NULL, (ID3D11ComputeShader**)oShader);
+  default:
+    return E_INVALIDARG;
+  }
+}
+
+static void SetShader(ID3D11DeviceContext *context, UINT stage, ID3D11DeviceChild *shader)
+{
+  switch(stage)
+  {
+  case D3DU_STAGE_VS:
+    context->VSSetShader(static_cast<ID3D11VertexShader*>(shader), NULL, 0);
+    break;
+  case D3DU_STAGE_HS:
+    context->HSSetShader(static_cast<ID3D11HullShader*>(shader), NULL, 0);
+    break;
+  case D3DU_STAGE_DS:
+    context->DSSetShader(static_cast<ID3D11DomainShader*>(shader), NULL, 0);
+    break;
+  case D3DU_STAGE_GS:
+    context->GSSetShader(static_cast<ID3D11GeometryShader*>(shader), NULL, 0);
+    break;
+  case D3DU_STAGE_PS:
+    context->PSSetShader(static_cast<ID3D11PixelShader*>(shader), NULL, 0);
+    break;
+  case D3DU_STAGE_CS:
+    context->CSSetShader(static_cast<ID3D11ComputeShader*>(shader), NULL, 0);
+    break;
+  }
+}
+
+static void SetSlots(ID3D11DeviceContext *context, UINT op, UINT stage, UINT start, UINT count, ID3D11DeviceChild *const *objects)
+{
+  ID3D11Buffer *const *buffers = (ID3D11Buffer *const *)objects;
+  ID3D11ShaderResourceView *const *views = (ID3D11ShaderResourceView *const *)objects;
+  ID3D11SamplerState *const *samplers = (ID3D11SamplerState *const *)objects;
+  switch(op)
+  {
+  case RECORD_SET_CONSTANT_BUFFERS:
+    switch(stage)
+    {
+    case D3DU_STAGE_VS: context->VSSetConstantBuffers(start, count, buffers); break;
+    case D3DU_STAGE_HS: context->HSSetConstantBuffers(start, count, buffers); break;
+    case D3DU_STAGE_DS: context->DSSetConstantBuffers(start, count, buffers); break;
+    case D3DU_STAGE_GS: context->GSSetConstantBuffers(start, count, buffers); break;
+    case D3DU_STAGE_PS: context->PSSetConstantBuffers(start, count, buffers); break;
+    case D3DU_STAGE_CS: context->CSSetConstantBuffers(start, count, buffers); break;
+    }
+    break;
+  case RECORD_SET_SHADER_RESOURCES:
+    switch(stage)
+    {
+    case D3DU_STAGE_VS: context->VSSetShaderResources(start, count, views); break;
+    case D3DU_STAGE_HS: context->HSSetShaderResources(start, count, views); break;
+    case D3DU_STAGE_DS: context->DSSetShaderResources(start, count, views); break;
+    case D3DU_STAGE_GS: context->GSSetShaderResources(start, count, views); break;
+    case D3DU_STAGE_PS: context->PSSetShaderResources(start, count, views); break;
+    case D3DU_STAGE_CS: context->CSSetShaderResources(start, count, views); break;
+    }
+    break;
+  case RECORD_SET_SAMPLERS:
+    switch(stage)
+    {
+    case D3DU_STAGE_VS: context->VSSetSamplers(start, count, samplers); break;
+    case D3DU_STAGE_HS: context->HSSetSamplers(start, count, samplers); break;
+    case D3DU_STAGE_DS: context->DSSetSamplers(start, count, samplers); break;
+    case D3DU_STAGE_GS: context->GSSetSamplers(start, count, samplers); break;
+    case D3DU_STAGE_PS: context->PSSetSamplers(start, count, samplers); break;
+    case D3DU_STAGE_CS: context->CSSetSamplers(start, count, samplers); break;
+    }
+    break;
+  }
+}
+
+static const UINT g_slotKinds[] = { REPLAY_BUFFER, REPLAY_SRV, REPLAY_SAMPLER_STATE };
+
+/// Issues the records of a log on a device. Frames are timed from the
+/// end of one to the end of the next, leaving out the time spent on
+/// records marked RECORD_DECLARED.
+class CReplayer
+{
+public:
+  CReplayer()
+  {
+    _frames = 0;
+    _calls = 0;
+    _skipped = 0;
+    _declaring = 0;
+    _frameStart.QuadPart = 0;
+    _start.QuadPart = 0;
+    QueryPerformanceFrequency(&_freq);
+  }
+
+  HRESULT Construct(ID3D11Device *device)
+  {
+    HRESULT hr;
+    D3D11_QUERY_DESC qd;
+    qd.Query = D3D11_QUERY_EVENT;
+    qd.MiscFlags = 0;
+    _device = device;
+    device->GetImmediateContext(&_immediate);
+    for(UINT i = 0; i < REPLAY_FRAME_LATENCY; ++i)
+    {
+      hr = device->CreateQuery(&qd, &_fences[i]);
+      if(FAILED(hr))
+        return hr;
+    }
+    QueryPerformanceCounter(&_start);
+    return S_OK;
+  }
+
+  HRESULT Pass(const BYTE *data, SIZE_T size)
+  {
+    CRecordReader log(data, size);
+    _objects.Clear();
+    _contexts.Clear();
+    _immediate.AddRef();
+    _contexts.Set(0, _immediate, REPLAY_CONTEXT);
+    _immediate->ClearState();
+    QueryPerformanceCounter(&_frameStart);
+    _declaring = 0;
+    while(log.Left())
+    {
+      RecordHeader header = log.Get<RecordHeader>();
+      const BYTE *args = log.Read(header.Size);
+      if(log.Failed())
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      CRecordReader r(args, header.Size);
+      UINT op = header.Op & ~RECORD_DECLARED;
+      REPLAY_RESULT result;
+      if(RECORD_FRAME == op)
+      {
+        EndFrame();
+        continue;
+      }
+      if(header.Op & RECORD_DECLARED)
+      {
+        LARGE_INTEGER begin, end;
+        QueryPerformanceCounter(&begin);
+        result = Issue(op, header.Context, r);
+        QueryPerformanceCounter(&end);
+        _declaring += end.QuadPart - begin.QuadPart;
+      }
+      else
+      {
+        result = Issue(op, header.Context, r);
+      }
+      if(REPLAY_INVALID == result || r.Failed())
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+      if(REPLAY_SKIPPED == result)
+        ++_skipped;
+      else
+        ++_calls;
+    }
+    _immediate->ClearState();
+    _objects.Clear();
+    _contexts.Clear();
+    return S_OK;
+  }
+
+  /// Waits for the device to finish.
+  void Finish(D3DU_REPLAY_STATISTICS *oStats)
+  {
+    LARGE_INTEGER now;
+    _immediate->End(_fences[0]);
+    _immediate->Flush();
+    Wait(_fences[0]);
+    QueryPerformanceCounter(&now);
+    oStats->Frames = _frames;
+    oStats->Calls = _calls;
+    oStats->Skipped = _skipped;
+    oStats->Seconds = (FLOAT)((double)(now.QuadPart - _start.QuadPart) / _freq.QuadPart);
+    oStats->FrameTimes.Samples = _frameTimes.Count;
+    oStats->FrameTimes.Min = Milliseconds(_frameTimes.Min());
+    oStats->FrameTimes.Mean = (FLOAT)(_frameTimes.Mean() / 1000.0);
+    oStats->FrameTimes.P50 = Milliseconds(_frameTimes.Percentile(0.50));
+    oStats->FrameTimes.P95 = Milliseconds(_frameTimes.Percentile(0.95));
+    oStats->FrameTimes.P99 = Milliseconds(_frameTimes.Percentile(0.99));
+    oStats->FrameTimes.Max = Milliseconds(_frameTimes.Max());
+  }
+
+private:
+  ComPtr<ID3D11Device> _device;
+  ComPtr<ID3D11DeviceContext> _immediate;
+  ComPtr<ID3D11Query> _fences[REPLAY_FRAME_LATENCY];
+  CReplayTable _objects;
+  CReplayTable _contexts;
+  CFrameTimeHistogram _frameTimes;
+  CRecordBuffer _initialData;
+  LARGE_INTEGER _freq;
+  LARGE_INTEGER _start;
+  LARGE_INTEGER _frameStart;
+  LONGLONG _declaring;
+  UINT64 _frames;
+  UINT64 _calls;
+  UINT64 _skipped;
+
+  static FLOAT Milliseconds(unsigned us)
+  {
+    return us / 1000.0f;
+  }
+
+  void Wait(ID3D11Query *fence)
+  {
+    while(S_FALSE == _immediate->GetData(fence, NULL, 0, 0))
+      Sleep(0);
+  }
+
+  /// Keeps at most REPLAY_FRAME_LATENCY frames in flight.
+  void EndFrame()
+  {
+    LARGE_INTEGER now;
+    ID3D11Query *fence = _fences[_frames % REPLAY_FRAME_LATENCY];
+    if(_frames >= REPLAY_FRAME_LATENCY)
+      Wait(fence);
+    _immediate->End(fence);
+    _immediate->Flush();
+    QueryPerformanceCounter(&now);
+    LONGLONG us = (now.QuadPart - _frameStart.QuadPart - _declaring) * 1000000 / _freq.QuadPart;
+    _frameTimes.Add(us < 0 ? 0 : us > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned)us);
+    _frameStart = now;
+    _declaring = 0;
+    ++_frames;
+  }
+
+  /// False when the object is not there; NULL is there for number 0.
+  template<class T>
+  bool GetObject(CRecordReader &r, UINT kinds, T **oObject)
+  {
+    UINT id = r.Get<UINT>();
+    ID3D11DeviceChild *object = id ? _objects.Get(id, kinds) : NULL;
+    *oObject = static_cast<T*>(object);
+    return !id || object;
+  }
+
+  /// False when one of them is not there, or there are too many.
+  bool GetObjects(CRecordReader &r, UINT count, UINT kinds, ID3D11DeviceChild **objects)
+  {
+    bool found = true;
+    if(count > RECORD_MAX_OBJECTS)
+      return false;
+    for(UINT i = 0; i < count; ++i)
+      found = GetObject(r, kinds, &objects[i]) && found;
+    return found;
+  }
+
+  REPLAY_RESULT Created(HRESULT hr, UINT id, ID3D11DeviceChild *object, UINT kind)
+  {
+    if(!_objects.Set(id, SUCCEEDED(hr) ? object : NULL, kind))
+      return REPLAY_INVALID;
+    return SUCCEEDED(hr) ? REPLAY_ISSUED : REPLAY_SKIPPED;
+  }
+
+  REPLAY_RESULT Issue(UINT op, UINT contextId, CRecordReader &r)
+  {
+    if(op < RECORD_CREATE_DEFERRED_CONTEXT)
+      return Create(op, r);
+    if(RECORD_CREATE_DEFERRED_CONTEXT == op)
+    {
+      ID3D11DeviceContext *context = NULL;
+      UINT flags = r.Get<UINT>();
+      if(r.Failed())
+        return REPLAY_INVALID;
+      HRESULT hr = _device->CreateDeferredContext(flags, &context);
+      if(!_contexts.Set(contextId, SUCCEEDED(hr) ? context : NULL, REPLAY_CONTEXT))
+        return REPLAY_INVALID;
+      return SUCCEEDED(hr) ? REPLAY_ISSUED : REPLAY_SKIPPED;
+    }
+    ID3D11DeviceContext *context = static_cast<ID3D11DeviceContext*>(_contexts.Get(contextId, REPLAY_CONTEXT));
+    if(!context)
+      return REPLAY_SKIPPED;
+    return Call(op, context, r);
+  }
+
+  REPLAY_RESULT Create(UINT op, CRecordReader &r)
+  {
+    HRESULT hr;
+    ID3D11DeviceChild *object = NULL;
+    UINT id = r.Get<UINT>();
+    switch(op)
+    {
+    case RECORD_CREATE_BUFFER:
+      {
+        D3D11_BUFFER_DESC d = r.Get<D3D11_BUFFER_DESC>();
+        D3D11_SUBRESOURCE_DATA initial;
+        bool hasData = 0 != r.Get<UINT>();
+        initial.pSysMem = hasData ? r.Read(d.ByteWidth) : NULL;
+        initial.SysMemPitch = d.ByteWidth;
+        initial.SysMemSlicePitch = d.ByteWidth;
+        if(r.Failed())
+          return REPLAY_INVALID;
+        // Immutable resources declared without data get it by updates.
+        if(!hasData && D3D11_USAGE_IMMUTABLE == d.Usage)
+          d.Usage = D3D11_USAGE_DEFAULT;
+        hr = _device->CreateBuffer(&d, hasData ? &initial : NULL, (ID3D11Buffer**)&object);
+        return Created(hr, id, object, REPLAY_BUFFER);
+      }
+    case RECORD_CREATE_TEXTURE1D:
+      {
+        D3D11_TEXTURE1D_DESC d = r.Get<D3D11_TEXTURE1D_DESC>();
+        RecordResourceDesc desc;
+        DescOf(d, &desc);
+        const D3D11_SUBRESOURCE_DATA *initial;
+        if(!GetInitialData(r, desc, &initial))
+          return REPLAY_INVALID;
+        if(!initial && D3D11_USAGE_IMMUTABLE == d.Usage)
+          d.Usage = D3D11_USAGE_DEFAULT;
+        hr = _device->CreateTexture1D(&d, initial, (ID3D11Texture1D**)&object);
+        return Created(hr, id, object, REPLAY_TEXTURE);
+      }
+    case RECORD_CREATE_TEXTURE2D:
+      {
+        D3D11_TEXTURE2D_DESC d = r.Get<D3D11_TEXTURE2D_DESC>();
+        RecordResourceDesc desc;
+        DescOf(d, &desc);
+        const D3D11_SUBRESOURCE_DATA *initial;
+        if(!GetInitialData(r, desc, &initial))
+          return REPLAY_INVALID;
+        if(!initial && D3D11_USAGE_IMMUTABLE == d.Usage)
+          d.Usage = D3D11_USAGE_DEFAULT;
+        hr = _device->CreateTexture2D(&d, initial, (ID3D11Texture2D**)&object);
+        return Created(hr, id, object, REPLAY_TEXTURE);
+      }
+    case RECORD_CREATE_TEXTURE3D:
+      {
+        D3D11_TEXTURE3D_DESC d = r.Get<D3D11_TEXTURE3D_DESC>();
+        RecordResourceDesc desc;
+        DescOf(d, &desc);
+        const D3D11_SUBRESOURCE_DATA *initial;
+        if(!GetInitialData(r, desc, &initial))
+          return REPLAY_INVALID;
+        if(!initial && D3D11_USAGE_IMMUTABLE == d.Usage)
+          d.Usage = D3D11_USAGE_DEFAULT;
+        hr = _device->CreateTexture3D(&d, initial, (ID3D11Texture3D**)&object);
+        return Created(hr, id, object, REPLAY_TEXTURE);
+      }
+    case RECORD_CREATE_SHADER_RESOURCE_VIEW:
+      {
+        ID3D11Resource *resource;
+        bool found = GetObject(r, REPLAY_RESOURCE, &resource);
+        D3D11_SHADER_RESOURCE_VIEW_DESC d = r.Get<D3D11_SHADER_RESOURCE_VIEW_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = found && resource ? _device->CreateShaderResourceView(resource, &d, (ID3D11ShaderResourceView**)&object) : E_FAIL;
+        return Created(hr, id, object, REPLAY_SRV);
+      }
+    case RECORD_CREATE_RENDER_TARGET_VIEW:
+      {
+        ID3D11Resource *resource;
+        bool found = GetObject(r, REPLAY_RESOURCE, &resource);
+        D3D11_RENDER_TARGET_VIEW_DESC d = r.Get<D3D11_RENDER_TARGET_VIEW_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = found && resource ? _device->CreateRenderTargetView(resource, &d, (ID3D11RenderTargetView**)&object) : E_FAIL;
+        return Created(hr, id, object, REPLAY_RTV);
+      }
+    case RECORD_CREATE_DEPTH_STENCIL_VIEW:
+      {
+        ID3D11Resource *resource;
+        bool found = GetObject(r, REPLAY_RESOURCE, &resource);
+        D3D11_DEPTH_STENCIL_VIEW_DESC d = r.Get<D3D11_DEPTH_STENCIL_VIEW_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = found && resource ? _device->CreateDepthStencilView(resource, &d, (ID3D11DepthStencilView**)&object) : E_FAIL;
+        return Created(hr, id, object, REPLAY_DSV);
+      }
+    case RECORD_CREATE_UNORDERED_ACCESS_VIEW:
+      {
+        ID3D11Resource *resource;
+        bool found = GetObject(r, REPLAY_RESOURCE, &resource);
+        D3D11_UNORDERED_ACCESS_VIEW_DESC d = r.Get<D3D11_UNORDERED_ACCESS_VIEW_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = found && resource ? _device->CreateUnorderedAccessView(resource, &d, (ID3D11UnorderedAccessView**)&object) : E_FAIL;
+        return Created(hr, id, object, REPLAY_UAV);
+      }
+    case RECORD_CREATE_SHADER:
+      {
+        UINT stage = r.Get<UINT>();
+        UINT size = r.Get<UINT>();
+        const BYTE *code = r.Read(size);
+        if(r.Failed() || stage > D3DU_STAGE_CS)
+          return REPLAY_INVALID;
+        hr = size ? CreateShader(_device, stage, code, size, &object) : E_FAIL;
+        return Created(hr, id, object, REPLAY_SHADER(stage));
+      }
+    case RECORD_CREATE_INPUT_LAYOUT:
+      {
+        UINT size = r.Get<UINT>();
+        const BYTE *layout = r.Read(size);
+        if(r.Failed())
+          return REPLAY_INVALID;
+        CRecordReader l(layout, size);
+        return CreateInputLayout(id, l);
+      }
+    case RECORD_CREATE_BLEND_STATE:
+      {
+        D3D11_BLEND_DESC d = r.Get<D3D11_BLEND_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateBlendState(&d, (ID3D11BlendState**)&object);
+        return Created(hr, id, object, REPLAY_BLEND_STATE);
+      }
+    case RECORD_CREATE_DEPTH_STENCIL_STATE:
+      {
+        D3D11_DEPTH_STENCIL_DESC d = r.Get<D3D11_DEPTH_STENCIL_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateDepthStencilState(&d, (ID3D11DepthStencilState**)&object);
+        return Created(hr, id, object, REPLAY_DEPTH_STENCIL_STATE);
+      }
+    case RECORD_CREATE_RASTERIZER_STATE:
+      {
+        D3D11_RASTERIZER_DESC d = r.Get<D3D11_RASTERIZER_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateRasterizerState(&d, (ID3D11RasterizerState**)&object);
+        return Created(hr, id, object, REPLAY_RASTERIZER_STATE);
+      }
+    case RECORD_CREATE_SAMPLER_STATE:
+      {
+        D3D11_SAMPLER_DESC d = r.Get<D3D11_SAMPLER_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateSamplerState(&d, (ID3D11SamplerState**)&object);
+        return Created(hr, id, object, REPLAY_SAMPLER_STATE);
+      }
+    case RECORD_CREATE_QUERY:
+      {
+        D3D11_QUERY_DESC d = r.Get<D3D11_QUERY_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateQuery(&d, (ID3D11Query**)&object);
+        return Created(hr, id, object, REPLAY_QUERY);
+      }
+    case RECORD_CREATE_PREDICATE:
+      {
+        D3D11_QUERY_DESC d = r.Get<D3D11_QUERY_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreatePredicate(&d, (ID3D11Predicate**)&object);
+        return Created(hr, id, object, REPLAY_PREDICATE);
+      }
+    case RECORD_CREATE_COUNTER:
+      {
+        D3D11_COUNTER_DESC d = r.Get<D3D11_COUNTER_DESC>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        hr = _device->CreateCounter(&d, (ID3D11Counter**)&object);
+        return Created(hr, id, object, REPLAY_COUNTER);
+      }
+    default:
+      return REPLAY_INVALID;
+    }
+  }
+
+  /// Initial data of a texture, one packed subresource after another.
+  bool GetInitialData(CRecordReader &r, const RecordResourceDesc &desc, const D3D11_SUBRESOURCE_DATA **oInitial)
+  {
+    *oInitial = NULL;
+    if(!r.Get<UINT>())
+      return !r.Failed();
+    if(!desc.MipLevels
+      || desc.MipLevels > D3D11_REQ_MIP_LEVELS
+      || !desc.ArraySize
+      || desc.ArraySize > D3D11_REQ_TEXTURE2D_ARRAY_AXIS_DIMENSION)
+      return false;
+    UINT count = desc.MipLevels * desc.ArraySize;
+    _initialData.Clear();
+    D3D11_SUBRESOURCE_DATA *initial = (D3D11_SUBRESOURCE_DATA*)_initialData.Reserve(sizeof(D3D11_SUBRESOURCE_DATA) * count);
+    for(UINT i = 0; i < count; ++i)
+    {
+      RecordLayout layout;
+      if(!SubresourceLayout(desc, i, NULL, &layout))
+        return false;
+      initial[i].pSysMem = r.Read(RecordLayoutBytes(layout));
+      initial[i].SysMemPitch = layout.RowBytes;
+      initial[i].SysMemSlicePitch = layout.RowBytes * layout.Rows;
+    }
+    *oInitial = initial;
+    return !r.Failed();
+  }
+
+  /// Semantic names are copied to terminate them.
+  REPLAY_RESULT CreateInputLayout(UINT id, CRecordReader &l)
+  {
+    D3D11_INPUT_ELEMENT_DESC elements[D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT];
+    CHAR names[D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT][REPLAY_MAX_SEMANTIC + 1];
+    ID3D11DeviceChild *object = NULL;
+    UINT count = l.Get<UINT>();
+    if(count > D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT)
+      return REPLAY_INVALID;
+    for(UINT i = 0; i < count; ++i)
+    {
+      UINT length = l.Get<UINT>();
+      if(length > REPLAY_MAX_SEMANTIC)
+        return REPLAY_INVALID;
+      const BYTE *name = l.Read(length);
+      if(l.Failed())
+        return REPLAY_INVALID;
+      memcpy(names[i], name, length);
+      names[i][length] = 0;
+      elements[i].SemanticName = names[i];
+      elements[i].SemanticIndex = l.Get<UINT>();
+      elements[i].Format = l.Get<DXGI_FORMAT>();
+      elements[i].InputSlot = l.Get<UINT>();
+      elements[i].AlignedByteOffset = l.Get<UINT>();
+      elements[i].InputSlotClass = l.Get<D3D11_INPUT_CLASSIFICATION>();
+      elements[i].InstanceDataStepRate = l.Get<UINT>();
+    }
+    UINT size = l.Get<UINT>();
+    const BYTE *code = l.Read(size);
+    if(l.Failed())
+      return REPLAY_INVALID;
+    HRESULT hr = _device->CreateInputLayout(elements, count, code, size, (ID3D11InputLayout**)&object);
+    return Created(hr, id, object, REPLAY_INPUT_LAYOUT);
+  }
+
+  /// Writes packed data to a subresource the way its usage allows.
+  void Upload(ID3D11DeviceContext *context, ID3D11Resource *resource, UINT subresource, const D3D11_BOX *box, const BYTE *data, const RecordLayout &layout, D3D11_USAGE usage)
+  {
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    switch(usage)
+    {
+    case D3D11_USAGE_DEFAULT:
+      context->UpdateSubresource(resource, subresource, box, data, layout.RowBytes, layout.RowBytes * layout.Rows);
+      break;
+    case D3D11_USAGE_DYNAMIC:
+    case D3D11_USAGE_STAGING:
+      if(SUCCEEDED(context->Map(resource, subresource, D3D11_USAGE_DYNAMIC == usage ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE, 0, &mapped)))
+      {
+        UnpackRows(data, layout, mapped.pData, mapped.RowPitch, mapped.DepthPitch);
+        context->Unmap(resource, subresource);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  REPLAY_RESULT Call(UINT op, ID3D11DeviceContext *context, CRecordReader &r)
+  {
+    ID3D11DeviceChild *objects[RECORD_MAX_OBJECTS];
+    bool found = true;
+    switch(op)
+    {
+    case RECORD_SET_CONSTANT_BUFFERS:
+    case RECORD_SET_SHADER_RESOURCES:
+    case RECORD_SET_SAMPLERS:
+      {
+        UINT stage = r.Get<UINT>();
+        UINT start = r.Get<UINT>();
+        UINT count = r.Get<UINT>();
+        if(count > RECORD_MAX_OBJECTS || stage > D3DU_STAGE_CS)
+          return REPLAY_INVALID;
+        found = GetObjects(r, count, g_slotKinds[op - RECORD_SET_CONSTANT_BUFFERS], objects);
+        if(r.Failed())
+          return REPLAY_INVALID;
+        if(found)
+          SetSlots(context, op, stage, start, count, objects);
+      }
+      break;
+    case RECORD_SET_SHADER:
+      {
+        UINT stage = r.Get<UINT>();
+        if(stage > D3DU_STAGE_CS)
+          return REPLAY_INVALID;
+        ID3D11DeviceChild *shader;
+        found = GetObject(r, REPLAY_SHADER(stage), &shader);
+        if(found && !r.Failed())
+          SetShader(context, stage, shader);
+      }
+      break;
+    case RECORD_SET_UNORDERED_ACCESS_VIEWS:
+      {
+        UINT start = r.Get<UINT>();
+        UINT count = r.Get<UINT>();
+        if(count > RECORD_MAX_OBJECTS)
+          return REPLAY_INVALID;
+        found = GetObjects(r, count, REPLAY_UAV, objects);
+        const UINT *counts = r.GetOptional<UINT>(count);
+        if(found && !r.Failed())
+          context->CSSetUnorderedAccessViews(start, count, (ID3D11UnorderedAccessView *const *)objects, counts);
+      }
+      break;
+    case RECORD_SET_INPUT_LAYOUT:
+      {
+        ID3D11InputLayout *layout;
+        found = GetObject(r, REPLAY_INPUT_LAYOUT, &layout);
+        if(found && !r.Failed())
+          context->IASetInputLayout(layout);
+      }
+      break;
+    case RECORD_SET_VERTEX_BUFFERS:
+      {
+        UINT start = r.Get<UINT>();
+        UINT count = r.Get<UINT>();
+        if(count > RECORD_MAX_OBJECTS)
+          return REPLAY_INVALID;
+        found = GetObjects(r, count, REPLAY_BUFFER, objects);
+        const UINT *strides = r.GetOptional<UINT>(count);
+        const UINT *offsets = r.GetOptional<UINT>(count);
+        if(found && !r.Failed())
+          context->IASetVertexBuffers(start, count, (ID3D11Buffer *const *)objects, strides, offsets);
+      }
+      break;
+    case RECORD_SET_INDEX_BUFFER:
+      {
+        ID3D11Buffer *buffer;
+        found = GetObject(r, REPLAY_BUFFER, &buffer);
+        DXGI_FORMAT format = r.Get<DXGI_FORMAT>();
+        UINT offset = r.Get<UINT>();
+        if(found && !r.Failed())
+          context->IASetIndexBuffer(buffer, format, offset);
+      }
+      break;
+    case RECORD_SET_PRIMITIVE_TOPOLOGY:
+      {
+        D3D11_PRIMITIVE_TOPOLOGY topology = r.Get<D3D11_PRIMITIVE_TOPOLOGY>();
+        if(!r.Failed())
+          context->IASetPrimitiveTopology(topology);
+      }
+      break;
+    case RECORD_SET_RENDER_TARGETS:
+      {
+        ID3D11DepthStencilView *dsv;
+        UINT count = r.Get<UINT>();
+        if(count > RECORD_MAX_OBJECTS)
+          return REPLAY_INVALID;
+        found = GetObjects(r, count, REPLAY_RTV, objects);
+        found = GetObject(r, REPLAY_DSV, &dsv) && found;
+        if(found && !r.Failed())
+          context->OMSetRenderTargets(count, (ID3D11RenderTargetView *const *)objects, dsv);
+      }
+      break;
+    case RECORD_SET_RENDER_TARGETS_AND_UNORDERED_ACCESS_VIEWS:
+      {
+        ID3D11DeviceChild *uavs[RECORD_MAX_OBJECTS];
+        ID3D11DepthStencilView *dsv = NULL;
+        const UINT *counts = NULL;
+        UINT rtvCount = r.Get<UINT>();
+        if(D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL != rtvCount)
+        {
+          if(rtvCount > RECORD_MAX_OBJECTS)
+            return REPLAY_INVALID;
+          found = GetObjects(r, rtvCount, REPLAY_RTV, objects);
+          found = GetObject(r, REPLAY_DSV, &dsv) && found;
+        }
+        UINT uavStart = r.Get<UINT>();
+        UINT uavCount = r.Get<UINT>();
+        if(D3D11_KEEP_UNORDERED_ACCESS_VIEWS != uavCount)
+        {
+          if(uavCount > RECORD_MAX_OBJECTS)
+            return REPLAY_INVALID;
+          found = GetObjects(r, uavCount, REPLAY_UAV, uavs) && found;
+          counts = r.GetOptional<UINT>(uavCount);
+        }
+        if(found && !r.Failed())
+          context->OMSetRenderTargetsAndUnorderedAccessViews(
+            rtvCount,
+            (ID3D11RenderTargetView *const *)objects,
+            dsv,
+            uavStart,
+            uavCount,
+            (ID3D11UnorderedAccessView *const *)uavs,
+            counts);
+      }
+      break;
+    case RECORD_SET_BLEND_STATE:
+      {
+        ID3D11BlendState *state;
+        found = GetObject(r, REPLAY_BLEND_STATE, &state);
+        const FLOAT *factor = r.GetOptional<FLOAT>(4);
+        UINT mask = r.Get<UINT>();
+        if(found && !r.Failed())
+          context->OMSetBlendState(state, factor, mask);
+      }
+      break;
+    case RECORD_SET_DEPTH_STENCIL_STATE:
+      {
+        ID3D11DepthStencilState *state;
+        found = GetObject(r, REPLAY_DEPTH_STENCIL_STATE, &state);
+        UINT stencilRef = r.Get<UINT>();
+        if(found && !r.Failed())
+          context->OMSetDepthStencilState(state, stencilRef);
+      }
+      break;
+    case RECORD_SET_SO_TARGETS:
+      {
+        UINT count = r.Get<UINT>();
+        if(count > RECORD_MAX_OBJECTS)
+          return REPLAY_INVALID;
+        found = GetObjects(r, count, REPLAY_BUFFER, objects);
+        const UINT *offsets = r.GetOptional<UINT>(count);
+        if(found && !r.Failed())
+          context->SOSetTargets(count, (ID3D11Buffer *const *)objects, offsets);
+      }
+      break;
+    case RECORD_SET_RASTERIZER_STATE:
+      {
+        ID3D11RasterizerState *state;
+        found = GetObject(r, REPLAY_RASTERIZER_STATE, &state);
+        if(found && !r.Failed())
+          context->RSSetState(state);
+      }
+      break;
+    case RECORD_SET_VIEWPORTS:
+      {
+        UINT count = r.Get<UINT>();
+        const D3D11_VIEWPORT *viewports = r.GetOptional<D3D11_VIEWPORT>(count);
+        if(!r.Failed())
+          context->RSSetViewports(count, viewports);
+      }
+      break;
+    case RECORD_SET_SCISSOR_RECTS:
+      {
+        UINT count = r.Get<UINT>();
+        const D3D11_RECT *rects = r.GetOptional<D3D11_RECT>(count);
+        if(!r.Failed())
+          context->RSSetScissorRects(count, rects);
+      }
+      break;
+    case RECORD_SET_PREDICATION:
+      {
+        ID3D11Predicate *predicate;
+        found = GetObject(r, REPLAY_PREDICATE, &predicate);
+        BOOL value = r.Get<BOOL>();
+        if(found && !r.Failed())
+          context->SetPredication(predicate, value);
+      }
+      break;
+    case RECORD_DRAW:
+      {
+        UINT vertexCount = r.Get<UINT>();
+        UINT startVertex = r.Get<UINT>();
+        if(!r.Failed())
+          context->Draw(vertexCount, startVertex);
+      }
+      break;
+    case RECORD_DRAW_INDEXED:
+      {
+        UINT indexCount = r.Get<UINT>();
+        UINT startIndex = r.Get<UINT>();
+        INT baseVertex = r.Get<INT>();
+        if(!r.Failed())
+          context->DrawIndexed(indexCount, startIndex, baseVertex);
+      }
+      break;
+    case RECORD_DRAW_INSTANCED:
+      {
+        UINT vertexCount = r.Get<UINT>();
+        UINT instanceCount = r.Get<UINT>();
+        UINT startVertex = r.Get<UINT>();
+        UINT startInstance = r.Get<UINT>();
+        if(!r.Failed())
+          context->DrawInstanced(vertexCount, instanceCount, startVertex, startInstance);
+      }
+      break;
+    case RECORD_DRAW_INDEXED_INSTANCED:
+      {
+        UINT indexCount = r.Get<UINT>();
+        UINT instanceCount = r.Get<UINT>();
+        UINT startIndex = r.Get<UINT>();
+        INT baseVertex = r.Get<INT>();
+        UINT startInstance = r.Get<UINT>();
+        if(!r.Failed())
+          context->DrawIndexedInstanced(indexCount, instanceCount, startIndex, baseVertex, startInstance);
+      }
+      break;
+    case RECORD_DRAW_AUTO:
+      context->DrawAuto();
+      break;
+    case RECORD_DRAW_INSTANCED_INDIRECT:
+    case RECORD_DRAW_INDEXED_INSTANCED_INDIRECT:
+    case RECORD_DISPATCH_INDIRECT:
+      {
+        ID3D11Buffer *buffer;
+        found = GetObject(r, REPLAY_BUFFER, &buffer) && buffer;
+        UINT offset = r.Get<UINT>();
+        if(!found || r.Failed())
+          break;
+        if(RECORD_DRAW_INSTANCED_INDIRECT == op)
+          context->DrawInstancedIndirect(buffer, offset);
+        else if(RECORD_DRAW_INDEXED_INSTANCED_INDIRECT == op)
+          context->DrawIndexedInstancedIndirect(buffer, offset);
+        else
+          context->DispatchIndirect(buffer, offset);
+      }
+      break;
+    case RECORD_DISPATCH:
+      {
+        UINT x = r.Get<UINT>();
+        UINT y = r.Get<UINT>();
+        UINT z = r.Get<UINT>();
+        if(!r.Failed())
+          context->Dispatch(x, y, z);
+      }
+      break;
+    case RECORD_MAP:
+      {
+        ID3D11Resource *resource;
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        RecordResourceDesc desc;
+        RecordLayout layout;
+        found = GetObject(r, REPLAY_RESOURCE, &resource) && resource;
+        UINT subresource = r.Get<UINT>();
+        D3D11_MAP type = r.Get<D3D11_MAP>();
+        UINT flags = r.Get<UINT>() & ~D3D11_MAP_FLAG_DO_NOT_WAIT;
+        bool written = 0 != r.Get<UINT>();
+        if(!found || r.Failed())
+          break;
+        ResourceDesc(resource, &desc);
+        // Maps of formats with no known size are recorded without data.
+        if(written && !SubresourceLayout(desc, subresource, NULL, &layout))
+          return REPLAY_INVALID;
+        const BYTE *data = written ? r.Read(RecordLayoutBytes(layout)) : NULL;
+        if(r.Failed())
+          return REPLAY_INVALID;
+        if(FAILED(context->Map(resource, subresource, type, flags, &mapped)))
+          break;
+        if(data)
+          UnpackRows(data, layout, mapped.pData, mapped.RowPitch, mapped.DepthPitch);
+        context->Unmap(resource, subresource);
+      }
+      break;
+    case RECORD_UPDATE_SUBRESOURCE:
+      {
+        ID3D11Resource *resource;
+        RecordResourceDesc desc;
+        RecordLayout layout;
+        found = GetObject(r, REPLAY_RESOURCE, &resource) && resource;
+        UINT subresource = r.Get<UINT>();
+        const D3D11_BOX *box = r.GetOptional<D3D11_BOX>(1);
+        if(!found || r.Failed())
+          break;
+        ResourceDesc(resource, &desc);
+        if(!SubresourceLayout(desc, subresource, box, &layout))
+          return REPLAY_INVALID;
+        const BYTE *data = r.Read(RecordLayoutBytes(layout));
+        if(r.Failed())
+          return REPLAY_INVALID;
+        Upload(context, resource, subresource, box, data, layout, desc.Usage);
+      }
+      break;
+    case RECORD_COPY_RESOURCE:
+      {
+        ID3D11Resource *dst, *src;
+        found = GetObject(r, REPLAY_RESOURCE, &dst) && dst;
+        found = GetObject(r, REPLAY_RESOURCE, &src) && src && found;
+        if(found && !r.Failed())
+          context->CopyResource(dst, src);
+      }
+      break;
+    case RECORD_COPY_SUBRESOURCE_REGION:
+      {
+        ID3D11Resource *dst, *src;
+        found = GetObject(r, REPLAY_RESOURCE, &dst) && dst;
+        UINT dstSubresource = r.Get<UINT>();
+        UINT x = r.Get<UINT>();
+        UINT y = r.Get<UINT>();
+        UINT z = r.Get<UINT>();
+        found = GetObject(r, REPLAY_RESOURCE, &src) && src && found;
+        UINT srcSubresource = r.Get<UINT>();
+        const D3D11_BOX *box = r.GetOptional<D3D11_BOX>(1);
+        if(found && !r.Failed())
+          context->CopySubresourceRegion(dst, dstSubresource, x, y, z, src, srcSubresource, box);
+      }
+      break;
+    case RECORD_COPY_STRUCTURE_COUNT:
+      {
+        ID3D11Buffer *buffer;
+        ID3D11UnorderedAccessView *uav;
+        found = GetObject(r, REPLAY_BUFFER, &buffer) && buffer;
+        UINT offset = r.Get<UINT>();
+        found = GetObject(r, REPLAY_UAV, &uav) && uav && found;
+        if(found && !r.Failed())
+          context->CopyStructureCount(buffer, offset, uav);
+      }
+      break;
+    case RECORD_RESOLVE_SUBRESOURCE:
+      {
+        ID3D11Resource *dst, *src;
+        found = GetObject(r, REPLAY_RESOURCE, &dst) && dst;
+        UINT dstSubresource = r.Get<UINT>();
+        found = GetObject(r, REPLAY_RESOURCE, &src) && src && found;
+        UINT srcSubresource = r.Get<UINT>();
+        DXGI_FORMAT format = r.Get<DXGI_FORMAT>();
+        if(found && !r.Failed())
+          context->ResolveSubresource(dst, dstSubresource, src, srcSubresource, format);
+      }
+      break;
+    case RECORD_GENERATE_MIPS:
+      {
+        ID3D11ShaderResourceView *srv;
+        found = GetObject(r, REPLAY_SRV, &srv) && srv;
+        if(found && !r.Failed())
+          context->GenerateMips(srv);
+      }
+      break;
+    case RECORD_SET_RESOURCE_MIN_LOD:
+      {
+        ID3D11Resource *resource;
+        found = GetObject(r, REPLAY_RESOURCE, &resource) && resource;
+        FLOAT lod = r.Get<FLOAT>();
+        if(found && !r.Failed())
+          context->SetResourceMinLOD(resource, lod);
+      }
+      break;
+    case RECORD_CLEAR_RENDER_TARGET_VIEW:
+      {
+        ID3D11RenderTargetView *rtv;
+        found = GetObject(r, REPLAY_RTV, &rtv) && rtv;
+        const FLOAT *color = r.GetArray<FLOAT>(4);
+        if(found && !r.Failed())
+          context->ClearRenderTargetView(rtv, color);
+      }
+      break;
+    case RECORD_CLEAR_UNORDERED_ACCESS_VIEW_UINT:
+      {
+        ID3D11UnorderedAccessView *uav;
+        found = GetObject(r, REPLAY_UAV, &uav) && uav;
+        const UINT *values = r.GetArray<UINT>(4);
+        if(found && !r.Failed())
+          context->ClearUnorderedAccessViewUint(uav, values);
+      }
+      break;
+    case RECORD_CLEAR_UNORDERED_ACCESS_VIEW_FLOAT:
+      {
+        ID3D11UnorderedAccessView *uav;
+        found = GetObject(r, REPLAY_UAV, &uav) && uav;
+        const FLOAT *values = r.GetArray<FLOAT>(4);
+        if(found && !r.Failed())
+          context->ClearUnorderedAccessViewFloat(uav, values);
+      }
+      break;
+    case RECORD_CLEAR_DEPTH_STENCIL_VIEW:
+      {
+        ID3D11DepthStencilView *dsv;
+        found = GetObject(r, REPLAY_DSV, &dsv) && dsv;
+        UINT flags = r.Get<UINT>();
+        FLOAT depth = r.Get<FLOAT>();
+        UINT stencil = r.Get<UINT>();
+        if(found && !r.Failed())
+          context->ClearDepthStencilView(dsv, flags, depth, (UINT8)stencil);
+      }
+      break;
+    case RECORD_BEGIN:
+    case RECORD_END:
+      {
+        ID3D11Asynchronous *async;
+        found = GetObject(r, REPLAY_ASYNCHRONOUS, &async) && async;
+        if(!found || r.Failed())
+          break;
+        if(RECORD_BEGIN == op)
+          context->Begin(async);
+        else
+          context->End(async);
+      }
+      break;
+    case RECORD_CLEAR_STATE:
+      context->ClearState();
+      break;
+    case RECORD_FLUSH:
+      context->Flush();
+      break;
+    case RECORD_EXECUTE_COMMAND_LIST:
+      {
+        ID3D11CommandList *list;
+        found = GetObject(r, REPLAY_COMMAND_LIST, &list) && list;
+        BOOL restore = r.Get<BOOL>();
+        if(found && !r.Failed())
+          context->ExecuteCommandList(list, restore);
+      }
+      break;
+    case RECORD_FINISH_COMMAND_LIST:
+      {
+        ID3D11CommandList *list = NULL;
+        BOOL restore = r.Get<BOOL>();
+        UINT id = r.Get<UINT>();
+        if(r.Failed())
+          return REPLAY_INVALID;
+        HRESULT hr = context->FinishCommandList(restore, &list);
+        return Created(hr, id, list, REPLAY_COMMAND_LIST);
+      }
+    default:
+      return REPLAY_INVALID;
+    }
+    return found ? REPLAY_ISSUED : REPLAY_SKIPPED;
+  }
+};
+
+static HRESULT ReadRecording(LPCWSTR filename, BYTE **oData, SIZE_T *oSize)
+{
+  HRESULT hr = S_OK;
+  LARGE_INTEGER size;
+  HANDLE file = CreateFile(
+    filename,
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    NULL,
+    OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    NULL);
+  if(INVALID_HANDLE_VALUE == file)
+    return HRESULT_FROM_WIN32(GetLastError());
+  if(!GetFileSizeEx(file, &size))
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(file);
+    return hr;
+  }
+  if((UINT64)size.QuadPart > (SIZE_T)-1 / 2)
+  {
+    CloseHandle(file);
+    return E_OUTOFMEMORY;
+  }
+  BYTE *data = new BYTE[(SIZE_T)size.QuadPart];
+  SIZE_T done = 0;
+  while(done < (SIZE_T)size.QuadPart)
+  {
+    DWORD read;
+    SIZE_T left = (SIZE_T)size.QuadPart - done;
+    DWORD chunk = left > 0x10000000 ? 0x10000000 : (DWORD)left;
+    if(!ReadFile(file, data + done, chunk, &read, NULL))
+    {
+      hr = HRESULT_FROM_WIN32(GetLastError());
+      break;
+    }
+    if(!read)
+    {
+      hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+      break;
+    }
+    done += read;
+  }
+  CloseHandle(file);
+  if(FAILED(hr))
+  {
+    delete[] data;
+    return hr;
+  }
+  *oData = data;
+  *oSize = done;
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUReplayRecording(
+  ID3D11Device *device,
+  LPCWSTR filename,
+  UINT passes,
+  D3DU_REPLAY_STATISTICS *oStats)
+{
+  if(!oStats)
+    return E_POINTER;
+  memset(oStats, 0, sizeof(*oStats));
+  if(!device || !filename || !passes)
+    return E_INVALIDARG;
+  HRESULT hr;
+  BYTE *data;
+  SIZE_T size;
+  hr = ReadRecording(filename, &data, &size);
+  if(FAILED(hr))
+    return hr;
+  CRecordReader r(data, size);
+  RecordFileHeader header = r.Get<RecordFileHeader>();
+  if(r.Failed() || RECORD_MAGIC != header.Magic || RECORD_VERSION != header.Version)
+  {
+    delete[] data;
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  if(device->GetFeatureLevel() < (D3D_FEATURE_LEVEL)header.FeatureLevel)
+    D3DU_LOG(D3DU_LOG_WARNING, "Replaying a recording made at feature level 0x%X.", header.FeatureLevel);
+  CReplayer *replayer = new CReplayer();
+  hr = replayer->Construct(device);
+  for(UINT i = 0; SUCCEEDED(hr) && i < passes; ++i)
+    hr = replayer->Pass(data + sizeof(header), size - sizeof(header));
+  if(SUCCEEDED(hr))
+    replayer->Finish(oStats);
+  delete replayer;
+  delete[] data;
+  return hr;
+}
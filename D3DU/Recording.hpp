@@ -0,0 +1,1580 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __RECORDING_HPP__
+#define __RECORDING_HPP__
+
+/// Recording of device and context calls, for D3DUReplayRecording.
+///
+/// CRecordingDevice and CRecordingContext sit right under the
+/// instrumented device and contexts, and pass every call on. While
+/// ID3DUDevice::StartRecording is in effect, they also append the calls
+/// that change what the GPU does to a log; getters, GetData and private
+/// data are left out. Calls of all contexts go to one log under a lock,
+/// in the order they were made, so command lists are finished before
+/// they are executed in the log as well. When no recording is under way
+/// a call costs one more virtual call and a load.
+///
+/// The log refers to objects by numbers, kept in their private data
+/// together with the number of the recording. The first call using an
+/// object that existed before the recording declares it: views and
+/// states by their descriptions, shaders and input layouts by the
+/// bytecode the device keeps for them, buffers and textures by their
+/// descriptions. Their contents follow, as subresource updates, the
+/// first time the immediate context uses them or a view of them, so a
+/// command list using a resource before that replays with whatever the
+/// resource held. Objects created during the recording are declared
+/// with the data they were created from. Class instances and stream
+/// output declarations are not recorded, nor are the contents of
+/// multisampled and depth stencil resources.
+///
+/// The log is a RecordFileHeader followed by records, each a
+/// RecordHeader and `Size' bytes of arguments. Arguments are those of
+/// the call in order, objects as UINT numbers with 0 for NULL, arrays
+/// after their length, and optional arguments after a UINT telling
+/// whether they were given. Subresource data is packed row after row
+/// without padding, see RecordLayoutOf. Maps are recorded at Unmap,
+/// with the whole subresource.
+
+#include "ContextProxy.hpp"
+#include "DeviceProxy.hpp"
+#include "MemoryTracker.hpp"
+#include "LockFree.hpp"
+#include "ThreadUtils.hpp"
+#include "Log.hpp"
+
+#define RECORD_MAGIC 0x52554433
+#define RECORD_VERSION 1
+#define RECORD_WRITE_SIZE (256*1024)
+/// Subresources a context may keep mapped while recording.
+#define RECORD_MAX_MAPS 16
+/// Largest array of objects a call takes.
+#define RECORD_MAX_OBJECTS D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT
+
+/// Private data key of RecordTag.
+static const GUID RECORD_TAG_KEY =
+  { 0x5A7D8B13, 0x2896, 0x456D, { 0xBE, 0x92, 0x1D, 0x26, 0x4E, 0x69, 0xC6, 0x7D } };
+/// Private data key of shader bytecode.
+static const GUID RECORD_BYTECODE_KEY =
+  { 0x58D7A767, 0x2CE3, 0x4E97, { 0xA2, 0xFA, 0xEF, 0x0E, 0xB3, 0xFE, 0x97, 0x53 } };
+/// Private data key of input layouts, in the form of their declaration.
+static const GUID RECORD_LAYOUT_KEY =
+  { 0xFE08C1FE, 0x61AE, 0x4B97, { 0xAB, 0x58, 0x99, 0xCB, 0xD1, 0x66, 0x66, 0xF1 } };
+
+typedef enum
+{
+  /// Ends a frame, see ID3DUDevice::EndFrame.
+  RECORD_FRAME = 1,
+
+  // Declarations, with the number of the object first.
+  RECORD_CREATE_BUFFER,
+  RECORD_CREATE_TEXTURE1D,
+  RECORD_CREATE_TEXTURE2D,
+  RECORD_CREATE_TEXTURE3D,
+  RECORD_CREATE_SHADER_RESOURCE_VIEW,
+  RECORD_CREATE_RENDER_TARGET_VIEW,
+  RECORD_CREATE_DEPTH_STENCIL_VIEW,
+  RECORD_CREATE_UNORDERED_ACCESS_VIEW,
+  RECORD_CREATE_SHADER,
+  RECORD_CREATE_INPUT_LAYOUT,
+  RECORD_CREATE_BLEND_STATE,
+  RECORD_CREATE_DEPTH_STENCIL_STATE,
+  RECORD_CREATE_RASTERIZER_STATE,
+  RECORD_CREATE_SAMPLER_STATE,
+  RECORD_CREATE_QUERY,
+  RECORD_CREATE_PREDICATE,
+  RECORD_CREATE_COUNTER,
+  /// Declares the context of the record, which has no arguments but
+  /// the context flags.
+  RECORD_CREATE_DEFERRED_CONTEXT,
+
+  // Context calls. Shader stage calls take a D3DU_SHADER_STAGE first.
+  RECORD_SET_CONSTANT_BUFFERS,
+  RECORD_SET_SHADER_RESOURCES,
+  RECORD_SET_SAMPLERS,
+  RECORD_SET_SHADER,
+  RECORD_SET_UNORDERED_ACCESS_VIEWS,
+  RECORD_SET_INPUT_LAYOUT,
+  RECORD_SET_VERTEX_BUFFERS,
+  RECORD_SET_INDEX_BUFFER,
+  RECORD_SET_PRIMITIVE_TOPOLOGY,
+  RECORD_SET_RENDER_TARGETS,
+  RECORD_SET_RENDER_TARGETS_AND_UNORDERED_ACCESS_VIEWS,
+  RECORD_SET_BLEND_STATE,
+  RECORD_SET_DEPTH_STENCIL_STATE,
+  RECORD_SET_SO_TARGETS,
+  RECORD_SET_RASTERIZER_STATE,
+  RECORD_SET_VIEWPORTS,
+  RECORD_SET_SCISSOR_RECTS,
+  RECORD_SET_PREDICATION,
+  RECORD_DRAW,
+  RECORD_DRAW_INDEXED,
+  RECORD_DRAW_INSTANCED,
+  RECORD_DRAW_INDEXED_INSTANCED,
+  RECORD_DRAW_AUTO,
+  RECORD_DRAW_INSTANCED_INDIRECT,
+  RECORD_DRAW_INDEXED_INSTANCED_INDIRECT,
+  RECORD_DISPATCH,
+  RECORD_DISPATCH_INDIRECT,
+  RECORD_MAP,
+  RECORD_UPDATE_SUBRESOURCE,
+  RECORD_COPY_RESOURCE,
+  RECORD_COPY_SUBRESOURCE_REGION,
+  RECORD_COPY_STRUCTURE_COUNT,
+  RECORD_RESOLVE_SUBRESOURCE,
+  RECORD_GENERATE_MIPS,
+  RECORD_SET_RESOURCE_MIN_LOD,
+  RECORD_CLEAR_RENDER_TARGET_VIEW,
+  RECORD_CLEAR_UNORDERED_ACCESS_VIEW_UINT,
+  RECORD_CLEAR_UNORDERED_ACCESS_VIEW_FLOAT,
+  RECORD_CLEAR_DEPTH_STENCIL_VIEW,
+  RECORD_BEGIN,
+  RECORD_END,
+  RECORD_CLEAR_STATE,
+  RECORD_FLUSH,
+  RECORD_EXECUTE_COMMAND_LIST,
+  /// Takes the restore flag and the number of the new command list.
+  RECORD_FINISH_COMMAND_LIST,
+} RECORD_OP;
+
+/// Set in the op of declarations of objects that existed before the
+/// recording; replays leave them out of frame times.
+#define RECORD_DECLARED 0x8000
+
+typedef struct
+{
+  UINT32 Magic;
+  UINT32 Version;
+  UINT32 FeatureLevel;
+} RecordFileHeader;
+
+typedef struct
+{
+  UINT16 Op;
+  /// 0 for the immediate context, otherwise a declared deferred one.
+  UINT16 Context;
+  UINT32 Size;
+} RecordHeader;
+
+/// Number of an object in a recording.
+typedef struct
+{
+  UINT Session;
+  UINT Id;
+  /// Contents of the object, or of the resource of a view, have not
+  /// been recorded yet.
+  BOOL Pending;
+} RecordTag;
+
+/// Rows of `RowBytes' bytes, `Rows' per slice.
+typedef struct
+{
+  UINT RowBytes;
+  UINT Rows;
+  UINT Slices;
+} RecordLayout;
+
+/// Layout of `width' x `height' x `depth' texels packed without
+/// padding. Block compressed formats have a row per four texel rows.
+/// False for formats of unknown size, whose contents are not recorded
+/// rather than read with a guessed pitch.
+inline bool RecordLayoutOf(DXGI_FORMAT format, UINT width, UINT height, UINT depth, RecordLayout *oLayout)
+{
+  UINT bits = FormatBitsPerPixel(format);
+  if(!bits)
+    return false;
+  if(FormatIsBlockCompressed(format))
+  {
+    // A block is 16 texels.
+    oLayout->RowBytes = (width + 3) / 4 * bits * 2;
+    oLayout->Rows = (height + 3) / 4;
+  }
+  else
+  {
+    oLayout->RowBytes = (width * bits + 7) / 8;
+    oLayout->Rows = height;
+  }
+  oLayout->Slices = depth;
+  return true;
+}
+
+inline UINT64 RecordLayoutBytes(const RecordLayout &layout)
+{
+  return (UINT64)layout.RowBytes * layout.Rows * layout.Slices;
+}
+
+/// Growing array of bytes.
+class CRecordBuffer
+{
+public:
+  CRecordBuffer()
+  {
+    _data = NULL;
+    _size = 0;
+    _capacity = 0;
+  }
+
+  ~CRecordBuffer()
+  {
+    delete[] _data;
+  }
+
+  /// Appends `size' bytes and returns them.
+  BYTE *Reserve(SIZE_T size)
+  {
+    if(_size + size > _capacity)
+    {
+      SIZE_T capacity = _capacity ? _capacity : 4096;
+      while(capacity < _size + size)
+        capacity *= 2;
+      BYTE *data = new BYTE[capacity];
+      if(_size)
+        memcpy(data, _data, _size);
+      delete[] _data;
+      _data = data;
+      _capacity = capacity;
+    }
+    BYTE *p = _data + _size;
+    _size += size;
+    return p;
+  }
+
+  void Put(const void *data, SIZE_T size)
+  {
+    if(size)
+      memcpy(Reserve(size), data, size);
+  }
+
+  template<class T>
+  void Put(const T &value)
+  {
+    Put(&value, sizeof(value));
+  }
+
+  /// Appends data laid out with the given pitches, packed by `layout'.
+  void PutRows(const void *data, UINT rowPitch, UINT depthPitch, const RecordLayout &layout)
+  {
+    BYTE *dst = Reserve((SIZE_T)RecordLayoutBytes(layout));
+    for(UINT z = 0; z < layout.Slices; ++z)
+    {
+      const BYTE *src = (const BYTE*)data + (SIZE_T)depthPitch * z;
+      for(UINT y = 0; y < layout.Rows; ++y)
+      {
+        memcpy(dst, src + (SIZE_T)rowPitch * y, layout.RowBytes);
+        dst += layout.RowBytes;
+      }
+    }
+  }
+
+  void Truncate(SIZE_T size)
+  {
+    if(size < _size)
+      _size = size;
+  }
+
+  void Clear()
+  {
+    _size = 0;
+  }
+
+  const BYTE *GetData() const
+  {
+    return _data;
+  }
+
+  SIZE_T GetSize() const
+  {
+    return _size;
+  }
+
+private:
+  CRecordBuffer(const CRecordBuffer&);
+  CRecordBuffer& operator=(const CRecordBuffer&);
+
+  BYTE *_data;
+  SIZE_T _size;
+  SIZE_T _capacity;
+};
+
+/// A context as the log knows it.
+typedef struct
+{
+  /// 0 for the immediate context; deferred ones are numbered in each
+  /// recording that uses them.
+  UINT Id;
+  UINT Session;
+  UINT Flags;
+  /// The real immediate context, through which contents of resources
+  /// are copied; NULL for deferred contexts.
+  ID3D11DeviceContext *Immediate;
+} RecordContext;
+
+/// The log, and the numbering of objects in it. Everything but Start,
+/// Stop, EndFrame and Active is for holders of the lock.
+class D3DU_NOVTABLE CCommandRecorder :
+  public IUnknown
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+  END_INTERFACE_MAP
+
+  CCommandRecorder();
+  virtual ~CCommandRecorder();
+
+  HRESULT Start(LPCWSTR filename, D3D_FEATURE_LEVEL featureLevel);
+  HRESULT Stop();
+  void EndFrame();
+
+  bool Active() const
+  {
+    return 0 != LfLoadAcquire(&_active);
+  }
+
+  CLock &GetLock()
+  {
+    return _lock;
+  }
+
+  /// Starts the record of a call, declaring `context' first if needed.
+  /// False when the recording has stopped meanwhile.
+  bool Begin(UINT op, RecordContext &context);
+
+  CRecordBuffer &GetArgs()
+  {
+    return _args;
+  }
+
+  void End();
+
+  /// Number of `object', declaring it first if this recording has not
+  /// seen it yet. `declared' tells whether it existed before.
+  UINT Resolve(ID3D11DeviceChild *object, ID3D11DeviceContext *immediate, bool declared = true);
+
+  /// Declares a buffer or texture just created, with `initialData'.
+  void Created(ID3D11Resource *resource, const D3D11_SUBRESOURCE_DATA *initialData);
+
+  /// Numbers a command list just finished.
+  UINT Finished(ID3D11CommandList *commandList);
+
+private:
+  CLock _lock;
+  volatile LONG _active;
+  HANDLE _file;
+  BYTE *_buffer;
+  UINT _used;
+  HRESULT _result;
+  UINT _session;
+  UINT _objects;
+  UINT _contexts;
+  UINT _op;
+  UINT _context;
+  CRecordBuffer _args;
+  CRecordBuffer _declaration;
+
+  bool IsOpen() const
+  {
+    return INVALID_HANDLE_VALUE != _file;
+  }
+
+  void Write(const void *data, SIZE_T size);
+  void WriteRecord(UINT op, UINT context, const CRecordBuffer &args);
+  void Flush();
+  UINT Tag(ID3D11DeviceChild *object, bool pending);
+  UINT Declare(ID3D11DeviceChild *object, ID3D11DeviceContext *immediate, UINT flags);
+  void DeclareResource(ID3D11Resource *resource, UINT id, UINT flags, const D3D11_SUBRESOURCE_DATA *initialData);
+  void PutContents(ID3D11Resource *resource, UINT id, ID3D11DeviceContext *immediate);
+  bool PutPrivateData(ID3D11DeviceChild *object, REFGUID key);
+};
+
+/// Subresource sizes, in the layout the log packs them in.
+bool RecordSubresourceLayout(ID3D11Resource *resource, UINT subresource, const D3D11_BOX *box, RecordLayout *oLayout);
+
+/// Subresources of `resource' taking initial data: mip levels times
+/// array slices.
+UINT RecordSubresourceCount(ID3D11Resource *resource);
+
+/// Holds the lock of the recorder for the record of one call, which
+/// goes to the log when the scope ends.
+class CRecordScope
+{
+public:
+  CRecordScope(CCommandRecorder *recorder, UINT op, RecordContext &context)
+    : _lock(recorder->GetLock())
+  {
+    _recorder = recorder;
+    _immediate = context.Immediate;
+    _open = recorder->Begin(op, context);
+  }
+
+  ~CRecordScope()
+  {
+    if(_open)
+      _recorder->End();
+  }
+
+  bool IsOpen() const
+  {
+    return _open;
+  }
+
+  template<class T>
+  void Put(const T &value)
+  {
+    _recorder->GetArgs().Put(value);
+  }
+
+  void Put(const void *data, SIZE_T size)
+  {
+    _recorder->GetArgs().Put(data, size);
+  }
+
+  /// Optional arrays and structures.
+  template<class T>
+  void PutOptional(const T *values, UINT count)
+  {
+    Put((UINT)(values ? 1 : 0));
+    if(values)
+      Put(values, sizeof(T) * count);
+  }
+
+  void PutObject(ID3D11DeviceChild *object)
+  {
+    Put(object ? _recorder->Resolve(object, _immediate) : 0u);
+  }
+
+  template<class T>
+  void PutObjects(UINT count, T *const *objects)
+  {
+    Put(count);
+    for(UINT i = 0; i < count; ++i)
+      PutObject(objects ? objects[i] : NULL);
+  }
+
+  CRecordBuffer &GetArgs()
+  {
+    return _recorder->GetArgs();
+  }
+
+private:
+  CRecordScope(const CRecordScope&);
+  CRecordScope& operator=(const CRecordScope&);
+
+  CAutoLock _lock;
+  CCommandRecorder *_recorder;
+  ID3D11DeviceContext *_immediate;
+  bool _open;
+};
+
+class D3DU_NOVTABLE CRecordingContext :
+  public CContextProxy<ID3D11DeviceContext>
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3D11DeviceChild)
+    INTERFACE_MAP_ENTRY(ID3D11DeviceContext)
+#ifdef D3DU_D3D11_1
+    // Calls made through it are not recorded.
+    if(__uuidof(ID3D11DeviceContext1) == riid)
+      return _context->QueryInterface(riid, oObject);
+#endif
+  END_INTERFACE_MAP
+
+  CRecordingContext()
+  {
+    _maps = 0;
+  }
+
+  virtual ~CRecordingContext() { }
+
+  STDMETHOD(Construct)(ID3D11DeviceContext *context, CCommandRecorder *recorder)
+  {
+    _context = context;
+    _recorder = recorder;
+    _record.Id = 0;
+    _record.Session = 0;
+    _record.Flags = context->GetContextFlags();
+    _record.Immediate = D3D11_DEVICE_CONTEXT_IMMEDIATE == context->GetType() ? context : NULL;
+    return S_OK;
+  }
+
+  // Shader stages
+
+  STDMETHOD_(void, VSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->VSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_VS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, VSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->VSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_VS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, VSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->VSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_VS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, VSSetShader)(ID3D11VertexShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->VSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_VS, shader);
+  }
+
+  STDMETHOD_(void, HSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->HSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_HS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, HSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->HSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_HS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, HSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->HSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_HS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, HSSetShader)(ID3D11HullShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->HSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_HS, shader);
+  }
+
+  STDMETHOD_(void, DSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->DSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_DS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, DSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->DSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_DS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, DSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->DSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_DS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, DSSetShader)(ID3D11DomainShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->DSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_DS, shader);
+  }
+
+  STDMETHOD_(void, GSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->GSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_GS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, GSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->GSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_GS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, GSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->GSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_GS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, GSSetShader)(ID3D11GeometryShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->GSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_GS, shader);
+  }
+
+  STDMETHOD_(void, PSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->PSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_PS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, PSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->PSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_PS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, PSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->PSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_PS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, PSSetShader)(ID3D11PixelShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->PSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_PS, shader);
+  }
+
+  STDMETHOD_(void, CSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    _context->CSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+    RecordSlots(RECORD_SET_CONSTANT_BUFFERS, D3DU_STAGE_CS, startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, CSSetShaderResources)(UINT startSlot, UINT numViews, ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    _context->CSSetShaderResources(startSlot, numViews, shaderResourceViews);
+    RecordSlots(RECORD_SET_SHADER_RESOURCES, D3DU_STAGE_CS, startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, CSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    _context->CSSetSamplers(startSlot, numSamplers, samplers);
+    RecordSlots(RECORD_SET_SAMPLERS, D3DU_STAGE_CS, startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, CSSetShader)(ID3D11ComputeShader *shader, ID3D11ClassInstance *const *classInstances, UINT numClassInstances)
+  {
+    _context->CSSetShader(shader, classInstances, numClassInstances);
+    RecordShader(D3DU_STAGE_CS, shader);
+  }
+
+  STDMETHOD_(void, CSSetUnorderedAccessViews)(
+    UINT startSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    _context->CSSetUnorderedAccessViews(startSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_UNORDERED_ACCESS_VIEWS, _record);
+    r.Put(startSlot);
+    r.PutObjects(numUavs, unorderedAccessViews);
+    r.PutOptional(uavInitialCounts, numUavs);
+  }
+
+  // Input assembler
+
+  STDMETHOD_(void, IASetInputLayout)(ID3D11InputLayout *inputLayout)
+  {
+    _context->IASetInputLayout(inputLayout);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_INPUT_LAYOUT, _record);
+    r.PutObject(inputLayout);
+  }
+
+  STDMETHOD_(void, IASetVertexBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *vertexBuffers,
+    const UINT *strides,
+    const UINT *offsets)
+  {
+    _context->IASetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_VERTEX_BUFFERS, _record);
+    r.Put(startSlot);
+    r.PutObjects(numBuffers, vertexBuffers);
+    r.PutOptional(strides, numBuffers);
+    r.PutOptional(offsets, numBuffers);
+  }
+
+  STDMETHOD_(void, IASetIndexBuffer)(ID3D11Buffer *indexBuffer, DXGI_FORMAT format, UINT offset)
+  {
+    _context->IASetIndexBuffer(indexBuffer, format, offset);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_INDEX_BUFFER, _record);
+    r.PutObject(indexBuffer);
+    r.Put(format);
+    r.Put(offset);
+  }
+
+  STDMETHOD_(void, IASetPrimitiveTopology)(D3D11_PRIMITIVE_TOPOLOGY topology)
+  {
+    _context->IASetPrimitiveTopology(topology);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_PRIMITIVE_TOPOLOGY, _record);
+    r.Put(topology);
+  }
+
+  // Output merger, stream output and rasterizer
+
+  STDMETHOD_(void, OMSetRenderTargets)(
+    UINT numViews,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView)
+  {
+    _context->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_RENDER_TARGETS, _record);
+    r.PutObjects(numViews, renderTargetViews);
+    r.PutObject(depthStencilView);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargetsAndUnorderedAccessViews)(
+    UINT numRTVs,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView,
+    UINT uavStartSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    _context->OMSetRenderTargetsAndUnorderedAccessViews(numRTVs, renderTargetViews, depthStencilView, uavStartSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_RENDER_TARGETS_AND_UNORDERED_ACCESS_VIEWS, _record);
+    // The keep constants leave the views they stand for unused.
+    if(D3D11_KEEP_RENDER_TARGETS_AND_DEPTH_STENCIL == numRTVs)
+      r.Put(numRTVs);
+    else
+    {
+      r.PutObjects(numRTVs, renderTargetViews);
+      r.PutObject(depthStencilView);
+    }
+    r.Put(uavStartSlot);
+    if(D3D11_KEEP_UNORDERED_ACCESS_VIEWS == numUavs)
+      r.Put(numUavs);
+    else
+    {
+      r.PutObjects(numUavs, unorderedAccessViews);
+      r.PutOptional(uavInitialCounts, numUavs);
+    }
+  }
+
+  STDMETHOD_(void, OMSetBlendState)(ID3D11BlendState *blendState, const FLOAT blendFactor[4], UINT sampleMask)
+  {
+    _context->OMSetBlendState(blendState, blendFactor, sampleMask);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_BLEND_STATE, _record);
+    r.PutObject(blendState);
+    r.PutOptional(blendFactor, 4);
+    r.Put(sampleMask);
+  }
+
+  STDMETHOD_(void, OMSetDepthStencilState)(ID3D11DepthStencilState *depthStencilState, UINT stencilRef)
+  {
+    _context->OMSetDepthStencilState(depthStencilState, stencilRef);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_DEPTH_STENCIL_STATE, _record);
+    r.PutObject(depthStencilState);
+    r.Put(stencilRef);
+  }
+
+  STDMETHOD_(void, SOSetTargets)(UINT numBuffers, ID3D11Buffer *const *soTargets, const UINT *offsets)
+  {
+    _context->SOSetTargets(numBuffers, soTargets, offsets);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_SO_TARGETS, _record);
+    r.PutObjects(numBuffers, soTargets);
+    r.PutOptional(offsets, numBuffers);
+  }
+
+  STDMETHOD_(void, RSSetState)(ID3D11RasterizerState *rasterizerState)
+  {
+    _context->RSSetState(rasterizerState);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_RASTERIZER_STATE, _record);
+    r.PutObject(rasterizerState);
+  }
+
+  STDMETHOD_(void, RSSetViewports)(UINT numViewports, const D3D11_VIEWPORT *viewports)
+  {
+    _context->RSSetViewports(numViewports, viewports);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_VIEWPORTS, _record);
+    r.Put(numViewports);
+    r.PutOptional(viewports, numViewports);
+  }
+
+  STDMETHOD_(void, RSSetScissorRects)(UINT numRects, const D3D11_RECT *rects)
+  {
+    _context->RSSetScissorRects(numRects, rects);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_SCISSOR_RECTS, _record);
+    r.Put(numRects);
+    r.PutOptional(rects, numRects);
+  }
+
+  STDMETHOD_(void, SetPredication)(ID3D11Predicate *predicate, BOOL predicateValue)
+  {
+    _context->SetPredication(predicate, predicateValue);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_PREDICATION, _record);
+    r.PutObject(predicate);
+    r.Put(predicateValue);
+  }
+
+  // Draws
+
+  STDMETHOD_(void, Draw)(UINT vertexCount, UINT startVertexLocation)
+  {
+    _context->Draw(vertexCount, startVertexLocation);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DRAW, _record);
+    r.Put(vertexCount);
+    r.Put(startVertexLocation);
+  }
+
+  STDMETHOD_(void, DrawIndexed)(UINT indexCount, UINT startIndexLocation, INT baseVertexLocation)
+  {
+    _context->DrawIndexed(indexCount, startIndexLocation, baseVertexLocation);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DRAW_INDEXED, _record);
+    r.Put(indexCount);
+    r.Put(startIndexLocation);
+    r.Put(baseVertexLocation);
+  }
+
+  STDMETHOD_(void, DrawInstanced)(
+    UINT vertexCountPerInstance,
+    UINT instanceCount,
+    UINT startVertexLocation,
+    UINT startInstanceLocation)
+  {
+    _context->DrawInstanced(vertexCountPerInstance, instanceCount, startVertexLocation, startInstanceLocation);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DRAW_INSTANCED, _record);
+    r.Put(vertexCountPerInstance);
+    r.Put(instanceCount);
+    r.Put(startVertexLocation);
+    r.Put(startInstanceLocation);
+  }
+
+  STDMETHOD_(void, DrawIndexedInstanced)(
+    UINT indexCountPerInstance,
+    UINT instanceCount,
+    UINT startIndexLocation,
+    INT baseVertexLocation,
+    UINT startInstanceLocation)
+  {
+    _context->DrawIndexedInstanced(indexCountPerInstance, instanceCount, startIndexLocation, baseVertexLocation, startInstanceLocation);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DRAW_INDEXED_INSTANCED, _record);
+    r.Put(indexCountPerInstance);
+    r.Put(instanceCount);
+    r.Put(startIndexLocation);
+    r.Put(baseVertexLocation);
+    r.Put(startInstanceLocation);
+  }
+
+  STDMETHOD_(void, DrawAuto)()
+  {
+    _context->DrawAuto();
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DRAW_AUTO, _record);
+  }
+
+  STDMETHOD_(void, DrawInstancedIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    _context->DrawInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+    RecordIndirect(RECORD_DRAW_INSTANCED_INDIRECT, bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, DrawIndexedInstancedIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    _context->DrawIndexedInstancedIndirect(bufferForArgs, alignedByteOffsetForArgs);
+    RecordIndirect(RECORD_DRAW_INDEXED_INSTANCED_INDIRECT, bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  STDMETHOD_(void, Dispatch)(UINT threadGroupCountX, UINT threadGroupCountY, UINT threadGroupCountZ)
+  {
+    _context->Dispatch(threadGroupCountX, threadGroupCountY, threadGroupCountZ);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_DISPATCH, _record);
+    r.Put(threadGroupCountX);
+    r.Put(threadGroupCountY);
+    r.Put(threadGroupCountZ);
+  }
+
+  STDMETHOD_(void, DispatchIndirect)(ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    _context->DispatchIndirect(bufferForArgs, alignedByteOffsetForArgs);
+    RecordIndirect(RECORD_DISPATCH_INDIRECT, bufferForArgs, alignedByteOffsetForArgs);
+  }
+
+  // Resources
+
+  STDMETHOD(Map)(
+    ID3D11Resource *resource,
+    UINT subresource,
+    D3D11_MAP mapType,
+    UINT mapFlags,
+    D3D11_MAPPED_SUBRESOURCE *mappedResource)
+  {
+    HRESULT hr = _context->Map(resource, subresource, mapType, mapFlags, mappedResource);
+    if(FAILED(hr) || !mappedResource || !_recorder->Active())
+      return hr;
+    if(RECORD_MAX_MAPS == _maps)
+    {
+      D3DU_LOG(D3DU_LOG_WARNING, "Too many subresources mapped to record another.");
+      return hr;
+    }
+    PendingMap &m = _pending[_maps++];
+    m.Resource = resource;
+    m.Subresource = subresource;
+    m.Type = mapType;
+    m.Flags = mapFlags;
+    m.Mapped = *mappedResource;
+    return hr;
+  }
+
+  /// Keeps what was written before the memory goes away, and records
+  /// the map once the resource is unmapped, since declaring it may copy
+  /// its contents.
+  STDMETHOD_(void, Unmap)(ID3D11Resource *resource, UINT subresource)
+  {
+    UINT i = 0;
+    while(i < _maps && (_pending[i].Resource != resource || _pending[i].Subresource != subresource))
+      ++i;
+    if(i == _maps)
+    {
+      _context->Unmap(resource, subresource);
+      return;
+    }
+    PendingMap m = _pending[i];
+    _pending[i] = _pending[--_maps];
+    RecordLayout layout;
+    bool written = D3D11_MAP_READ != m.Type && RecordSubresourceLayout(resource, subresource, NULL, &layout);
+    _written.Clear();
+    if(written)
+      _written.PutRows(m.Mapped.pData, m.Mapped.RowPitch, m.Mapped.DepthPitch, layout);
+    _context->Unmap(resource, subresource);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_MAP, _record);
+    r.PutObject(resource);
+    r.Put(subresource);
+    r.Put(m.Type);
+    r.Put(m.Flags);
+    r.Put((UINT)(written ? 1 : 0));
+    r.Put(_written.GetData(), _written.GetSize());
+  }
+
+  STDMETHOD_(void, UpdateSubresource)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    const D3D11_BOX *dstBox,
+    const void *srcData,
+    UINT srcRowPitch,
+    UINT srcDepthPitch)
+  {
+    _context->UpdateSubresource(dstResource, dstSubresource, dstBox, srcData, srcRowPitch, srcDepthPitch);
+    RecordLayout layout;
+    if(!_recorder->Active() || !RecordSubresourceLayout(dstResource, dstSubresource, dstBox, &layout))
+      return;
+    CRecordScope r(_recorder, RECORD_UPDATE_SUBRESOURCE, _record);
+    r.PutObject(dstResource);
+    r.Put(dstSubresource);
+    r.PutOptional(dstBox, 1);
+    r.GetArgs().PutRows(srcData, srcRowPitch, srcDepthPitch, layout);
+  }
+
+  STDMETHOD_(void, CopyResource)(ID3D11Resource *dstResource, ID3D11Resource *srcResource)
+  {
+    _context->CopyResource(dstResource, srcResource);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_COPY_RESOURCE, _record);
+    r.PutObject(dstResource);
+    r.PutObject(srcResource);
+  }
+
+  STDMETHOD_(void, CopySubresourceRegion)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    UINT dstX,
+    UINT dstY,
+    UINT dstZ,
+    ID3D11Resource *srcResource,
+    UINT srcSubresource,
+    const D3D11_BOX *srcBox)
+  {
+    _context->CopySubresourceRegion(dstResource, dstSubresource, dstX, dstY, dstZ, srcResource, srcSubresource, srcBox);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_COPY_SUBRESOURCE_REGION, _record);
+    r.PutObject(dstResource);
+    r.Put(dstSubresource);
+    r.Put(dstX);
+    r.Put(dstY);
+    r.Put(dstZ);
+    r.PutObject(srcResource);
+    r.Put(srcSubresource);
+    r.PutOptional(srcBox, 1);
+  }
+
+  STDMETHOD_(void, CopyStructureCount)(ID3D11Buffer *dstBuffer, UINT dstAlignedByteOffset, ID3D11UnorderedAccessView *srcView)
+  {
+    _context->CopyStructureCount(dstBuffer, dstAlignedByteOffset, srcView);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_COPY_STRUCTURE_COUNT, _record);
+    r.PutObject(dstBuffer);
+    r.Put(dstAlignedByteOffset);
+    r.PutObject(srcView);
+  }
+
+  STDMETHOD_(void, ResolveSubresource)(
+    ID3D11Resource *dstResource,
+    UINT dstSubresource,
+    ID3D11Resource *srcResource,
+    UINT srcSubresource,
+    DXGI_FORMAT format)
+  {
+    _context->ResolveSubresource(dstResource, dstSubresource, srcResource, srcSubresource, format);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_RESOLVE_SUBRESOURCE, _record);
+    r.PutObject(dstResource);
+    r.Put(dstSubresource);
+    r.PutObject(srcResource);
+    r.Put(srcSubresource);
+    r.Put(format);
+  }
+
+  STDMETHOD_(void, GenerateMips)(ID3D11ShaderResourceView *shaderResourceView)
+  {
+    _context->GenerateMips(shaderResourceView);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_GENERATE_MIPS, _record);
+    r.PutObject(shaderResourceView);
+  }
+
+  STDMETHOD_(void, SetResourceMinLOD)(ID3D11Resource *resource, FLOAT minLOD)
+  {
+    _context->SetResourceMinLOD(resource, minLOD);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_RESOURCE_MIN_LOD, _record);
+    r.PutObject(resource);
+    r.Put(minLOD);
+  }
+
+  // Clears
+
+  STDMETHOD_(void, ClearRenderTargetView)(ID3D11RenderTargetView *renderTargetView, const FLOAT colorRGBA[4])
+  {
+    _context->ClearRenderTargetView(renderTargetView, colorRGBA);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_CLEAR_RENDER_TARGET_VIEW, _record);
+    r.PutObject(renderTargetView);
+    r.Put(colorRGBA, 4 * sizeof(FLOAT));
+  }
+
+  STDMETHOD_(void, ClearUnorderedAccessViewUint)(ID3D11UnorderedAccessView *unorderedAccessView, const UINT values[4])
+  {
+    _context->ClearUnorderedAccessViewUint(unorderedAccessView, values);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_CLEAR_UNORDERED_ACCESS_VIEW_UINT, _record);
+    r.PutObject(unorderedAccessView);
+    r.Put(values, 4 * sizeof(UINT));
+  }
+
+  STDMETHOD_(void, ClearUnorderedAccessViewFloat)(ID3D11UnorderedAccessView *unorderedAccessView, const FLOAT values[4])
+  {
+    _context->ClearUnorderedAccessViewFloat(unorderedAccessView, values);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_CLEAR_UNORDERED_ACCESS_VIEW_FLOAT, _record);
+    r.PutObject(unorderedAccessView);
+    r.Put(values, 4 * sizeof(FLOAT));
+  }
+
+  STDMETHOD_(void, ClearDepthStencilView)(ID3D11DepthStencilView *depthStencilView, UINT clearFlags, FLOAT depth, UINT8 stencil)
+  {
+    _context->ClearDepthStencilView(depthStencilView, clearFlags, depth, stencil);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_CLEAR_DEPTH_STENCIL_VIEW, _record);
+    r.PutObject(depthStencilView);
+    r.Put(clearFlags);
+    r.Put(depth);
+    r.Put((UINT)stencil);
+  }
+
+  // Queries
+
+  STDMETHOD_(void, Begin)(ID3D11Asynchronous *async)
+  {
+    _context->Begin(async);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_BEGIN, _record);
+    r.PutObject(async);
+  }
+
+  STDMETHOD_(void, End)(ID3D11Asynchronous *async)
+  {
+    _context->End(async);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_END, _record);
+    r.PutObject(async);
+  }
+
+  // Context
+
+  STDMETHOD_(void, ClearState)()
+  {
+    _context->ClearState();
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_CLEAR_STATE, _record);
+  }
+
+  STDMETHOD_(void, Flush)()
+  {
+    _context->Flush();
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_FLUSH, _record);
+  }
+
+  STDMETHOD_(void, ExecuteCommandList)(ID3D11CommandList *commandList, BOOL restoreContextState)
+  {
+    _context->ExecuteCommandList(commandList, restoreContextState);
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_EXECUTE_COMMAND_LIST, _record);
+    r.PutObject(commandList);
+    r.Put(restoreContextState);
+  }
+
+  STDMETHOD(FinishCommandList)(BOOL restoreDeferredContextState, ID3D11CommandList **commandList)
+  {
+    HRESULT hr = _context->FinishCommandList(restoreDeferredContextState, commandList);
+    if(FAILED(hr) || !commandList || !_recorder->Active())
+      return hr;
+    CRecordScope r(_recorder, RECORD_FINISH_COMMAND_LIST, _record);
+    r.Put(restoreDeferredContextState);
+    r.Put(_recorder->Finished(*commandList));
+    return hr;
+  }
+
+private:
+  typedef struct
+  {
+    ID3D11Resource *Resource;
+    UINT Subresource;
+    D3D11_MAP Type;
+    UINT Flags;
+    D3D11_MAPPED_SUBRESOURCE Mapped;
+  } PendingMap;
+
+  ComPtr<CCommandRecorder> _recorder;
+  RecordContext _record;
+  PendingMap _pending[RECORD_MAX_MAPS];
+  UINT _maps;
+  CRecordBuffer _written;
+
+  template<class T>
+  void RecordSlots(UINT op, D3DU_SHADER_STAGE stage, UINT startSlot, UINT count, T *const *objects)
+  {
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, op, _record);
+    r.Put((UINT)stage);
+    r.Put(startSlot);
+    r.PutObjects(count, objects);
+  }
+
+  /// Class instances are not recorded.
+  void RecordShader(D3DU_SHADER_STAGE stage, ID3D11DeviceChild *shader)
+  {
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, RECORD_SET_SHADER, _record);
+    r.Put((UINT)stage);
+    r.PutObject(shader);
+  }
+
+  void RecordIndirect(UINT op, ID3D11Buffer *bufferForArgs, UINT alignedByteOffsetForArgs)
+  {
+    if(!_recorder->Active())
+      return;
+    CRecordScope r(_recorder, op, _record);
+    r.PutObject(bufferForArgs);
+    r.Put(alignedByteOffsetForArgs);
+  }
+};
+
+/// Keeps shader bytecode and input layouts with the objects, so that
+/// recordings can declare them, and records what is created while a
+/// recording is under way.
+class D3DU_NOVTABLE CRecordingDevice :
+  public CDeviceProxy<ID3D11Device>
+{
+public:
+
+  /// Other interfaces are the real device's, like CInstrumentedDevice.
+  STDMETHOD(QueryInterface)(REFIID riid, LPVOID *oObject)
+  {
+    if(__uuidof(IUnknown) == riid || __uuidof(ID3D11Device) == riid)
+    {
+      *oObject = (ID3D11Device*)this;
+      AddRef();
+      return S_OK;
+    }
+    return _device->QueryInterface(riid, oObject);
+  }
+
+  CRecordingDevice()
+  {
+    _recorder.Attach(new ComObject<CCommandRecorder>());
+  }
+
+  virtual ~CRecordingDevice() { }
+
+  STDMETHOD(Construct)(ID3D11Device *device)
+  {
+    _device = device;
+    return S_OK;
+  }
+
+  STDMETHOD(CreateImmediateContext)(ID3D11DeviceContext *context, ID3D11DeviceContext **oContext)
+  {
+    return Wrap(context, oContext);
+  }
+
+  STDMETHOD(StartRecording)(LPCWSTR filename)
+  {
+    return _recorder->Start(filename, _device->GetFeatureLevel());
+  }
+
+  STDMETHOD(StopRecording)()
+  {
+    return _recorder->Stop();
+  }
+
+  STDMETHOD_(void, EndFrame)()
+  {
+    _recorder->EndFrame();
+  }
+
+  STDMETHOD(CreateDeferredContext)(UINT contextFlags, ID3D11DeviceContext **deferredContext)
+  {
+    HRESULT hr;
+    ComPtr<ID3D11DeviceContext> context;
+    hr = _device->CreateDeferredContext(contextFlags, &context);
+    if(FAILED(hr) || !deferredContext)
+      return hr;
+    return Wrap(context, deferredContext);
+  }
+
+  // Resources
+
+  STDMETHOD(CreateBuffer)(
+    const D3D11_BUFFER_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Buffer **buffer)
+  {
+    return Created(_device->CreateBuffer(desc, initialData, buffer), buffer, initialData);
+  }
+
+  STDMETHOD(CreateTexture1D)(
+    const D3D11_TEXTURE1D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture1D **texture1D)
+  {
+    return Created(_device->CreateTexture1D(desc, initialData, texture1D), texture1D, initialData);
+  }
+
+  STDMETHOD(CreateTexture2D)(
+    const D3D11_TEXTURE2D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture2D **texture2D)
+  {
+    return Created(_device->CreateTexture2D(desc, initialData, texture2D), texture2D, initialData);
+  }
+
+  STDMETHOD(CreateTexture3D)(
+    const D3D11_TEXTURE3D_DESC *desc,
+    const D3D11_SUBRESOURCE_DATA *initialData,
+    ID3D11Texture3D **texture3D)
+  {
+    return Created(_device->CreateTexture3D(desc, initialData, texture3D), texture3D, initialData);
+  }
+
+  // Views and states
+
+  STDMETHOD(CreateShaderResourceView)(
+    ID3D11Resource *resource,
+    const D3D11_SHADER_RESOURCE_VIEW_DESC *desc,
+    ID3D11ShaderResourceView **srv)
+  {
+    return Created(_device->CreateShaderResourceView(resource, desc, srv), srv);
+  }
+
+  STDMETHOD(CreateUnorderedAccessView)(
+    ID3D11Resource *resource,
+    const D3D11_UNORDERED_ACCESS_VIEW_DESC *desc,
+    ID3D11UnorderedAccessView **uav)
+  {
+    return Created(_device->CreateUnorderedAccessView(resource, desc, uav), uav);
+  }
+
+  STDMETHOD(CreateRenderTargetView)(
+    ID3D11Resource *resource,
+    const D3D11_RENDER_TARGET_VIEW_DESC *desc,
+    ID3D11RenderTargetView **rtv)
+  {
+    return Created(_device->CreateRenderTargetView(resource, desc, rtv), rtv);
+  }
+
+  STDMETHOD(CreateDepthStencilView)(
+    ID3D11Resource *resource,
+    const D3D11_DEPTH_STENCIL_VIEW_DESC *desc,
+    ID3D11DepthStencilView **depthStencilView)
+  {
+    return Created(_device->CreateDepthStencilView(resource, desc, depthStencilView), depthStencilView);
+  }
+
+  STDMETHOD(CreateBlendState)(const D3D11_BLEND_DESC *blendStateDesc, ID3D11BlendState **blendState)
+  {
+    return Created(_device->CreateBlendState(blendStateDesc, blendState), blendState);
+  }
+
+  STDMETHOD(CreateDepthStencilState)(
+    const D3D11_DEPTH_STENCIL_DESC *depthStencilDesc,
+    ID3D11DepthStencilState **depthStencilState)
+  {
+    return Created(_device->CreateDepthStencilState(depthStencilDesc, depthStencilState), depthStencilState);
+  }
+
+  STDMETHOD(CreateRasterizerState)(
+    const D3D11_RASTERIZER_DESC *rasterizerDesc,
+    ID3D11RasterizerState **rasterizerState)
+  {
+    return Created(_device->CreateRasterizerState(rasterizerDesc, rasterizerState), rasterizerState);
+  }
+
+  STDMETHOD(CreateSamplerState)(const D3D11_SAMPLER_DESC *samplerDesc, ID3D11SamplerState **samplerState)
+  {
+    return Created(_device->CreateSamplerState(samplerDesc, samplerState), samplerState);
+  }
+
+  STDMETHOD(CreateQuery)(const D3D11_QUERY_DESC *queryDesc, ID3D11Query **query)
+  {
+    return Created(_device->CreateQuery(queryDesc, query), query);
+  }
+
+  STDMETHOD(CreatePredicate)(const D3D11_QUERY_DESC *predicateDesc, ID3D11Predicate **predicate)
+  {
+    return Created(_device->CreatePredicate(predicateDesc, predicate), predicate);
+  }
+
+  STDMETHOD(CreateCounter)(const D3D11_COUNTER_DESC *counterDesc, ID3D11Counter **counter)
+  {
+    return Created(_device->CreateCounter(counterDesc, counter), counter);
+  }
+
+  // Shaders
+
+  STDMETHOD(CreateVertexShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11VertexShader **vertexShader)
+  {
+    HRESULT hr = _device->CreateVertexShader(shaderBytecode, bytecodeLength, classLinkage, vertexShader);
+    return Compiled(hr, vertexShader, shaderBytecode, bytecodeLength);
+  }
+
+  STDMETHOD(CreateHullShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11HullShader **hullShader)
+  {
+    HRESULT hr = _device->CreateHullShader(shaderBytecode, bytecodeLength, classLinkage, hullShader);
+    return Compiled(hr, hullShader, shaderBytecode, bytecodeLength);
+  }
+
+  STDMETHOD(CreateDomainShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11DomainShader **domainShader)
+  {
+    HRESULT hr = _device->CreateDomainShader(shaderBytecode, bytecodeLength, classLinkage, domainShader);
+    return Compiled(hr, domainShader, shaderBytecode, bytecodeLength);
+  }
+
+  STDMETHOD(CreateGeometryShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11GeometryShader **geometryShader)
+  {
+    HRESULT hr = _device->CreateGeometryShader(shaderBytecode, bytecodeLength, classLinkage, geometryShader);
+    return Compiled(hr, geometryShader, shaderBytecode, bytecodeLength);
+  }
+
+  /// Replays create a plain geometry shader from the bytecode.
+  STDMETHOD(CreateGeometryShaderWithStreamOutput)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    const D3D11_SO_DECLARATION_ENTRY *soDeclaration,
+    UINT numEntries,
+    const UINT *bufferStrides,
+    UINT numStrides,
+    UINT rasterizedStream,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11GeometryShader **geometryShader)
+  {
+    HRESULT hr = _device->CreateGeometryShaderWithStreamOutput(shaderBytecode, bytecodeLength, soDeclaration, numEntries, bufferStrides, numStrides, rasterizedStream, classLinkage, geometryShader);
+    return Compiled(hr, geometryShader, shaderBytecode, bytecodeLength);
+  }
+
+  STDMETHOD(CreatePixelShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11PixelShader **pixelShader)
+  {
+    HRESULT hr = _device->CreatePixelShader(shaderBytecode, bytecodeLength, classLinkage, pixelShader);
+    return Compiled(hr, pixelShader, shaderBytecode, bytecodeLength);
+  }
+
+  STDMETHOD(CreateComputeShader)(
+    const void *shaderBytecode,
+    SIZE_T bytecodeLength,
+    ID3D11ClassLinkage *classLinkage,
+    ID3D11ComputeShader **computeShader)
+  {
+    HRESULT hr = _device->CreateComputeShader(shaderBytecode, bytecodeLength, classLinkage, computeShader);
+    return Compiled(hr, computeShader, shaderBytecode, bytecodeLength);
+  }
+
+  /// Keeps the elements, names included, and the bytecode in the form
+  /// RECORD_CREATE_INPUT_LAYOUT takes them.
+  STDMETHOD(CreateInputLayout)(
+    const D3D11_INPUT_ELEMENT_DESC *inputElementDescs,
+    UINT numElements,
+    const void *shaderBytecodeWithInputSignature,
+    SIZE_T bytecodeLength,
+    ID3D11InputLayout **inputLayout)
+  {
+    HRESULT hr = _device->CreateInputLayout(inputElementDescs, numElements, shaderBytecodeWithInputSignature, bytecodeLength, inputLayout);
+    if(S_OK != hr || !inputLayout)
+      return hr;
+    CRecordBuffer layout;
+    layout.Put(numElements);
+    for(UINT i = 0; i < numElements; ++i)
+    {
+      const D3D11_INPUT_ELEMENT_DESC &e = inputElementDescs[i];
+      UINT length = (UINT)strlen(e.SemanticName);
+      layout.Put(length);
+      layout.Put(e.SemanticName, length);
+      layout.Put(e.SemanticIndex);
+      layout.Put(e.Format);
+      layout.Put(e.InputSlot);
+      layout.Put(e.AlignedByteOffset);
+      layout.Put(e.InputSlotClass);
+      layout.Put(e.InstanceDataStepRate);
+    }
+    layout.Put((UINT)bytecodeLength);
+    layout.Put(shaderBytecodeWithInputSignature, bytecodeLength);
+    (*inputLayout)->SetPrivateData(RECORD_LAYOUT_KEY, (UINT)layout.GetSize(), layout.GetData());
+    return Created(hr, inputLayout);
+  }
+
+private:
+  ComPtr<CCommandRecorder> _recorder;
+
+  /// Output pointers are NULL when only validating parameters.
+  template<class T>
+  HRESULT Created(HRESULT hr, T **object)
+  {
+    if(S_OK == hr && object && _recorder->Active())
+    {
+      CAutoLock lock(_recorder->GetLock());
+      _recorder->Resolve(*object, NULL, false);
+    }
+    return hr;
+  }
+
+  template<class T>
+  HRESULT Created(HRESULT hr, T **resource, const D3D11_SUBRESOURCE_DATA *initialData)
+  {
+    if(S_OK == hr && resource && _recorder->Active())
+    {
+      CAutoLock lock(_recorder->GetLock());
+      _recorder->Created(*resource, initialData);
+    }
+    return hr;
+  }
+
+  template<class T>
+  HRESULT Compiled(HRESULT hr, T **shader, const void *bytecode, SIZE_T length)
+  {
+    if(S_OK != hr || !shader)
+      return hr;
+    (*shader)->SetPrivateData(RECORD_BYTECODE_KEY, (UINT)length, bytecode);
+    return Created(hr, shader);
+  }
+
+  HRESULT Wrap(ID3D11DeviceContext *context, ID3D11DeviceContext **oContext)
+  {
+    HRESULT hr;
+    ComObject<CRecordingContext> *recording = new ComObject<CRecordingContext>();
+    hr = recording->Construct(context, _recorder);
+    if(FAILED(hr))
+    {
+      delete recording;
+      return hr;
+    }
+    *oContext = recording;
+    return S_OK;
+  }
+};
+
+#endif // __RECORDING_HPP__
@@ -0,0 +1,514 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "FrameStats.hpp"
+#include "PixelUtils.hpp"
+#include "Log.hpp"
+#include <math.h>
+#include <float.h>
+
+/// Defaults for zero fields of D3DU_REGRESSION_DESC.
+#define REGRESSION_WIDTH 640
+#define REGRESSION_HEIGHT 480
+#define REGRESSION_FRAMES 120
+#define REGRESSION_FRAME_SECONDS (1.0f / 60)
+#define REGRESSION_MIN_PSNR 40.0f
+#define REGRESSION_MAX_ERROR 16
+#define REGRESSION_TIME_TOLERANCE 0.25f
+#define REGRESSION_TIME_SLACK 0.5f
+
+/// Baselines are small text files; anything larger is not one.
+#define REGRESSION_MAX_BASELINE 4096
+
+/// Waiting for the GPU yields to other threads for this long, so that
+/// fast frames are timed closely, and then sleeps with Sleep(1) until
+/// the timeout.
+#define REGRESSION_WAIT_YIELD_MS 2
+#define REGRESSION_WAIT_TIMEOUT_MS 10000
+
+static void GetDefaults(const D3DU_REGRESSION_DESC *desc, D3DU_REGRESSION_DESC *oDesc)
+{
+  *oDesc = *desc;
+  if(!oDesc->Width)
+    oDesc->Width = REGRESSION_WIDTH;
+  if(!oDesc->Height)
+    oDesc->Height = REGRESSION_HEIGHT;
+  if(!oDesc->Frames)
+    oDesc->Frames = REGRESSION_FRAMES;
+  if(oDesc->FrameSeconds <= 0)
+    oDesc->FrameSeconds = REGRESSION_FRAME_SECONDS;
+  if(!oDesc->FeatureLevel)
+    oDesc->FeatureLevel = D3D_FEATURE_LEVEL_10_0;
+  if(oDesc->MinPsnr <= 0)
+    oDesc->MinPsnr = REGRESSION_MIN_PSNR;
+  if(!oDesc->MaxError)
+    oDesc->MaxError = REGRESSION_MAX_ERROR;
+  if(oDesc->TimeTolerance <= 0)
+    oDesc->TimeTolerance = REGRESSION_TIME_TOLERANCE;
+  if(oDesc->TimeSlack <= 0)
+    oDesc->TimeSlack = REGRESSION_TIME_SLACK;
+}
+
+static FLOAT Milliseconds(unsigned us)
+{
+  return us / 1000.0f;
+}
+
+static void GetStatistics(const CFrameTimeHistogram &h, D3DU_FRAME_TIME_STATISTICS *oStats)
+{
+  oStats->Samples = h.Count;
+  oStats->Min = Milliseconds(h.Min());
+  oStats->Mean = (FLOAT)(h.Mean() / 1000.0);
+  oStats->P50 = Milliseconds(h.Percentile(0.50));
+  oStats->P95 = Milliseconds(h.Percentile(0.95));
+  oStats->P99 = Milliseconds(h.Percentile(0.99));
+  oStats->Max = Milliseconds(h.Max());
+}
+
+static HRESULT ReadWholeFile(LPCWSTR filename, DWORD maxSize, BYTE **oData, DWORD *oSize)
+{
+  HRESULT hr = S_OK;
+  LARGE_INTEGER size;
+  DWORD read;
+  HANDLE file = CreateFile(
+    filename,
+    GENERIC_READ,
+    FILE_SHARE_READ,
+    NULL,
+    OPEN_EXISTING,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    NULL);
+  if(INVALID_HANDLE_VALUE == file)
+    return HRESULT_FROM_WIN32(GetLastError());
+  if(!GetFileSizeEx(file, &size))
+  {
+    hr = HRESULT_FROM_WIN32(GetLastError());
+    CloseHandle(file);
+    return hr;
+  }
+  if(size.QuadPart > maxSize)
+  {
+    CloseHandle(file);
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  // One more byte, so that text can be terminated.
+  BYTE *data = new BYTE[(SIZE_T)size.QuadPart + 1];
+  if(!ReadFile(file, data, (DWORD)size.QuadPart, &read, NULL))
+    hr = HRESULT_FROM_WIN32(GetLastError());
+  else if(read != (DWORD)size.QuadPart)
+    hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  CloseHandle(file);
+  if(FAILED(hr))
+  {
+    delete[] data;
+    return hr;
+  }
+  data[read] = 0;
+  *oData = data;
+  *oSize = read;
+  return S_OK;
+}
+
+static HRESULT WriteWholeFile(LPCWSTR filename, const void *head, DWORD headSize, const void *data, DWORD size)
+{
+  HRESULT hr = S_OK;
+  DWORD written;
+  HANDLE file = CreateFile(
+    filename,
+    GENERIC_WRITE,
+    0,
+    NULL,
+    CREATE_ALWAYS,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    NULL);
+  if(INVALID_HANDLE_VALUE == file)
+    return HRESULT_FROM_WIN32(GetLastError());
+  if(!WriteFile(file, head, headSize, &written, NULL)
+    || (size && !WriteFile(file, data, size, &written, NULL)))
+    hr = HRESULT_FROM_WIN32(GetLastError());
+  CloseHandle(file);
+  return hr;
+}
+
+/// Top-down 32bpp BGRA, which is also what BMP keeps.
+static HRESULT ReadFrame(ID3DUTarget *target, UINT width, UINT height, BYTE *oPixels)
+{
+  HRESULT hr;
+  ComPtr<ID3D11Device> device;
+  ComPtr<ID3D11DeviceContext> dc;
+  ComPtr<ID3D11RenderTargetView> rtv;
+  ComPtr<ID3D11Texture2D> color;
+  ComPtr<ID3D11Texture2D> resolved;
+  ComPtr<ID3D11Texture2D> staging;
+  D3D11_TEXTURE2D_DESC td;
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  BOOL bgra;
+  target->GetDevice(&device);
+  target->GetDC(&dc);
+  target->GetFrameRTV(&rtv);
+  rtv->GetResource((ID3D11Resource**)&color);
+  color->GetDesc(&td);
+  switch(td.Format)
+  {
+  case DXGI_FORMAT_R8G8B8A8_UNORM:
+  case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    bgra = FALSE;
+    break;
+  case DXGI_FORMAT_B8G8R8A8_UNORM:
+  case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+    bgra = TRUE;
+    break;
+  default:
+    D3DU_LOG(D3DU_LOG_ERROR, "Unable to compare frames of format %u.", (UINT)td.Format);
+    return E_INVALIDARG;
+  }
+  if(td.Width != width || td.Height != height)
+    return E_UNEXPECTED;
+  UINT samples = td.SampleDesc.Count;
+  td.SampleDesc.Count = 1;
+  td.SampleDesc.Quality = 0;
+  td.BindFlags = 0;
+  td.MiscFlags = 0;
+  if(samples > 1)
+  {
+    hr = device->CreateTexture2D(&td, NULL, &resolved);
+    if(FAILED(hr))
+      return hr;
+    dc->ResolveSubresource(resolved, 0, color, 0, td.Format);
+    color = resolved;
+  }
+  td.Usage = D3D11_USAGE_STAGING;
+  td.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  hr = device->CreateTexture2D(&td, NULL, &staging);
+  if(FAILED(hr))
+    return hr;
+  dc->CopyResource(staging, color);
+  hr = dc->Map(staging, 0, D3D11_MAP_READ, 0, &mapped);
+  if(FAILED(hr))
+    return hr;
+  PixelCopyBgra(oPixels, (const BYTE*)mapped.pData, mapped.RowPitch, width, height, bgra);
+  dc->Unmap(staging, 0);
+  return S_OK;
+}
+
+/// Negative height marks rows as top-down.
+static HRESULT WriteBitmap(LPCWSTR filename, const BYTE *pixels, UINT width, UINT height)
+{
+  BITMAPFILEHEADER file;
+  BITMAPINFOHEADER info;
+  BYTE head[sizeof(file) + sizeof(info)];
+  DWORD size = width * height * 4;
+  memset(&file, 0, sizeof(file));
+  memset(&info, 0, sizeof(info));
+  file.bfType = 0x4D42;
+  file.bfOffBits = sizeof(head);
+  file.bfSize = sizeof(head) + size;
+  info.biSize = sizeof(info);
+  info.biWidth = (LONG)width;
+  info.biHeight = -(LONG)height;
+  info.biPlanes = 1;
+  info.biBitCount = 32;
+  info.biCompression = BI_RGB;
+  info.biSizeImage = size;
+  memcpy(head, &file, sizeof(file));
+  memcpy(head + sizeof(file), &info, sizeof(info));
+  return WriteWholeFile(filename, head, sizeof(head), pixels, size);
+}
+
+/// Takes 32bpp BI_RGB bitmaps either way up.
+static HRESULT ReadBitmap(LPCWSTR filename, UINT width, UINT height, BYTE *oPixels)
+{
+  HRESULT hr;
+  BYTE *data;
+  DWORD size;
+  hr = ReadWholeFile(filename, 0x7FFFFFFF, &data, &size);
+  if(FAILED(hr))
+    return hr;
+  BITMAPFILEHEADER file;
+  BITMAPINFOHEADER info;
+  DWORD rowSize = width * 4;
+  hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  if(size >= sizeof(file) + sizeof(info))
+  {
+    memcpy(&file, data, sizeof(file));
+    memcpy(&info, data + sizeof(file), sizeof(info));
+    UINT rows = info.biHeight < 0 ? (UINT)-info.biHeight : (UINT)info.biHeight;
+    if(0x4D42 != file.bfType
+      || 32 != info.biBitCount
+      || BI_RGB != info.biCompression)
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "%s is not a 32bpp bitmap.", filename);
+    }
+    else if((UINT)info.biWidth != width || rows != height)
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "Golden image is %u x %u, frames are %u x %u.", (UINT)info.biWidth, rows, width, height);
+    }
+    else if(file.bfOffBits <= size && size - file.bfOffBits >= rowSize * height)
+    {
+      for(UINT y = 0; y < height; ++y)
+      {
+        UINT row = info.biHeight < 0 ? y : height - 1 - y;
+        memcpy(oPixels + y * rowSize, data + file.bfOffBits + row * rowSize, rowSize);
+      }
+      hr = S_OK;
+    }
+  }
+  delete[] data;
+  return hr;
+}
+
+static HRESULT WriteBaseline(LPCWSTR filename, const D3DU_FRAME_TIME_STATISTICS &stats)
+{
+  CHAR text[256];
+  int n = sprintf_s(
+    text,
+    sizeof(text),
+    "samples %u\r\nmin %.3f\r\nmean %.3f\r\np50 %.3f\r\np95 %.3f\r\np99 %.3f\r\nmax %.3f\r\n",
+    stats.Samples,
+    stats.Min,
+    stats.Mean,
+    stats.P50,
+    stats.P95,
+    stats.P99,
+    stats.Max);
+  if(n < 0)
+    return E_UNEXPECTED;
+  return WriteWholeFile(filename, text, (DWORD)n, NULL, 0);
+}
+
+static HRESULT ReadBaseline(LPCWSTR filename, D3DU_FRAME_TIME_STATISTICS *oStats)
+{
+  HRESULT hr;
+  BYTE *data;
+  DWORD size;
+  hr = ReadWholeFile(filename, REGRESSION_MAX_BASELINE, &data, &size);
+  if(FAILED(hr))
+    return hr;
+  int n = sscanf_s(
+    (const char*)data,
+    " samples %u min %f mean %f p50 %f p95 %f p99 %f max %f",
+    &oStats->Samples,
+    &oStats->Min,
+    &oStats->Mean,
+    &oStats->P50,
+    &oStats->P95,
+    &oStats->P99,
+    &oStats->Max);
+  delete[] data;
+  return 7 == n ? S_OK : HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+}
+
+/// Waits until the GPU has got to `fence', without spinning a core
+/// for frames that take long.
+static HRESULT WaitForFence(ID3D11DeviceContext *dc, ID3D11Query *fence, const LARGE_INTEGER &freq)
+{
+  HRESULT hr;
+  LARGE_INTEGER start, now;
+  QueryPerformanceCounter(&start);
+  for(;;)
+  {
+    hr = dc->GetData(fence, NULL, 0, 0);
+    if(S_FALSE != hr)
+      return hr;
+    QueryPerformanceCounter(&now);
+    LONGLONG ms = (now.QuadPart - start.QuadPart) * 1000 / freq.QuadPart;
+    if(ms >= REGRESSION_WAIT_TIMEOUT_MS)
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "The GPU did not finish a frame in %u ms.", REGRESSION_WAIT_TIMEOUT_MS);
+      return DXGI_ERROR_WAS_STILL_DRAWING;
+    }
+    if(ms < REGRESSION_WAIT_YIELD_MS)
+      SwitchToThread();
+    else
+      Sleep(1);
+  }
+}
+
+/// Renders `frames' frames, waiting for the device after each, so that
+/// the times cover the work of the frame rather than only submitting it.
+/// The first frame, which pays for state created on first use, is left out.
+static HRESULT DrawFrames(ID3DUTarget *target, UINT frames, CFrameTimeHistogram *oTimes)
+{
+  HRESULT hr;
+  ComPtr<ID3D11Device> device;
+  ComPtr<ID3D11DeviceContext> dc;
+  ComPtr<ID3D11Query> fence;
+  D3D11_QUERY_DESC qd;
+  LARGE_INTEGER freq, start, end;
+  qd.Query = D3D11_QUERY_EVENT;
+  qd.MiscFlags = 0;
+  target->GetDevice(&device);
+  target->GetDC(&dc);
+  hr = device->CreateQuery(&qd, &fence);
+  if(FAILED(hr))
+    return hr;
+  QueryPerformanceFrequency(&freq);
+  for(UINT i = 0; i < frames; ++i)
+  {
+    QueryPerformanceCounter(&start);
+    hr = target->Render();
+    if(FAILED(hr))
+      return hr;
+    dc->End(fence);
+    dc->Flush();
+    hr = WaitForFence(dc, fence, freq);
+    if(FAILED(hr))
+      return hr;
+    QueryPerformanceCounter(&end);
+    if(!i)
+      continue;
+    LONGLONG us = (end.QuadPart - start.QuadPart) * 1000000 / freq.QuadPart;
+    oTimes->Add(us < 0 ? 0 : us > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned)us);
+  }
+  return S_OK;
+}
+
+static HRESULT CheckImage(ID3DUTarget *target, const D3DU_REGRESSION_DESC &desc, D3DU_REGRESSION_RESULT *oResult)
+{
+  HRESULT hr;
+  SIZE_T count = (SIZE_T)desc.Width * desc.Height;
+  BYTE *frame = new BYTE[count * 4];
+  BYTE *golden = NULL;
+  hr = ReadFrame(target, desc.Width, desc.Height, frame);
+  if(SUCCEEDED(hr) && (desc.Flags & D3DU_REGRESSION_UPDATE))
+  {
+    hr = WriteBitmap(desc.GoldenImage, frame, desc.Width, desc.Height);
+    if(FAILED(hr))
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to write %s (0x%08X).", desc.GoldenImage, hr);
+    else
+      D3DU_LOG(D3DU_LOG_INFO, "Golden image written to %s.", desc.GoldenImage);
+  }
+  else if(SUCCEEDED(hr))
+  {
+    golden = new BYTE[count * 4];
+    hr = ReadBitmap(desc.GoldenImage, desc.Width, desc.Height, golden);
+    if(FAILED(hr))
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to read %s (0x%08X).", desc.GoldenImage, hr);
+  }
+  if(golden && SUCCEEDED(hr))
+  {
+    UINT64 squares;
+    UINT maxError;
+    PixelCompare(frame, golden, count, &squares, &maxError);
+    oResult->MaxError = maxError;
+    if(squares)
+      oResult->Psnr = (FLOAT)(10.0 * log10(255.0 * 255.0 * 3 * count / (double)squares));
+    oResult->ImageMatches = oResult->Psnr >= desc.MinPsnr && maxError <= desc.MaxError;
+    if(oResult->ImageMatches)
+      D3DU_LOG(D3DU_LOG_INFO, "Last frame matches %s: PSNR %.2f dB, max error %u.", desc.GoldenImage, (double)oResult->Psnr, maxError);
+    else
+      D3DU_LOG(D3DU_LOG_ERROR, "Last frame differs from %s: PSNR %.2f dB, max error %u.", desc.GoldenImage, (double)oResult->Psnr, maxError);
+  }
+  delete[] golden;
+  delete[] frame;
+  return hr;
+}
+
+static HRESULT CheckTimes(const D3DU_REGRESSION_DESC &desc, D3DU_REGRESSION_RESULT *oResult)
+{
+  HRESULT hr;
+  const D3DU_FRAME_TIME_STATISTICS &now = oResult->FrameTimes;
+  const D3DU_FRAME_TIME_STATISTICS &base = oResult->Baseline;
+  if(desc.Flags & D3DU_REGRESSION_UPDATE)
+  {
+    hr = WriteBaseline(desc.Baseline, now);
+    if(FAILED(hr))
+      D3DU_LOG(D3DU_LOG_ERROR, "Unable to write %s (0x%08X).", desc.Baseline, hr);
+    else
+      D3DU_LOG(D3DU_LOG_INFO, "Baseline written to %s.", desc.Baseline);
+    oResult->Baseline = now;
+    return hr;
+  }
+  hr = ReadBaseline(desc.Baseline, &oResult->Baseline);
+  if(FAILED(hr))
+  {
+    D3DU_LOG(D3DU_LOG_ERROR, "Unable to read %s (0x%08X).", desc.Baseline, hr);
+    return hr;
+  }
+  FLOAT scale = 1 + desc.TimeTolerance;
+  oResult->TimesMatch =
+    now.P50 <= base.P50 * scale + desc.TimeSlack
+    && now.P95 <= base.P95 * scale + desc.TimeSlack;
+  if(oResult->TimesMatch)
+    D3DU_LOG(D3DU_LOG_INFO, "Frame times match: p50 %.3f ms, p95 %.3f ms.", (double)now.P50, (double)now.P95);
+  else
+    D3DU_LOG(
+      D3DU_LOG_ERROR,
+      "Frame times regressed: p50 %.3f ms against %.3f, p95 %.3f ms against %.3f.",
+      (double)now.P50,
+      (double)base.P50,
+      (double)now.P95,
+      (double)base.P95);
+  return S_OK;
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DURunRegression(
+  ID3DUFrameSink *sink,
+  const D3DU_REGRESSION_DESC *desc,
+  D3DU_REGRESSION_RESULT *oResult)
+{
+  HRESULT hr;
+  D3DU_REGRESSION_DESC d;
+  D3DU_REGRESSION_RESULT result;
+  CFrameTimeHistogram times;
+  ComPtr<ID3DUDevice> device;
+  ComPtr<ID3DUTarget> target;
+  if(oResult)
+    memset(oResult, 0, sizeof(*oResult));
+  if(!sink || !desc)
+    return E_INVALIDARG;
+  GetDefaults(desc, &d);
+  memset(&result, 0, sizeof(result));
+  result.ImageMatches = TRUE;
+  result.TimesMatch = TRUE;
+  result.Psnr = FLT_MAX;
+  hr = D3DUCreateSoftwareDevice(d.FeatureLevel, &device);
+  if(FAILED(hr))
+    return hr;
+  hr = D3DUCreateOffscreenTarget(device, d.Width, d.Height, d.TargetDesc, &target);
+  if(FAILED(hr))
+  {
+    D3DU_LOG(D3DU_LOG_ERROR, "Unable to create regression target (0x%08X).", hr);
+    return hr;
+  }
+  D3DUSetFixedClock(d.FrameSeconds);
+  target->SetFrameSink(sink);
+  hr = DrawFrames(target, d.Frames, &times);
+  if(SUCCEEDED(hr) && d.GoldenImage)
+    hr = CheckImage(target, d, &result);
+  target->SetFrameSink(NULL);
+  D3DUSetFixedClock(0);
+  if(FAILED(hr))
+    return hr;
+  GetStatistics(times, &result.FrameTimes);
+  if(d.Baseline)
+  {
+    hr = CheckTimes(d, &result);
+    if(FAILED(hr))
+      return hr;
+  }
+  if(oResult)
+    *oResult = result;
+  return result.ImageMatches && result.TimesMatch ? S_OK : S_FALSE;
+}
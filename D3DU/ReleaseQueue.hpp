@@ -0,0 +1,271 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __RELEASE_QUEUE_HPP__
+#define __RELEASE_QUEUE_HPP__
+
+#include <d3d11.h>
+#include "ComUtils.hpp"
+
+#define RELEASE_QUEUE_INITIAL_CAPACITY 64
+#define QUERY_FENCE_DEPTH 8
+
+/// Tells how far the GPU has got. Frames are numbered from 1, and
+/// GetCompleted returns 0 until the first one is done.
+/// CQueryFence is the one the target uses; CMockFence stands in for it
+/// in D3DUTest.
+class IFrameFence
+{
+public:
+  virtual ~IFrameFence() { }
+  /// Called after everything of `frame' is submitted.
+  virtual void Signal(unsigned long long frame) = 0;
+  /// Newest frame the GPU has finished. Must not block.
+  virtual unsigned long long GetCompleted() = 0;
+};
+
+/// Completes frames only when told to, so that a test can hold the GPU
+/// back at any frame.
+class CMockFence :
+  public IFrameFence
+{
+public:
+  CMockFence()
+  {
+    _signaled = 0;
+    _completed = 0;
+  }
+
+  void Signal(unsigned long long frame)
+  {
+    _signaled = frame;
+  }
+
+  unsigned long long GetCompleted()
+  {
+    return _completed;
+  }
+
+  /// Pretends the GPU got through `frame'.
+  void Complete(unsigned long long frame)
+  {
+    _completed = frame;
+  }
+
+  unsigned long long GetSignaled() const
+  {
+    return _signaled;
+  }
+
+private:
+  unsigned long long _signaled;
+  unsigned long long _completed;
+};
+
+/// Keeps released objects alive until the GPU is past the frame that
+/// released them, so that tearing down and rebuilding resources never
+/// makes the driver wait for work still in flight, or keep shadow copies.
+/// Objects queue in release order, which is also frame order, so
+/// collecting only ever looks at the head of the queue.
+/// Without a fence everything is freed at the end of the frame.
+/// Render thread only.
+class CReleaseQueue
+{
+public:
+  CReleaseQueue()
+  {
+    _fence = NULL;
+    _entries = NULL;
+    _head = 0;
+    _count = 0;
+    _capacity = 0;
+    _frame = 1;
+  }
+
+  ~CReleaseQueue()
+  {
+    Flush();
+    delete[] _entries;
+  }
+
+  /// Not owned.
+  void SetFence(IFrameFence *fence)
+  {
+    _fence = fence;
+  }
+
+  /// Takes a reference to `object', given up once the current frame is done.
+  void Add(IUnknown *object)
+  {
+    if(!object)
+      return;
+    if(_count == _capacity)
+      Grow();
+    Entry &e = _entries[(_head + _count) % _capacity];
+    object->AddRef();
+    e.Object = object;
+    e.Frame = _frame;
+    ++_count;
+  }
+
+  void EndFrame()
+  {
+    if(_fence)
+      _fence->Signal(_frame);
+    ++_frame;
+    Collect();
+  }
+
+  void Collect()
+  {
+    if(!_fence)
+    {
+      Flush();
+      return;
+    }
+    if(!_count)
+      return;
+    unsigned long long completed = _fence->GetCompleted();
+    while(_count && _entries[_head].Frame <= completed)
+      Pop();
+  }
+
+  /// Frees everything at once, when the device goes away.
+  void Flush()
+  {
+    while(_count)
+      Pop();
+  }
+
+  unsigned GetCount() const
+  {
+    return _count;
+  }
+
+  /// Frame objects added now are tagged with.
+  unsigned long long GetFrame() const
+  {
+    return _frame;
+  }
+
+private:
+  typedef struct
+  {
+    IUnknown *Object;
+    unsigned long long Frame;
+  } Entry;
+
+  IFrameFence *_fence;
+  Entry *_entries;
+  unsigned _head;
+  unsigned _count;
+  unsigned _capacity;
+  unsigned long long _frame;
+
+  void Pop()
+  {
+    IUnknown *object = _entries[_head].Object;
+    _head = (_head + 1) % _capacity;
+    --_count;
+    object->Release();
+  }
+
+  void Grow()
+  {
+    unsigned capacity = _capacity ? _capacity * 2 : RELEASE_QUEUE_INITIAL_CAPACITY;
+    Entry *entries = new Entry[capacity];
+    for(unsigned i = 0; i < _count; ++i)
+      entries[i] = _entries[(_head + i) % _capacity];
+    delete[] _entries;
+    _entries = entries;
+    _head = 0;
+    _capacity = capacity;
+  }
+};
+
+/// Fence made of event queries, one per frame in flight.
+/// The GPU finishes frames in order, so the newest query that is done
+/// covers all older ones, and older queries are not polled at all.
+/// Should the CPU run more than QUERY_FENCE_DEPTH frames ahead, a slot
+/// is reused before its query is seen; that frame is simply covered by
+/// a later one.
+class CQueryFence :
+  public IFrameFence
+{
+public:
+  CQueryFence()
+  {
+    _last = 0;
+    _completed = 0;
+    memset(_frames, 0, sizeof(_frames));
+  }
+
+  HRESULT Init(ID3D11Device *device, ID3D11DeviceContext *context)
+  {
+    HRESULT hr;
+    D3D11_QUERY_DESC qd = { D3D11_QUERY_EVENT, 0 };
+    for(UINT i = 0; i < QUERY_FENCE_DEPTH; ++i)
+    {
+      _queries[i].Release();
+      hr = device->CreateQuery(&qd, &_queries[i]);
+      if(FAILED(hr))
+        return hr;
+    }
+    _context = context;
+    return S_OK;
+  }
+
+  void Signal(unsigned long long frame)
+  {
+    UINT slot = (UINT)(frame % QUERY_FENCE_DEPTH);
+    _context->End(_queries[slot]);
+    _frames[slot] = frame;
+    _last = frame;
+  }
+
+  unsigned long long GetCompleted()
+  {
+    unsigned long long oldest = _last > QUERY_FENCE_DEPTH ? _last - QUERY_FENCE_DEPTH + 1 : 1;
+    if(oldest <= _completed)
+      oldest = _completed + 1;
+    for(unsigned long long frame = _last; frame >= oldest && frame > 0; --frame)
+    {
+      UINT slot = (UINT)(frame % QUERY_FENCE_DEPTH);
+      if(_frames[slot] == frame
+        && S_OK == _context->GetData(_queries[slot], NULL, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH))
+      {
+        _completed = frame;
+        break;
+      }
+    }
+    return _completed;
+  }
+
+private:
+  ComPtr<ID3D11DeviceContext> _context;
+  ComPtr<ID3D11Query> _queries[QUERY_FENCE_DEPTH];
+  unsigned long long _frames[QUERY_FENCE_DEPTH];
+  unsigned long long _last;
+  unsigned long long _completed;
+};
+
+#endif // __RELEASE_QUEUE_HPP__
@@ -0,0 +1,261 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "RenderGraph.hpp"
+#include "Log.hpp"
+
+class D3DU_NOVTABLE CRenderGraph :
+  public ID3DURenderGraph
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameSink)
+    INTERFACE_MAP_ENTRY(ID3DURenderGraph)
+  END_INTERFACE_MAP
+
+  CRenderGraph()
+  {
+    _target = NULL;
+    _width = 0;
+    _height = 0;
+    _dirty = TRUE;
+    _rendering = FALSE;
+    _uniqueCount = 0;
+    memset(_descs, 0, sizeof(_descs));
+    memset(_textures, 0, sizeof(_textures));
+    _compiler.AddResource(0, true);
+  }
+
+  virtual ~CRenderGraph() { }
+
+  STDMETHOD_(void, Attach)(ID3DUTarget *target)
+  {
+    _target = target;
+    target->GetSize(&_width, &_height);
+    _dirty = TRUE;
+    for(UINT i = 0; i < _compiler.GetPassCount(); ++i)
+      _passes[i]->Attach(target);
+  }
+
+  STDMETHOD_(void, Detach)(ID3DUTarget *target)
+  {
+    for(UINT i = 0; i < _compiler.GetPassCount(); ++i)
+      _passes[i]->Detach(target);
+    _target = NULL;
+  }
+
+  STDMETHOD_(void, RenderFrame)(ID3DUTarget *target)
+  {
+    HRESULT hr;
+    ComPtr<ID3DUResourcePool> pool;
+    if(_dirty && FAILED(Compile()))
+      return;
+    target->GetResourcePool(&pool);
+    for(UINT i = 0; i < _compiler.GetPhysicalCount(); ++i)
+    {
+      hr = pool->AcquireTexture(&_physicalDescs[i], D3DU_POOL_DEFAULT, &_textures[i]);
+      if(FAILED(hr))
+      {
+        D3DU_LOG(D3DU_LOG_WARNING, "Unable to acquire render graph texture (0x%08X). Frame skipped.", hr);
+        return;
+      }
+    }
+    target->GetFrameRTV(&_rtv);
+    target->GetFrameDSV(&_dsv);
+    _rendering = TRUE;
+    for(UINT i = 0; i < _compiler.GetOrderCount(); ++i)
+      _passes[_compiler.GetOrder(i)]->RenderFrame(target);
+    _rendering = FALSE;
+    _rtv.Release();
+    _dsv.Release();
+  }
+
+  STDMETHOD_(void, Resize)(ID3DUTarget *target, UINT width, UINT height)
+  {
+    _width = width;
+    _height = height;
+    _dirty = TRUE;
+    for(UINT i = 0; i < _compiler.GetPassCount(); ++i)
+      _passes[i]->Resize(target, width, height);
+  }
+
+  STDMETHOD(CreateTexture)(const D3D11_TEXTURE2D_DESC *desc, UINT *oResource)
+  {
+    if(!oResource)
+      return E_POINTER;
+    if(!desc)
+      return E_INVALIDARG;
+    if(_rendering)
+      return E_FAIL;
+    UINT resource = _compiler.AddResource(0, false);
+    if(RENDER_GRAPH_NONE == resource)
+      return E_OUTOFMEMORY;
+    _descs[resource] = *desc;
+    _dirty = TRUE;
+    *oResource = resource;
+    return S_OK;
+  }
+
+  STDMETHOD(AddPass)(
+    ID3DUFrameSink *pass,
+    UINT readCount,
+    const UINT *reads,
+    UINT writeCount,
+    const UINT *writes,
+    UINT flags)
+  {
+    if(!pass || (readCount && !reads) || (writeCount && !writes))
+      return E_INVALIDARG;
+    if(_rendering)
+      return E_FAIL;
+    UINT index = _compiler.AddPass(reads, readCount, writes, writeCount, 0 != (flags & D3DU_GRAPH_PASS_KEEP));
+    if(RENDER_GRAPH_NONE == index)
+      return E_INVALIDARG;
+    _passes[index] = pass;
+    _dirty = TRUE;
+    if(_target)
+      pass->Attach(_target);
+    return S_OK;
+  }
+
+  STDMETHOD(Compile)()
+  {
+    _uniqueCount = 0;
+    for(UINT i = 0; i < _compiler.GetResourceCount(); ++i)
+    {
+      if(D3DU_GRAPH_BACK_BUFFER != i)
+        _compiler.SetResourceDesc(i, ResolveDesc(_descs[i]));
+    }
+    if(!_compiler.Compile())
+    {
+      D3DU_LOG(D3DU_LOG_ERROR, "Render graph pass reads a texture before any pass writes it.");
+      return E_FAIL;
+    }
+    for(UINT i = 0; i < _compiler.GetPhysicalCount(); ++i)
+      _physicalDescs[i] = _unique[_compiler.GetPhysicalDesc(i)];
+    _dirty = FALSE;
+    return S_OK;
+  }
+
+  STDMETHOD(GetTexture)(UINT resource, D3DU_POOLED_TEXTURE *oTexture)
+  {
+    if(!oTexture)
+      return E_POINTER;
+    memset(oTexture, 0, sizeof(*oTexture));
+    if(!_rendering || resource >= _compiler.GetResourceCount())
+      return E_INVALIDARG;
+    if(D3DU_GRAPH_BACK_BUFFER == resource)
+    {
+      oTexture->RTV = _rtv;
+      oTexture->DSV = _dsv;
+      oTexture->Width = _width;
+      oTexture->Height = _height;
+      return S_OK;
+    }
+    UINT physical = _compiler.GetPhysical(resource);
+    if(RENDER_GRAPH_NONE == physical)
+      return E_INVALIDARG;
+    *oTexture = _textures[physical];
+    return S_OK;
+  }
+
+  STDMETHOD(Clear)()
+  {
+    if(_rendering)
+      return E_FAIL;
+    for(UINT i = 0; i < _compiler.GetPassCount(); ++i)
+    {
+      if(_target)
+        _passes[i]->Detach(_target);
+      _passes[i].Release();
+    }
+    _compiler.Reset();
+    _compiler.AddResource(0, true);
+    _dirty = TRUE;
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_GRAPH_STATISTICS *oStats)
+  {
+    HRESULT hr;
+    if(!oStats)
+      return E_POINTER;
+    if(_dirty)
+    {
+      hr = Compile();
+      if(FAILED(hr))
+        return hr;
+    }
+    oStats->PassCount = _compiler.GetPassCount();
+    oStats->PassesCulled = _compiler.GetPassCount() - _compiler.GetOrderCount();
+    oStats->ResourceCount = _compiler.GetResourceCount() - 1;
+    oStats->TextureCount = _compiler.GetPhysicalCount();
+    return S_OK;
+  }
+
+private:
+  ID3DUTarget *_target;
+  UINT _width;
+  UINT _height;
+  BOOL _dirty;
+  BOOL _rendering;
+  CRenderGraphCompiler _compiler;
+  ComPtr<ID3DUFrameSink> _passes[RENDER_GRAPH_MAX_PASSES];
+  D3D11_TEXTURE2D_DESC _descs[RENDER_GRAPH_MAX_RESOURCES];
+  D3D11_TEXTURE2D_DESC _unique[RENDER_GRAPH_MAX_RESOURCES];
+  UINT _uniqueCount;
+  D3D11_TEXTURE2D_DESC _physicalDescs[RENDER_GRAPH_MAX_RESOURCES];
+  D3DU_POOLED_TEXTURE _textures[RENDER_GRAPH_MAX_RESOURCES];
+  ComPtr<ID3D11RenderTargetView> _rtv;
+  ComPtr<ID3D11DepthStencilView> _dsv;
+
+  /// Resources with equal descriptors after sizing get equal ids,
+  /// which is what lets the compiler alias them.
+  UINT ResolveDesc(const D3D11_TEXTURE2D_DESC &desc)
+  {
+    D3D11_TEXTURE2D_DESC d = desc;
+    if(0 == d.Width)
+      d.Width = _width;
+    if(0 == d.Height)
+      d.Height = _height;
+    for(UINT i = 0; i < _uniqueCount; ++i)
+    {
+      if(0 == memcmp(&_unique[i], &d, sizeof(d)))
+        return i;
+    }
+    _unique[_uniqueCount] = d;
+    return _uniqueCount++;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateRenderGraph(
+  ID3DURenderGraph **oGraph)
+{
+  if(!oGraph)
+    return E_POINTER;
+  *oGraph = new ComObject<CRenderGraph>();
+  return S_OK;
+}
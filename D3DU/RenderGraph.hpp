@@ -0,0 +1,427 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __RENDER_GRAPH_HPP__
+#define __RENDER_GRAPH_HPP__
+
+/// Render graph compiler.
+///
+/// Passes declare the resources they read and write. Compile() orders
+/// them, culls the ones whose results nobody uses, and assigns resources
+/// whose lifetimes do not overlap to shared physical textures.
+///
+/// Ordering: passes are added in the order their accesses take effect.
+/// Every write makes a new version of a resource, and a read sees the
+/// version of the last pass before it that wrote the resource. So a
+/// reader depends on that writer, and a writer depends on the previous
+/// writer and on every pass that read the resource since. A pass that
+/// adds to what a resource holds, by blending say, reads and writes it.
+/// Since all dependencies point back to earlier passes, live passes run
+/// in the order they were added.
+///
+/// Culling: passes writing an imported resource (the back buffer) and
+/// passes added with `keep' set are roots. The writers of the versions
+/// they read survive, transitively; the rest is culled. A write nobody
+/// reads before the next write is dead, and so is its pass unless it
+/// has another reason to live.
+///
+/// Transient resources hold nothing at the start of a frame, so
+/// Compile() fails when a live pass reads one before any pass wrote it.
+///
+/// Aliasing: resources get the same `descId' when one texture can stand
+/// in for another. Each resource lives from the first to the last live
+/// pass touching it; resources of equal `descId' share a physical texture
+/// when their lifetimes are disjoint.
+///
+/// This header does not depend on Direct3D, so graphs can be compiled
+/// and checked without a device.
+
+/// Passes are sets of bits in 64 bit masks, so no more than 64.
+#define RENDER_GRAPH_MAX_PASSES 64
+#define RENDER_GRAPH_MAX_RESOURCES 64
+#define RENDER_GRAPH_MAX_ACCESSES 512
+#define RENDER_GRAPH_NONE 0xFFFFFFFFu
+
+class CRenderGraphCompiler
+{
+public:
+  CRenderGraphCompiler()
+  {
+    Reset();
+  }
+
+  void Reset()
+  {
+    _passCount = 0;
+    _resourceCount = 0;
+    _accessCount = 0;
+    _orderCount = 0;
+    _physicalCount = 0;
+  }
+
+  /// Returns RENDER_GRAPH_NONE when full.
+  unsigned AddResource(unsigned descId, bool imported)
+  {
+    if(_resourceCount == RENDER_GRAPH_MAX_RESOURCES)
+      return RENDER_GRAPH_NONE;
+    Resource &r = _resources[_resourceCount];
+    r.DescId = descId;
+    r.Imported = imported;
+    return _resourceCount++;
+  }
+
+  void SetResourceDesc(unsigned resource, unsigned descId)
+  {
+    _resources[resource].DescId = descId;
+  }
+
+  /// Returns RENDER_GRAPH_NONE when full or a resource is unknown.
+  unsigned AddPass(
+    const unsigned *reads,
+    unsigned readCount,
+    const unsigned *writes,
+    unsigned writeCount,
+    bool keep)
+  {
+    if(_passCount == RENDER_GRAPH_MAX_PASSES
+      || _accessCount + readCount + writeCount > RENDER_GRAPH_MAX_ACCESSES)
+      return RENDER_GRAPH_NONE;
+    for(unsigned i = 0; i < readCount; ++i)
+    {
+      if(reads[i] >= _resourceCount)
+        return RENDER_GRAPH_NONE;
+    }
+    for(unsigned i = 0; i < writeCount; ++i)
+    {
+      if(writes[i] >= _resourceCount)
+        return RENDER_GRAPH_NONE;
+    }
+    Pass &p = _passes[_passCount];
+    p.First = _accessCount;
+    p.ReadCount = readCount;
+    p.WriteCount = writeCount;
+    p.Keep = keep;
+    for(unsigned i = 0; i < readCount; ++i)
+      _accesses[_accessCount++] = reads[i];
+    for(unsigned i = 0; i < writeCount; ++i)
+      _accesses[_accessCount++] = writes[i];
+    return _passCount++;
+  }
+
+  /// Returns false when a live pass reads a transient resource
+  /// no earlier pass writes.
+  bool Compile()
+  {
+    _orderCount = 0;
+    _physicalCount = 0;
+    Link();
+    Cull();
+    for(unsigned i = 0; i < _passCount; ++i)
+    {
+      if(_passes[i].Live && _passes[i].ReadsUndefined)
+        return false;
+    }
+    Sort();
+    ComputeLifetimes();
+    Alias();
+    return true;
+  }
+
+  unsigned GetPassCount() const
+  {
+    return _passCount;
+  }
+
+  unsigned GetResourceCount() const
+  {
+    return _resourceCount;
+  }
+
+  /// Number of live passes, in execution order.
+  unsigned GetOrderCount() const
+  {
+    return _orderCount;
+  }
+
+  unsigned GetOrder(unsigned position) const
+  {
+    return _order[position];
+  }
+
+  bool IsCulled(unsigned pass) const
+  {
+    return !_passes[pass].Live;
+  }
+
+  /// Whether `after' has to run after `before', directly.
+  bool DependsOn(unsigned after, unsigned before) const
+  {
+    return 0 != (_passes[after].After & Bit(before));
+  }
+
+  /// RENDER_GRAPH_NONE for imported and unused resources.
+  unsigned GetPhysical(unsigned resource) const
+  {
+    return _resources[resource].Physical;
+  }
+
+  unsigned GetPhysicalCount() const
+  {
+    return _physicalCount;
+  }
+
+  unsigned GetPhysicalDesc(unsigned physical) const
+  {
+    return _physical[physical].DescId;
+  }
+
+  /// Positions in execution order, RENDER_GRAPH_NONE when unused.
+  unsigned GetFirstUse(unsigned resource) const
+  {
+    return _resources[resource].FirstUse;
+  }
+
+  unsigned GetLastUse(unsigned resource) const
+  {
+    return _resources[resource].LastUse;
+  }
+
+private:
+  typedef unsigned long long PassMask;
+
+  struct Pass
+  {
+    unsigned First;
+    unsigned ReadCount;
+    unsigned WriteCount;
+    bool Keep;
+    bool Live;
+    /// Writers of the versions the pass reads.
+    PassMask Sources;
+    /// Every pass it has to run after: sources, and for each resource
+    /// it writes, the previous writer and the readers since.
+    PassMask After;
+    bool ReadsUndefined;
+  };
+
+  struct Resource
+  {
+    unsigned DescId;
+    bool Imported;
+    unsigned FirstUse;
+    unsigned LastUse;
+    unsigned Physical;
+  };
+
+  struct Physical
+  {
+    unsigned DescId;
+    unsigned LastUse;
+  };
+
+  Pass _passes[RENDER_GRAPH_MAX_PASSES];
+  Resource _resources[RENDER_GRAPH_MAX_RESOURCES];
+  unsigned _accesses[RENDER_GRAPH_MAX_ACCESSES];
+  unsigned _order[RENDER_GRAPH_MAX_PASSES];
+  Physical _physical[RENDER_GRAPH_MAX_RESOURCES];
+  unsigned _passCount;
+  unsigned _resourceCount;
+  unsigned _accessCount;
+  unsigned _orderCount;
+  unsigned _physicalCount;
+
+  bool Reads(unsigned pass, unsigned resource) const
+  {
+    const Pass &p = _passes[pass];
+    for(unsigned i = 0; i < p.ReadCount; ++i)
+    {
+      if(_accesses[p.First + i] == resource)
+        return true;
+    }
+    return false;
+  }
+
+  bool Writes(unsigned pass, unsigned resource) const
+  {
+    const Pass &p = _passes[pass];
+    for(unsigned i = 0; i < p.WriteCount; ++i)
+    {
+      if(_accesses[p.First + p.ReadCount + i] == resource)
+        return true;
+    }
+    return false;
+  }
+
+  bool Touches(unsigned pass, unsigned resource) const
+  {
+    return Reads(pass, resource) || Writes(pass, resource);
+  }
+
+  static PassMask Bit(unsigned pass)
+  {
+    return (PassMask)1 << pass;
+  }
+
+  /// Finds the dependencies of every pass, going over the passes in
+  /// order and keeping the last writer of each resource and the passes
+  /// that read it since.
+  void Link()
+  {
+    unsigned writer[RENDER_GRAPH_MAX_RESOURCES];
+    PassMask readers[RENDER_GRAPH_MAX_RESOURCES];
+    for(unsigned r = 0; r < _resourceCount; ++r)
+    {
+      writer[r] = RENDER_GRAPH_NONE;
+      readers[r] = 0;
+    }
+    for(unsigned i = 0; i < _passCount; ++i)
+    {
+      Pass &p = _passes[i];
+      const unsigned *reads = _accesses + p.First;
+      const unsigned *writes = reads + p.ReadCount;
+      p.Sources = 0;
+      p.ReadsUndefined = false;
+      for(unsigned j = 0; j < p.ReadCount; ++j)
+      {
+        unsigned r = reads[j];
+        if(RENDER_GRAPH_NONE != writer[r])
+          p.Sources |= Bit(writer[r]);
+        else if(!_resources[r].Imported)
+          p.ReadsUndefined = true;
+      }
+      p.After = p.Sources;
+      for(unsigned j = 0; j < p.WriteCount; ++j)
+      {
+        unsigned r = writes[j];
+        if(RENDER_GRAPH_NONE != writer[r])
+          p.After |= Bit(writer[r]);
+        p.After |= readers[r];
+      }
+      // Only now, so that a pass reading and writing a resource reads
+      // the version before its own.
+      for(unsigned j = 0; j < p.ReadCount; ++j)
+        readers[reads[j]] |= Bit(i);
+      for(unsigned j = 0; j < p.WriteCount; ++j)
+      {
+        writer[writes[j]] = i;
+        readers[writes[j]] = 0;
+      }
+    }
+  }
+
+  /// Walks back from the roots over the writers of what live passes read.
+  void Cull()
+  {
+    unsigned stack[RENDER_GRAPH_MAX_PASSES];
+    unsigned top = 0;
+    for(unsigned i = 0; i < _passCount; ++i)
+    {
+      Pass &p = _passes[i];
+      p.Live = p.Keep;
+      for(unsigned j = 0; j < p.WriteCount && !p.Live; ++j)
+        p.Live = _resources[_accesses[p.First + p.ReadCount + j]].Imported;
+      if(p.Live)
+        stack[top++] = i;
+    }
+    while(top > 0)
+    {
+      PassMask sources = _passes[stack[--top]].Sources;
+      for(unsigned k = 0; k < _passCount; ++k)
+      {
+        if(!(sources & Bit(k)) || _passes[k].Live)
+          continue;
+        _passes[k].Live = true;
+        stack[top++] = k;
+      }
+    }
+  }
+
+  /// Kahn's algorithm over live passes; ties go to the pass added first.
+  /// Dependencies only point back, so this keeps the order passes were
+  /// added in, less the culled ones.
+  void Sort()
+  {
+    PassMask done = 0;
+    PassMask live = 0;
+    for(unsigned i = 0; i < _passCount; ++i)
+    {
+      if(_passes[i].Live)
+        live |= Bit(i);
+      else
+        done |= Bit(i);
+    }
+    while(live & ~done)
+    {
+      unsigned next = 0;
+      while((done & Bit(next)) || (_passes[next].After & live & ~done))
+        ++next;
+      done |= Bit(next);
+      _order[_orderCount++] = next;
+    }
+  }
+
+  void ComputeLifetimes()
+  {
+    for(unsigned r = 0; r < _resourceCount; ++r)
+    {
+      Resource &res = _resources[r];
+      res.FirstUse = RENDER_GRAPH_NONE;
+      res.LastUse = RENDER_GRAPH_NONE;
+      res.Physical = RENDER_GRAPH_NONE;
+      for(unsigned i = 0; i < _orderCount; ++i)
+      {
+        if(!Touches(_order[i], r))
+          continue;
+        if(RENDER_GRAPH_NONE == res.FirstUse)
+          res.FirstUse = i;
+        res.LastUse = i;
+      }
+    }
+  }
+
+  /// Greedy interval assignment in order of first use.
+  void Alias()
+  {
+    for(unsigned position = 0; position < _orderCount; ++position)
+    {
+      for(unsigned r = 0; r < _resourceCount; ++r)
+      {
+        Resource &res = _resources[r];
+        if(res.Imported || res.FirstUse != position)
+          continue;
+        unsigned p = 0;
+        while(p < _physicalCount
+          && !(_physical[p].DescId == res.DescId && _physical[p].LastUse < position))
+          ++p;
+        if(p == _physicalCount)
+        {
+          _physical[p].DescId = res.DescId;
+          ++_physicalCount;
+        }
+        _physical[p].LastUse = res.LastUse;
+        res.Physical = p;
+      }
+    }
+  }
+};
+
+#endif // __RENDER_GRAPH_HPP__
@@ -0,0 +1,213 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "RenderQueue.hpp"
+#include "Trace.hpp"
+
+#define RENDER_QUEUE_INITIAL_CAPACITY 256
+
+class D3DU_NOVTABLE CRenderQueue :
+  public ID3DURenderQueue
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DURenderQueue)
+  END_INTERFACE_MAP
+
+  CRenderQueue()
+  {
+    _packets = NULL;
+    _items = NULL;
+    _scratch = NULL;
+    _count = 0;
+    _capacity = 0;
+    memset(&_stats, 0, sizeof(_stats));
+  }
+
+  virtual ~CRenderQueue()
+  {
+    delete[] _packets;
+    delete[] _items;
+    delete[] _scratch;
+  }
+
+  STDMETHOD_(UINT64, MakeKey)(UINT pass, UINT shader, UINT material, FLOAT depth, UINT instance)
+  {
+    return RenderQueueKey(pass, shader, material, RenderQueueDepth(depth), instance);
+  }
+
+  STDMETHOD(Add)(UINT64 key, const D3DU_DRAW_PACKET *packet)
+  {
+    if(!packet)
+      return E_INVALIDARG;
+    if(_count == _capacity)
+      Grow();
+    _packets[_count] = *packet;
+    _items[_count].Key = key;
+    _items[_count].Index = _count;
+    ++_count;
+    return S_OK;
+  }
+
+  STDMETHOD(Submit)(ID3D11DeviceContext *context)
+  {
+    HRESULT hr;
+    ComPtr<ID3DUStateCache> cache;
+    D3DU_STATE_CACHE_STATISTICS before, after;
+    if(!context)
+      return E_INVALIDARG;
+    D3DU_TRACE_ZONE("RenderQueue::Submit");
+    hr = GetCache(context, &cache);
+    if(FAILED(hr))
+      return hr;
+    RenderQueueItem *sorted = RenderQueueSort(_items, _scratch, _count);
+    cache->GetStatistics(&before);
+    for(UINT i = 0; i < _count; ++i)
+      Draw(cache, _packets[sorted[i].Index]);
+    cache->GetStatistics(&after);
+    _stats.PacketCount = _count;
+    _stats.StateChanges = after.Misses - before.Misses;
+    _stats.StateChangesFiltered = after.Hits - before.Hits;
+    _count = 0;
+    return S_OK;
+  }
+
+  STDMETHOD(Clear)()
+  {
+    _count = 0;
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_QUEUE_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    *oStats = _stats;
+    return S_OK;
+  }
+
+private:
+  D3DU_DRAW_PACKET *_packets;
+  RenderQueueItem *_items;
+  RenderQueueItem *_scratch;
+  UINT _count;
+  UINT _capacity;
+  D3DU_QUEUE_STATISTICS _stats;
+  ComPtr<ID3DUStateCache> _cache;
+  ComPtr<ID3D11DeviceContext> _cachedContext;
+
+  void Grow()
+  {
+    UINT capacity = _capacity ? _capacity * 2 : RENDER_QUEUE_INITIAL_CAPACITY;
+    D3DU_DRAW_PACKET *packets = new D3DU_DRAW_PACKET[capacity];
+    RenderQueueItem *items = new RenderQueueItem[capacity];
+    RenderQueueItem *scratch = new RenderQueueItem[capacity];
+    if(_count)
+    {
+      memcpy(packets, _packets, _count * sizeof(D3DU_DRAW_PACKET));
+      memcpy(items, _items, _count * sizeof(RenderQueueItem));
+    }
+    delete[] _packets;
+    delete[] _items;
+    delete[] _scratch;
+    _packets = packets;
+    _items = items;
+    _scratch = scratch;
+    _capacity = capacity;
+  }
+
+  /// The device context already is a state cache; deferred ones are not.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE GetCache(ID3D11DeviceContext *context, ID3DUStateCache **oCache)
+  {
+    HRESULT hr;
+    ID3DUStateCache *cache;
+    if(SUCCEEDED(context->QueryInterface(__uuidof(ID3DUStateCache), (void**)&cache)))
+    {
+      // Interfaces of this library do not AddRef in QueryInterface.
+      cache->AddRef();
+      *oCache = cache;
+      return S_OK;
+    }
+    if(_cachedContext != context)
+    {
+      _cache.Release();
+      _cachedContext.Release();
+      hr = D3DUCreateStateCache(context, &_cache);
+      if(FAILED(hr))
+        return hr;
+      _cachedContext = context;
+    }
+    else
+    {
+      _cache->Invalidate();
+    }
+    _cache.AddRef();
+    *oCache = _cache;
+    return S_OK;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Draw(ID3D11DeviceContext *dc, const D3DU_DRAW_PACKET &p)
+  {
+    dc->IASetInputLayout(p.InputLayout);
+    dc->IASetPrimitiveTopology(p.Topology);
+    dc->IASetVertexBuffers(0, D3DU_PACKET_VERTEX_BUFFERS, p.VertexBuffers, p.Strides, p.Offsets);
+    dc->IASetIndexBuffer(p.IndexBuffer, p.IndexFormat, 0);
+    dc->VSSetShader(p.VS, NULL, 0);
+    dc->VSSetConstantBuffers(0, D3DU_PACKET_CONSTANT_BUFFERS, p.VSConstantBuffers);
+    dc->PSSetShader(p.PS, NULL, 0);
+    dc->PSSetConstantBuffers(0, D3DU_PACKET_CONSTANT_BUFFERS, p.PSConstantBuffers);
+    dc->PSSetShaderResources(0, D3DU_PACKET_RESOURCES, p.PSResources);
+    dc->PSSetSamplers(0, D3DU_PACKET_SAMPLERS, p.PSSamplers);
+    dc->RSSetState(p.RasterizerState);
+    dc->OMSetBlendState(p.BlendState, NULL, 0xFFFFFFFF);
+    dc->OMSetDepthStencilState(p.DepthStencilState, p.StencilRef);
+    // Plain draws would read per-instance data from instance 0.
+    BOOL instanced = p.InstanceCount > 1 || p.StartInstance;
+    UINT instances = p.InstanceCount ? p.InstanceCount : 1;
+    if(p.IndexCount)
+    {
+      if(instanced)
+        dc->DrawIndexedInstanced(p.IndexCount, instances, p.StartIndex, p.BaseVertex, p.StartInstance);
+      else
+        dc->DrawIndexed(p.IndexCount, p.StartIndex, p.BaseVertex);
+    }
+    else
+    {
+      if(instanced)
+        dc->DrawInstanced(p.VertexCount, instances, p.StartVertex, p.StartInstance);
+      else
+        dc->Draw(p.VertexCount, p.StartVertex);
+    }
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateRenderQueue(
+  ID3DURenderQueue **oQueue)
+{
+  if(!oQueue)
+    return E_POINTER;
+  *oQueue = new ComObject<CRenderQueue>();
+  return S_OK;
+}
@@ -0,0 +1,136 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __RENDER_QUEUE_HPP__
+#define __RENDER_QUEUE_HPP__
+
+/// Sort keys and the sort behind ID3DURenderQueue.
+///
+/// Keys pack, from the most significant bits down, the pass, the shader,
+/// the material, the depth and an instance tie breaker:
+///
+///   | pass 4 | shader 12 | material 16 | depth 24 | instance 8 |
+///
+/// Sorting by key therefore runs passes in order, and within a pass
+/// groups draws by shader, then by material, so that each shader and
+/// each material is bound once per pass. Depth sorts front to back
+/// inside a material, which helps early depth rejection. Fields wider
+/// than their bits are truncated.
+///
+/// The sort is an LSD radix sort over the eight key bytes. Byte positions
+/// where all keys agree, typically the high pass bits and unused shader
+/// bits, are skipped, so few distinct values sort in fewer than eight
+/// passes. It is stable, so equal keys keep the order they were added in.
+///
+/// This header does not depend on Direct3D.
+
+#define RENDER_QUEUE_PASS_BITS 4
+#define RENDER_QUEUE_SHADER_BITS 12
+#define RENDER_QUEUE_MATERIAL_BITS 16
+#define RENDER_QUEUE_DEPTH_BITS 24
+#define RENDER_QUEUE_INSTANCE_BITS 8
+
+#define RENDER_QUEUE_INSTANCE_SHIFT 0
+#define RENDER_QUEUE_DEPTH_SHIFT (RENDER_QUEUE_INSTANCE_SHIFT + RENDER_QUEUE_INSTANCE_BITS)
+#define RENDER_QUEUE_MATERIAL_SHIFT (RENDER_QUEUE_DEPTH_SHIFT + RENDER_QUEUE_DEPTH_BITS)
+#define RENDER_QUEUE_SHADER_SHIFT (RENDER_QUEUE_MATERIAL_SHIFT + RENDER_QUEUE_MATERIAL_BITS)
+#define RENDER_QUEUE_PASS_SHIFT (RENDER_QUEUE_SHADER_SHIFT + RENDER_QUEUE_SHADER_BITS)
+
+struct RenderQueueItem
+{
+  unsigned long long Key;
+  unsigned Index;
+};
+
+inline unsigned long long RenderQueueField(unsigned value, unsigned bits, unsigned shift)
+{
+  return ((unsigned long long)value & ((1ull << bits) - 1)) << shift;
+}
+
+/// `depth' is clamped to [0, 1] and quantized to 24 bits.
+inline unsigned RenderQueueDepth(float depth)
+{
+  const unsigned max = (1u << RENDER_QUEUE_DEPTH_BITS) - 1;
+  if(!(depth > 0.0f))
+    return 0;
+  if(depth >= 1.0f)
+    return max;
+  return (unsigned)(depth * (float)max);
+}
+
+inline unsigned long long RenderQueueKey(
+  unsigned pass,
+  unsigned shader,
+  unsigned material,
+  unsigned depth,
+  unsigned instance)
+{
+  return RenderQueueField(pass, RENDER_QUEUE_PASS_BITS, RENDER_QUEUE_PASS_SHIFT)
+    | RenderQueueField(shader, RENDER_QUEUE_SHADER_BITS, RENDER_QUEUE_SHADER_SHIFT)
+    | RenderQueueField(material, RENDER_QUEUE_MATERIAL_BITS, RENDER_QUEUE_MATERIAL_SHIFT)
+    | RenderQueueField(depth, RENDER_QUEUE_DEPTH_BITS, RENDER_QUEUE_DEPTH_SHIFT)
+    | RenderQueueField(instance, RENDER_QUEUE_INSTANCE_BITS, RENDER_QUEUE_INSTANCE_SHIFT);
+}
+
+/// Sorts `count' items by key. `scratch' has room for as many; the
+/// result ends up in either array, the one returned.
+inline RenderQueueItem *RenderQueueSort(RenderQueueItem *items, RenderQueueItem *scratch, unsigned count)
+{
+  unsigned histograms[8][256];
+  RenderQueueItem *src = items;
+  RenderQueueItem *dst = scratch;
+  if(count < 2)
+    return items;
+  for(unsigned b = 0; b < 8; ++b)
+  {
+    for(unsigned i = 0; i < 256; ++i)
+      histograms[b][i] = 0;
+  }
+  for(unsigned i = 0; i < count; ++i)
+  {
+    unsigned long long key = items[i].Key;
+    for(unsigned b = 0; b < 8; ++b)
+      ++histograms[b][(unsigned)(key >> (b * 8)) & 0xFF];
+  }
+  for(unsigned b = 0; b < 8; ++b)
+  {
+    unsigned *histogram = histograms[b];
+    unsigned shift = b * 8;
+    if(histogram[(unsigned)(src[0].Key >> shift) & 0xFF] == count)
+      continue;
+    unsigned offset = 0;
+    for(unsigned i = 0; i < 256; ++i)
+    {
+      unsigned n = histogram[i];
+      histogram[i] = offset;
+      offset += n;
+    }
+    for(unsigned i = 0; i < count; ++i)
+      dst[histogram[(unsigned)(src[i].Key >> shift) & 0xFF]++] = src[i];
+    RenderQueueItem *t = src;
+    src = dst;
+    dst = t;
+  }
+  return src;
+}
+
+#endif // __RENDER_QUEUE_HPP__
@@ -0,0 +1,156 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __RESOLUTION_CONTROLLER_HPP__
+#define __RESOLUTION_CONTROLLER_HPP__
+
+/// Picks a render scale from measured frame times.
+///
+/// Frame times are averaged over a window of frames. Pixel cost grows with
+/// the square of the scale, so the scale is corrected by the square root of
+/// budget / average. Going down reacts to any frame window over budget,
+/// going up only when there is clear headroom, and by smaller steps, so
+/// the scale settles instead of oscillating around the budget. Scales are
+/// quantized to 1/32 steps, and the window restarts after each change so
+/// that the next decision only sees frames rendered at the new scale.
+///
+/// This header does not depend on Direct3D or Win32.
+
+#include <math.h>
+
+#define RESOLUTION_MAX_WINDOW 64
+#define RESOLUTION_SCALE_STEP (1.0f / 32.0f)
+/// Scale goes up only when the average is below this part of the budget.
+#define RESOLUTION_HEADROOM 0.85f
+/// Scale is chosen to land at this part of the budget.
+#define RESOLUTION_TARGET 0.95f
+#define RESOLUTION_MAX_INCREASE 1.1f
+#define RESOLUTION_MAX_DECREASE 0.75f
+
+class CResolutionController
+{
+public:
+  CResolutionController()
+  {
+    Init(1.0f / 60.0f, 0.5f, 1.0f, 8);
+  }
+
+  /// `budget' is in seconds. Scale starts at `maxScale'.
+  void Init(float budget, float minScale, float maxScale, unsigned window)
+  {
+    if(window < 1)
+      window = 1;
+    if(window > RESOLUTION_MAX_WINDOW)
+      window = RESOLUTION_MAX_WINDOW;
+    if(minScale > maxScale)
+      minScale = maxScale;
+    _budget = budget;
+    _minScale = minScale;
+    _maxScale = maxScale;
+    _window = window;
+    _scale = maxScale;
+    Reset();
+  }
+
+  /// Forgets measured frames, keeps the scale.
+  void Reset()
+  {
+    _count = 0;
+    _next = 0;
+    _sum = 0.0;
+    _average = 0.0;
+  }
+
+  /// Adds one frame time in seconds. Returns true when the scale changed.
+  bool Update(double frameTime)
+  {
+    if(_count == _window)
+      _sum -= _history[_next];
+    else
+      ++_count;
+    _history[_next] = frameTime;
+    _sum += frameTime;
+    _next = (_next + 1) % _window;
+    _average = _sum / _count;
+    if(_count < _window || _average <= 0.0)
+      return false;
+    if(_average <= _budget && _average >= _budget * RESOLUTION_HEADROOM)
+      return false;
+    float factor = (float)sqrt(_budget * RESOLUTION_TARGET / _average);
+    if(factor > RESOLUTION_MAX_INCREASE)
+      factor = RESOLUTION_MAX_INCREASE;
+    if(factor < RESOLUTION_MAX_DECREASE)
+      factor = RESOLUTION_MAX_DECREASE;
+    float scale = Quantize(_scale * factor);
+    if(scale < _minScale)
+      scale = _minScale;
+    if(scale > _maxScale)
+      scale = _maxScale;
+    if(scale == _scale)
+      return false;
+    _scale = scale;
+    Reset();
+    return true;
+  }
+
+  float GetScale() const
+  {
+    return _scale;
+  }
+
+  /// Average of the current window, zero right after a change.
+  double GetAverage() const
+  {
+    return _average;
+  }
+
+  float GetBudget() const
+  {
+    return _budget;
+  }
+
+private:
+  double _history[RESOLUTION_MAX_WINDOW];
+  double _sum;
+  double _average;
+  unsigned _window;
+  unsigned _count;
+  unsigned _next;
+  float _budget;
+  float _minScale;
+  float _maxScale;
+  float _scale;
+
+  /// Rounds to the nearest step, but always moves at least one step
+  /// in the direction of the correction.
+  float Quantize(float scale) const
+  {
+    float quantized = (float)floor(scale / RESOLUTION_SCALE_STEP + 0.5f) * RESOLUTION_SCALE_STEP;
+    if(scale > _scale && quantized < _scale + RESOLUTION_SCALE_STEP)
+      quantized = _scale + RESOLUTION_SCALE_STEP;
+    if(scale < _scale && quantized > _scale - RESOLUTION_SCALE_STEP)
+      quantized = _scale - RESOLUTION_SCALE_STEP;
+    return quantized;
+  }
+};
+
+#endif // __RESOLUTION_CONTROLLER_HPP__
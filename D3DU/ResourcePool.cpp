@@ -0,0 +1,422 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "ThreadUtils.hpp"
+#include "MemoryTracker.hpp"
+
+#define D3DU_POOL_MAX_TEXTURES 256
+/// Returned textures not requested again for this many frames are freed.
+#define D3DU_POOL_IDLE_FRAMES 30
+
+class D3DU_NOVTABLE CResourcePool :
+  public ID3DUResourcePool
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUResourcePool)
+  END_INTERFACE_MAP
+
+  CResourcePool()
+  {
+    memset(_entries, 0, sizeof(_entries));
+    _frame = 0;
+    _budget = 0;
+    _allocated = 0;
+    _peak = 0;
+    _hits = 0;
+    _misses = 0;
+  }
+
+  STDMETHOD(Construct)(ID3D11Device *device)
+  {
+    _device = device;
+    return S_OK;
+  }
+
+  virtual ~CResourcePool()
+  {
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+      Free(_entries[i]);
+  }
+
+  STDMETHOD(AcquireTexture)(const D3D11_TEXTURE2D_DESC *desc, UINT flags, D3DU_POOLED_TEXTURE *oTexture)
+  {
+    HRESULT hr;
+    if(!oTexture)
+      return E_POINTER;
+    memset(oTexture, 0, sizeof(*oTexture));
+    if(!desc || 0 == desc->Width || 0 == desc->Height)
+      return E_INVALIDARG;
+    D3D11_TEXTURE2D_DESC key = *desc;
+    if(flags & D3DU_POOL_ROUND_SIZE)
+    {
+      key.Width = RoundSize(key.Width);
+      key.Height = RoundSize(key.Height);
+    }
+    UINT status = (flags & D3DU_POOL_PERSISTENT) ? ENTRY_PERSISTENT : ENTRY_FRAME;
+    CAutoLock lock(_lock);
+    Entry *entry = NULL;
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      Entry &e = _entries[i];
+      if(ENTRY_FREE == e.Status
+        && 0 == memcmp(&e.Desc, &key, sizeof(key))
+        && (!entry || e.LastUsed > entry->LastUsed))
+        entry = &e;
+    }
+    if(entry)
+    {
+      ++_hits;
+      entry->Status = status;
+      entry->LastUsed = _frame;
+      *oTexture = entry->Texture;
+      return S_OK;
+    }
+    ++_misses;
+    UINT64 bytes = EstimateTextureBytes(key);
+    if(_budget && _allocated + bytes > _budget)
+      Evict(_allocated + bytes - _budget);
+    entry = FindEmpty();
+    if(!entry)
+    {
+      Evict(1);
+      entry = FindEmpty();
+      if(!entry)
+        return E_OUTOFMEMORY;
+    }
+    entry->Desc = key;
+    hr = Create(*entry);
+    if(FAILED(hr))
+    {
+      Free(*entry);
+      return hr;
+    }
+    entry->Status = status;
+    entry->Bytes = bytes;
+    entry->LastUsed = _frame;
+    _allocated += bytes;
+    if(_allocated > _peak)
+      _peak = _allocated;
+    *oTexture = entry->Texture;
+    return S_OK;
+  }
+
+  STDMETHOD(ReleaseTexture)(ID3D11Texture2D *texture)
+  {
+    if(!texture)
+      return E_INVALIDARG;
+    CAutoLock lock(_lock);
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      Entry &e = _entries[i];
+      if((ENTRY_FRAME == e.Status || ENTRY_PERSISTENT == e.Status)
+        && e.Texture.Texture == texture)
+      {
+        Return(e);
+        return S_OK;
+      }
+    }
+    return S_FALSE;
+  }
+
+  STDMETHOD(EndFrame)()
+  {
+    CAutoLock lock(_lock);
+    ++_frame;
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      Entry &e = _entries[i];
+      if(ENTRY_FRAME == e.Status)
+        Return(e);
+      else if(ENTRY_FREE == e.Status && _frame - e.LastUsed > D3DU_POOL_IDLE_FRAMES)
+        Free(e);
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(SetBudget)(UINT64 bytes)
+  {
+    CAutoLock lock(_lock);
+    _budget = bytes;
+    if(_budget && _allocated > _budget)
+      Evict(_allocated - _budget);
+    return S_OK;
+  }
+
+  STDMETHOD(Trim)()
+  {
+    CAutoLock lock(_lock);
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      if(ENTRY_FREE == _entries[i].Status)
+        Free(_entries[i]);
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_POOL_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    CAutoLock lock(_lock);
+    memset(oStats, 0, sizeof(*oStats));
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      UINT status = _entries[i].Status;
+      if(ENTRY_EMPTY != status)
+        ++oStats->TextureCount;
+      if(ENTRY_FRAME == status || ENTRY_PERSISTENT == status)
+        ++oStats->TexturesInUse;
+    }
+    oStats->AllocatedBytes = _allocated;
+    oStats->PeakBytes = _peak;
+    oStats->Hits = _hits;
+    oStats->Misses = _misses;
+    return S_OK;
+  }
+
+private:
+  enum
+  {
+    ENTRY_EMPTY,
+    ENTRY_FREE,
+    ENTRY_FRAME,
+    ENTRY_PERSISTENT,
+  };
+
+  /// Texture and views are referenced by the entry itself.
+  struct Entry
+  {
+    UINT Status;
+    D3D11_TEXTURE2D_DESC Desc;
+    D3DU_POOLED_TEXTURE Texture;
+    UINT64 Bytes;
+    UINT64 LastUsed;
+  };
+
+  CLock _lock;
+  ComPtr<ID3D11Device> _device;
+  Entry _entries[D3DU_POOL_MAX_TEXTURES];
+  UINT64 _frame;
+  UINT64 _budget;
+  UINT64 _allocated;
+  UINT64 _peak;
+  UINT64 _hits;
+  UINT64 _misses;
+
+  Entry* FindEmpty()
+  {
+    for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+    {
+      if(ENTRY_EMPTY == _entries[i].Status)
+        return &_entries[i];
+    }
+    return NULL;
+  }
+
+  /// Keeps the texture for reuse unless the pool is over budget.
+  void Return(Entry &e)
+  {
+    if(_budget && _allocated > _budget)
+    {
+      Free(e);
+      return;
+    }
+    e.Status = ENTRY_FREE;
+    e.LastUsed = _frame;
+  }
+
+  /// Frees least recently used free textures until `bytes' are released.
+  void Evict(UINT64 bytes)
+  {
+    UINT64 released = 0;
+    while(released < bytes)
+    {
+      Entry *oldest = NULL;
+      for(UINT i = 0; i < D3DU_POOL_MAX_TEXTURES; ++i)
+      {
+        Entry &e = _entries[i];
+        if(ENTRY_FREE == e.Status && (!oldest || e.LastUsed < oldest->LastUsed))
+          oldest = &e;
+      }
+      if(!oldest)
+        return;
+      released += oldest->Bytes;
+      Free(*oldest);
+    }
+  }
+
+  void Free(Entry &e)
+  {
+    D3DU_POOLED_TEXTURE &t = e.Texture;
+    if(t.RTV)
+      t.RTV->Release();
+    if(t.DSV)
+      t.DSV->Release();
+    if(t.SRV)
+      t.SRV->Release();
+    if(t.UAV)
+      t.UAV->Release();
+    if(t.Texture)
+      t.Texture->Release();
+    if(ENTRY_EMPTY != e.Status)
+      _allocated -= e.Bytes;
+    memset(&e, 0, sizeof(e));
+  }
+
+  HRESULT Create(Entry &e)
+  {
+    HRESULT hr;
+    D3DU_POOLED_TEXTURE &t = e.Texture;
+    const D3D11_TEXTURE2D_DESC &d = e.Desc;
+    DXGI_FORMAT dsvFormat, srvFormat;
+    ViewFormats(d.Format, &dsvFormat, &srvFormat);
+    BOOL ms = d.SampleDesc.Count > 1;
+    BOOL array = d.ArraySize > 1;
+    hr = _device->CreateTexture2D(&d, NULL, &t.Texture);
+    if(FAILED(hr))
+      return hr;
+    t.Width = d.Width;
+    t.Height = d.Height;
+    if(d.BindFlags & D3D11_BIND_RENDER_TARGET)
+    {
+      hr = _device->CreateRenderTargetView(t.Texture, NULL, &t.RTV);
+      if(FAILED(hr))
+        return hr;
+    }
+    if(d.BindFlags & D3D11_BIND_DEPTH_STENCIL)
+    {
+      D3D11_DEPTH_STENCIL_VIEW_DESC vd;
+      memset(&vd, 0, sizeof(vd));
+      vd.Format = dsvFormat;
+      if(ms)
+      {
+        vd.ViewDimension = array ? D3D11_DSV_DIMENSION_TEXTURE2DMSARRAY : D3D11_DSV_DIMENSION_TEXTURE2DMS;
+        vd.Texture2DMSArray.ArraySize = d.ArraySize;
+      }
+      else
+      {
+        vd.ViewDimension = array ? D3D11_DSV_DIMENSION_TEXTURE2DARRAY : D3D11_DSV_DIMENSION_TEXTURE2D;
+        vd.Texture2DArray.ArraySize = d.ArraySize;
+      }
+      hr = _device->CreateDepthStencilView(t.Texture, dsvFormat == d.Format ? NULL : &vd, &t.DSV);
+      if(FAILED(hr))
+        return hr;
+    }
+    if(d.BindFlags & D3D11_BIND_SHADER_RESOURCE)
+    {
+      D3D11_SHADER_RESOURCE_VIEW_DESC vd;
+      memset(&vd, 0, sizeof(vd));
+      vd.Format = srvFormat;
+      if(ms)
+      {
+        vd.ViewDimension = array ? D3D11_SRV_DIMENSION_TEXTURE2DMSARRAY : D3D11_SRV_DIMENSION_TEXTURE2DMS;
+        vd.Texture2DMSArray.ArraySize = d.ArraySize;
+      }
+      else if(array)
+      {
+        vd.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+        vd.Texture2DArray.MipLevels = (UINT)-1;
+        vd.Texture2DArray.ArraySize = d.ArraySize;
+      }
+      else
+      {
+        vd.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+        vd.Texture2D.MipLevels = (UINT)-1;
+      }
+      hr = _device->CreateShaderResourceView(t.Texture, srvFormat == d.Format ? NULL : &vd, &t.SRV);
+      if(FAILED(hr))
+        return hr;
+    }
+    if(d.BindFlags & D3D11_BIND_UNORDERED_ACCESS)
+    {
+      hr = _device->CreateUnorderedAccessView(t.Texture, NULL, &t.UAV);
+      if(FAILED(hr))
+        return hr;
+    }
+    return S_OK;
+  }
+
+  /// Depth textures read by shaders are created typeless;
+  /// their views need typed formats.
+  static void ViewFormats(DXGI_FORMAT format, DXGI_FORMAT *oDepth, DXGI_FORMAT *oShader)
+  {
+    switch(format)
+    {
+    case DXGI_FORMAT_R32_TYPELESS:
+      *oDepth = DXGI_FORMAT_D32_FLOAT;
+      *oShader = DXGI_FORMAT_R32_FLOAT;
+      break;
+    case DXGI_FORMAT_R24G8_TYPELESS:
+      *oDepth = DXGI_FORMAT_D24_UNORM_S8_UINT;
+      *oShader = DXGI_FORMAT_R24_UNORM_X8_TYPELESS;
+      break;
+    case DXGI_FORMAT_R16_TYPELESS:
+      *oDepth = DXGI_FORMAT_D16_UNORM;
+      *oShader = DXGI_FORMAT_R16_UNORM;
+      break;
+    case DXGI_FORMAT_R32G8X24_TYPELESS:
+      *oDepth = DXGI_FORMAT_D32_FLOAT_S8X24_UINT;
+      *oShader = DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS;
+      break;
+    default:
+      *oDepth = format;
+      *oShader = format;
+      break;
+    }
+  }
+
+  /// Steps are an eighth of the highest power of two not above `size',
+  /// so rounding wastes at most 12.5% in each dimension.
+  static UINT RoundSize(UINT size)
+  {
+    UINT high = 1;
+    while(high <= size / 2)
+      high <<= 1;
+    UINT step = high / 8 > 16 ? high / 8 : 16;
+    return (size + step - 1) / step * step;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateResourcePool(
+  ID3D11Device *device,
+  ID3DUResourcePool **oPool)
+{
+  if(!oPool)
+    return E_POINTER;
+  *oPool = NULL;
+  if(!device)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CResourcePool> *pool = new ComObject<CResourcePool>();
+  hr = pool->Construct(device);
+  if(FAILED(hr))
+  {
+    delete pool;
+    return hr;
+  }
+  *oPool = pool;
+  return S_OK;
+}
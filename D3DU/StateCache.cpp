@@ -0,0 +1,718 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "ContextProxy.hpp"
+
+/// Shadow value of a slot nothing is known about. No object lives there,
+/// so it differs from anything a Set call passes.
+#define STATE_UNKNOWN ((void*)~(UINT_PTR)0)
+#define STATE_UNKNOWN_VALUE 0xFFFFFFFF
+
+enum
+{
+  STAGE_VS,
+  STAGE_HS,
+  STAGE_DS,
+  STAGE_GS,
+  STAGE_PS,
+  STAGE_CS,
+  STAGE_COUNT
+};
+
+class D3DU_NOVTABLE CStateCache :
+  public CContextProxy<ID3DUStateCache>
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3D11DeviceChild)
+    INTERFACE_MAP_ENTRY(ID3D11DeviceContext)
+    INTERFACE_MAP_ENTRY(ID3DUStateCache)
+#ifdef D3DU_D3D11_1
+    // The upload ring binds offsets through it, see UploadRing.cpp.
+    // Anything else set through it bypasses the cache.
+    if(__uuidof(ID3D11DeviceContext1) == riid)
+      return _context->QueryInterface(riid, oObject);
+#endif
+  END_INTERFACE_MAP
+
+  CStateCache()
+  {
+    memset(&_stats, 0, sizeof(_stats));
+  }
+
+  virtual ~CStateCache() { }
+
+  STDMETHOD(Construct)(ID3D11DeviceContext *context)
+  {
+    _context = context;
+    Reset(FALSE);
+    _stats.Resets = 0;
+    return S_OK;
+  }
+
+  // ID3DUStateCache
+
+  STDMETHOD(GetContext)(ID3D11DeviceContext **oContext)
+  {
+    if(!oContext)
+      return E_POINTER;
+    _context.AddRef();
+    *oContext = _context;
+    return S_OK;
+  }
+
+  STDMETHOD(Invalidate)()
+  {
+    Reset(FALSE);
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_STATE_CACHE_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    *oStats = _stats;
+    return S_OK;
+  }
+
+  STDMETHOD(ResetStatistics)()
+  {
+    memset(&_stats, 0, sizeof(_stats));
+    return S_OK;
+  }
+
+  // Input assembler
+
+  STDMETHOD_(void, IASetInputLayout)(ID3D11InputLayout *inputLayout)
+  {
+    if(Filter(_inputLayout, (void*)inputLayout))
+      _context->IASetInputLayout(inputLayout);
+  }
+
+  STDMETHOD_(void, IASetPrimitiveTopology)(D3D11_PRIMITIVE_TOPOLOGY topology)
+  {
+    if(Filter(_topology, topology))
+      _context->IASetPrimitiveTopology(topology);
+  }
+
+  STDMETHOD_(void, IASetVertexBuffers)(
+    UINT startSlot,
+    UINT numBuffers,
+    ID3D11Buffer *const *vertexBuffers,
+    const UINT *strides,
+    const UINT *offsets)
+  {
+    if(startSlot >= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT
+      || numBuffers > D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT - startSlot
+      || !vertexBuffers || !strides || !offsets)
+    {
+      ++_stats.Misses;
+      _context->IASetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+      return;
+    }
+    UINT first = numBuffers;
+    UINT last = 0;
+    for(UINT i = 0; i < numBuffers; ++i)
+    {
+      UINT slot = startSlot + i;
+      if(_vertexBuffers[slot] == vertexBuffers[i]
+        && _strides[slot] == strides[i]
+        && _offsets[slot] == offsets[i])
+        continue;
+      _vertexBuffers[slot] = vertexBuffers[i];
+      _strides[slot] = strides[i];
+      _offsets[slot] = offsets[i];
+      if(first == numBuffers)
+        first = i;
+      last = i;
+    }
+    if(first == numBuffers)
+    {
+      ++_stats.Hits;
+      return;
+    }
+    ++_stats.Misses;
+    _context->IASetVertexBuffers(
+      startSlot + first,
+      last - first + 1,
+      vertexBuffers + first,
+      strides + first,
+      offsets + first);
+  }
+
+  STDMETHOD_(void, IASetIndexBuffer)(ID3D11Buffer *indexBuffer, DXGI_FORMAT format, UINT offset)
+  {
+    if(_indexBuffer == indexBuffer && _indexFormat == format && _indexOffset == offset)
+    {
+      ++_stats.Hits;
+      return;
+    }
+    ++_stats.Misses;
+    _indexBuffer = indexBuffer;
+    _indexFormat = format;
+    _indexOffset = offset;
+    _context->IASetIndexBuffer(indexBuffer, format, offset);
+  }
+
+  // Shader stages
+
+  STDMETHOD_(void, VSSetShader)(
+    ID3D11VertexShader *vertexShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_VS, vertexShader, numClassInstances))
+      _context->VSSetShader(vertexShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, VSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_VS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->VSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, VSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_VS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->VSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, VSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_VS].Samplers, startSlot, numSamplers, samplers))
+      _context->VSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, HSSetShader)(
+    ID3D11HullShader *hullShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_HS, hullShader, numClassInstances))
+      _context->HSSetShader(hullShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, HSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_HS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->HSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, HSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_HS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->HSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, HSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_HS].Samplers, startSlot, numSamplers, samplers))
+      _context->HSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, DSSetShader)(
+    ID3D11DomainShader *domainShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_DS, domainShader, numClassInstances))
+      _context->DSSetShader(domainShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, DSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_DS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->DSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, DSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_DS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->DSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, DSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_DS].Samplers, startSlot, numSamplers, samplers))
+      _context->DSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, GSSetShader)(
+    ID3D11GeometryShader *shader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_GS, shader, numClassInstances))
+      _context->GSSetShader(shader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, GSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_GS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->GSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, GSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_GS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->GSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, GSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_GS].Samplers, startSlot, numSamplers, samplers))
+      _context->GSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, PSSetShader)(
+    ID3D11PixelShader *pixelShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_PS, pixelShader, numClassInstances))
+      _context->PSSetShader(pixelShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, PSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_PS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->PSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, PSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_PS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->PSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, PSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_PS].Samplers, startSlot, numSamplers, samplers))
+      _context->PSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  STDMETHOD_(void, CSSetShader)(
+    ID3D11ComputeShader *computeShader,
+    ID3D11ClassInstance *const *classInstances,
+    UINT numClassInstances)
+  {
+    if(FilterShader(STAGE_CS, computeShader, numClassInstances))
+      _context->CSSetShader(computeShader, classInstances, numClassInstances);
+  }
+
+  STDMETHOD_(void, CSSetConstantBuffers)(UINT startSlot, UINT numBuffers, ID3D11Buffer *const *constantBuffers)
+  {
+    if(FilterSlots(_stages[STAGE_CS].ConstantBuffers, startSlot, numBuffers, constantBuffers))
+      _context->CSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+  }
+
+  STDMETHOD_(void, CSSetShaderResources)(
+    UINT startSlot,
+    UINT numViews,
+    ID3D11ShaderResourceView *const *shaderResourceViews)
+  {
+    if(FilterSlots(_stages[STAGE_CS].Resources, startSlot, numViews, shaderResourceViews))
+      _context->CSSetShaderResources(startSlot, numViews, shaderResourceViews);
+  }
+
+  STDMETHOD_(void, CSSetSamplers)(UINT startSlot, UINT numSamplers, ID3D11SamplerState *const *samplers)
+  {
+    if(FilterSlots(_stages[STAGE_CS].Samplers, startSlot, numSamplers, samplers))
+      _context->CSSetSamplers(startSlot, numSamplers, samplers);
+  }
+
+  /// Unordered access views are not shadowed, their initial counts
+  /// make every call meaningful.
+  STDMETHOD_(void, CSSetUnorderedAccessViews)(
+    UINT startSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    ++_stats.Misses;
+    ForgetOutputs();
+    ForgetInputs(TRUE);
+    _context->CSSetUnorderedAccessViews(startSlot, numUavs, unorderedAccessViews, uavInitialCounts);
+  }
+
+  // Rasterizer
+
+  STDMETHOD_(void, RSSetState)(ID3D11RasterizerState *rasterizerState)
+  {
+    if(Filter(_rasterizerState, (void*)rasterizerState))
+      _context->RSSetState(rasterizerState);
+  }
+
+  STDMETHOD_(void, RSSetViewports)(UINT numViewports, const D3D11_VIEWPORT *viewports)
+  {
+    if(FilterRects(_viewports, _viewportCount, numViewports, viewports))
+      _context->RSSetViewports(numViewports, viewports);
+  }
+
+  STDMETHOD_(void, RSSetScissorRects)(UINT numRects, const D3D11_RECT *rects)
+  {
+    if(FilterRects(_scissors, _scissorCount, numRects, rects))
+      _context->RSSetScissorRects(numRects, rects);
+  }
+
+  // Output merger
+
+  STDMETHOD_(void, OMSetRenderTargets)(
+    UINT numViews,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView)
+  {
+    if(numViews > D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT || (numViews && !renderTargetViews))
+    {
+      ++_stats.Misses;
+      ForgetOutputs();
+      ForgetInputs(TRUE);
+      _context->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+      return;
+    }
+    BOOL changed = _depthStencilView != depthStencilView;
+    for(UINT i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT && !changed; ++i)
+      changed = _renderTargetViews[i] != (i < numViews ? renderTargetViews[i] : NULL);
+    if(!changed)
+    {
+      ++_stats.Hits;
+      return;
+    }
+    ++_stats.Misses;
+    // Binding an output unbinds the same resource from every input slot.
+    // Textures are only ever bound through views, buffers also as vertex,
+    // index and constant buffers.
+    BOOL buffers = FALSE;
+    for(UINT i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; ++i)
+    {
+      ID3D11RenderTargetView *rtv = i < numViews ? renderTargetViews[i] : NULL;
+      _renderTargetViews[i] = rtv;
+      if(rtv && !buffers)
+      {
+        D3D11_RENDER_TARGET_VIEW_DESC desc;
+        rtv->GetDesc(&desc);
+        buffers = D3D11_RTV_DIMENSION_BUFFER == desc.ViewDimension;
+      }
+    }
+    _depthStencilView = depthStencilView;
+    ForgetInputs(buffers);
+    _context->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+  }
+
+  STDMETHOD_(void, OMSetRenderTargetsAndUnorderedAccessViews)(
+    UINT numRTVs,
+    ID3D11RenderTargetView *const *renderTargetViews,
+    ID3D11DepthStencilView *depthStencilView,
+    UINT uavStartSlot,
+    UINT numUavs,
+    ID3D11UnorderedAccessView *const *unorderedAccessViews,
+    const UINT *uavInitialCounts)
+  {
+    ++_stats.Misses;
+    ForgetOutputs();
+    ForgetInputs(TRUE);
+    _context->OMSetRenderTargetsAndUnorderedAccessViews(
+      numRTVs,
+      renderTargetViews,
+      depthStencilView,
+      uavStartSlot,
+      numUavs,
+      unorderedAccessViews,
+      uavInitialCounts);
+  }
+
+  STDMETHOD_(void, OMSetBlendState)(ID3D11BlendState *blendState, const FLOAT blendFactor[4], UINT sampleMask)
+  {
+    static const FLOAT defaultFactor[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    const FLOAT *factor = blendFactor ? blendFactor : defaultFactor;
+    if(_blendState == blendState
+      && 0 == memcmp(_blendFactor, factor, sizeof(_blendFactor))
+      && _sampleMask == sampleMask)
+    {
+      ++_stats.Hits;
+      return;
+    }
+    ++_stats.Misses;
+    _blendState = blendState;
+    memcpy(_blendFactor, factor, sizeof(_blendFactor));
+    _sampleMask = sampleMask;
+    _context->OMSetBlendState(blendState, blendFactor, sampleMask);
+  }
+
+  STDMETHOD_(void, OMSetDepthStencilState)(ID3D11DepthStencilState *depthStencilState, UINT stencilRef)
+  {
+    if(_depthStencilState == depthStencilState && _stencilRef == stencilRef)
+    {
+      ++_stats.Hits;
+      return;
+    }
+    ++_stats.Misses;
+    _depthStencilState = depthStencilState;
+    _stencilRef = stencilRef;
+    _context->OMSetDepthStencilState(depthStencilState, stencilRef);
+  }
+
+  STDMETHOD_(void, SOSetTargets)(UINT numBuffers, ID3D11Buffer *const *soTargets, const UINT *offsets)
+  {
+    ++_stats.Misses;
+    ForgetOutputs();
+    ForgetInputs(TRUE);
+    _context->SOSetTargets(numBuffers, soTargets, offsets);
+  }
+
+  // Calls resetting the whole state
+
+  STDMETHOD_(void, ClearState)()
+  {
+    _context->ClearState();
+    Reset(TRUE);
+  }
+
+  STDMETHOD_(void, ExecuteCommandList)(ID3D11CommandList *commandList, BOOL restoreContextState)
+  {
+    _context->ExecuteCommandList(commandList, restoreContextState);
+    if(!restoreContextState)
+      Reset(TRUE);
+  }
+
+  STDMETHOD(FinishCommandList)(BOOL restoreDeferredContextState, ID3D11CommandList **commandList)
+  {
+    HRESULT hr = _context->FinishCommandList(restoreDeferredContextState, commandList);
+    if(!restoreDeferredContextState)
+      Reset(TRUE);
+    return hr;
+  }
+
+private:
+  struct Stage
+  {
+    void *Shader;
+    void *ConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+    void *Resources[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+    void *Samplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+  };
+
+  D3DU_STATE_CACHE_STATISTICS _stats;
+  Stage _stages[STAGE_COUNT];
+  void *_inputLayout;
+  D3D11_PRIMITIVE_TOPOLOGY _topology;
+  void *_vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+  UINT _strides[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+  UINT _offsets[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+  void *_indexBuffer;
+  DXGI_FORMAT _indexFormat;
+  UINT _indexOffset;
+  void *_rasterizerState;
+  D3D11_VIEWPORT _viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+  UINT _viewportCount;
+  D3D11_RECT _scissors[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+  UINT _scissorCount;
+  void *_renderTargetViews[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+  void *_depthStencilView;
+  void *_blendState;
+  FLOAT _blendFactor[4];
+  UINT _sampleMask;
+  void *_depthStencilState;
+  UINT _stencilRef;
+
+  template<class T>
+  bool Filter(T &shadow, T value)
+  {
+    if(shadow == value)
+    {
+      ++_stats.Hits;
+      return false;
+    }
+    ++_stats.Misses;
+    shadow = value;
+    return true;
+  }
+
+  /// Shaders with class instances are passed on and not remembered.
+  bool FilterShader(UINT stage, void *shader, UINT numClassInstances)
+  {
+    if(numClassInstances)
+    {
+      ++_stats.Misses;
+      _stages[stage].Shader = STATE_UNKNOWN;
+      return true;
+    }
+    return Filter(_stages[stage].Shader, shader);
+  }
+
+  /// Narrows `start' and `count' down to the slots that actually change,
+  /// and moves `values' along. Out of range calls are passed on as they
+  /// are, for the runtime to complain about.
+  template<class T, UINT N>
+  bool FilterSlots(void *(&shadow)[N], UINT &start, UINT &count, T *const *&values)
+  {
+    if(start >= N || count > N - start || !values)
+    {
+      ++_stats.Misses;
+      return true;
+    }
+    UINT first = count;
+    UINT last = 0;
+    for(UINT i = 0; i < count; ++i)
+    {
+      if(shadow[start + i] == values[i])
+        continue;
+      shadow[start + i] = values[i];
+      if(first == count)
+        first = i;
+      last = i;
+    }
+    if(first == count)
+    {
+      ++_stats.Hits;
+      return false;
+    }
+    ++_stats.Misses;
+    start += first;
+    values += first;
+    count = last - first + 1;
+    return true;
+  }
+
+  template<class T, UINT N>
+  bool FilterRects(T (&shadow)[N], UINT &shadowCount, UINT count, const T *rects)
+  {
+    if(count > N || (count && !rects))
+    {
+      ++_stats.Misses;
+      shadowCount = STATE_UNKNOWN_VALUE;
+      return true;
+    }
+    if(shadowCount == count && 0 == memcmp(shadow, rects, count * sizeof(T)))
+    {
+      ++_stats.Hits;
+      return false;
+    }
+    ++_stats.Misses;
+    shadowCount = count;
+    memcpy(shadow, rects, count * sizeof(T));
+    return true;
+  }
+
+  static void Fill(void **slots, UINT count, void *value)
+  {
+    for(UINT i = 0; i < count; ++i)
+      slots[i] = value;
+  }
+
+  /// Called when output bindings change: the runtime unbinds resources
+  /// bound as outputs from every input slot without telling anybody.
+  void ForgetInputs(BOOL buffers)
+  {
+    for(UINT i = 0; i < STAGE_COUNT; ++i)
+    {
+      Fill(_stages[i].Resources, ARRAYSIZE(_stages[i].Resources), STATE_UNKNOWN);
+      if(buffers)
+        Fill(_stages[i].ConstantBuffers, ARRAYSIZE(_stages[i].ConstantBuffers), STATE_UNKNOWN);
+    }
+    if(buffers)
+    {
+      Fill(_vertexBuffers, ARRAYSIZE(_vertexBuffers), STATE_UNKNOWN);
+      _indexBuffer = STATE_UNKNOWN;
+    }
+  }
+
+  void ForgetOutputs()
+  {
+    Fill(_renderTargetViews, ARRAYSIZE(_renderTargetViews), STATE_UNKNOWN);
+    _depthStencilView = STATE_UNKNOWN;
+  }
+
+  /// With `cleared' set, the shadow takes the values ClearState leaves
+  /// behind, otherwise everything becomes unknown.
+  void Reset(BOOL cleared)
+  {
+    void *value = cleared ? NULL : STATE_UNKNOWN;
+    for(UINT i = 0; i < STAGE_COUNT; ++i)
+    {
+      Stage &stage = _stages[i];
+      stage.Shader = value;
+      Fill(stage.ConstantBuffers, ARRAYSIZE(stage.ConstantBuffers), value);
+      Fill(stage.Resources, ARRAYSIZE(stage.Resources), value);
+      Fill(stage.Samplers, ARRAYSIZE(stage.Samplers), value);
+    }
+    _inputLayout = value;
+    _topology = cleared ? D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED : (D3D11_PRIMITIVE_TOPOLOGY)STATE_UNKNOWN_VALUE;
+    Fill(_vertexBuffers, ARRAYSIZE(_vertexBuffers), value);
+    memset(_strides, 0, sizeof(_strides));
+    memset(_offsets, 0, sizeof(_offsets));
+    _indexBuffer = value;
+    _indexFormat = DXGI_FORMAT_UNKNOWN;
+    _indexOffset = 0;
+    _rasterizerState = value;
+    _viewportCount = cleared ? 0 : STATE_UNKNOWN_VALUE;
+    _scissorCount = cleared ? 0 : STATE_UNKNOWN_VALUE;
+    Fill(_renderTargetViews, ARRAYSIZE(_renderTargetViews), value);
+    _depthStencilView = value;
+    _blendState = value;
+    for(UINT i = 0; i < 4; ++i)
+      _blendFactor[i] = 1.0f;
+    _sampleMask = 0xFFFFFFFF;
+    _depthStencilState = value;
+    _stencilRef = 0;
+    ++_stats.Resets;
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateStateCache(
+  ID3D11DeviceContext *context,
+  ID3DUStateCache **oCache)
+{
+  if(!oCache)
+    return E_POINTER;
+  *oCache = NULL;
+  if(!context)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CStateCache> *cache = new ComObject<CStateCache>();
+  hr = cache->Construct(context);
+  if(FAILED(hr))
+  {
+    delete cache;
+    return hr;
+  }
+  *oCache = cache;
+  return S_OK;
+}
@@ -26,6 +26,9 @@
 #include <windows.h>
 #include <dwmapi.h>
 #include <d3d11.h>
+#ifdef D3DU_D3D11_1
+#include <d3d11_1.h>
+#endif
 #include <d3d10_1.h>
 #include <d3dcompiler.h>
 #include <cstdlib>
@@ -0,0 +1,216 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __THREAD_UTILS_HPP__
+#define __THREAD_UTILS_HPP__
+
+#include <process.h>
+
+#define D3DU_MAX_WORKER_THREADS 64
+
+class CLock
+{
+public:
+  CLock()
+  {
+    InitializeCriticalSectionAndSpinCount(&_cs, 1000);
+  }
+
+  ~CLock()
+  {
+    DeleteCriticalSection(&_cs);
+  }
+
+  void Enter()
+  {
+    EnterCriticalSection(&_cs);
+  }
+
+  void Leave()
+  {
+    LeaveCriticalSection(&_cs);
+  }
+
+private:
+  CLock(const CLock&);
+  CLock& operator=(const CLock&);
+
+  CRITICAL_SECTION _cs;
+};
+
+/// Holds a CLock for the lifetime of a scope.
+class CAutoLock
+{
+public:
+  CAutoLock(CLock &lock) : _lock(lock)
+  {
+    _lock.Enter();
+  }
+
+  ~CAutoLock()
+  {
+    _lock.Leave();
+  }
+
+private:
+  CAutoLock(const CAutoLock&);
+  CAutoLock& operator=(const CAutoLock&);
+
+  CLock &_lock;
+};
+
+/// Fixed set of worker threads running parallel loops.
+/// ParallelFor must only be called from one thread at a time.
+class CThreadPool
+{
+public:
+  typedef void (*Task)(void *context, UINT index);
+
+  CThreadPool()
+  {
+    _threadCount = 0;
+    _wake = NULL;
+    _done = NULL;
+    _task = NULL;
+    _context = NULL;
+    _count = 0;
+    _next = 0;
+    _active = 0;
+    _stop = 0;
+  }
+
+  ~CThreadPool()
+  {
+    Shutdown();
+  }
+
+  /// Zero `threadCount' starts one worker per processor besides the calling thread.
+  HRESULT Init(UINT threadCount)
+  {
+    Shutdown();
+    if(0 == threadCount)
+    {
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      threadCount = si.dwNumberOfProcessors > 1 ? si.dwNumberOfProcessors - 1 : 0;
+    }
+    if(threadCount > D3DU_MAX_WORKER_THREADS)
+      threadCount = D3DU_MAX_WORKER_THREADS;
+    _stop = 0;
+    _wake = CreateSemaphore(NULL, 0, D3DU_MAX_WORKER_THREADS, NULL);
+    if(!_wake)
+      return HRESULT_FROM_WIN32(GetLastError());
+    _done = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if(!_done)
+      return HRESULT_FROM_WIN32(GetLastError());
+    for(UINT i = 0; i < threadCount; ++i)
+    {
+      _threads[i] = (HANDLE)_beginthreadex(NULL, 0, WorkerProc, this, 0, NULL);
+      if(!_threads[i])
+        return E_FAIL;
+      ++_threadCount;
+    }
+    return S_OK;
+  }
+
+  void Shutdown()
+  {
+    if(_threadCount)
+    {
+      InterlockedExchange(&_stop, 1);
+      ReleaseSemaphore(_wake, _threadCount, NULL);
+      WaitForMultipleObjects(_threadCount, _threads, TRUE, INFINITE);
+      for(UINT i = 0; i < _threadCount; ++i)
+        CloseHandle(_threads[i]);
+      _threadCount = 0;
+    }
+    if(_wake)
+      CloseHandle(_wake);
+    if(_done)
+      CloseHandle(_done);
+    _wake = NULL;
+    _done = NULL;
+  }
+
+  UINT GetThreadCount() const
+  {
+    return _threadCount;
+  }
+
+  /// Calls task(context, i) for every i in [0, count). The calling thread
+  /// takes part in the loop; returns when every call has finished.
+  void ParallelFor(UINT count, Task task, void *context)
+  {
+    if(0 == count)
+      return;
+    UINT helpers = count - 1 < _threadCount ? count - 1 : _threadCount;
+    _task = task;
+    _context = context;
+    _count = (LONG)count;
+    _next = 0;
+    _active = (LONG)helpers;
+    if(helpers)
+      ReleaseSemaphore(_wake, helpers, NULL);
+    RunItems();
+    if(helpers)
+      WaitForSingleObject(_done, INFINITE);
+  }
+
+private:
+  CThreadPool(const CThreadPool&);
+  CThreadPool& operator=(const CThreadPool&);
+
+  HANDLE _threads[D3DU_MAX_WORKER_THREADS];
+  UINT _threadCount;
+  HANDLE _wake;
+  HANDLE _done;
+  Task _task;
+  void *_context;
+  LONG _count;
+  volatile LONG _next;
+  volatile LONG _active;
+  volatile LONG _stop;
+
+  void RunItems()
+  {
+    LONG i;
+    while((i = InterlockedIncrement(&_next) - 1) < _count)
+      _task(_context, (UINT)i);
+  }
+
+  static unsigned int __stdcall WorkerProc(void *param)
+  {
+    CThreadPool *self = (CThreadPool*)param;
+    for(;;)
+    {
+      WaitForSingleObject(self->_wake, INFINITE);
+      if(self->_stop)
+        break;
+      self->RunItems();
+      if(0 == InterlockedDecrement(&self->_active))
+        SetEvent(self->_done);
+    }
+    return 0;
+  }
+};
+
+#endif // __THREAD_UTILS_HPP__
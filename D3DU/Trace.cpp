@@ -0,0 +1,413 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "LockFree.hpp"
+#include "ThreadUtils.hpp"
+#include "Trace.hpp"
+#ifdef _MSC_VER
+#include <intrin.h>
+#pragma intrinsic(__rdtsc)
+#else
+#include <x86intrin.h>
+#endif
+
+/// Zones kept per thread; newer ones overwrite the oldest.
+#define TRACE_BUFFER_EVENTS 8192
+/// Zones nested deeper than this are not recorded.
+#define TRACE_MAX_DEPTH 32
+#define TRACE_WRITE_SIZE (64*1024)
+/// Shortest time the time stamp counter is measured against QPC.
+#define TRACE_CALIBRATION_MS 10
+
+typedef struct
+{
+  LPCSTR Name;
+  unsigned long long Begin;
+  unsigned long long End;
+} TraceEvent;
+
+/// Zones of one thread. The thread writes finished zones into a ring
+/// and bumps a counter; a writer on another thread copies the ring and
+/// then drops whatever the owner may have overwritten meanwhile, so
+/// recording never waits for it.
+class CTraceBuffer
+{
+public:
+  CTraceBuffer(DWORD threadId)
+  {
+    Next = NULL;
+    Reset(threadId);
+  }
+
+  /// Hands the buffer to another thread, dropping the zones of the
+  /// previous one. Only while no writer runs.
+  void Reset(DWORD threadId)
+  {
+    ThreadId = threadId;
+    Retired = 0;
+    _depth = 0;
+    _written = 0;
+    _full = 0;
+  }
+
+  /// Owner only.
+  BOOL Begin(LPCSTR name, unsigned long long ticks)
+  {
+    if(TRACE_MAX_DEPTH == _depth)
+      return FALSE;
+    _open[_depth].Name = name;
+    _open[_depth].Begin = ticks;
+    ++_depth;
+    return TRUE;
+  }
+
+  /// Owner only.
+  void End(unsigned long long ticks)
+  {
+    if(!_depth)
+      return;
+    --_depth;
+    TraceEvent &e = _events[_written % TRACE_BUFFER_EVENTS];
+    e.Name = _open[_depth].Name;
+    e.Begin = _open[_depth].Begin;
+    e.End = ticks;
+    if(TRACE_BUFFER_EVENTS - 1 == _written % TRACE_BUFFER_EVENTS)
+      LfStoreRelease(&_full, 1u);
+    LfStoreRelease(&_written, _written + 1);
+  }
+
+  /// Any thread. Copies the zones still in the ring into `events',
+  /// oldest first, and returns how many.
+  unsigned Snapshot(TraceEvent *events) const
+  {
+    unsigned full = LfLoadAcquire(&_full);
+    unsigned last = LfLoadAcquire(&_written);
+    unsigned count = full || last >= TRACE_BUFFER_EVENTS ? TRACE_BUFFER_EVENTS : last;
+    for(unsigned i = 0; i < count; ++i)
+      events[i] = _events[(last - count + i) % TRACE_BUFFER_EVENTS];
+    LfFenceAcquire();
+    // The owner may have finished `now - last' zones over the oldest
+    // copied ones, and be writing one more.
+    unsigned now = LfLoadAcquire(&_written);
+    long long skip = (long long)(unsigned)(now - last) + 1 + count - TRACE_BUFFER_EVENTS;
+    if(skip <= 0)
+      return count;
+    if(skip >= (long long)count)
+      return 0;
+    memmove(events, events + skip, (count - (unsigned)skip) * sizeof(TraceEvent));
+    return count - (unsigned)skip;
+  }
+
+  DWORD ThreadId;
+  CTraceBuffer *Next;
+  /// Set when the owner exits; its zones stay until a new thread takes
+  /// the buffer over.
+  volatile LONG Retired;
+
+private:
+  TraceEvent _events[TRACE_BUFFER_EVENTS];
+  TraceEvent _open[TRACE_MAX_DEPTH];
+  unsigned _depth;
+  volatile unsigned _written;
+  volatile unsigned _full;
+};
+
+/// Buffers of the threads that recorded zones, each found by its owner
+/// through a TLS slot. Implicit TLS (__declspec(thread)) is not set up
+/// for a DLL loaded with LoadLibrary before Vista, hence TlsAlloc.
+///
+/// A buffer is never freed while the library is loaded: an exiting
+/// thread only marks its own retired, and the next thread to record
+/// takes it over instead of allocating, so there are never more buffers
+/// than threads recording at the same time. Acquire and Write run under
+/// the lock, so a buffer is not reset while being written out; threads
+/// record into their own without it.
+class CTraceRegistry
+{
+public:
+  CTraceRegistry()
+  {
+    _head = NULL;
+    _slot = TlsAlloc();
+  }
+
+  ~CTraceRegistry()
+  {
+    while(_head)
+    {
+      CTraceBuffer *next = _head->Next;
+      delete _head;
+      _head = next;
+    }
+    if(TLS_OUT_OF_INDEXES != _slot)
+      TlsFree(_slot);
+  }
+
+  /// Buffer of the calling thread, NULL if it has none yet.
+  CTraceBuffer *Get() const
+  {
+    if(TLS_OUT_OF_INDEXES == _slot)
+      return NULL;
+    return (CTraceBuffer*)TlsGetValue(_slot);
+  }
+
+  /// Gives the calling thread a retired buffer, or a new one.
+  /// Under the lock.
+  CTraceBuffer *Acquire()
+  {
+    if(TLS_OUT_OF_INDEXES == _slot)
+      return NULL;
+    DWORD threadId = GetCurrentThreadId();
+    CTraceBuffer *buffer;
+    for(buffer = _head; buffer; buffer = buffer->Next)
+    {
+      if(LfLoadAcquire(&buffer->Retired))
+      {
+        buffer->Reset(threadId);
+        break;
+      }
+    }
+    if(!buffer)
+    {
+      buffer = new CTraceBuffer(threadId);
+      buffer->Next = _head;
+      _head = buffer;
+    }
+    TlsSetValue(_slot, buffer);
+    return buffer;
+  }
+
+  /// Called by the exiting thread, with the loader lock held, so it
+  /// must not take the trace lock.
+  void Retire()
+  {
+    CTraceBuffer *buffer = Get();
+    if(!buffer)
+      return;
+    TlsSetValue(_slot, NULL);
+    LfStoreRelease(&buffer->Retired, (LONG)1);
+  }
+
+  /// Under the lock.
+  CTraceBuffer *GetHead() const
+  {
+    return _head;
+  }
+
+private:
+  CTraceRegistry(const CTraceRegistry&);
+  CTraceRegistry& operator=(const CTraceRegistry&);
+
+  CTraceBuffer *_head;
+  DWORD _slot;
+};
+
+/// Writes trace event JSON through a buffer.
+class CTraceWriter
+{
+public:
+  CTraceWriter(HANDLE file)
+  {
+    _file = file;
+    _used = 0;
+    _result = S_OK;
+  }
+
+  void Put(LPCSTR s)
+  {
+    while(*s)
+      PutChar(*s++);
+  }
+
+  /// Quotes and escapes `s' as a JSON string.
+  void PutString(LPCSTR s)
+  {
+    PutChar('"');
+    for(; *s; ++s)
+    {
+      unsigned char c = (unsigned char)*s;
+      if('"' == c || '\\' == c)
+      {
+        PutChar('\\');
+        PutChar(c);
+      }
+      else if(c < 0x20)
+      {
+        CHAR escaped[8];
+        sprintf_s(escaped, sizeof(escaped), "\\u%04x", c);
+        Put(escaped);
+      }
+      else
+      {
+        PutChar(c);
+      }
+    }
+    PutChar('"');
+  }
+
+  void PutChar(CHAR c)
+  {
+    if(TRACE_WRITE_SIZE == _used)
+      Flush();
+    _buffer[_used++] = c;
+  }
+
+  HRESULT Flush()
+  {
+    DWORD written;
+    if(_used && SUCCEEDED(_result) && !WriteFile(_file, _buffer, _used, &written, NULL))
+      _result = HRESULT_FROM_WIN32(GetLastError());
+    _used = 0;
+    return _result;
+  }
+
+private:
+  HANDLE _file;
+  CHAR _buffer[TRACE_WRITE_SIZE];
+  DWORD _used;
+  HRESULT _result;
+};
+
+static volatile LONG g_traceEnabled = 0;
+static CTraceRegistry g_traceBuffers;
+static CLock g_traceLock;
+static unsigned long long g_traceStartTicks = 0;
+static LARGE_INTEGER g_traceStartTime;
+
+void TraceThreadDetach()
+{
+  g_traceBuffers.Retire();
+}
+
+D3DU_EXTERN HRESULT D3DU_API D3DUTraceEnable(BOOL enable)
+{
+  CAutoLock lock(g_traceLock);
+  if(!enable)
+  {
+    LfStoreRelease(&g_traceEnabled, (LONG)0);
+    return S_OK;
+  }
+  if(LfLoadAcquire(&g_traceEnabled))
+    return S_FALSE;
+  QueryPerformanceCounter(&g_traceStartTime);
+  g_traceStartTicks = __rdtsc();
+  LfStoreRelease(&g_traceEnabled, (LONG)1);
+  return S_OK;
+}
+
+/// The first zone of a thread takes the trace lock to get a buffer;
+/// zones cost two reads of the time stamp counter after that.
+D3DU_EXTERN BOOL D3DU_API D3DUTraceBegin(LPCSTR name)
+{
+  if(!LfLoadAcquire(&g_traceEnabled) || !name)
+    return FALSE;
+  CTraceBuffer *buffer = g_traceBuffers.Get();
+  if(!buffer)
+  {
+    CAutoLock lock(g_traceLock);
+    buffer = g_traceBuffers.Acquire();
+    if(!buffer)
+      return FALSE;
+  }
+  return buffer->Begin(name, __rdtsc());
+}
+
+D3DU_EXTERN void D3DU_API D3DUTraceEnd()
+{
+  CTraceBuffer *buffer = g_traceBuffers.Get();
+  if(buffer)
+    buffer->End(__rdtsc());
+}
+
+/// Time stamp counter ticks are converted to microseconds by comparing
+/// how far the counter and QPC got since tracing was enabled. This
+/// assumes an invariant counter, the same on every core, as all
+/// processors of the last years have.
+D3DU_EXTERN HRESULT D3DU_API D3DUTraceWrite(LPCWSTR filename)
+{
+  LARGE_INTEGER now, freq;
+  unsigned long long nowTicks, startTicks;
+  if(!filename)
+    return E_INVALIDARG;
+  CAutoLock lock(g_traceLock);
+  if(!g_traceStartTicks)
+    return E_FAIL;
+  startTicks = g_traceStartTicks;
+  QueryPerformanceFrequency(&freq);
+  for(;;)
+  {
+    QueryPerformanceCounter(&now);
+    nowTicks = __rdtsc();
+    if((now.QuadPart - g_traceStartTime.QuadPart) * 1000 >= freq.QuadPart * TRACE_CALIBRATION_MS)
+      break;
+    Sleep(TRACE_CALIBRATION_MS);
+  }
+  double elapsedUs = (double)(now.QuadPart - g_traceStartTime.QuadPart) * 1000000.0 / freq.QuadPart;
+  double usPerTick = elapsedUs / (double)(nowTicks - startTicks);
+
+  HANDLE file = CreateFile(
+    filename,
+    GENERIC_WRITE,
+    FILE_SHARE_READ,
+    NULL,
+    CREATE_ALWAYS,
+    FILE_FLAG_SEQUENTIAL_SCAN,
+    NULL);
+  if(INVALID_HANDLE_VALUE == file)
+    return HRESULT_FROM_WIN32(GetLastError());
+  TraceEvent *events = new TraceEvent[TRACE_BUFFER_EVENTS];
+  CTraceWriter *writer = new CTraceWriter(file);
+  DWORD pid = GetCurrentProcessId();
+  BOOL first = TRUE;
+  writer->Put("{\"traceEvents\":[");
+  for(CTraceBuffer *buffer = g_traceBuffers.GetHead(); buffer; buffer = buffer->Next)
+  {
+    unsigned count = buffer->Snapshot(events);
+    for(unsigned i = 0; i < count; ++i)
+    {
+      const TraceEvent &e = events[i];
+      CHAR fields[160];
+      if(e.Begin < startTicks)
+        continue;
+      writer->Put(first ? "\n{\"name\":" : ",\n{\"name\":");
+      writer->PutString(e.Name);
+      sprintf_s(
+        fields,
+        sizeof(fields),
+        ",\"cat\":\"d3du\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+        pid,
+        buffer->ThreadId,
+        (e.Begin - startTicks) * usPerTick,
+        (e.End - e.Begin) * usPerTick);
+      writer->Put(fields);
+      first = FALSE;
+    }
+  }
+  writer->Put("\n],\"displayTimeUnit\":\"ms\"}\n");
+  HRESULT hr = writer->Flush();
+  delete writer;
+  delete[] events;
+  CloseHandle(file);
+  return hr;
+}
@@ -0,0 +1,77 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __TRACE_HPP__
+#define __TRACE_HPP__
+
+#include "D3DU.h"
+
+/// Scoped trace zones, for seeing where the time of a slow frame went.
+///
+/// D3DU_TRACE_ZONE("Name") records the rest of the enclosing scope as one
+/// zone of the calling thread, once D3DUTraceEnable has turned recording
+/// on; D3DUTraceWrite saves the zones for chrome://tracing or Perfetto.
+/// The macro expands to nothing unless D3DU_TRACE is defined, so zones
+/// may stay in the code of release builds. The library itself is built
+/// with its zones only when D3DU_TRACE is defined for it, but sinks can
+/// record their own with any build.
+///
+/// Names are kept by pointer and must outlive the trace, like string
+/// literals do.
+
+class CTraceZone
+{
+public:
+  explicit CTraceZone(LPCSTR name)
+  {
+    _open = D3DUTraceBegin(name);
+  }
+
+  ~CTraceZone()
+  {
+    if(_open)
+      D3DUTraceEnd();
+  }
+
+private:
+  CTraceZone(const CTraceZone&);
+  CTraceZone& operator=(const CTraceZone&);
+
+  BOOL _open;
+};
+
+#define D3DU_TRACE_CONCAT_(a, b) a##b
+#define D3DU_TRACE_CONCAT(a, b) D3DU_TRACE_CONCAT_(a, b)
+
+#ifdef D3DU_TRACE
+#define D3DU_TRACE_ZONE(name) CTraceZone D3DU_TRACE_CONCAT(_traceZone, __LINE__)(name)
+#else
+#define D3DU_TRACE_ZONE(name) ((void)0)
+#endif
+
+#ifdef D3DU_INTERNALS
+/// Lets the next thread to record reuse the buffer of the calling one;
+/// DllMain calls it as threads exit.
+void TraceThreadDetach();
+#endif
+
+#endif // __TRACE_HPP__
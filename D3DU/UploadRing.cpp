@@ -0,0 +1,503 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "StdAfx.h"
+#include "D3DU.h"
+#include "UploadRing.hpp"
+#include "Log.hpp"
+
+#define UPLOAD_RING_DEFAULT_SIZE (1024*1024)
+#define UPLOAD_MAX_STRIDE D3D11_REQ_MULTI_ELEMENT_STRUCTURE_SIZE_IN_BYTES
+
+class D3DU_NOVTABLE CUploadRing :
+  public ID3DUUploadRing
+{
+public:
+
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUUploadRing)
+  END_INTERFACE_MAP
+
+  CUploadRing()
+  {
+    _mapped = NULL;
+    _mappedData = NULL;
+    _deferred = FALSE;
+    _streamSize = 0;
+    _streamData = NULL;
+    memset(_classes, 0, sizeof(_classes));
+    memset(&_stats, 0, sizeof(_stats));
+  }
+
+  virtual ~CUploadRing()
+  {
+    Unmap();
+    UnmapStream();
+    for(UINT i = 0; i < UPLOAD_SIZE_CLASSES; ++i)
+    {
+      SizeClass &c = _classes[i];
+      for(UINT j = 0; j < c.Count; ++j)
+        c.Buffers[j]->Release();
+      delete[] c.Buffers;
+    }
+  }
+
+  /// Deferred contexts may only map with DISCARD, so they always pool.
+  STDMETHOD(Construct)(ID3D11DeviceContext *context, UINT size)
+  {
+    _context = context;
+    context->GetDevice(&_device);
+    _deferred = D3D11_DEVICE_CONTEXT_DEFERRED == context->GetType();
+    _streamSize = size;
+#ifdef D3DU_D3D11_1
+    if(!_deferred)
+      InitRing(size);
+#endif
+    return S_OK;
+  }
+
+  STDMETHOD(Allocate)(UINT size, void **oData, D3DU_CONSTANT_SLICE *oSlice)
+  {
+    if(!oData || !oSlice)
+      return E_POINTER;
+    if(0 == size || size > UPLOAD_MAX_SIZE)
+      return E_INVALIDARG;
+#ifdef D3DU_D3D11_1
+    if(_ring)
+      return AllocateRing(size, oData, oSlice);
+#endif
+    return AllocatePool(size, oData, oSlice);
+  }
+
+  STDMETHOD(Upload)(const void *data, UINT size, D3DU_CONSTANT_SLICE *oSlice)
+  {
+    HRESULT hr;
+    void *dst;
+    if(!data)
+      return E_INVALIDARG;
+    hr = Allocate(size, &dst, oSlice);
+    if(FAILED(hr))
+      return hr;
+    memcpy(dst, data, size);
+    return S_OK;
+  }
+
+  /// With offsets, slices are bound through the plain call first. The
+  /// state cache then remembers the ring buffer in these slots, and lets
+  /// the next plain bind of anything else through.
+  STDMETHOD(SetConstantBuffers)(
+    D3DU_SHADER_STAGE stage,
+    UINT startSlot,
+    UINT count,
+    const D3DU_CONSTANT_SLICE *slices)
+  {
+    ID3D11Buffer *buffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+    if((count && !slices)
+      || stage > D3DU_STAGE_CS
+      || startSlot > D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT
+      || count > D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT - startSlot)
+      return E_INVALIDARG;
+    Unmap();
+    for(UINT i = 0; i < count; ++i)
+      buffers[i] = slices[i].Buffer;
+    Bind(stage, startSlot, count, buffers);
+#ifdef D3DU_D3D11_1
+    if(_ring)
+    {
+      UINT first[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+      UINT num[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+      for(UINT i = 0; i < count; ++i)
+      {
+        first[i] = slices[i].FirstConstant;
+        num[i] = slices[i].NumConstants;
+      }
+      BindOffsets(stage, startSlot, count, buffers, first, num);
+    }
+#endif
+    return S_OK;
+  }
+
+  STDMETHOD(EndFrame)()
+  {
+    Unmap();
+    UnmapStream();
+    for(UINT i = 0; i < UPLOAD_SIZE_CLASSES; ++i)
+      _classes[i].Used = 0;
+    return S_OK;
+  }
+
+  STDMETHOD(GetStatistics)(D3DU_UPLOAD_STATISTICS *oStats)
+  {
+    if(!oStats)
+      return E_POINTER;
+    *oStats = _stats;
+    oStats->BufferCount = _stream ? 1 : 0;
+    oStats->Offsets = FALSE;
+#ifdef D3DU_D3D11_1
+    if(_ring)
+    {
+      oStats->BufferCount += 1;
+      oStats->Offsets = TRUE;
+      return S_OK;
+    }
+#endif
+    for(UINT i = 0; i < UPLOAD_SIZE_CLASSES; ++i)
+      oStats->BufferCount += _classes[i].Count;
+    return S_OK;
+  }
+
+  /// The stream stays mapped across allocations until it is bound, so a
+  /// frame which allocates every record first maps it once. Deferred
+  /// contexts may only map with DISCARD, so there every new map starts
+  /// over at the beginning of a renamed buffer.
+  STDMETHOD(AllocateInstances)(UINT stride, UINT count, void **oData, UINT *oFirstInstance)
+  {
+    HRESULT hr;
+    bool wrapped;
+    if(!oData || !oFirstInstance)
+      return E_POINTER;
+    if(0 == stride
+      || stride > UPLOAD_MAX_STRIDE
+      || 0 == count
+      || (UINT64)stride * count > 0x7FFFFFFF)
+      return E_INVALIDARG;
+    UINT size = stride * count;
+    if(size > _streamAllocator.GetCapacity())
+    {
+      hr = ReserveStream(size);
+      if(FAILED(hr))
+        return hr;
+    }
+    if(_deferred && !_streamData)
+      _streamAllocator.Reset(_streamAllocator.GetCapacity());
+    UINT first = _streamAllocator.AllocateRecords(stride, count, wrapped);
+    if(wrapped)
+    {
+      UnmapStream();
+      if(!_deferred)
+        ++_stats.Wraps;
+    }
+    if(!_streamData)
+    {
+      D3D11_MAPPED_SUBRESOURCE ms;
+      hr = _context->Map(_stream, 0, wrapped ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &ms);
+      if(FAILED(hr))
+      {
+        _streamAllocator.Reset(_streamAllocator.GetCapacity());
+        return hr;
+      }
+      _streamData = (BYTE*)ms.pData;
+      ++_stats.Maps;
+    }
+    *oData = _streamData + first * stride;
+    *oFirstInstance = first;
+    ++_stats.Uploads;
+    _stats.BytesUploaded += size;
+    return S_OK;
+  }
+
+  STDMETHOD(SetInstanceBuffer)(UINT stride)
+  {
+    if(0 == stride || stride > UPLOAD_MAX_STRIDE)
+      return E_INVALIDARG;
+    if(!_stream)
+      return E_FAIL;
+    UnmapStream();
+    ID3D11Buffer *buffer = _stream;
+    UINT offset = 0;
+    _context->IASetVertexBuffers(D3DU_INSTANCE_SLOT, 1, &buffer, &stride, &offset);
+    return S_OK;
+  }
+
+private:
+  /// Buffers[0..Used) were handed out this frame.
+  struct SizeClass
+  {
+    ID3D11Buffer **Buffers;
+    UINT Count;
+    UINT Capacity;
+    UINT Used;
+  };
+
+  ComPtr<ID3D11DeviceContext> _context;
+  ComPtr<ID3D11Device> _device;
+  ID3D11Buffer *_mapped;
+  BYTE *_mappedData;
+  SizeClass _classes[UPLOAD_SIZE_CLASSES];
+  D3DU_UPLOAD_STATISTICS _stats;
+  BOOL _deferred;
+  UINT _streamSize;
+  ComPtr<ID3D11Buffer> _stream;
+  BYTE *_streamData;
+  CUploadRingAllocator _streamAllocator;
+#ifdef D3DU_D3D11_1
+  ComPtr<ID3D11DeviceContext1> _context1;
+  ComPtr<ID3D11Buffer> _ring;
+  CUploadRingAllocator _allocator;
+
+  /// Leaves the ring off when anything is missing.
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE InitRing(UINT size)
+  {
+    HRESULT hr;
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options;
+    D3D11_BUFFER_DESC bd = {0};
+    hr = _device->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options));
+    if(FAILED(hr) || !options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+      return;
+    hr = _context->QueryInterface(__uuidof(ID3D11DeviceContext1), (void**)&_context1);
+    if(FAILED(hr))
+      return;
+    if(size < UPLOAD_MAX_SIZE)
+      size = UPLOAD_MAX_SIZE;
+    bd.ByteWidth = CUploadRingAllocator::Align(size);
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = _device->CreateBuffer(&bd, NULL, &_ring);
+    if(FAILED(hr))
+    {
+      D3DU_LOG(D3DU_LOG_INFO, "Unable to create upload ring (0x%08X). Falling back to buffer pool.", hr);
+      _context1.Release();
+      return;
+    }
+    _allocator.Reset(bd.ByteWidth);
+  }
+
+  /// The ring stays mapped across allocations until something binds.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE AllocateRing(
+    UINT size,
+    void **oData,
+    D3DU_CONSTANT_SLICE *oSlice)
+  {
+    HRESULT hr;
+    bool wrapped;
+    UINT aligned = CUploadRingAllocator::Align(size);
+    UINT offset = _allocator.Allocate(aligned, wrapped);
+    if(wrapped)
+    {
+      Unmap();
+      ++_stats.Wraps;
+    }
+    if(!_mapped)
+    {
+      D3D11_MAPPED_SUBRESOURCE ms;
+      hr = _context->Map(_ring, 0, wrapped ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &ms);
+      if(FAILED(hr))
+      {
+        _allocator.Reset(_allocator.GetCapacity());
+        return hr;
+      }
+      _mapped = _ring;
+      _mappedData = (BYTE*)ms.pData;
+      ++_stats.Maps;
+    }
+    *oData = _mappedData + offset;
+    oSlice->Buffer = _ring;
+    oSlice->FirstConstant = offset / UPLOAD_CONSTANT_SIZE;
+    oSlice->NumConstants = aligned / UPLOAD_CONSTANT_SIZE;
+    ++_stats.Uploads;
+    _stats.BytesUploaded += size;
+    return S_OK;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE BindOffsets(
+    D3DU_SHADER_STAGE stage,
+    UINT startSlot,
+    UINT count,
+    ID3D11Buffer **buffers,
+    const UINT *first,
+    const UINT *num)
+  {
+    switch(stage)
+    {
+    case D3DU_STAGE_VS:
+      _context1->VSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    case D3DU_STAGE_HS:
+      _context1->HSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    case D3DU_STAGE_DS:
+      _context1->DSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    case D3DU_STAGE_GS:
+      _context1->GSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    case D3DU_STAGE_PS:
+      _context1->PSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    case D3DU_STAGE_CS:
+      _context1->CSSetConstantBuffers1(startSlot, count, buffers, first, num);
+      break;
+    }
+  }
+#endif
+
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE AllocatePool(
+    UINT size,
+    void **oData,
+    D3DU_CONSTANT_SLICE *oSlice)
+  {
+    HRESULT hr;
+    D3D11_MAPPED_SUBRESOURCE ms;
+    UINT index = CUploadRingAllocator::SizeClass(size);
+    SizeClass &c = _classes[index];
+    Unmap();
+    if(c.Used == c.Count)
+    {
+      hr = Grow(c, CUploadRingAllocator::ClassSize(index));
+      if(FAILED(hr))
+        return hr;
+    }
+    ID3D11Buffer *buffer = c.Buffers[c.Used];
+    hr = _context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &ms);
+    if(FAILED(hr))
+      return hr;
+    ++c.Used;
+    _mapped = buffer;
+    _mappedData = (BYTE*)ms.pData;
+    *oData = _mappedData;
+    oSlice->Buffer = buffer;
+    oSlice->FirstConstant = 0;
+    oSlice->NumConstants = CUploadRingAllocator::ClassSize(index) / UPLOAD_CONSTANT_SIZE;
+    ++_stats.Uploads;
+    ++_stats.Maps;
+    _stats.BytesUploaded += size;
+    return S_OK;
+  }
+
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Grow(SizeClass &c, UINT byteWidth)
+  {
+    HRESULT hr;
+    ID3D11Buffer *buffer;
+    D3D11_BUFFER_DESC bd = {0};
+    bd.ByteWidth = byteWidth;
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = _device->CreateBuffer(&bd, NULL, &buffer);
+    if(FAILED(hr))
+      return hr;
+    if(c.Count == c.Capacity)
+    {
+      UINT capacity = c.Capacity ? c.Capacity * 2 : 8;
+      ID3D11Buffer **buffers = new ID3D11Buffer*[capacity];
+      if(c.Count)
+        memcpy(buffers, c.Buffers, c.Count * sizeof(ID3D11Buffer*));
+      delete[] c.Buffers;
+      c.Buffers = buffers;
+      c.Capacity = capacity;
+    }
+    c.Buffers[c.Count++] = buffer;
+    return S_OK;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Unmap()
+  {
+    if(!_mapped)
+      return;
+    _context->Unmap(_mapped, 0);
+    _mapped = NULL;
+    _mappedData = NULL;
+  }
+
+  /// Starts at the ring size and grows by powers of two. Records handed
+  /// out before growing are lost with the old buffer, like on a wrap.
+  HRESULT COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE ReserveStream(UINT size)
+  {
+    HRESULT hr;
+    D3D11_BUFFER_DESC bd = {0};
+    UINT capacity = _streamSize;
+    while(capacity < size)
+      capacity *= 2;
+    UnmapStream();
+    bd.ByteWidth = capacity;
+    bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bd.Usage = D3D11_USAGE_DYNAMIC;
+    bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    _stream.Release();
+    _streamAllocator.Reset(0);
+    hr = _device->CreateBuffer(&bd, NULL, &_stream);
+    if(FAILED(hr))
+      return hr;
+    _streamAllocator.Reset(capacity);
+    return S_OK;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE UnmapStream()
+  {
+    if(!_streamData)
+      return;
+    _context->Unmap(_stream, 0);
+    _streamData = NULL;
+  }
+
+  void COM_DECLSPEC_NOTHROW STDMETHODCALLTYPE Bind(
+    D3DU_SHADER_STAGE stage,
+    UINT startSlot,
+    UINT count,
+    ID3D11Buffer **buffers)
+  {
+    switch(stage)
+    {
+    case D3DU_STAGE_VS:
+      _context->VSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    case D3DU_STAGE_HS:
+      _context->HSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    case D3DU_STAGE_DS:
+      _context->DSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    case D3DU_STAGE_GS:
+      _context->GSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    case D3DU_STAGE_PS:
+      _context->PSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    case D3DU_STAGE_CS:
+      _context->CSSetConstantBuffers(startSlot, count, buffers);
+      break;
+    }
+  }
+};
+
+D3DU_EXTERN HRESULT D3DU_API D3DUCreateUploadRing(
+  ID3D11DeviceContext *context,
+  UINT size,
+  ID3DUUploadRing **oRing)
+{
+  if(!oRing)
+    return E_POINTER;
+  *oRing = NULL;
+  if(!context)
+    return E_INVALIDARG;
+  HRESULT hr;
+  ComObject<CUploadRing> *ring = new ComObject<CUploadRing>();
+  hr = ring->Construct(context, size ? size : UPLOAD_RING_DEFAULT_SIZE);
+  if(FAILED(hr))
+  {
+    delete ring;
+    return hr;
+  }
+  *oRing = ring;
+  return S_OK;
+}
@@ -0,0 +1,134 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __UPLOAD_RING_HPP__
+#define __UPLOAD_RING_HPP__
+
+/// Offset arithmetic of the upload ring.
+///
+/// Ring mode: allocations are carved from one buffer front to back. The
+/// buffer is written with NO_OVERWRITE, which promises the driver not to
+/// touch anything the GPU may still read; when an allocation does not fit
+/// in what is left, the ring starts over at zero and the buffer is mapped
+/// with DISCARD once, which hands out fresh memory while the GPU finishes
+/// with the old one. No fences are needed for that.
+///
+/// Pool mode: without constant buffer offsets every allocation needs a
+/// buffer of its own. Buffers come in power of two size classes from 16
+/// bytes to the 64K a constant buffer can address, and each one is mapped
+/// with DISCARD.
+///
+/// Costs: binding unmaps, so that the GPU sees the data. Ring mode thus
+/// maps once per bind, however many allocations came before it, and
+/// once per frame when the slices of every draw are allocated before
+/// the first bind. Pool mode maps once per allocation, which with
+/// constants of their own for every draw is a Map and an Unmap per draw,
+/// as many as plain dynamic buffers take. It saves creating buffers and
+/// keeps draws from renaming one buffer over and over, but does not make
+/// draws cheaper. Pool mode is what builds without D3DU_D3D11_1 get.
+///
+/// Instance stream: Direct3D 11.0 only allows NO_OVERWRITE on vertex and
+/// index buffers, so per-draw data that should cost one Map a frame
+/// there goes into a dynamic vertex buffer instead, carved like the ring
+/// but in whole records, and is read as per-instance data: a draw of one
+/// instance starting at the record's index sees it in every vertex.
+///
+/// This header does not depend on Direct3D.
+
+/// Constant buffer offsets and sizes go in units of 16 constants.
+#define UPLOAD_RING_ALIGNMENT 256
+#define UPLOAD_CONSTANT_SIZE 16
+/// 4096 constants, all a shader can see of a constant buffer.
+#define UPLOAD_MAX_SIZE 65536
+#define UPLOAD_SIZE_CLASSES 13
+
+class CUploadRingAllocator
+{
+public:
+  CUploadRingAllocator()
+  {
+    Reset(0);
+  }
+
+  /// Next allocation wraps.
+  void Reset(unsigned capacity)
+  {
+    _capacity = capacity;
+    _offset = capacity;
+  }
+
+  unsigned GetCapacity() const
+  {
+    return _capacity;
+  }
+
+  /// `size' must be aligned and not exceed the capacity. `wrapped' is set
+  /// when the ring started over, i.e. the next map has to discard.
+  unsigned Allocate(unsigned size, bool &wrapped)
+  {
+    wrapped = size > _capacity - _offset;
+    if(wrapped)
+      _offset = 0;
+    unsigned offset = _offset;
+    _offset += size;
+    return offset;
+  }
+
+  /// Like Allocate, for `count' records of `stride' bytes read as vertex
+  /// data: the offset is a multiple of `stride', and returned in records.
+  /// `stride' times `count' must not exceed the capacity.
+  unsigned AllocateRecords(unsigned stride, unsigned count, bool &wrapped)
+  {
+    unsigned first = _offset / stride + (_offset % stride ? 1 : 0);
+    unsigned size = stride * count;
+    wrapped = first > _capacity / stride || size > _capacity - first * stride;
+    if(wrapped)
+      first = 0;
+    _offset = first * stride + size;
+    return first;
+  }
+
+  static unsigned Align(unsigned size)
+  {
+    return (size + UPLOAD_RING_ALIGNMENT - 1) & ~(unsigned)(UPLOAD_RING_ALIGNMENT - 1);
+  }
+
+  /// Smallest class of 16 << class bytes holding `size'.
+  static unsigned SizeClass(unsigned size)
+  {
+    unsigned c = 0;
+    while(c + 1 < UPLOAD_SIZE_CLASSES && ((unsigned)UPLOAD_CONSTANT_SIZE << c) < size)
+      ++c;
+    return c;
+  }
+
+  static unsigned ClassSize(unsigned sizeClass)
+  {
+    return UPLOAD_CONSTANT_SIZE << sizeClass;
+  }
+
+private:
+  unsigned _capacity;
+  unsigned _offset;
+};
+
+#endif // __UPLOAD_RING_HPP__
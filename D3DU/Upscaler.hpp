@@ -0,0 +1,216 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __UPSCALER_HPP__
+#define __UPSCALER_HPP__
+
+/// Stretches the top left part of a texture over a whole render target
+/// with bilinear filtering. Draws a single triangle generated from
+/// SV_VertexID, so it needs feature level 10.0.
+///
+/// Draw saves every piece of pipeline state it changes and puts it back
+/// afterwards, so whatever draws next finds the context as it was left.
+class CUpscaler
+{
+public:
+  HRESULT Init(ID3D11Device *device)
+  {
+    static const char code[] =
+      "cbuffer Params : register(b0) { float4 UvScaleMax; };\n"
+      "Texture2D Source : register(t0);\n"
+      "SamplerState Linear : register(s0);\n"
+      "void VS(uint id : SV_VertexID, out float4 pos : SV_Position, out float2 uv : TEXCOORD0)\n"
+      "{\n"
+      "  uv = float2((id << 1) & 2, id & 2);\n"
+      "  pos = float4(uv * float2(2, -2) + float2(-1, 1), 0, 1);\n"
+      "}\n"
+      "float4 PS(float4 pos : SV_Position, float2 uv : TEXCOORD0) : SV_Target\n"
+      "{\n"
+      "  return Source.Sample(Linear, min(uv * UvScaleMax.xy, UvScaleMax.zw));\n"
+      "}\n";
+    HRESULT hr;
+    ComPtr<ID3DBlob> blob;
+    hr = D3DUCompileFromMemory(code, sizeof(code) - 1, "VS", "vs_4_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, &blob);
+    if(FAILED(hr))
+      return hr;
+    hr = device->CreateVertexShader(blob->GetBufferPointer(), blob->GetBufferSize(), NULL, &_vs);
+    if(FAILED(hr))
+      return hr;
+    blob.Release();
+    hr = D3DUCompileFromMemory(code, sizeof(code) - 1, "PS", "ps_4_0", D3DCOMPILE_OPTIMIZATION_LEVEL3, &blob);
+    if(FAILED(hr))
+      return hr;
+    hr = device->CreatePixelShader(blob->GetBufferPointer(), blob->GetBufferSize(), NULL, &_ps);
+    if(FAILED(hr))
+      return hr;
+    D3D11_BUFFER_DESC bd;
+    memset(&bd, 0, sizeof(bd));
+    bd.ByteWidth = 4 * sizeof(FLOAT);
+    bd.Usage = D3D11_USAGE_DEFAULT;
+    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    hr = device->CreateBuffer(&bd, NULL, &_cb);
+    if(FAILED(hr))
+      return hr;
+    D3D11_SAMPLER_DESC sd;
+    memset(&sd, 0, sizeof(sd));
+    sd.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    sd.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.ComparisonFunc = D3D11_COMPARISON_NEVER;
+    sd.MaxLOD = D3D11_FLOAT32_MAX;
+    return device->CreateSamplerState(&sd, &_sampler);
+  }
+
+  void Release()
+  {
+    _vs.Release();
+    _ps.Release();
+    _cb.Release();
+    _sampler.Release();
+  }
+
+  /// Reads `srcWidth' x `srcHeight' texels of a `width' x `height' source
+  /// and covers the whole `width' x `height' destination with them.
+  void Draw(
+    ID3D11DeviceContext *dc,
+    ID3D11ShaderResourceView *source,
+    ID3D11RenderTargetView *dest,
+    UINT width,
+    UINT height,
+    UINT srcWidth,
+    UINT srcHeight)
+  {
+    FLOAT params[4] =
+    {
+      (FLOAT)srcWidth / width,
+      (FLOAT)srcHeight / height,
+      (srcWidth - 0.5f) / width,
+      (srcHeight - 0.5f) / height,
+    };
+    D3D11_VIEWPORT vp = { 0.0f, 0.0f, (FLOAT)width, (FLOAT)height, 0.0f, 1.0f };
+    Save(dc);
+    dc->UpdateSubresource(_cb, 0, NULL, params, 0, 0);
+    dc->OMSetRenderTargets(1, &dest, NULL);
+    dc->OMSetBlendState(NULL, NULL, 0xFFFFFFFF);
+    dc->OMSetDepthStencilState(NULL, 0);
+    dc->RSSetState(NULL);
+    dc->RSSetViewports(1, &vp);
+    dc->IASetInputLayout(NULL);
+    dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    dc->VSSetShader(_vs, NULL, 0);
+    dc->PSSetShader(_ps, NULL, 0);
+    dc->PSSetConstantBuffers(0, 1, &_cb);
+    dc->PSSetSamplers(0, 1, &_sampler);
+    dc->PSSetShaderResources(0, 1, &source);
+    dc->Draw(3, 0);
+    Restore(dc);
+  }
+
+private:
+  /// State Draw binds. Get calls add references, Restore drops them.
+  struct SavedState
+  {
+    ID3D11RenderTargetView *RTVs[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+    ID3D11DepthStencilView *DSV;
+    ID3D11BlendState *BlendState;
+    FLOAT BlendFactor[4];
+    UINT SampleMask;
+    ID3D11DepthStencilState *DepthStencilState;
+    UINT StencilRef;
+    ID3D11RasterizerState *RasterizerState;
+    D3D11_VIEWPORT Viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+    UINT ViewportCount;
+    ID3D11InputLayout *InputLayout;
+    D3D11_PRIMITIVE_TOPOLOGY Topology;
+    ID3D11VertexShader *VS;
+    ID3D11PixelShader *PS;
+    ID3D11Buffer *ConstantBuffer;
+    ID3D11SamplerState *Sampler;
+    ID3D11ShaderResourceView *Resource;
+  };
+
+  template<typename T>
+  static void SafeRelease(T *p)
+  {
+    if(p)
+      p->Release();
+  }
+
+  void Save(ID3D11DeviceContext *dc)
+  {
+    SavedState &s = _saved;
+    dc->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, s.RTVs, &s.DSV);
+    dc->OMGetBlendState(&s.BlendState, s.BlendFactor, &s.SampleMask);
+    dc->OMGetDepthStencilState(&s.DepthStencilState, &s.StencilRef);
+    dc->RSGetState(&s.RasterizerState);
+    s.ViewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+    dc->RSGetViewports(&s.ViewportCount, s.Viewports);
+    dc->IAGetInputLayout(&s.InputLayout);
+    dc->IAGetPrimitiveTopology(&s.Topology);
+    // Class instances are not saved; the library binds none.
+    dc->VSGetShader(&s.VS, NULL, NULL);
+    dc->PSGetShader(&s.PS, NULL, NULL);
+    dc->PSGetConstantBuffers(0, 1, &s.ConstantBuffer);
+    dc->PSGetSamplers(0, 1, &s.Sampler);
+    dc->PSGetShaderResources(0, 1, &s.Resource);
+  }
+
+  void Restore(ID3D11DeviceContext *dc)
+  {
+    SavedState &s = _saved;
+    // The source goes back out of slot 0 before its texture may be
+    // bound for output again.
+    dc->PSSetShaderResources(0, 1, &s.Resource);
+    dc->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, s.RTVs, s.DSV);
+    dc->OMSetBlendState(s.BlendState, s.BlendFactor, s.SampleMask);
+    dc->OMSetDepthStencilState(s.DepthStencilState, s.StencilRef);
+    dc->RSSetState(s.RasterizerState);
+    dc->RSSetViewports(s.ViewportCount, s.Viewports);
+    dc->IASetInputLayout(s.InputLayout);
+    dc->IASetPrimitiveTopology(s.Topology);
+    dc->VSSetShader(s.VS, NULL, 0);
+    dc->PSSetShader(s.PS, NULL, 0);
+    dc->PSSetConstantBuffers(0, 1, &s.ConstantBuffer);
+    dc->PSSetSamplers(0, 1, &s.Sampler);
+    for(UINT i = 0; i < D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT; ++i)
+      SafeRelease(s.RTVs[i]);
+    SafeRelease(s.DSV);
+    SafeRelease(s.BlendState);
+    SafeRelease(s.DepthStencilState);
+    SafeRelease(s.RasterizerState);
+    SafeRelease(s.InputLayout);
+    SafeRelease(s.VS);
+    SafeRelease(s.PS);
+    SafeRelease(s.ConstantBuffer);
+    SafeRelease(s.Sampler);
+    SafeRelease(s.Resource);
+  }
+
+  SavedState _saved;
+  ComPtr<ID3D11VertexShader> _vs;
+  ComPtr<ID3D11PixelShader> _ps;
+  ComPtr<ID3D11Buffer> _cb;
+  ComPtr<ID3D11SamplerState> _sampler;
+};
+
+#endif // __UPSCALER_HPP__
@@ -0,0 +1,788 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <windows.h>
+#include <D3DU.h>
+#include <ComUtils.hpp>
+#include <RenderQueue.hpp>
+
+/// Microbenchmarks of the library's hot paths.
+///
+///   D3DUBench [--filter text] [--samples n] [--json file]
+///   D3DUBench --replay file [--passes n] [--null]
+///
+/// Each benchmark first finds how many iterations take at least
+/// SAMPLE_MS, runs one sample to warm caches up, and then times
+/// `samples' more. The thread is pinned to one core at high priority,
+/// so that migrations and other processes disturb samples less; the
+/// median is the number to compare, the spread tells whether the
+/// machine was quiet enough for it to mean anything.
+///
+/// Device benchmarks run on the null driver, so they measure what the
+/// library and the runtime cost the CPU, and never wait for a GPU.
+///
+/// --replay times a log written by ID3DUDevice::StartRecording instead,
+/// on the hardware, or with --null on the null driver.
+
+#define SAMPLE_MS 10
+#define DEFAULT_SAMPLES 30
+#define MAX_SAMPLES 1000
+#define MAX_BENCHMARKS 16
+#define SORT_ITEMS 4096
+/// Draws per frame of the upload benchmarks, and bytes of data each.
+#define UPLOAD_DRAWS 256
+#define UPLOAD_RECORD_SIZE 64
+
+typedef void (*BenchFunction)(void *context, UINT64 iterations);
+
+typedef struct
+{
+  LPCSTR Name;
+  BenchFunction Run;
+  void *Context;
+} Benchmark;
+
+typedef struct
+{
+  LPCSTR Name;
+  UINT64 Iterations;
+  double Min;
+  double Median;
+  double Mean;
+  double StdDev;
+  double Max;
+} BenchResult;
+
+/// Keeps results of benchmarked calls alive, so that the optimizer does
+/// not drop the calls.
+static volatile UINT64 g_sink;
+
+/// Object for the ComPtr and ComObject benchmarks.
+class D3DU_NOVTABLE CBenchObject :
+  public IUnknown
+{
+public:
+  BEGIN_INTERFACE_MAP
+  END_INTERFACE_MAP
+
+  virtual ~CBenchObject() { }
+};
+
+/// Code the stub compiler hands out; it keeps one blob and returns
+/// references to it, so that compiling allocates nothing.
+class D3DU_NOVTABLE CStaticBlob :
+  public ID3DBlob
+{
+public:
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DBlob)
+  END_INTERFACE_MAP
+
+  CStaticBlob()
+  {
+    memset(_code, 0, sizeof(_code));
+  }
+
+  virtual ~CStaticBlob() { }
+
+  STDMETHOD_(LPVOID, GetBufferPointer)()
+  {
+    return _code;
+  }
+
+  STDMETHOD_(SIZE_T, GetBufferSize)()
+  {
+    return sizeof(_code);
+  }
+
+private:
+  BYTE _code[256];
+};
+
+/// Succeeds at once, leaving only what the library does around the
+/// compiler to measure.
+class D3DU_NOVTABLE CStubCompiler :
+  public ID3DUShaderCompiler
+{
+public:
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUShaderCompiler)
+  END_INTERFACE_MAP
+
+  virtual ~CStubCompiler() { }
+
+  STDMETHOD(Construct)()
+  {
+    _blob.Attach(new ComObject<CStaticBlob>());
+    return S_OK;
+  }
+
+  STDMETHOD(Compile)(
+    LPCVOID code,
+    SIZE_T size,
+    LPCSTR entry,
+    LPCSTR target,
+    DWORD shaderFlags,
+    ID3DBlob **oCodeBlob,
+    ID3DBlob **oErrorBlob)
+  {
+    if(!oCodeBlob)
+      return E_POINTER;
+    if(oErrorBlob)
+      *oErrorBlob = NULL;
+    _blob.AddRef();
+    *oCodeBlob = _blob;
+    return S_OK;
+  }
+
+private:
+  ComPtr<ID3DBlob> _blob;
+};
+
+/// Does what a light frame does: binds the frame views, clears them and
+/// sets a viewport.
+class D3DU_NOVTABLE CBenchSink :
+  public ID3DUFrameSink
+{
+public:
+  BEGIN_INTERFACE_MAP
+    INTERFACE_MAP_ENTRY(ID3DUSink)
+    INTERFACE_MAP_ENTRY(ID3DUFrameSink)
+  END_INTERFACE_MAP
+
+  virtual ~CBenchSink() { }
+
+  STDMETHOD_(void, Attach)(ID3DUTarget *target)
+  {
+    _dc.Release();
+    target->GetDC(&_dc);
+  }
+
+  STDMETHOD_(void, Detach)(ID3DUTarget *target)
+  {
+    _dc.Release();
+  }
+
+  STDMETHOD_(void, RenderFrame)(ID3DUTarget *target)
+  {
+    static const FLOAT color[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    ComPtr<ID3D11RenderTargetView> rtv;
+    ComPtr<ID3D11DepthStencilView> dsv;
+    UINT width, height;
+    if(!_dc)
+      return;
+    target->GetFrameRTV(&rtv);
+    target->GetFrameDSV(&dsv);
+    target->GetSize(&width, &height);
+    D3D11_VIEWPORT vp = {0.0f, 0.0f, (FLOAT)width, (FLOAT)height, 0.0f, 1.0f};
+    _dc->OMSetRenderTargets(1, &rtv, dsv);
+    _dc->RSSetViewports(1, &vp);
+    if(rtv)
+      _dc->ClearRenderTargetView(rtv, color);
+    if(dsv)
+      _dc->ClearDepthStencilView(dsv, D3D11_CLEAR_DEPTH, 1.0f, 0);
+  }
+
+  STDMETHOD_(void, Resize)(ID3DUTarget *target, UINT width, UINT height)
+  {
+  }
+
+private:
+  ComPtr<ID3D11DeviceContext> _dc;
+};
+
+typedef struct
+{
+  LPCSTR Code;
+  SIZE_T Size;
+  WCHAR Filename[MAX_PATH];
+} CompileContext;
+
+typedef struct
+{
+  RenderQueueItem *Original;
+  RenderQueueItem *Items;
+  RenderQueueItem *Scratch;
+} SortContext;
+
+typedef struct
+{
+  ID3DURenderQueue *Queue;
+  FLOAT *Depths;
+} KeyContext;
+
+typedef struct
+{
+  LPCSTR Name;
+  ID3DUUploadRing *Ring;
+  UINT64 Frames;
+} UploadContext;
+
+static void BenchAnimationQuery(void *context, UINT64 iterations)
+{
+  ID3DUFloatAnimation *animation = (ID3DUFloatAnimation*)context;
+  FLOAT value, sum = 0.0f;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    animation->Query(&value);
+    sum += value;
+  }
+  g_sink += (UINT64)sum;
+}
+
+static void BenchComPtrCopy(void *context, UINT64 iterations)
+{
+  ComPtr<IUnknown> original((IUnknown*)context);
+  original.AddRef();
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    ComPtr<IUnknown> copy(original);
+    g_sink += (UINT64)(IUnknown*)copy;
+  }
+}
+
+/// Assigns from a raw pointer, and from another ComPtr.
+static void BenchComPtrAssign(void *context, UINT64 iterations)
+{
+  IUnknown *object = (IUnknown*)context;
+  ComPtr<IUnknown> a, b;
+  a = object;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    b = object;
+    a = b;
+  }
+  g_sink += (UINT64)(IUnknown*)a;
+}
+
+static void BenchComPtrRelease(void *context, UINT64 iterations)
+{
+  IUnknown *object = (IUnknown*)context;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    ComPtr<IUnknown> p;
+    object->AddRef();
+    p.Attach(object);
+    p.Release();
+  }
+}
+
+static void BenchComObjectCreate(void *context, UINT64 iterations)
+{
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    ComPtr<IUnknown> object(new ComObject<CBenchObject>());
+    g_sink += (UINT64)(IUnknown*)object;
+  }
+}
+
+static void BenchCompileMemory(void *context, UINT64 iterations)
+{
+  CompileContext *cc = (CompileContext*)context;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    ComPtr<ID3DBlob> blob;
+    D3DUCompileFromMemory(cc->Code, cc->Size, "PS", "ps_4_0", 0, &blob);
+    g_sink += (UINT64)(ID3DBlob*)blob;
+  }
+}
+
+static void BenchCompileFile(void *context, UINT64 iterations)
+{
+  CompileContext *cc = (CompileContext*)context;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    ComPtr<ID3DBlob> blob;
+    D3DUCompileFromFile(cc->Filename, "PS", "ps_4_0", 0, &blob);
+    g_sink += (UINT64)(ID3DBlob*)blob;
+  }
+}
+
+static void BenchTargetDraw(void *context, UINT64 iterations)
+{
+  ID3DUTarget *target = (ID3DUTarget*)context;
+  for(UINT64 i = 0; i < iterations; ++i)
+    target->Draw();
+}
+
+/// Sorts keys that differ in every field, the slowest case.
+static void BenchRenderQueueSort(void *context, UINT64 iterations)
+{
+  SortContext *sc = (SortContext*)context;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    memcpy(sc->Items, sc->Original, SORT_ITEMS * sizeof(RenderQueueItem));
+    RenderQueueItem *sorted = RenderQueueSort(sc->Items, sc->Scratch, SORT_ITEMS);
+    g_sink += sorted[0].Index;
+  }
+}
+
+/// Builds keys with the inline helpers, depth quantization included.
+static void BenchRenderQueueKey(void *context, UINT64 iterations)
+{
+  KeyContext *kc = (KeyContext*)context;
+  UINT64 sum = 0;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    UINT n = (UINT)i & (SORT_ITEMS - 1);
+    sum += RenderQueueKey(n & 3, n & 63, n & 1023, RenderQueueDepth(kc->Depths[n]), n);
+  }
+  g_sink += sum;
+}
+
+/// A frame of per-draw constants, uploaded and bound draw by draw. Without
+/// constant buffer offsets every upload maps a pool buffer of its own.
+static void BenchUploadConstants(void *context, UINT64 iterations)
+{
+  UploadContext *uc = (UploadContext*)context;
+  BYTE data[UPLOAD_RECORD_SIZE] = {0};
+  D3DU_CONSTANT_SLICE slice;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    for(UINT j = 0; j < UPLOAD_DRAWS; ++j)
+    {
+      data[0] = (BYTE)j;
+      uc->Ring->Upload(data, sizeof(data), &slice);
+      uc->Ring->SetConstantBuffers(D3DU_STAGE_VS, 0, 1, &slice);
+    }
+    uc->Ring->EndFrame();
+    ++uc->Frames;
+  }
+}
+
+/// The same data as instance records, all written before one bind.
+static void BenchUploadInstances(void *context, UINT64 iterations)
+{
+  UploadContext *uc = (UploadContext*)context;
+  BYTE data[UPLOAD_RECORD_SIZE] = {0};
+  void *record;
+  UINT first;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    for(UINT j = 0; j < UPLOAD_DRAWS; ++j)
+    {
+      data[0] = (BYTE)j;
+      if(SUCCEEDED(uc->Ring->AllocateInstances(sizeof(data), 1, &record, &first)))
+        memcpy(record, data, sizeof(data));
+    }
+    uc->Ring->SetInstanceBuffer(sizeof(data));
+    uc->Ring->EndFrame();
+    ++uc->Frames;
+  }
+}
+
+/// Builds the same keys through ID3DURenderQueue::MakeKey.
+static void BenchRenderQueueMakeKey(void *context, UINT64 iterations)
+{
+  KeyContext *kc = (KeyContext*)context;
+  UINT64 sum = 0;
+  for(UINT64 i = 0; i < iterations; ++i)
+  {
+    UINT n = (UINT)i & (SORT_ITEMS - 1);
+    sum += kc->Queue->MakeKey(n & 3, n & 63, n & 1023, kc->Depths[n], n);
+  }
+  g_sink += sum;
+}
+
+static double Seconds(LONGLONG ticks)
+{
+  LARGE_INTEGER freq;
+  QueryPerformanceFrequency(&freq);
+  return (double)ticks / freq.QuadPart;
+}
+
+static double TimeRun(const Benchmark &b, UINT64 iterations)
+{
+  LARGE_INTEGER start, end;
+  QueryPerformanceCounter(&start);
+  b.Run(b.Context, iterations);
+  QueryPerformanceCounter(&end);
+  return Seconds(end.QuadPart - start.QuadPart);
+}
+
+static int CompareDoubles(const void *a, const void *b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void RunBenchmark(const Benchmark &b, UINT samples, BenchResult *oResult)
+{
+  double times[MAX_SAMPLES];
+  UINT64 iterations = 1;
+  while(TimeRun(b, iterations) < SAMPLE_MS / 1000.0 && iterations < (1ull << 40))
+    iterations *= 2;
+  TimeRun(b, iterations);
+  double sum = 0.0;
+  for(UINT i = 0; i < samples; ++i)
+  {
+    times[i] = TimeRun(b, iterations) * 1e9 / iterations;
+    sum += times[i];
+  }
+  double mean = sum / samples;
+  double squares = 0.0;
+  for(UINT i = 0; i < samples; ++i)
+    squares += (times[i] - mean) * (times[i] - mean);
+  qsort(times, samples, sizeof(double), CompareDoubles);
+  oResult->Name = b.Name;
+  oResult->Iterations = iterations;
+  oResult->Min = times[0];
+  oResult->Median = samples % 2 ? times[samples / 2] : (times[samples / 2 - 1] + times[samples / 2]) / 2;
+  oResult->Mean = mean;
+  oResult->StdDev = samples > 1 ? sqrt(squares / (samples - 1)) : 0.0;
+  oResult->Max = times[samples - 1];
+}
+
+static HRESULT WriteJson(LPCWSTR filename, const BenchResult *results, UINT count, UINT samples)
+{
+  FILE *file;
+  if(_wfopen_s(&file, filename, L"w"))
+    return E_FAIL;
+  fprintf(file, "{\n  \"unit\": \"ns/op\",\n  \"samples\": %u,\n  \"results\": [", samples);
+  for(UINT i = 0; i < count; ++i)
+  {
+    const BenchResult &r = results[i];
+    fprintf(
+      file,
+      "%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"min\": %.3f, \"median\": %.3f,"
+      " \"mean\": %.3f, \"stddev\": %.3f, \"max\": %.3f}",
+      i ? "," : "",
+      r.Name,
+      r.Iterations,
+      r.Min,
+      r.Median,
+      r.Mean,
+      r.StdDev,
+      r.Max);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) ? E_FAIL : S_OK;
+}
+
+/// Keeps the benchmarks on the second core, away from the interrupts
+/// that tend to go to the first one, and ahead of normal processes.
+static void SteadyThread()
+{
+  DWORD_PTR process, system;
+  DWORD_PTR core = 1;
+  if(GetProcessAffinityMask(GetCurrentProcess(), &process, &system) && (process & 2))
+    core = 2;
+  SetThreadAffinityMask(GetCurrentThread(), core);
+  SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+}
+
+static HRESULT CreateNullTarget(ID3DUTarget **oTarget)
+{
+  HRESULT hr;
+  ComPtr<ID3DUDevice> device;
+  ComPtr<ID3DUTarget> target;
+  hr = D3DUCreateNullDevice(D3D_FEATURE_LEVEL_10_0, &device);
+  if(FAILED(hr))
+    return hr;
+  hr = D3DUCreateOffscreenTarget(device, 256, 256, NULL, &target);
+  if(FAILED(hr))
+    return hr;
+  ComPtr<ComObject<CBenchSink> > sink(new ComObject<CBenchSink>());
+  hr = target->SetFrameSink(sink);
+  if(FAILED(hr))
+    return hr;
+  hr = target->Draw();
+  if(FAILED(hr))
+    return hr;
+  target.AddRef();
+  *oTarget = target;
+  return S_OK;
+}
+
+static int Replay(LPCWSTR filename, UINT passes, BOOL nullDriver)
+{
+  HRESULT hr;
+  ComPtr<ID3DUDevice> device;
+  ComPtr<ID3D11Device> d3d;
+  D3DU_REPLAY_STATISTICS stats;
+  static const D3D_FEATURE_LEVEL levels[] = { D3D_FEATURE_LEVEL_11_0, D3D_FEATURE_LEVEL_10_0 };
+  for(UINT i = 0; i < ARRAYSIZE(levels); ++i)
+  {
+    hr = nullDriver
+      ? D3DUCreateNullDevice(levels[i], &device)
+      : D3DUCreateDevice(levels[i], FALSE, &device);
+    if(SUCCEEDED(hr))
+      break;
+  }
+  if(FAILED(hr))
+  {
+    fprintf(stderr, "Unable to create device (0x%08lX).\n", (unsigned long)hr);
+    return 1;
+  }
+  device->GetDevice(&d3d);
+  SteadyThread();
+  hr = D3DUReplayRecording(d3d, filename, passes, &stats);
+  if(FAILED(hr))
+  {
+    fwprintf(stderr, L"Unable to replay %s (0x%08lX).\n", filename, (unsigned long)hr);
+    return 1;
+  }
+  printf(
+    "%llu frames, %llu calls, %llu skipped, in %.3f s\n",
+    stats.Frames,
+    stats.Calls,
+    stats.Skipped,
+    stats.Seconds);
+  printf(
+    "frame ms: min %.3f, mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+    stats.FrameTimes.Min,
+    stats.FrameTimes.Mean,
+    stats.FrameTimes.P50,
+    stats.FrameTimes.P95,
+    stats.FrameTimes.P99,
+    stats.FrameTimes.Max);
+  return 0;
+}
+
+static HRESULT CreateShaderFile(const CompileContext &cc, LPWSTR filename)
+{
+  WCHAR path[MAX_PATH];
+  DWORD written;
+  if(!GetTempPath(MAX_PATH, path) || !GetTempFileName(path, L"d3du", 0, filename))
+    return HRESULT_FROM_WIN32(GetLastError());
+  HANDLE file = CreateFile(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 0, NULL);
+  if(INVALID_HANDLE_VALUE == file)
+    return HRESULT_FROM_WIN32(GetLastError());
+  BOOL ok = WriteFile(file, cc.Code, (DWORD)cc.Size, &written, NULL);
+  CloseHandle(file);
+  return ok ? S_OK : E_FAIL;
+}
+
+int wmain(int argc, wchar_t **argv)
+{
+  static const CHAR shader[] = "float4 PS() : SV_Target { return float4(1, 1, 1, 1); }";
+  LPCWSTR jsonFile = NULL;
+  LPCWSTR filter = NULL;
+  LPCWSTR replayFile = NULL;
+  UINT samples = DEFAULT_SAMPLES;
+  UINT passes = 1;
+  BOOL nullDriver = FALSE;
+  for(int i = 1; i < argc; ++i)
+  {
+    if(!wcscmp(argv[i], L"--json") && i + 1 < argc)
+      jsonFile = argv[++i];
+    else if(!wcscmp(argv[i], L"--filter") && i + 1 < argc)
+      filter = argv[++i];
+    else if(!wcscmp(argv[i], L"--samples") && i + 1 < argc)
+      samples = (UINT)_wtoi(argv[++i]);
+    else if(!wcscmp(argv[i], L"--replay") && i + 1 < argc)
+      replayFile = argv[++i];
+    else if(!wcscmp(argv[i], L"--passes") && i + 1 < argc)
+      passes = (UINT)_wtoi(argv[++i]);
+    else if(!wcscmp(argv[i], L"--null"))
+      nullDriver = TRUE;
+    else
+    {
+      fwprintf(stderr, L"Usage: %s [--filter text] [--samples n] [--json file]\n", argv[0]);
+      fwprintf(stderr, L"       %s --replay file [--passes n] [--null]\n", argv[0]);
+      return 2;
+    }
+  }
+  if(samples < 1 || samples > MAX_SAMPLES)
+  {
+    fwprintf(stderr, L"Samples must be between 1 and %d.\n", MAX_SAMPLES);
+    return 2;
+  }
+  if(replayFile)
+  {
+    if(passes < 1)
+    {
+      fwprintf(stderr, L"Passes must be at least 1.\n");
+      return 2;
+    }
+    return Replay(replayFile, passes, nullDriver);
+  }
+
+  HRESULT hr;
+  Benchmark benchmarks[MAX_BENCHMARKS];
+  UINT count = 0;
+
+  ComPtr<ID3DUFloatAnimation> animation;
+  hr = D3DUCreateFloatAnimation(0.0f, 1.0f, 1.0f, TRUE, TRUE, &animation);
+  if(SUCCEEDED(hr))
+  {
+    animation->Start();
+    Benchmark b = {"animation.query", BenchAnimationQuery, (ID3DUFloatAnimation*)animation};
+    benchmarks[count++] = b;
+  }
+
+  ComPtr<IUnknown> object(new ComObject<CBenchObject>());
+  {
+    Benchmark copy = {"comptr.copy", BenchComPtrCopy, (IUnknown*)object};
+    Benchmark assign = {"comptr.assign", BenchComPtrAssign, (IUnknown*)object};
+    Benchmark release = {"comptr.release", BenchComPtrRelease, (IUnknown*)object};
+    Benchmark create = {"comobject.create", BenchComObjectCreate, NULL};
+    benchmarks[count++] = copy;
+    benchmarks[count++] = assign;
+    benchmarks[count++] = release;
+    benchmarks[count++] = create;
+  }
+
+  CompileContext cc;
+  cc.Code = shader;
+  cc.Size = sizeof(shader) - 1;
+  cc.Filename[0] = 0;
+  ComPtr<ComObject<CStubCompiler> > compiler(new ComObject<CStubCompiler>());
+  compiler->Construct();
+  hr = D3DUSetShaderCompiler(compiler);
+  if(SUCCEEDED(hr))
+  {
+    Benchmark b = {"compile.memory", BenchCompileMemory, &cc};
+    benchmarks[count++] = b;
+    if(SUCCEEDED(CreateShaderFile(cc, cc.Filename)))
+    {
+      Benchmark f = {"compile.file", BenchCompileFile, &cc};
+      benchmarks[count++] = f;
+    }
+  }
+
+  ComPtr<ID3DUTarget> target;
+  ComPtr<ID3DUUploadRing> constantRing, instanceRing;
+  UploadContext uploads[2] = {{"upload.constants", NULL, 0}, {"upload.instances", NULL, 0}};
+  hr = CreateNullTarget(&target);
+  if(SUCCEEDED(hr))
+  {
+    Benchmark b = {"target.draw", BenchTargetDraw, (ID3DUTarget*)target};
+    benchmarks[count++] = b;
+    ComPtr<ID3D11DeviceContext> dc;
+    target->GetDC(&dc);
+    if(SUCCEEDED(D3DUCreateUploadRing(dc, 0, &constantRing))
+      && SUCCEEDED(D3DUCreateUploadRing(dc, 0, &instanceRing)))
+    {
+      uploads[0].Ring = constantRing;
+      uploads[1].Ring = instanceRing;
+      Benchmark c = {uploads[0].Name, BenchUploadConstants, &uploads[0]};
+      Benchmark s = {uploads[1].Name, BenchUploadInstances, &uploads[1]};
+      benchmarks[count++] = c;
+      benchmarks[count++] = s;
+    }
+  }
+  else
+    fprintf(stderr, "Skipping target.draw and upload, no null device (0x%08lX).\n", (unsigned long)hr);
+
+  SortContext sc;
+  sc.Original = new RenderQueueItem[SORT_ITEMS];
+  sc.Items = new RenderQueueItem[SORT_ITEMS];
+  sc.Scratch = new RenderQueueItem[SORT_ITEMS];
+  srand(1);
+  for(UINT i = 0; i < SORT_ITEMS; ++i)
+  {
+    sc.Original[i].Key = RenderQueueKey(
+      rand() % 4,
+      rand() % 64,
+      rand() % 1024,
+      ((unsigned)rand() << 12) ^ (unsigned)rand(),
+      i);
+    sc.Original[i].Index = i;
+  }
+  {
+    Benchmark b = {"renderqueue.sort", BenchRenderQueueSort, &sc};
+    benchmarks[count++] = b;
+  }
+
+  KeyContext kc;
+  kc.Depths = new FLOAT[SORT_ITEMS];
+  for(UINT i = 0; i < SORT_ITEMS; ++i)
+    kc.Depths[i] = (FLOAT)rand() / RAND_MAX;
+  {
+    Benchmark b = {"renderqueue.key", BenchRenderQueueKey, &kc};
+    benchmarks[count++] = b;
+  }
+  ComPtr<ID3DURenderQueue> queue;
+  hr = D3DUCreateRenderQueue(&queue);
+  kc.Queue = queue;
+  if(SUCCEEDED(hr))
+  {
+    Benchmark b = {"renderqueue.makekey", BenchRenderQueueMakeKey, &kc};
+    benchmarks[count++] = b;
+  }
+  else
+    fprintf(stderr, "Skipping renderqueue.makekey, no render queue (0x%08lX).\n", (unsigned long)hr);
+
+  SteadyThread();
+  BenchResult results[MAX_BENCHMARKS];
+  UINT ran = 0;
+  printf("%-20s %12s %10s %10s %10s %10s %10s\n", "benchmark", "iterations", "min", "median", "mean", "stddev", "max");
+  for(UINT i = 0; i < count; ++i)
+  {
+    if(filter)
+    {
+      WCHAR name[64];
+      MultiByteToWideChar(CP_ACP, 0, benchmarks[i].Name, -1, name, ARRAYSIZE(name));
+      if(!wcsstr(name, filter))
+        continue;
+    }
+    BenchResult &r = results[ran++];
+    RunBenchmark(benchmarks[i], samples, &r);
+    printf(
+      "%-20s %12llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+      r.Name,
+      r.Iterations,
+      r.Min,
+      r.Median,
+      r.Mean,
+      r.StdDev,
+      r.Max);
+  }
+  printf("Times are in ns per iteration.\n");
+  for(UINT i = 0; i < ARRAYSIZE(uploads); ++i)
+  {
+    D3DU_UPLOAD_STATISTICS stats;
+    if(!uploads[i].Frames || FAILED(uploads[i].Ring->GetStatistics(&stats)))
+      continue;
+    printf(
+      "%-20s %.1f maps per frame of %u draws\n",
+      uploads[i].Name,
+      (double)stats.Maps / uploads[i].Frames,
+      UPLOAD_DRAWS);
+  }
+
+  int status = 0;
+  if(jsonFile)
+  {
+    hr = WriteJson(jsonFile, results, ran, samples);
+    if(FAILED(hr))
+    {
+      fwprintf(stderr, L"Unable to write %s.\n", jsonFile);
+      status = 1;
+    }
+  }
+  D3DUSetShaderCompiler(NULL);
+  if(cc.Filename[0])
+    DeleteFile(cc.Filename);
+  delete[] sc.Original;
+  delete[] sc.Items;
+  delete[] sc.Scratch;
+  delete[] kc.Depths;
+  return status;
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <stdio.h>
+#include <string.h>
+#include "Test.hpp"
+
+/// Tests of the parts of the library that need no device.
+///
+///   D3DUTest [--filter text]
+///
+/// Exits with 1 when any check fails.
+///
+/// This file and the tests of the headers that do not need Windows also
+/// build on POSIX systems, see the Makefile next to it.
+
+typedef void (*TestFunction)();
+
+typedef struct
+{
+  const char *Name;
+  TestFunction Run;
+} Test;
+
+static const Test g_tests[] =
+{
+  {"framering", TestFrameRing},
+  {"inputqueue", TestInputQueue},
+#ifdef _WIN32
+  {"layers", TestLayers},
+  {"mandelbrot", TestMandelbrot},
+  {"memorytracker", TestMemoryTracker},
+  {"recording", TestRecording},
+  {"releasequeue", TestReleaseQueue},
+  {"rendergraph", TestRenderGraph},
+#endif
+  {"resolutioncontroller", TestResolutionController},
+  {"uploadring", TestUploadRing},
+};
+
+static unsigned int g_failures;
+
+void TestCheck(bool ok, const char *expr, const char *file, int line)
+{
+  if(ok)
+    return;
+  fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expr);
+  ++g_failures;
+}
+
+int main(int argc, char **argv)
+{
+  const char *filter = NULL;
+  for(int i = 1; i < argc; ++i)
+  {
+    if(!strcmp(argv[i], "--filter") && i + 1 < argc)
+      filter = argv[++i];
+    else
+    {
+      fprintf(stderr, "Usage: %s [--filter text]\n", argv[0]);
+      return 2;
+    }
+  }
+  unsigned int failed = 0;
+  for(size_t i = 0; i < sizeof(g_tests) / sizeof(g_tests[0]); ++i)
+  {
+    if(filter && !strstr(g_tests[i].Name, filter))
+      continue;
+    unsigned int before = g_failures;
+    g_tests[i].Run();
+    bool ok = before == g_failures;
+    printf("%-20s %s\n", g_tests[i].Name, ok ? "ok" : "FAILED");
+    if(!ok)
+      ++failed;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,176 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <FrameRing.hpp>
+#include "Test.hpp"
+
+#define RING_NAME "D3DUTestFrameRing"
+#define RING_SLOTS 4
+#define RING_WIDTH 16
+#define RING_HEIGHT 8
+#define RING_STRIDE (RING_WIDTH * 4)
+#define THREADED_FRAMES 20000
+
+/// Publishes one frame filled with the low byte of its sequence number.
+static void Publish(CFrameRingWriter &writer, uint32_t sequence)
+{
+  uint8_t *data = writer.BeginWrite(RING_WIDTH, RING_HEIGHT, RING_STRIDE, FRAME_RING_FORMAT_RGBA8);
+  TEST_CHECK(NULL != data);
+  if(!data)
+    return;
+  memset(data, (uint8_t)sequence, RING_STRIDE * RING_HEIGHT);
+  writer.EndWrite(sequence);
+}
+
+static bool Filled(const FrameRingFrame &frame)
+{
+  for(uint32_t i = 0; i < frame.Stride * frame.Height; ++i)
+    if(frame.Data[i] != (uint8_t)frame.Sequence)
+      return false;
+  return true;
+}
+
+static void TestEmptyAndClosed()
+{
+  CFrameRingWriter writer;
+  CFrameRingReader reader;
+  FrameRingFrame frame;
+  TEST_CHECK(writer.Create(RING_NAME, RING_SLOTS, RING_STRIDE * RING_HEIGHT, 1000));
+  TEST_CHECK(reader.Open(RING_NAME));
+  TEST_CHECK(FRAME_RING_EMPTY == reader.Acquire(&frame));
+  TEST_CHECK(NULL == writer.BeginWrite(RING_WIDTH, RING_HEIGHT * 2, RING_STRIDE, FRAME_RING_FORMAT_RGBA8));
+  Publish(writer, 1);
+  TEST_CHECK(FRAME_RING_OK == reader.Acquire(&frame));
+  TEST_CHECK(1 == frame.Sequence);
+  TEST_CHECK(RING_WIDTH == frame.Width && RING_HEIGHT == frame.Height);
+  TEST_CHECK(1 == frame.Timestamp);
+  TEST_CHECK(Filled(frame));
+  TEST_CHECK(reader.Validate(frame));
+  TEST_CHECK(FRAME_RING_EMPTY == reader.Acquire(&frame));
+  // The reader keeps its own mapping after the producer goes away.
+  writer.Close();
+  TEST_CHECK(FRAME_RING_CLOSED == reader.Acquire(&frame));
+  TEST_CHECK(0 == reader.Lost());
+}
+
+/// A reader left behind by more frames than the ring holds loses the
+/// oldest ones and resumes from the oldest intact frame.
+static void TestWrapAround()
+{
+  CFrameRingWriter writer;
+  CFrameRingReader reader;
+  FrameRingFrame frame;
+  TEST_CHECK(writer.Create(RING_NAME, RING_SLOTS, RING_STRIDE * RING_HEIGHT, 1000));
+  TEST_CHECK(reader.Open(RING_NAME));
+  for(uint32_t i = 1; i <= 10; ++i)
+    Publish(writer, i);
+  // Of frames 1 to 10, the slot of frame 7 is next to be rewritten,
+  // so 8, 9 and 10 are what is left to read.
+  for(uint32_t i = 8; i <= 10; ++i)
+  {
+    TEST_CHECK(FRAME_RING_OK == reader.Acquire(&frame));
+    TEST_CHECK(i == frame.Sequence);
+    TEST_CHECK(Filled(frame));
+  }
+  TEST_CHECK(7 == reader.Lost());
+  TEST_CHECK(FRAME_RING_EMPTY == reader.Acquire(&frame));
+  // A frame held while the producer laps the ring no longer validates.
+  Publish(writer, 11);
+  TEST_CHECK(FRAME_RING_OK == reader.Acquire(&frame));
+  TEST_CHECK(reader.Validate(frame));
+  for(uint32_t i = 12; i < 12 + RING_SLOTS; ++i)
+    Publish(writer, i);
+  TEST_CHECK(!reader.Validate(frame));
+}
+
+typedef struct
+{
+  CFrameRingWriter *Writer;
+  volatile long Start;
+} ProducerContext;
+
+static TEST_THREAD_PROC ProducerProc(void *param)
+{
+  ProducerContext *pc = (ProducerContext*)param;
+  while(!LfLoadAcquire(&pc->Start))
+    YieldThread();
+  // Yielding now and then lets the consumer in on a single core too.
+  for(uint32_t i = 1; i <= THREADED_FRAMES; ++i)
+  {
+    Publish(*pc->Writer, i);
+    if(0 == i % 8)
+      YieldThread();
+  }
+  pc->Writer->Close();
+  return 0;
+}
+
+/// Frames the consumer reads intact must be whole, come in order, and
+/// together with the lost and torn ones account for every frame.
+static void TestProducerConsumer()
+{
+  CFrameRingWriter writer;
+  CFrameRingReader reader;
+  FrameRingFrame frame;
+  ProducerContext pc = {&writer, 0};
+  TEST_CHECK(writer.Create(RING_NAME, RING_SLOTS, RING_STRIDE * RING_HEIGHT, 1000));
+  TEST_CHECK(reader.Open(RING_NAME));
+  TestThread thread;
+  bool started = StartThread(&thread, ProducerProc, &pc);
+  TEST_CHECK(started);
+  if(!started)
+    return;
+  LfStoreRelease(&pc.Start, 1L);
+  uint32_t last = 0;
+  uint64_t intact = 0, torn = 0;
+  bool ordered = true, whole = true;
+  for(;;)
+  {
+    FrameRingStatus status = reader.Acquire(&frame);
+    if(FRAME_RING_CLOSED == status)
+      break;
+    if(FRAME_RING_EMPTY == status)
+      continue;
+    ordered = ordered && frame.Sequence > last;
+    last = frame.Sequence;
+    bool filled = Filled(frame);
+    if(!reader.Validate(frame))
+    {
+      ++torn;
+      continue;
+    }
+    whole = whole && filled;
+    ++intact;
+  }
+  JoinThread(thread);
+  TEST_CHECK(ordered);
+  TEST_CHECK(whole);
+  TEST_CHECK(intact > 0);
+  TEST_CHECK(THREADED_FRAMES == intact + torn + reader.Lost());
+}
+
+void TestFrameRing()
+{
+  TestEmptyAndClosed();
+  TestWrapAround();
+  TestProducerConsumer();
+}
@@ -0,0 +1,228 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <InputQueue.hpp>
+#include "Test.hpp"
+
+#define QUEUE_CAPACITY 8
+#define MOVE_LIMIT (QUEUE_CAPACITY / 4 * 3)
+#define THREADED_EVENTS 200000
+
+enum
+{
+  EVENT_KEY,
+  EVENT_MOVE,
+  EVENT_BUTTON,
+  EVENT_WHEEL,
+};
+
+/// The fields CInputQueue relies on, and a few to tell events apart by.
+struct Event
+{
+  int Type;
+  unsigned int Coalesced;
+  unsigned int Time;
+  int X;
+};
+
+typedef CInputQueue<Event, EVENT_MOVE> CEventQueue;
+
+static bool Push(CEventQueue &queue, int type, unsigned int time, int x = 0)
+{
+  Event e = {type, 0, time, x};
+  return queue.Push(e);
+}
+
+/// Moves between two other events come out as one, carrying the time
+/// and position of the last of them; the other events keep their order
+/// and their own times.
+static void TestCoalesce()
+{
+  CEventQueue queue;
+  queue.Init(QUEUE_CAPACITY * 2);
+  Push(queue, EVENT_MOVE, 1, 10);
+  Push(queue, EVENT_MOVE, 2, 20);
+  Push(queue, EVENT_BUTTON, 3);
+  Push(queue, EVENT_MOVE, 4, 40);
+  Push(queue, EVENT_WHEEL, 5);
+  Push(queue, EVENT_MOVE, 6, 60);
+  Push(queue, EVENT_MOVE, 7, 70);
+  Push(queue, EVENT_KEY, 8);
+  Event batch[QUEUE_CAPACITY];
+  unsigned int n = queue.Drain(batch, QUEUE_CAPACITY);
+  static const int types[] = {EVENT_MOVE, EVENT_BUTTON, EVENT_MOVE, EVENT_WHEEL, EVENT_MOVE, EVENT_KEY};
+  static const unsigned int times[] = {2, 3, 4, 5, 7, 8};
+  static const unsigned int coalesced[] = {1, 0, 0, 0, 1, 0};
+  TEST_CHECK(6 == n);
+  for(unsigned int i = 0; i < n && i < 6; ++i)
+  {
+    TEST_CHECK(types[i] == batch[i].Type);
+    TEST_CHECK(times[i] == batch[i].Time);
+    TEST_CHECK(coalesced[i] == batch[i].Coalesced);
+  }
+  TEST_CHECK(20 == batch[0].X);
+  TEST_CHECK(70 == batch[4].X);
+  TEST_CHECK(0 == queue.Drain(batch, QUEUE_CAPACITY));
+  TEST_CHECK(0 == queue.GetDropped());
+}
+
+/// A full batch stops draining before the next event that needs a slot
+/// of its own, but moves following its last one still merge into it.
+static void TestShortBatch()
+{
+  CEventQueue queue;
+  queue.Init(QUEUE_CAPACITY);
+  Push(queue, EVENT_KEY, 1);
+  Push(queue, EVENT_MOVE, 2);
+  Push(queue, EVENT_MOVE, 3);
+  Push(queue, EVENT_MOVE, 4);
+  Push(queue, EVENT_KEY, 5);
+  Event batch[2];
+  TEST_CHECK(2 == queue.Drain(batch, 2));
+  TEST_CHECK(EVENT_KEY == batch[0].Type);
+  TEST_CHECK(EVENT_MOVE == batch[1].Type);
+  TEST_CHECK(4 == batch[1].Time);
+  TEST_CHECK(2 == batch[1].Coalesced);
+  TEST_CHECK(1 == queue.Drain(batch, 2));
+  TEST_CHECK(5 == batch[0].Time);
+}
+
+/// Past three quarters of the capacity a move is written over the move
+/// at the tail, and refused when the tail is another event; other events
+/// are refused only once the queue is full. Refusals are counted.
+static void TestFull()
+{
+  CEventQueue queue;
+  queue.Init(QUEUE_CAPACITY);
+  unsigned int time = 0;
+  for(unsigned int i = 0; i < MOVE_LIMIT; ++i)
+    TEST_CHECK(Push(queue, EVENT_MOVE, ++time));
+  TEST_CHECK(Push(queue, EVENT_MOVE, ++time, 99));
+  TEST_CHECK(Push(queue, EVENT_MOVE, ++time, 100));
+  TEST_CHECK(0 == queue.GetDropped());
+  for(unsigned int i = MOVE_LIMIT; i < QUEUE_CAPACITY; ++i)
+    TEST_CHECK(Push(queue, EVENT_BUTTON, ++time));
+  TEST_CHECK(!Push(queue, EVENT_MOVE, ++time));
+  TEST_CHECK(1 == queue.GetDropped());
+  TEST_CHECK(!Push(queue, EVENT_KEY, ++time));
+  TEST_CHECK(2 == queue.GetDropped());
+  Event batch[QUEUE_CAPACITY];
+  unsigned int n = queue.Drain(batch, QUEUE_CAPACITY);
+  TEST_CHECK(1 + QUEUE_CAPACITY - MOVE_LIMIT == n);
+  TEST_CHECK(EVENT_MOVE == batch[0].Type);
+  TEST_CHECK(MOVE_LIMIT + 2 == batch[0].Time);
+  TEST_CHECK(100 == batch[0].X);
+  TEST_CHECK(MOVE_LIMIT + 1 == batch[0].Coalesced);
+  TEST_CHECK(EVENT_BUTTON == batch[1].Type);
+  TEST_CHECK(Push(queue, EVENT_MOVE, ++time));
+}
+
+/// Many more events than slots go through a small queue, so that the
+/// indices wrap around the ring again and again.
+static void TestWrap()
+{
+  CEventQueue queue;
+  queue.Init(QUEUE_CAPACITY);
+  unsigned int time = 0;
+  for(unsigned int round = 0; round < 100; ++round)
+  {
+    Push(queue, EVENT_KEY, ++time);
+    Push(queue, EVENT_MOVE, ++time);
+    Push(queue, EVENT_MOVE, ++time);
+    Push(queue, EVENT_WHEEL, ++time);
+    Push(queue, EVENT_MOVE, ++time);
+    Event batch[QUEUE_CAPACITY];
+    unsigned int n = queue.Drain(batch, QUEUE_CAPACITY);
+    TEST_CHECK(4 == n);
+    if(4 != n)
+      return;
+    TEST_CHECK(EVENT_KEY == batch[0].Type && time - 4 == batch[0].Time);
+    TEST_CHECK(EVENT_MOVE == batch[1].Type && time - 2 == batch[1].Time);
+    TEST_CHECK(EVENT_WHEEL == batch[2].Type && time - 1 == batch[2].Time);
+    TEST_CHECK(EVENT_MOVE == batch[3].Type && time == batch[3].Time);
+  }
+  TEST_CHECK(0 == queue.GetDropped());
+}
+
+typedef struct
+{
+  CEventQueue *Queue;
+  volatile long Done;
+} ProducerContext;
+
+static TEST_THREAD_PROC ProducerProc(void *param)
+{
+  ProducerContext *pc = (ProducerContext*)param;
+  for(unsigned int i = 1; i <= THREADED_EVENTS; ++i)
+  {
+    Push(*pc->Queue, 0 == i % 1024 ? EVENT_KEY : EVENT_MOVE, i, (int)i);
+    if(0 == i % 64)
+      YieldThread();
+  }
+  LfStoreRelease(&pc->Done, 1L);
+  return 0;
+}
+
+/// Moves written over while the consumer drains must come out whole and
+/// in order, and every event pushed is either drained, merged into a
+/// drained move, or counted as dropped.
+static void TestProducerConsumer()
+{
+  CEventQueue queue;
+  queue.Init(QUEUE_CAPACITY);
+  ProducerContext pc = {&queue, 0};
+  TestThread thread;
+  bool started = StartThread(&thread, ProducerProc, &pc);
+  TEST_CHECK(started);
+  if(!started)
+    return;
+  Event batch[QUEUE_CAPACITY];
+  unsigned int seen = 0, last = 0;
+  bool ordered = true, whole = true;
+  for(;;)
+  {
+    bool done = 0 != LfLoadAcquire(&pc.Done);
+    unsigned int n = queue.Drain(batch, QUEUE_CAPACITY);
+    for(unsigned int i = 0; i < n; ++i)
+    {
+      ordered = ordered && batch[i].Time > last;
+      last = batch[i].Time;
+      whole = whole && batch[i].X == (int)batch[i].Time;
+      seen += 1 + batch[i].Coalesced;
+    }
+    if(done && !n)
+      break;
+  }
+  JoinThread(thread);
+  TEST_CHECK(ordered);
+  TEST_CHECK(whole);
+  TEST_CHECK(THREADED_EVENTS == seen + queue.GetDropped());
+}
+
+void TestInputQueue()
+{
+  TestCoalesce();
+  TestShortBatch();
+  TestFull();
+  TestWrap();
+  TestProducerConsumer();
+}
@@ -0,0 +1,130 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include <Layers.hpp>
+#include "Test.hpp"
+
+#define LAYERS_TEST_LAYERS 48
+#define LAYERS_TEST_FRAMES 20
+#define LAYERS_TEST_THREADS 4
+
+/// Stands in for the deferred contexts, and notes the order it is
+/// driven in.
+class CMockBackend :
+  public ILayerBackend
+{
+public:
+  CMockBackend()
+  {
+    FailBegin = false;
+    Begun = 0;
+    Ended = 0;
+    _count = 0;
+  }
+
+  HRESULT BeginFrame(UINT count)
+  {
+    ++Begun;
+    if(FailBegin)
+      return E_FAIL;
+    _count = count;
+    _recorded = 0;
+    Submitted = 0;
+    _recordedBeforeSubmit = true;
+    _submittedInOrder = true;
+    for(UINT i = 0; i < LAYERS_TEST_LAYERS; ++i)
+      _records[i] = 0;
+    return S_OK;
+  }
+
+  void Record(UINT index)
+  {
+    // Long enough that the workers overlap.
+    volatile UINT spin = 0;
+    for(UINT i = 0; i < 1000 * (index % 7 + 1); ++i)
+      spin += i;
+    InterlockedIncrement(&_records[index]);
+    InterlockedIncrement(&_recorded);
+  }
+
+  void Submit(UINT index)
+  {
+    if((UINT)_recorded != _count)
+      _recordedBeforeSubmit = false;
+    if(index != Submitted)
+      _submittedInOrder = false;
+    ++Submitted;
+  }
+
+  void EndFrame()
+  {
+    ++Ended;
+  }
+
+  /// Each layer recorded once, all before the first submission, and
+  /// submitted in order.
+  bool FrameWasRight() const
+  {
+    for(UINT i = 0; i < _count; ++i)
+    {
+      if(1 != _records[i])
+        return false;
+    }
+    return _recordedBeforeSubmit && _submittedInOrder && Submitted == _count;
+  }
+
+  bool FailBegin;
+  UINT Begun;
+  UINT Ended;
+  UINT Submitted;
+
+private:
+  UINT _count;
+  volatile LONG _records[LAYERS_TEST_LAYERS];
+  volatile LONG _recorded;
+  bool _recordedBeforeSubmit;
+  bool _submittedInOrder;
+};
+
+void TestLayers()
+{
+  CLayerScheduler scheduler;
+  CMockBackend backend;
+  TEST_CHECK(SUCCEEDED(scheduler.Init(LAYERS_TEST_THREADS)));
+  for(UINT frame = 0; frame < LAYERS_TEST_FRAMES; ++frame)
+  {
+    // Fewer layers than threads some frames, many more in others.
+    UINT count = frame % 2 ? LAYERS_TEST_LAYERS : frame % LAYERS_TEST_THREADS;
+    TEST_CHECK(S_OK == scheduler.Run(&backend, count));
+    TEST_CHECK(backend.FrameWasRight());
+  }
+  TEST_CHECK(LAYERS_TEST_FRAMES == backend.Begun);
+  TEST_CHECK(LAYERS_TEST_FRAMES == backend.Ended);
+  // A frame the backend cannot begin records and submits nothing.
+  backend.FailBegin = true;
+  backend.Submitted = 0;
+  TEST_CHECK(E_FAIL == scheduler.Run(&backend, LAYERS_TEST_LAYERS));
+  TEST_CHECK(0 == backend.Submitted);
+  TEST_CHECK(LAYERS_TEST_FRAMES == backend.Ended);
+  scheduler.Shutdown();
+}
@@ -0,0 +1,67 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include "../MandelbrotCube/Mandelbrot.hpp"
+#include "Test.hpp"
+
+#define MANDELBROT_TEST_THREADS 4
+
+static void Compare(UINT width, UINT height, const FLOAT *color1, const FLOAT *color2)
+{
+  const UINT pitch = width * 4;
+  const UINT size = pitch * height;
+  BYTE *fast = new BYTE[size];
+  BYTE *reference = new BYTE[size];
+  CMandelbrotRenderer renderer;
+  TEST_CHECK(SUCCEEDED(renderer.Init(MANDELBROT_TEST_THREADS)));
+  memset(fast, 0xCD, size);
+  renderer.Render(fast, pitch, width, height, color1, color2);
+  CMandelbrotRenderer::RenderReference(reference, pitch, width, height, color1, color2);
+  UINT maxError = 0, differing = 0;
+  for(UINT i = 0; i < size; ++i)
+  {
+    UINT error = fast[i] > reference[i] ? fast[i] - reference[i] : reference[i] - fast[i];
+    if(error > maxError)
+      maxError = error;
+    if(error)
+      ++differing;
+  }
+  TEST_CHECK(maxError <= 1);
+  // A handful of channels in a million, where the logarithms round
+  // across a step.
+  TEST_CHECK(differing <= size / 10000);
+  delete[] reference;
+  delete[] fast;
+}
+
+/// The SSE2 renderer stays within one step of the scalar PS. The second
+/// size is not a multiple of the tile size or of eight, so that partial
+/// tiles and the last pixels of a row are covered too.
+void TestMandelbrot()
+{
+  const FLOAT blue[3] = {0.1f, 0.2f, 0.9f};
+  const FLOAT orange[3] = {1.0f, 0.6f, 0.1f};
+  const FLOAT black[3] = {0, 0, 0};
+  Compare(1024, 1024, blue, orange);
+  Compare(509, 307, black, orange);
+}
@@ -0,0 +1,63 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include <D3DU.h>
+#include <ComUtils.hpp>
+#include <MemoryTracker.hpp>
+#include "Test.hpp"
+
+/// Sizes the tracker and the pool charge budgets with.
+void TestMemoryTracker()
+{
+  // 256x256 RGBA8 with its full chain of 9 mips.
+  UINT64 chain = 0;
+  for(UINT size = 256; size; size /= 2)
+    chain += (UINT64)size * size * 4;
+  TEST_CHECK(chain == EstimateTextureBytes(DXGI_FORMAT_R8G8B8A8_UNORM, 256, 256, 1, 0, 1, 1));
+  TEST_CHECK(256 * 256 * 4 == EstimateTextureBytes(DXGI_FORMAT_R8G8B8A8_UNORM, 256, 256, 1, 1, 1, 1));
+  // Array slices and samples multiply.
+  TEST_CHECK(64 * 64 * 4 * 6 * 4 == EstimateTextureBytes(DXGI_FORMAT_D24_UNORM_S8_UINT, 64, 64, 1, 1, 6, 4));
+  // 3D mips halve the depth as well.
+  TEST_CHECK(8 * 8 * 8 * 2 + 4 * 4 * 4 * 2 == EstimateTextureBytes(DXGI_FORMAT_R16_FLOAT, 8, 8, 8, 2, 1, 1));
+  // BC7 and BC6H are 16 bytes a block, BC1 8.
+  TEST_CHECK(256 * 256 == EstimateTextureBytes(DXGI_FORMAT_BC7_UNORM, 256, 256, 1, 1, 1, 1));
+  TEST_CHECK(256 * 256 == EstimateTextureBytes(DXGI_FORMAT_BC6H_SF16, 256, 256, 1, 1, 1, 1));
+  TEST_CHECK(256 * 256 / 2 == EstimateTextureBytes(DXGI_FORMAT_BC1_UNORM, 256, 256, 1, 1, 1, 1));
+  // The 4x4, 2x2 and 1x1 mips of a BC texture take a whole block each.
+  TEST_CHECK(16 * 3 == EstimateTextureBytes(DXGI_FORMAT_BC3_UNORM, 4, 4, 1, 0, 1, 1));
+  // 16-bit packed formats.
+  TEST_CHECK(100 * 100 * 2 == EstimateTextureBytes(DXGI_FORMAT_B5G6R5_UNORM, 100, 100, 1, 1, 1, 1));
+  TEST_CHECK(100 * 100 * 2 == EstimateTextureBytes(DXGI_FORMAT_B5G5R5A1_UNORM, 100, 100, 1, 1, 1, 1));
+  // Formats it does not know do not count.
+  TEST_CHECK(0 == EstimateTextureBytes((DXGI_FORMAT)0x7FFF, 100, 100, 1, 1, 1, 1));
+  // The Texture2D overload reads the description.
+  D3D11_TEXTURE2D_DESC d;
+  memset(&d, 0, sizeof(d));
+  d.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+  d.Width = 10;
+  d.Height = 3;
+  d.MipLevels = 1;
+  d.ArraySize = 2;
+  d.SampleDesc.Count = 1;
+  TEST_CHECK(10 * 3 * 16 * 2 == EstimateTextureBytes(d));
+}
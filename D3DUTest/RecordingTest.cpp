@@ -0,0 +1,64 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include <D3DU.h>
+#include <ComUtils.hpp>
+#include <Recording.hpp>
+#include "Test.hpp"
+
+static bool Layout(DXGI_FORMAT format, UINT width, UINT height, UINT depth, RecordLayout *oLayout)
+{
+  oLayout->RowBytes = 0xCDCDCDCD;
+  oLayout->Rows = 0xCDCDCDCD;
+  oLayout->Slices = 0xCDCDCDCD;
+  return RecordLayoutOf(format, width, height, depth, oLayout);
+}
+
+/// Rows are as long as the data the runtime reads for them, so that
+/// recording copies no byte past the rows of the caller.
+void TestRecording()
+{
+  RecordLayout l;
+  // BC1 blocks are 8 bytes, and partial blocks take whole ones.
+  TEST_CHECK(Layout(DXGI_FORMAT_BC1_UNORM, 64, 32, 1, &l));
+  TEST_CHECK(16 * 8 == l.RowBytes && 8 == l.Rows && 1 == l.Slices);
+  TEST_CHECK(Layout(DXGI_FORMAT_BC1_UNORM_SRGB, 5, 1, 1, &l));
+  TEST_CHECK(2 * 8 == l.RowBytes && 1 == l.Rows);
+  // BC7 and BC6H blocks are 16 bytes.
+  TEST_CHECK(Layout(DXGI_FORMAT_BC7_UNORM, 64, 32, 1, &l));
+  TEST_CHECK(16 * 16 == l.RowBytes && 8 == l.Rows);
+  TEST_CHECK(Layout(DXGI_FORMAT_BC6H_UF16, 6, 6, 1, &l));
+  TEST_CHECK(2 * 16 == l.RowBytes && 2 == l.Rows);
+  // R8 rows are one byte a texel, slices follow the depth.
+  TEST_CHECK(Layout(DXGI_FORMAT_R8_UNORM, 13, 7, 3, &l));
+  TEST_CHECK(13 == l.RowBytes && 7 == l.Rows && 3 == l.Slices);
+  TEST_CHECK(13 * 7 * 3 == RecordLayoutBytes(l));
+  // 16-bit packed formats are two bytes a texel, not four.
+  TEST_CHECK(Layout(DXGI_FORMAT_B5G6R5_UNORM, 10, 2, 1, &l));
+  TEST_CHECK(20 == l.RowBytes);
+  TEST_CHECK(Layout(DXGI_FORMAT_B5G5R5A1_UNORM, 10, 2, 1, &l));
+  TEST_CHECK(20 == l.RowBytes);
+  // Formats of unknown size are refused rather than guessed.
+  TEST_CHECK(!Layout(DXGI_FORMAT_UNKNOWN, 16, 16, 1, &l));
+  TEST_CHECK(!Layout((DXGI_FORMAT)0x7FFF, 16, 16, 1, &l));
+}
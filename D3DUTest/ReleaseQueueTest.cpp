@@ -0,0 +1,129 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include <D3DU.h>
+#include <ReleaseQueue.hpp>
+#include "Test.hpp"
+
+static UINT g_destroyed;
+
+/// Counts its destructions in g_destroyed.
+class D3DU_NOVTABLE CTrackedObject :
+  public IUnknown
+{
+public:
+  BEGIN_INTERFACE_MAP
+  END_INTERFACE_MAP
+
+  virtual ~CTrackedObject()
+  {
+    ++g_destroyed;
+  }
+};
+
+/// Adds an object the queue then holds the only reference to.
+static void AddObject(CReleaseQueue &queue)
+{
+  IUnknown *object = new ComObject<CTrackedObject>();
+  queue.Add(object);
+  object->Release();
+}
+
+/// Nothing goes before the fence says the GPU is past its frame.
+static void TestFenced()
+{
+  CMockFence fence;
+  CReleaseQueue queue;
+  queue.SetFence(&fence);
+  g_destroyed = 0;
+  AddObject(queue);
+  AddObject(queue);
+  TEST_CHECK(1 == queue.GetFrame());
+  queue.EndFrame();
+  TEST_CHECK(1 == fence.GetSignaled());
+  AddObject(queue);
+  queue.EndFrame();
+  queue.EndFrame();
+  TEST_CHECK(3 == fence.GetSignaled());
+  TEST_CHECK(0 == g_destroyed);
+  TEST_CHECK(3 == queue.GetCount());
+  fence.Complete(1);
+  queue.Collect();
+  TEST_CHECK(2 == g_destroyed);
+  TEST_CHECK(1 == queue.GetCount());
+  // Frame 2 was the one the last object was added in.
+  fence.Complete(2);
+  queue.Collect();
+  TEST_CHECK(3 == g_destroyed);
+  TEST_CHECK(0 == queue.GetCount());
+}
+
+/// Without a fence the end of the frame is enough.
+static void TestUnfenced()
+{
+  CReleaseQueue queue;
+  g_destroyed = 0;
+  AddObject(queue);
+  queue.Add(NULL);
+  TEST_CHECK(1 == queue.GetCount());
+  queue.EndFrame();
+  TEST_CHECK(1 == g_destroyed);
+  TEST_CHECK(0 == queue.GetCount());
+}
+
+/// The queue grows while its head is in the middle of the ring, keeps
+/// frame order, and frees what is left when it goes away.
+static void TestGrowAndFlush()
+{
+  CMockFence fence;
+  g_destroyed = 0;
+  {
+    CReleaseQueue queue;
+    queue.SetFence(&fence);
+    for(UINT i = 0; i < RELEASE_QUEUE_INITIAL_CAPACITY; ++i)
+    {
+      AddObject(queue);
+      queue.EndFrame();
+    }
+    fence.Complete(RELEASE_QUEUE_INITIAL_CAPACITY / 2);
+    queue.Collect();
+    TEST_CHECK(RELEASE_QUEUE_INITIAL_CAPACITY / 2 == g_destroyed);
+    unsigned long long frame = queue.GetFrame();
+    for(UINT i = 0; i < RELEASE_QUEUE_INITIAL_CAPACITY; ++i)
+      AddObject(queue);
+    TEST_CHECK(RELEASE_QUEUE_INITIAL_CAPACITY * 3 / 2 == queue.GetCount());
+    queue.EndFrame();
+    fence.Complete(frame - 1);
+    queue.Collect();
+    TEST_CHECK(RELEASE_QUEUE_INITIAL_CAPACITY == g_destroyed);
+    TEST_CHECK(RELEASE_QUEUE_INITIAL_CAPACITY == queue.GetCount());
+  }
+  TEST_CHECK(RELEASE_QUEUE_INITIAL_CAPACITY * 2 == g_destroyed);
+}
+
+void TestReleaseQueue()
+{
+  TestFenced();
+  TestUnfenced();
+  TestGrowAndFlush();
+}
@@ -0,0 +1,187 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <windows.h>
+#include <RenderGraph.hpp>
+#include "Test.hpp"
+
+#define DESC_COLOR 1
+#define DESC_DEPTH 2
+
+static unsigned AddPass(
+  CRenderGraphCompiler &c,
+  unsigned read0,
+  unsigned read1,
+  unsigned write,
+  bool keep = false)
+{
+  unsigned reads[2];
+  unsigned readCount = 0;
+  if(RENDER_GRAPH_NONE != read0)
+    reads[readCount++] = read0;
+  if(RENDER_GRAPH_NONE != read1)
+    reads[readCount++] = read1;
+  return c.AddPass(reads, readCount, &write, 1, keep);
+}
+
+static bool OrderIs(const CRenderGraphCompiler &c, const unsigned *order, unsigned count)
+{
+  if(c.GetOrderCount() != count)
+    return false;
+  for(unsigned i = 0; i < count; ++i)
+  {
+    if(c.GetOrder(i) != order[i])
+      return false;
+  }
+  return true;
+}
+
+/// Blur passes going back and forth between two textures read and
+/// overwrite the same one; that is no cycle.
+static void TestPingPong()
+{
+  const unsigned N = RENDER_GRAPH_NONE;
+  CRenderGraphCompiler c;
+  unsigned out = c.AddResource(0, true);
+  unsigned a = c.AddResource(DESC_COLOR, false);
+  unsigned b = c.AddResource(DESC_COLOR, false);
+  AddPass(c, N, N, a);
+  AddPass(c, a, N, b);
+  AddPass(c, b, N, a);
+  AddPass(c, a, N, out);
+  TEST_CHECK(c.Compile());
+  static const unsigned order[] = {0, 1, 2, 3};
+  TEST_CHECK(OrderIs(c, order, ARRAYSIZE(order)));
+  TEST_CHECK(c.DependsOn(1, 0));
+  TEST_CHECK(c.DependsOn(2, 1));
+  TEST_CHECK(c.DependsOn(2, 0));
+  TEST_CHECK(c.DependsOn(3, 2));
+  TEST_CHECK(!c.DependsOn(3, 0));
+  TEST_CHECK(2 == c.GetPhysicalCount());
+  TEST_CHECK(c.GetPhysical(a) != c.GetPhysical(b));
+}
+
+/// A pass overwriting a texture runs after the passes reading what
+/// was there before, so they do not see its data.
+static void TestWriteAfterRead()
+{
+  const unsigned N = RENDER_GRAPH_NONE;
+  CRenderGraphCompiler c;
+  unsigned out = c.AddResource(0, true);
+  unsigned a = c.AddResource(DESC_COLOR, false);
+  unsigned b = c.AddResource(DESC_COLOR, false);
+  AddPass(c, N, N, a);
+  AddPass(c, a, N, b);
+  AddPass(c, N, N, a);
+  AddPass(c, a, b, out);
+  TEST_CHECK(c.Compile());
+  static const unsigned order[] = {0, 1, 2, 3};
+  TEST_CHECK(OrderIs(c, order, ARRAYSIZE(order)));
+  TEST_CHECK(c.DependsOn(2, 1));
+  TEST_CHECK(c.DependsOn(2, 0));
+  TEST_CHECK(c.DependsOn(3, 2));
+  TEST_CHECK(c.DependsOn(3, 1));
+  TEST_CHECK(!c.DependsOn(3, 0));
+  for(unsigned i = 0; i < 4; ++i)
+    TEST_CHECK(!c.IsCulled(i));
+}
+
+static void TestCull()
+{
+  const unsigned N = RENDER_GRAPH_NONE;
+  CRenderGraphCompiler c;
+  unsigned out = c.AddResource(0, true);
+  unsigned a = c.AddResource(DESC_COLOR, false);
+  unsigned d = c.AddResource(DESC_COLOR, false);
+  unsigned e = c.AddResource(DESC_COLOR, false);
+  unsigned f = c.AddResource(DESC_COLOR, false);
+  // Overwritten before anything reads it.
+  AddPass(c, N, N, a);
+  AddPass(c, N, N, a);
+  AddPass(c, a, N, out);
+  // Needed by a kept pass only.
+  AddPass(c, N, N, d);
+  AddPass(c, d, N, e, true);
+  // Nobody reads it.
+  AddPass(c, N, N, f);
+  TEST_CHECK(c.Compile());
+  static const unsigned order[] = {1, 2, 3, 4};
+  TEST_CHECK(OrderIs(c, order, ARRAYSIZE(order)));
+  TEST_CHECK(c.IsCulled(0));
+  TEST_CHECK(c.IsCulled(5));
+  TEST_CHECK(RENDER_GRAPH_NONE == c.GetPhysical(f));
+  TEST_CHECK(RENDER_GRAPH_NONE == c.GetFirstUse(f));
+  TEST_CHECK(RENDER_GRAPH_NONE == c.GetPhysical(out));
+}
+
+static void TestAlias()
+{
+  const unsigned N = RENDER_GRAPH_NONE;
+  CRenderGraphCompiler c;
+  unsigned out = c.AddResource(0, true);
+  unsigned a = c.AddResource(DESC_COLOR, false);
+  unsigned b = c.AddResource(DESC_COLOR, false);
+  unsigned x = c.AddResource(DESC_COLOR, false);
+  unsigned z = c.AddResource(DESC_DEPTH, false);
+  AddPass(c, N, N, a);
+  AddPass(c, a, N, b);
+  AddPass(c, b, N, x);
+  AddPass(c, x, N, z);
+  AddPass(c, z, N, out);
+  TEST_CHECK(c.Compile());
+  TEST_CHECK(0 == c.GetFirstUse(a) && 1 == c.GetLastUse(a));
+  TEST_CHECK(1 == c.GetFirstUse(b) && 2 == c.GetLastUse(b));
+  TEST_CHECK(2 == c.GetFirstUse(x) && 3 == c.GetLastUse(x));
+  // `a' is done with before `x' is written; `b' overlaps both, and
+  // `z' is of another kind.
+  TEST_CHECK(c.GetPhysical(a) == c.GetPhysical(x));
+  TEST_CHECK(c.GetPhysical(a) != c.GetPhysical(b));
+  TEST_CHECK(3 == c.GetPhysicalCount());
+  TEST_CHECK(DESC_DEPTH == c.GetPhysicalDesc(c.GetPhysical(z)));
+}
+
+static void TestUndefinedRead()
+{
+  const unsigned N = RENDER_GRAPH_NONE;
+  CRenderGraphCompiler c;
+  unsigned out = c.AddResource(0, true);
+  unsigned a = c.AddResource(DESC_COLOR, false);
+  unsigned b = c.AddResource(DESC_COLOR, false);
+  // Culled passes may read anything.
+  AddPass(c, a, N, b);
+  // The back buffer holds the frame before the graph runs.
+  AddPass(c, out, N, out);
+  TEST_CHECK(c.Compile());
+  TEST_CHECK(c.IsCulled(0));
+  AddPass(c, a, N, out);
+  TEST_CHECK(!c.Compile());
+  TEST_CHECK(RENDER_GRAPH_NONE == AddPass(c, 99, N, out));
+}
+
+void TestRenderGraph()
+{
+  TestPingPong();
+  TestWriteAfterRead();
+  TestCull();
+  TestAlias();
+  TestUndefinedRead();
+}
@@ -0,0 +1,122 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <math.h>
+#include <ResolutionController.hpp>
+#include "Test.hpp"
+
+#define BUDGET (1.0f / 60.0f)
+
+/// Feeds the controller the times of a GPU whose frame cost grows with
+/// the square of the scale, `cost' being the time at scale 1, for
+/// `frames' frames. Returns how many times the scale changed.
+static unsigned int Run(CResolutionController &controller, double cost, unsigned int frames)
+{
+  unsigned int changes = 0;
+  for(unsigned int i = 0; i < frames; ++i)
+  {
+    double scale = controller.GetScale();
+    if(controller.Update(cost * scale * scale))
+      ++changes;
+  }
+  return changes;
+}
+
+static bool OnStep(float scale)
+{
+  float steps = scale / RESOLUTION_SCALE_STEP;
+  return steps == floor(steps);
+}
+
+/// A GPU twice too slow at full scale settles on a scale whose frames
+/// fit the budget with no more than the allowed headroom, and stays there.
+static void TestConverge()
+{
+  CResolutionController controller;
+  controller.Init(BUDGET, 0.25f, 1.0f, 8);
+  double cost = BUDGET * 2.0;
+  TEST_CHECK(Run(controller, cost, 200) > 0);
+  float scale = controller.GetScale();
+  double time = cost * scale * scale;
+  TEST_CHECK(OnStep(scale));
+  TEST_CHECK(time <= BUDGET);
+  TEST_CHECK(time >= BUDGET * RESOLUTION_HEADROOM);
+  TEST_CHECK(0 == Run(controller, cost, 200));
+  // Half the load later, the scale climbs back towards full.
+  TEST_CHECK(Run(controller, cost / 2.0, 400) > 0);
+  TEST_CHECK(controller.GetScale() > scale);
+  time = cost / 2.0 * controller.GetScale() * controller.GetScale();
+  TEST_CHECK(time <= BUDGET);
+  TEST_CHECK(controller.GetScale() == 1.0f || time >= BUDGET * RESOLUTION_HEADROOM);
+}
+
+/// Each change steps by a whole number of 1/32 steps, at least one even
+/// when the correction alone would round back to the same scale, and the
+/// window starts over after it.
+static void TestQuantize()
+{
+  CResolutionController controller;
+  controller.Init(BUDGET, 0.25f, 1.0f, 4);
+  for(unsigned int i = 0; i < 3; ++i)
+    TEST_CHECK(!controller.Update(BUDGET * 1.02));
+  TEST_CHECK(controller.Update(BUDGET * 1.02));
+  TEST_CHECK(1.0f - RESOLUTION_SCALE_STEP == controller.GetScale());
+  TEST_CHECK(0.0 == controller.GetAverage());
+  // A window far over budget steps down by at most RESOLUTION_MAX_DECREASE.
+  for(unsigned int i = 0; i < 4; ++i)
+    controller.Update(BUDGET * 1.8);
+  float scale = controller.GetScale();
+  TEST_CHECK(OnStep(scale));
+  TEST_CHECK(scale < 1.0f - RESOLUTION_SCALE_STEP);
+  TEST_CHECK(scale >= (1.0f - RESOLUTION_SCALE_STEP) * RESOLUTION_MAX_DECREASE - RESOLUTION_SCALE_STEP / 2);
+  // At 8/32 the same correction rounds back to 8/32, yet still moves.
+  controller.Init(BUDGET, 0.125f, 0.25f, 4);
+  for(unsigned int i = 0; i < 4; ++i)
+    controller.Update(BUDGET * 1.02);
+  TEST_CHECK(0.25f - RESOLUTION_SCALE_STEP == controller.GetScale());
+}
+
+/// However slow or fast the GPU, the scale stays within the limits, even
+/// ones that do not fall on a step.
+static void TestClamp()
+{
+  CResolutionController controller;
+  controller.Init(BUDGET, 0.3f, 0.9f, 8);
+  TEST_CHECK(0.9f == controller.GetScale());
+  Run(controller, BUDGET * 100.0, 400);
+  TEST_CHECK(0.3f == controller.GetScale());
+  TEST_CHECK(0 == Run(controller, BUDGET * 100.0, 100));
+  Run(controller, BUDGET / 100.0, 400);
+  TEST_CHECK(0.9f == controller.GetScale());
+  TEST_CHECK(0 == Run(controller, BUDGET / 100.0, 100));
+  // Limits given the wrong way round pin the scale to the upper one.
+  controller.Init(BUDGET, 0.8f, 0.5f, 8);
+  Run(controller, BUDGET * 100.0, 100);
+  TEST_CHECK(0.5f == controller.GetScale());
+}
+
+void TestResolutionController()
+{
+  TestConverge();
+  TestQuantize();
+  TestClamp();
+}
@@ -0,0 +1,99 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __TEST_HPP__
+#define __TEST_HPP__
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/// Records a failed check in the running test and prints where it is.
+/// Tests go on after a failure, so that one run shows all of them.
+#define TEST_CHECK(expr) TestCheck(!!(expr), #expr, __FILE__, __LINE__)
+
+void TestCheck(bool ok, const char *expr, const char *file, int line);
+
+// Threads for the tests that also build on POSIX systems.
+
+#ifdef _WIN32
+typedef HANDLE TestThread;
+#define TEST_THREAD_PROC unsigned int __stdcall
+typedef unsigned int (__stdcall *TestThreadProc)(void*);
+
+inline bool StartThread(TestThread *thread, TestThreadProc proc, void *param)
+{
+  *thread = (HANDLE)_beginthreadex(NULL, 0, proc, param, 0, NULL);
+  return NULL != *thread;
+}
+
+inline void JoinThread(TestThread thread)
+{
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+inline void YieldThread()
+{
+  Sleep(0);
+}
+#else
+typedef pthread_t TestThread;
+#define TEST_THREAD_PROC void*
+typedef void *(*TestThreadProc)(void*);
+
+inline bool StartThread(TestThread *thread, TestThreadProc proc, void *param)
+{
+  return 0 == pthread_create(thread, NULL, proc, param);
+}
+
+inline void JoinThread(TestThread thread)
+{
+  pthread_join(thread, NULL);
+}
+
+inline void YieldThread()
+{
+  sched_yield();
+}
+#endif
+
+// Tests, one function per header under test.
+
+void TestFrameRing();
+void TestInputQueue();
+void TestLayers();
+void TestMandelbrot();
+void TestMemoryTracker();
+void TestRecording();
+void TestReleaseQueue();
+void TestResolutionController();
+void TestUploadRing();
+void TestRenderGraph();
+
+#endif // __TEST_HPP__
@@ -0,0 +1,79 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include <UploadRing.hpp>
+#include "Test.hpp"
+
+/// Constant slices go front to back and start over at zero when the
+/// next one does not fit; a freshly reset ring wraps on its first use.
+static void TestAllocate()
+{
+  CUploadRingAllocator ring;
+  bool wrapped;
+  ring.Reset(1024);
+  TEST_CHECK(0 == ring.Allocate(256, wrapped));
+  TEST_CHECK(wrapped);
+  TEST_CHECK(256 == ring.Allocate(512, wrapped));
+  TEST_CHECK(!wrapped);
+  TEST_CHECK(768 == ring.Allocate(256, wrapped));
+  TEST_CHECK(!wrapped);
+  TEST_CHECK(0 == ring.Allocate(256, wrapped));
+  TEST_CHECK(wrapped);
+  TEST_CHECK(256 == CUploadRingAllocator::Align(1));
+  TEST_CHECK(512 == CUploadRingAllocator::Align(257));
+  TEST_CHECK(0 == CUploadRingAllocator::SizeClass(1));
+  TEST_CHECK(2 == CUploadRingAllocator::SizeClass(64));
+  TEST_CHECK(3 == CUploadRingAllocator::SizeClass(65));
+  TEST_CHECK(UPLOAD_MAX_SIZE == CUploadRingAllocator::ClassSize(CUploadRingAllocator::SizeClass(UPLOAD_MAX_SIZE)));
+}
+
+/// Records start at a multiple of their own stride, whatever came
+/// before them, and are numbered in strides from the buffer start.
+static void TestAllocateRecords()
+{
+  CUploadRingAllocator ring;
+  bool wrapped;
+  ring.Reset(1000);
+  TEST_CHECK(0 == ring.AllocateRecords(48, 2, wrapped));
+  TEST_CHECK(wrapped);
+  // 96 bytes used, so the next 64 byte record is the third one.
+  TEST_CHECK(2 == ring.AllocateRecords(64, 1, wrapped));
+  TEST_CHECK(!wrapped);
+  // 192 bytes used; 100 byte records from 200 fill the rest exactly.
+  TEST_CHECK(2 == ring.AllocateRecords(100, 8, wrapped));
+  TEST_CHECK(!wrapped);
+  TEST_CHECK(0 == ring.AllocateRecords(4, 1, wrapped));
+  TEST_CHECK(wrapped);
+  // A record that would fit in the bytes left but not after aligning.
+  ring.Reset(1000);
+  ring.AllocateRecords(1, 900, wrapped);
+  TEST_CHECK(0 == ring.AllocateRecords(96, 1, wrapped));
+  TEST_CHECK(wrapped);
+  TEST_CHECK(1 == ring.AllocateRecords(96, 1, wrapped));
+  TEST_CHECK(!wrapped);
+}
+
+void TestUploadRing()
+{
+  TestAllocate();
+  TestAllocateRecords();
+}
@@ -0,0 +1,279 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "Mandelbrot.hpp"
+#include <math.h>
+#include <emmintrin.h>
+
+static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+/// Base 2 logarithm of positive normal numbers, within a few ulps.
+/// The mantissa is brought to [sqrt(0.5), sqrt(2)), and the natural
+/// logarithm of it taken with the polynomial of Cephes logf.
+static inline __m128 Log2(__m128 x)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128i bits = _mm_castps_si128(x);
+  __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(126)));
+  __m128 m = _mm_castsi128_ps(_mm_or_si128(
+    _mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)),
+    _mm_set1_epi32(0x3F000000)));
+  __m128 small = _mm_cmplt_ps(m, _mm_set1_ps(0.707106781f));
+  e = _mm_sub_ps(e, _mm_and_ps(small, one));
+  m = _mm_sub_ps(_mm_add_ps(m, _mm_and_ps(small, m)), one);
+  __m128 z = _mm_mul_ps(m, m);
+  __m128 p = _mm_set1_ps(7.0376836292e-2f);
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.1514610310e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(1.1676998740e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.2420140846e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(1.4249322787e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.6668057665e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(2.0000714765e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-2.4999993993e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.3333331174e-1f));
+  p = _mm_mul_ps(_mm_mul_ps(p, m), z);
+  p = _mm_sub_ps(p, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+  return _mm_add_ps(e, _mm_mul_ps(_mm_add_ps(m, p), _mm_set1_ps(1.44269504f)));
+}
+
+/// One channel of the band blend in PS. 32-bit MSVC passes only three
+/// vectors by value.
+static inline __m128 Blend(__m128 band3, __m128 band2, __m128 t, const __m128 &c1, const __m128 &c2)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 a = Select(band3, c2, _mm_and_ps(band2, c1));
+  __m128 b = Select(band3, one, Select(band2, c2, c1));
+  __m128 c = _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+  // Saturates the way render targets do. NaN goes to 0, as max returns
+  // its second operand when either is NaN.
+  c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), one);
+  return _mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f));
+}
+
+/// The colors PS gives four pixels that left the loop with lenSq after
+/// n iterations.
+static inline __m128i Color4(__m128 lenSq, __m128 n, const __m128 *color1, const __m128 *color2)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+  const __m128 maxIters = _mm_set1_ps((FLOAT)MANDELBROT_MAX_ITERS);
+  // Points that never escape get v above MAX_ITERS, or NaN when lenSq
+  // is below 1; points that escape at once divide by log(1) and get -inf.
+  // All of them come out black, so the logarithms skip them.
+  __m128 valid = _mm_and_ps(_mm_cmpge_ps(lenSq, four), _mm_cmpge_ps(n, two));
+  __m128 num = Log2(Select(valid, lenSq, four));
+  __m128 den = Log2(Select(valid, n, two));
+  // log(sqrt(l)) / log(n) is the same ratio in base 2.
+  __m128 v = _mm_sub_ps(n, Log2(_mm_div_ps(_mm_mul_ps(num, _mm_set1_ps(0.5f)), den)));
+  __m128 black = _mm_or_ps(_mm_cmpgt_ps(v, maxIters), _mm_cmpeq_ps(valid, zero));
+  __m128 band3 = _mm_cmpgt_ps(v, _mm_set1_ps((FLOAT)(MANDELBROT_MAX_ITERS / 4)));
+  __m128 band2 = _mm_cmpgt_ps(v, _mm_set1_ps((FLOAT)(MANDELBROT_MAX_ITERS / 8)));
+  __m128 t2 = _mm_div_ps(_mm_mul_ps(_mm_set1_ps(8.0f), v), maxIters);
+  __m128 t = Select(band3,
+    _mm_sub_ps(_mm_div_ps(_mm_mul_ps(four, v), maxIters), one),
+    Select(band2, _mm_sub_ps(t2, one), t2));
+  __m128i r = _mm_cvttps_epi32(_mm_andnot_ps(black, Blend(band3, band2, t, color1[0], color2[0])));
+  __m128i g = _mm_cvttps_epi32(_mm_andnot_ps(black, Blend(band3, band2, t, color1[1], color2[1])));
+  __m128i b = _mm_cvttps_epi32(_mm_andnot_ps(black, Blend(band3, band2, t, color1[2], color2[2])));
+  return _mm_or_si128(
+    _mm_or_si128(r, _mm_slli_epi32(g, 8)),
+    _mm_or_si128(_mm_slli_epi32(b, 16), _mm_set1_epi32(0xFF000000)));
+}
+
+/// PS for eight pixels of a row, from x0 = tex.x * 2.5 - 1.75 and
+/// y0 = tex.y * 2 - 1. The two groups of four are independent, so each
+/// hides the latency of the other. Lanes go on iterating after they
+/// escape, into infinities and NaN, but keep the lenSq they escaped
+/// with; the loop ends as soon as all eight have escaped.
+static inline void Shade8(const __m128 *x0, __m128 y0, const __m128 *color1, const __m128 *color2, __m128i *oPixels)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 four = _mm_set1_ps(4.0f);
+  __m128 x[2] = {zero, zero};
+  __m128 y[2] = {zero, zero};
+  __m128 n[2] = {zero, zero};
+  __m128 lenSq[2] = {zero, zero};
+  __m128 active[2];
+  active[0] = active[1] = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  for(UINT i = 0; i < MANDELBROT_MAX_ITERS; ++i)
+  {
+    __m128 xx[2], yy[2];
+    for(UINT k = 0; k < 2; ++k)
+    {
+      xx[k] = _mm_mul_ps(x[k], x[k]);
+      yy[k] = _mm_mul_ps(y[k], y[k]);
+      __m128 l = _mm_add_ps(xx[k], yy[k]);
+      lenSq[k] = Select(active[k], l, lenSq[k]);
+      active[k] = _mm_and_ps(active[k], _mm_cmplt_ps(l, four));
+    }
+    if(!_mm_movemask_ps(_mm_or_ps(active[0], active[1])))
+      break;
+    for(UINT k = 0; k < 2; ++k)
+    {
+      __m128 xy = _mm_mul_ps(x[k], y[k]);
+      x[k] = _mm_add_ps(_mm_sub_ps(xx[k], yy[k]), x0[k]);
+      y[k] = _mm_add_ps(_mm_add_ps(xy, xy), y0);
+      n[k] = _mm_add_ps(n[k], _mm_and_ps(active[k], one));
+    }
+  }
+  for(UINT k = 0; k < 2; ++k)
+  {
+    // Lanes that ran out of iterations take lenSq where they stopped.
+    __m128 l = _mm_add_ps(_mm_mul_ps(x[k], x[k]), _mm_mul_ps(y[k], y[k]));
+    lenSq[k] = Select(active[k], l, lenSq[k]);
+    oPixels[k] = Color4(lenSq[k], n[k], color1, color2);
+  }
+}
+
+/// PS for one pixel, as written, with render target saturation and
+/// rounding.
+static DWORD Shade(FLOAT x0, FLOAT y0, const FLOAT *color1, const FLOAT *color2)
+{
+  FLOAT x = 0, y = 0, lenSq;
+  int n = 0;
+  while((lenSq = x*x + y*y) < 4 && n < MANDELBROT_MAX_ITERS)
+  {
+    FLOAT xtmp = x*x - y*y + x0;
+    y = 2*x*y + y0;
+    x = xtmp;
+    ++n;
+  }
+  FLOAT v = n - (FLOAT)(log(log(sqrt((double)lenSq)) / log((double)n)) / log(2.0));
+  if(v > MANDELBROT_MAX_ITERS)
+    return 0xFF000000;
+  FLOAT a[3], b[3], t;
+  for(UINT c = 0; c < 3; ++c)
+  {
+    if(v > MANDELBROT_MAX_ITERS / 4)
+    {
+      a[c] = color2[c];
+      b[c] = 1;
+    }
+    else if(v > MANDELBROT_MAX_ITERS / 8)
+    {
+      a[c] = color1[c];
+      b[c] = color2[c];
+    }
+    else
+    {
+      a[c] = 0;
+      b[c] = color1[c];
+    }
+  }
+  if(v > MANDELBROT_MAX_ITERS / 4)
+    t = 4*v/MANDELBROT_MAX_ITERS - 1;
+  else if(v > MANDELBROT_MAX_ITERS / 8)
+    t = 8*v/MANDELBROT_MAX_ITERS - 1;
+  else
+    t = 8*v/MANDELBROT_MAX_ITERS;
+  DWORD pixel = 0xFF000000;
+  for(UINT c = 0; c < 3; ++c)
+  {
+    FLOAT value = a[c] + t * (b[c] - a[c]);
+    // NaN fails both comparisons and goes to 0 as well.
+    if(!(value > 0))
+      value = 0;
+    else if(value > 1)
+      value = 1;
+    pixel |= (DWORD)(value * 255 + 0.5f) << (c * 8);
+  }
+  return pixel;
+}
+
+void CMandelbrotRenderer::RenderReference(BYTE *dst, UINT pitch, UINT width, UINT height, const FLOAT *color1, const FLOAT *color2)
+{
+  for(UINT y = 0; y < height; ++y)
+  {
+    DWORD *row = (DWORD*)(dst + (SIZE_T)y * pitch);
+    FLOAT y0 = (y + 0.5f) / height * 2 - 1;
+    for(UINT x = 0; x < width; ++x)
+      row[x] = Shade((x + 0.5f) / width * 2.5f - 1.75f, y0, color1, color2);
+  }
+}
+
+void CMandelbrotRenderer::Render(BYTE *dst, UINT pitch, UINT width, UINT height, const FLOAT *color1, const FLOAT *color2)
+{
+  _dst = dst;
+  _pitch = pitch;
+  _width = width;
+  _height = height;
+  _tilesX = (width + MANDELBROT_TILE_SIZE - 1) / MANDELBROT_TILE_SIZE;
+  UINT tilesY = (height + MANDELBROT_TILE_SIZE - 1) / MANDELBROT_TILE_SIZE;
+  memcpy(_color1, color1, sizeof(_color1));
+  memcpy(_color2, color2, sizeof(_color2));
+  _pool.ParallelFor(_tilesX * tilesY, RenderTile, this);
+}
+
+void CMandelbrotRenderer::RenderTile(void *context, UINT index)
+{
+  CMandelbrotRenderer *self = (CMandelbrotRenderer*)context;
+  UINT left = index % self->_tilesX * MANDELBROT_TILE_SIZE;
+  UINT top = index / self->_tilesX * MANDELBROT_TILE_SIZE;
+  UINT right = left + MANDELBROT_TILE_SIZE < self->_width ? left + MANDELBROT_TILE_SIZE : self->_width;
+  UINT bottom = top + MANDELBROT_TILE_SIZE < self->_height ? top + MANDELBROT_TILE_SIZE : self->_height;
+  __m128 color1[3], color2[3];
+  for(UINT c = 0; c < 3; ++c)
+  {
+    color1[c] = _mm_set1_ps(self->_color1[c]);
+    color2[c] = _mm_set1_ps(self->_color2[c]);
+  }
+  const __m128 centers[2] =
+  {
+    _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f),
+    _mm_setr_ps(4.5f, 5.5f, 6.5f, 7.5f),
+  };
+  const __m128 width = _mm_set1_ps((FLOAT)self->_width);
+  for(UINT y = top; y < bottom; ++y)
+  {
+    BYTE *row = self->_dst + (SIZE_T)y * self->_pitch;
+    __m128 y0 = _mm_set1_ps((y + 0.5f) / self->_height * 2 - 1);
+    for(UINT x = left; x < right; x += 8)
+    {
+      __m128 x0[2];
+      __m128i px[2];
+      for(UINT k = 0; k < 2; ++k)
+      {
+        __m128 u = _mm_div_ps(_mm_add_ps(_mm_set1_ps((FLOAT)x), centers[k]), width);
+        x0[k] = _mm_sub_ps(_mm_mul_ps(u, _mm_set1_ps(2.5f)), _mm_set1_ps(1.75f));
+      }
+      Shade8(x0, y0, color1, color2, px);
+      if(right - x >= 8)
+      {
+        _mm_storeu_si128((__m128i*)(row + x * 4), px[0]);
+        _mm_storeu_si128((__m128i*)(row + x * 4) + 1, px[1]);
+      }
+      else
+      {
+        __m128i last[2];
+        _mm_storeu_si128(last, px[0]);
+        _mm_storeu_si128(last + 1, px[1]);
+        memcpy(row + x * 4, last, (right - x) * 4);
+      }
+    }
+  }
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2012, Dmitry Ignatiev <lovesan.ru at gmail.com>
+// 
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use, copy,
+// modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#ifndef __MANDELBROT_HPP__
+#define __MANDELBROT_HPP__
+
+#include <windows.h>
+#include <string.h>
+#include <ThreadUtils.hpp>
+
+/// Must match MAX_ITERS in Shaders.fx.
+#define MANDELBROT_MAX_ITERS 80
+/// Tiles are square; their count should well exceed the thread count,
+/// since tiles inside the set take MANDELBROT_MAX_ITERS iterations
+/// and the ones outside only a few.
+#define MANDELBROT_TILE_SIZE 32
+
+/// Draws what PS in Shaders.fx draws, on the CPU: eight pixels at a time
+/// with SSE2, in tiles spread over a thread pool. Used when the adapter
+/// is a software one, and to check the shader against.
+///
+/// The SSE2 kernel takes logarithms with a polynomial rather than the C
+/// runtime, so a few pixels come out one step off RenderReference, the
+/// plain transcription of PS; none are further off.
+class CMandelbrotRenderer
+{
+public:
+  CMandelbrotRenderer()
+  {
+    _dst = NULL;
+    _pitch = 0;
+    _width = 0;
+    _height = 0;
+    _tilesX = 0;
+    memset(_color1, 0, sizeof(_color1));
+    memset(_color2, 0, sizeof(_color2));
+  }
+
+  /// Zero `threadCount' uses every processor.
+  HRESULT Init(UINT threadCount)
+  {
+    return _pool.Init(threadCount);
+  }
+
+  /// Fills `width' x `height' R8G8B8A8 pixels, rows `pitch' bytes apart,
+  /// taking texture coordinates at pixel centers like the rasterizer does.
+  /// Colors are RGB.
+  void Render(BYTE *dst, UINT pitch, UINT width, UINT height, const FLOAT *color1, const FLOAT *color2);
+
+  /// Same as Render, one pixel at a time on the calling thread.
+  static void RenderReference(BYTE *dst, UINT pitch, UINT width, UINT height, const FLOAT *color1, const FLOAT *color2);
+
+private:
+  CThreadPool _pool;
+  BYTE *_dst;
+  UINT _pitch;
+  UINT _width;
+  UINT _height;
+  UINT _tilesX;
+  FLOAT _color1[3];
+  FLOAT _color2[3];
+
+  static void RenderTile(void *context, UINT index);
+};
+
+#endif // __MANDELBROT_HPP__
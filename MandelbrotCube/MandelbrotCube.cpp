@@ -21,11 +21,15 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include <sstream>
+#include <math.h>
 #include <windows.h>
 #include <D3DU.h>
 #include <ComUtils.hpp>
+#include <ConstantBuffer.hpp>
+#include <Trace.hpp>
 #include <xnamath.h>
 #include "Resource.h"
+#include "Mandelbrot.hpp"
 
 typedef struct
 {
@@ -37,14 +41,42 @@ typedef struct
   XMMATRIX worldViewProj;
 } VsBuffer;
 
+/// Mirrors `float3 color1, color2' in Shaders.fx,
+/// where color2 starts at the second register.
 typedef struct
 {
-  XMVECTOR color1, color2;
+  XMFLOAT3 color1;
+  FLOAT pad1;
+  XMFLOAT3 color2;
+  FLOAT pad2;
 } PsBuffer;
+D3DU_CHECK_CONSTANT(PsBuffer, color1);
+D3DU_CHECK_CONSTANT(PsBuffer, color2);
+
+/// Instanced mode draws a GRID x GRID wall of cubes with one call.
+#define GRID 100
+
+/// Software mode draws faces with a TEXTURE_SIZE x TEXTURE_SIZE texture
+/// that CMandelbrotRenderer fills whenever the colors change.
+#define TEXTURE_SIZE 512
+
+/// --validate draws PS into a VALIDATE_SIZE x VALIDATE_SIZE square. Points
+/// near the edge of the set may escape an iteration apart on the GPU, so
+/// pixels off by more than VALIDATE_TOLERANCE may make up to
+/// VALIDATE_MAX_PERMILLE of it.
+#define VALIDATE_SIZE 1024
+#define VALIDATE_TOLERANCE 2
+#define VALIDATE_MAX_PERMILLE 5
+
+typedef struct
+{
+  XMFLOAT4X4 world;
+} Instance;
 
 class D3DU_NOVTABLE CMandelbrotCube :
   public virtual ID3DUFrameSink,
   public virtual ID3DUKeySink,
+  public virtual ID3DUMouseSink,
   public virtual ID3DUSink,
   public virtual IUnknown
 {
@@ -53,11 +85,25 @@ public:
     INTERFACE_MAP_ENTRY(ID3DUSink)
     INTERFACE_MAP_ENTRY(ID3DUFrameSink)
     INTERFACE_MAP_ENTRY(ID3DUKeySink)
+    INTERFACE_MAP_ENTRY(ID3DUMouseSink)
   END_INTERFACE_MAP
 
   CMandelbrotCube()
   {
     _initialized = FALSE;
+    _dynamicResolution = FALSE;
+    _instanced = FALSE;
+    _tracing = FALSE;
+    _software = FALSE;
+    _textureValid = FALSE;
+    _instances = NULL;
+    _zoom = 1.0f;
+  }
+
+  /// Draws the fractal on the CPU rather than in PS; `C' toggles it too.
+  void SetSoftware(BOOL software)
+  {
+    _software = software;
   }
 
   STDMETHOD_(void, Attach)(ID3DUTarget *target)
@@ -153,12 +199,7 @@ public:
     if(FAILED(hr)) return;
     hr = device->CreateBuffer(&bd, &sd, &_ib);
     if(FAILED(hr)) return;
-    bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-    bd.ByteWidth = sizeof(VsBuffer);
-    hr = device->CreateBuffer(&bd, NULL, &_vsCb);
-    if(FAILED(hr)) return;
-    bd.ByteWidth = sizeof(PsBuffer);
-    hr = device->CreateBuffer(&bd, NULL, &_psCb);
+    hr = _psCb.Create(device);
     if(FAILED(hr)) return;
 
     DWORD shaderFlags = D3DCOMPILE_OPTIMIZATION_LEVEL2 | D3DCOMPILE_ENABLE_STRICTNESS;
@@ -193,6 +234,39 @@ public:
       &_il);
     if(FAILED(hr)) return;
     blob.Release();
+    hr = D3DUCompileFromResource(
+      GetModuleHandle(NULL),
+      MAKEINTRESOURCE(ID_SHADER),
+      MAKEINTRESOURCE(RT_SHADER),
+      "VSInstanced",
+      "vs_4_0",
+      shaderFlags,
+      &blob);
+    if(FAILED(hr)) return;
+    hr = device->CreateVertexShader(
+      blob->GetBufferPointer(),
+      blob->GetBufferSize(),
+      NULL,
+      &_vsInstanced);
+    if(FAILED(hr)) return;
+    D3DU_INSTANCE_ELEMENT instanceLayout[] =
+    {
+      { "WORLD", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 4 }
+    };
+    hr = D3DUCreateInstanceInputLayout(
+      device,
+      layout,
+      ARRAYSIZE(layout),
+      instanceLayout,
+      ARRAYSIZE(instanceLayout),
+      blob->GetBufferPointer(),
+      blob->GetBufferSize(),
+      &_ilInstanced);
+    if(FAILED(hr)) return;
+    blob.Release();
+    hr = D3DUCreateInstanceBatch(device, &_batch);
+    if(FAILED(hr)) return;
+    _instances = new Instance[GRID * GRID];
     hr = D3DUCompileFromResource(
       GetModuleHandle(NULL),
       MAKEINTRESOURCE(ID_SHADER),
@@ -209,6 +283,8 @@ public:
       NULL,
       &_ps);
     if(FAILED(hr)) return;
+    hr = InitSoftware(device, shaderFlags);
+    if(FAILED(hr)) return;
     
     _vp.Width = (FLOAT)width;
     _vp.Height = (FLOAT)height;
@@ -218,10 +294,7 @@ public:
     _vp.MaxDepth = 1.0f;
     dc->RSSetViewports(1, &_vp);
     _world = XMMatrixIdentity();
-    XMVECTOR eye = XMVectorSet(1.0f, 1.0f, -3.0f, 1.0f);
-    XMVECTOR at = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
-    XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 1.0f);
-    _view = XMMatrixLookAtLH(eye, at, up);
+    UpdateView();
     _proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, _vp.Width/_vp.Height, 0.001f, 100.0f);
     
     hr = D3DUCreateFloatAnimation(0, 1, 1, TRUE, TRUE, &_colorAnimation);
@@ -241,13 +314,24 @@ public:
       return;
     _colorAnimation->Stop();
     _colorAnimation.Release();
-    _vb.Release();
-    _ib.Release();
-    _vsCb.Release();
+    // The last frame may still be using these.
+    Retire(target, _vb);
+    Retire(target, _ib);
+    target->DeferRelease(_psCb.GetBuffer());
     _psCb.Release();
-    _vs.Release();
-    _ps.Release();
-    _il.Release();
+    Retire(target, _vsInstanced);
+    Retire(target, _ilInstanced);
+    Retire(target, _batch);
+    delete[] _instances;
+    _instances = NULL;
+    Retire(target, _vs);
+    Retire(target, _ps);
+    Retire(target, _il);
+    Retire(target, _psTexture);
+    Retire(target, _srv);
+    Retire(target, _texture);
+    Retire(target, _sampler);
+    _textureValid = FALSE;
     _initialized = FALSE;
   }
 
@@ -255,17 +339,21 @@ public:
   {
     if(!_initialized)
       return;
+    D3DU_TRACE_ZONE("MandelbrotCube::RenderFrame");
     ComPtr<ID3D11DeviceContext> dc;
     ComPtr<ID3D11RenderTargetView> rtv;
     ComPtr<ID3D11DepthStencilView> dsv;
+    ComPtr<ID3DUUploadRing> ring;
     VsBuffer vsCb;
-    PsBuffer psCb;
+    D3DU_CONSTANT_SLICE vsSlice;
+    ID3D11Buffer *psCb;
+    XMFLOAT3 color1, color2;
     FLOAT clearColor[4] = {0.0f, 0.4f, 1.0f, 1.0f};
 
     FLOAT colorScale;
     _colorAnimation->Query(&colorScale);
-    XMVECTOR color1 = XMVectorLerp(XMVectorSet(1, 0, 0, 1), XMVectorSet(0, 0, 1, 1), colorScale),
-             color2 = XMVectorLerp(XMVectorSet(1, 1, 0, 1), XMVectorSet(0, 1, 0, 1), colorScale);
+    XMStoreFloat3(&color1, XMVectorLerp(XMVectorSet(1, 0, 0, 1), XMVectorSet(0, 0, 1, 1), colorScale));
+    XMStoreFloat3(&color2, XMVectorLerp(XMVectorSet(1, 1, 0, 1), XMVectorSet(0, 1, 0, 1), colorScale));
 
     FLOAT angle;
     _cubeAnimation->Query(&angle);
@@ -274,26 +362,56 @@ public:
     target->GetDC(&dc);
     target->GetFrameRTV(&rtv);
     target->GetFrameDSV(&dsv);
+    target->GetUploadRing(&ring);
     dc->ClearRenderTargetView(rtv, clearColor);
     dc->ClearDepthStencilView(dsv, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 255);
     dc->OMSetRenderTargets(1, &rtv, dsv);
-    vsCb.worldViewProj = _world * _view * _proj;
-    psCb.color1 = color1;
-    psCb.color2 = color2;
-    dc->UpdateSubresource(_vsCb, 0, NULL, &vsCb, 0, 0);
-    dc->UpdateSubresource(_psCb, 0, NULL, &psCb, 0, 0);
+    vsCb.worldViewProj = _instanced ? _view * _proj : _world * _view * _proj;
+    if(FAILED(ring->Upload(&vsCb, sizeof(vsCb), &vsSlice)))
+      return;
+    // Uploads nothing while the color animation is stopped.
+    _psCb.Set(&PsBuffer::color1, color1);
+    _psCb.Set(&PsBuffer::color2, color2);
+    _psCb.Update(dc);
+    psCb = _psCb.GetBuffer();
+    ring->SetConstantBuffers(D3DU_STAGE_VS, 0, 1, &vsSlice);
+    if(_software)
+    {
+      if(FAILED(UpdateTexture(dc, color1, color2)))
+        return;
+      dc->PSSetShaderResources(0, 1, &_srv);
+      dc->PSSetSamplers(0, 1, &_sampler);
+      dc->PSSetShader(_psTexture, NULL, 0);
+    }
+    else
+    {
+      dc->PSSetConstantBuffers(0, 1, &psCb);
+      dc->PSSetShader(_ps, NULL, 0);
+    }
+
+    D3D11_BUFFER_DESC ibd;
+    _ib->GetDesc(&ibd);
+    if(_instanced)
+    {
+      D3DU_MESH mesh = {0};
+      mesh.Topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+      mesh.VertexBuffer = _vb;
+      mesh.VertexStride = sizeof(Vertex);
+      mesh.IndexBuffer = _ib;
+      mesh.IndexFormat = DXGI_FORMAT_R32_UINT;
+      mesh.IndexCount = ibd.ByteWidth / sizeof(DWORD);
+      UpdateInstances(angle);
+      dc->IASetInputLayout(_ilInstanced);
+      dc->VSSetShader(_vsInstanced, NULL, 0);
+      _batch->Draw(dc, &mesh, _instances, sizeof(Instance), GRID * GRID);
+      return;
+    }
     dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
     dc->IASetInputLayout(_il);
     UINT offset = 0, stride = sizeof(Vertex);
     dc->IASetVertexBuffers(0, 1, &_vb, &stride, &offset);
     dc->IASetIndexBuffer(_ib, DXGI_FORMAT_R32_UINT, 0);
-    dc->VSSetConstantBuffers(0, 1, &_vsCb);
-    dc->PSSetConstantBuffers(0, 1, &_psCb);
     dc->VSSetShader(_vs, NULL, 0);
-    dc->PSSetShader(_ps, NULL, 0);
-    
-    D3D11_BUFFER_DESC ibd;
-    _ib->GetDesc(&ibd);
     dc->DrawIndexed(ibd.ByteWidth / sizeof(DWORD), 0, 0);
   }
 
@@ -313,6 +431,22 @@ public:
   {
   }
 
+  /// The wheel moves the camera closer or farther.
+  STDMETHOD_(void, InputEvents)(ID3DUWindowTarget *target, const D3DU_INPUT_EVENT *events, UINT count)
+  {
+    for(UINT i = 0; i < count; ++i)
+    {
+      if(D3DU_INPUT_WHEEL != events[i].Type)
+        continue;
+      _zoom *= powf(0.9f, (FLOAT)events[i].Wheel / WHEEL_DELTA);
+      if(_zoom < 0.25f)
+        _zoom = 0.25f;
+      else if(_zoom > 4.0f)
+        _zoom = 4.0f;
+      UpdateView();
+    }
+  }
+
   STDMETHOD_(void, KeyUp)(ID3DUWindowTarget *target, DWORD key, DWORD sks)
   {
     if(VK_SPACE == key)
@@ -325,25 +459,341 @@ public:
       else
         animation->Start();
     }
+    else if('I' == key)
+    {
+      _instanced = !_instanced;
+    }
+    else if('C' == key)
+    {
+      _software = !_software;
+    }
+    else if('T' == key)
+    {
+      _tracing = !_tracing;
+      D3DUTraceEnable(_tracing);
+      if(!_tracing && SUCCEEDED(D3DUTraceWrite(L"MandelbrotCube.trace.json")))
+        OutputDebugString(L"Trace written to MandelbrotCube.trace.json\n");
+    }
+    else if('R' == key)
+    {
+      D3DU_DYNAMIC_RESOLUTION_DESC desc = {0};
+      if(SUCCEEDED(target->SetDynamicResolution(_dynamicResolution ? NULL : &desc)))
+        _dynamicResolution = !_dynamicResolution;
+    }
+    else if('S' == key)
+    {
+      D3DU_TARGET_STATISTICS stats;
+      target->GetStatistics(&stats);
+      std::wstringstream s;
+      s << L"Frame " << stats.FrameCount
+        << L": " << stats.LastFrame.DrawCalls << L" draws, "
+        << stats.LastFrame.Primitives << L" primitives, "
+        << stats.LastFrame.StateChanges << L" state changes, "
+        << stats.LastFrame.BytesUploaded << L" bytes uploaded; average "
+        << stats.Average.DrawCalls << L" draws, "
+        << stats.Average.StateChanges << L" state changes\n";
+      ComPtr<ID3DUDevice> device;
+      ComPtr<ID3DUMemoryTracker> memory;
+      D3DU_MEMORY_STATISTICS memoryStats;
+      target->GetD3DUDevice(&device);
+      if(SUCCEEDED(device->GetMemoryTracker(&memory)) && SUCCEEDED(memory->GetStatistics(&memoryStats)))
+      {
+        const D3DU_MEMORY_USAGE &total = memoryStats.Usage[D3DU_MEMORY_TOTAL];
+        s << L"GPU memory: " << total.Bytes << L" bytes in "
+          << total.Allocations << L" resources, "
+          << memoryStats.Usage[D3DU_MEMORY_TARGETS].Bytes << L" of them targets; peak "
+          << total.HighWater << L" bytes\n";
+      }
+      ComPtr<ID3DUFrameStats> frameStats;
+      D3DU_FRAME_TIME_STATISTICS frameTimes;
+      if(SUCCEEDED(target->GetFrameStats(&frameStats))
+        && SUCCEEDED(frameStats->GetFrameTimes(D3DU_FRAME_TIME_INTERVAL, &frameTimes)))
+      {
+        s << L"Frame time over " << frameTimes.Samples << L" frames: p50 "
+          << frameTimes.P50 << L" ms, p95 " << frameTimes.P95 << L" ms, p99 "
+          << frameTimes.P99 << L" ms, max " << frameTimes.Max << L" ms\n";
+      }
+      OutputDebugString(s.str().c_str());
+    }
   }
 
 private:  
   BOOL _initialized;
+  BOOL _dynamicResolution;
+  BOOL _instanced;
+  BOOL _tracing;
+  BOOL _software;
+  BOOL _textureValid;
   ComPtr<ID3DUFloatAnimation> _colorAnimation;
   ComPtr<ID3DUFloatAnimation> _cubeAnimation;
   ComPtr<ID3D11Buffer> _vb;
   ComPtr<ID3D11Buffer> _ib;
-  ComPtr<ID3D11Buffer> _vsCb;
-  ComPtr<ID3D11Buffer> _psCb;
   ComPtr<ID3D11VertexShader> _vs;
   ComPtr<ID3D11PixelShader> _ps;
   ComPtr<ID3D11InputLayout> _il;
+  ComPtr<ID3D11VertexShader> _vsInstanced;
+  ComPtr<ID3D11InputLayout> _ilInstanced;
+  ComPtr<ID3DUInstanceBatch> _batch;
+  Instance *_instances;
+  D3DUConstantBuffer<PsBuffer> _psCb;
+  ComPtr<ID3D11PixelShader> _psTexture;
+  ComPtr<ID3D11Texture2D> _texture;
+  ComPtr<ID3D11ShaderResourceView> _srv;
+  ComPtr<ID3D11SamplerState> _sampler;
+  CMandelbrotRenderer _renderer;
+  XMFLOAT3 _textureColor1;
+  XMFLOAT3 _textureColor2;
   D3D11_VIEWPORT _vp;
   XMMATRIX _world;
+  FLOAT _zoom;
   XMMATRIX _view;
   XMMATRIX _proj;
+
+  /// Cubes spin with a phase growing along the wall.
+  void UpdateInstances(FLOAT angle)
+  {
+    const FLOAT spacing = 2.0f / GRID;
+    XMMATRIX scale = XMMatrixScaling(spacing * 0.4f, spacing * 0.4f, spacing * 0.4f);
+    for(UINT y = 0; y < GRID; ++y)
+    {
+      for(UINT x = 0; x < GRID; ++x)
+      {
+        FLOAT phase = angle + (x + y) * 0.05f;
+        XMMATRIX world = scale
+          * XMMatrixRotationX(phase)
+          * XMMatrixRotationY(phase)
+          * XMMatrixTranslation(-1.0f + (x + 0.5f) * spacing, -1.0f + (y + 0.5f) * spacing, 0.0f);
+        XMStoreFloat4x4(&_instances[y * GRID + x].world, world);
+      }
+    }
+  }
+
+  HRESULT InitSoftware(ID3D11Device *device, DWORD shaderFlags)
+  {
+    HRESULT hr;
+    ComPtr<ID3DBlob> blob;
+    D3D11_TEXTURE2D_DESC td = {0};
+    D3D11_SAMPLER_DESC sd;
+    hr = _renderer.Init(0);
+    if(FAILED(hr))
+      return hr;
+    td.Width = TEXTURE_SIZE;
+    td.Height = TEXTURE_SIZE;
+    td.MipLevels = 1;
+    td.ArraySize = 1;
+    td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    td.SampleDesc.Count = 1;
+    td.Usage = D3D11_USAGE_DYNAMIC;
+    td.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    td.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    hr = device->CreateTexture2D(&td, NULL, &_texture);
+    if(FAILED(hr))
+      return hr;
+    hr = device->CreateShaderResourceView(_texture, NULL, &_srv);
+    if(FAILED(hr))
+      return hr;
+    memset(&sd, 0, sizeof(sd));
+    sd.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+    sd.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+    sd.MaxLOD = D3D11_FLOAT32_MAX;
+    hr = device->CreateSamplerState(&sd, &_sampler);
+    if(FAILED(hr))
+      return hr;
+    hr = D3DUCompileFromResource(
+      GetModuleHandle(NULL),
+      MAKEINTRESOURCE(ID_SHADER),
+      MAKEINTRESOURCE(RT_SHADER),
+      "PSTexture",
+      "ps_4_0",
+      shaderFlags,
+      &blob);
+    if(FAILED(hr))
+      return hr;
+    return device->CreatePixelShader(
+      blob->GetBufferPointer(),
+      blob->GetBufferSize(),
+      NULL,
+      &_psTexture);
+  }
+
+  /// Draws the texture again unless it already has these colors.
+  HRESULT UpdateTexture(ID3D11DeviceContext *dc, const XMFLOAT3 &color1, const XMFLOAT3 &color2)
+  {
+    HRESULT hr;
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if(_textureValid
+      && !memcmp(&color1, &_textureColor1, sizeof(color1))
+      && !memcmp(&color2, &_textureColor2, sizeof(color2)))
+      return S_OK;
+    hr = dc->Map(_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped);
+    if(FAILED(hr))
+      return hr;
+    _renderer.Render((BYTE*)mapped.pData, mapped.RowPitch, TEXTURE_SIZE, TEXTURE_SIZE, &color1.x, &color2.x);
+    dc->Unmap(_texture, 0);
+    _textureColor1 = color1;
+    _textureColor2 = color2;
+    _textureValid = TRUE;
+    return S_OK;
+  }
+
+  void UpdateView()
+  {
+    XMVECTOR eye = XMVectorSet(1.0f * _zoom, 1.0f * _zoom, -3.0f * _zoom, 1.0f);
+    XMVECTOR at = XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f);
+    XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 1.0f);
+    _view = XMMatrixLookAtLH(eye, at, up);
+  }
+
+  template<class T>
+  static void Retire(ID3DUTarget *target, ComPtr<T> &object)
+  {
+    if(object)
+      target->DeferRelease(object);
+    object.Release();
+  }
 };
 
+/// Command line modes report through the library's log.
+static void LogToStderr()
+{
+  ComPtr<ID3DULogSink> log;
+  if(SUCCEEDED(D3DUCreateLogSink(D3DU_LOG_SINK_STDERR, NULL, &log)))
+    D3DUAddLogSink(log);
+  D3DUSetLogLevel(D3DU_LOG_INFO);
+}
+
+/// Draws PS with VSQuad on the GPU and compares it with what
+/// CMandelbrotRenderer draws, for the colors the animation starts with.
+/// The exit code is 0 when they agree.
+static INT Validate()
+{
+  HRESULT hr;
+  ComPtr<ID3DUDevice> d3du;
+  ComPtr<ID3D11Device> device;
+  ComPtr<ID3D11DeviceContext> dc;
+  ComPtr<ID3D11Texture2D> color;
+  ComPtr<ID3D11Texture2D> staging;
+  ComPtr<ID3D11RenderTargetView> rtv;
+  ComPtr<ID3D11VertexShader> vs;
+  ComPtr<ID3D11PixelShader> ps;
+  ComPtr<ID3DBlob> blob;
+  D3DUConstantBuffer<PsBuffer> cb;
+  D3D11_TEXTURE2D_DESC td = {0};
+  D3D11_VIEWPORT vp = {0, 0, VALIDATE_SIZE, VALIDATE_SIZE, 0, 1};
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  XMFLOAT3 color1(1, 0, 0), color2(1, 1, 0);
+  LogToStderr();
+  hr = D3DUCreateDevice(D3D_FEATURE_LEVEL_10_0, TRUE, &d3du);
+  if(FAILED(hr))
+    return 1;
+  d3du->GetDevice(&device);
+  d3du->GetDC(&dc);
+  td.Width = VALIDATE_SIZE;
+  td.Height = VALIDATE_SIZE;
+  td.MipLevels = 1;
+  td.ArraySize = 1;
+  td.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+  td.SampleDesc.Count = 1;
+  td.BindFlags = D3D11_BIND_RENDER_TARGET;
+  if(FAILED(device->CreateTexture2D(&td, NULL, &color))
+    || FAILED(device->CreateRenderTargetView(color, NULL, &rtv)))
+    return 1;
+  td.BindFlags = 0;
+  td.Usage = D3D11_USAGE_STAGING;
+  td.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  if(FAILED(device->CreateTexture2D(&td, NULL, &staging)))
+    return 1;
+  hr = D3DUCompileFromResource(GetModuleHandle(NULL), MAKEINTRESOURCE(ID_SHADER), MAKEINTRESOURCE(RT_SHADER), "VSQuad", "vs_4_0", 0, &blob);
+  if(FAILED(hr) || FAILED(device->CreateVertexShader(blob->GetBufferPointer(), blob->GetBufferSize(), NULL, &vs)))
+    return 1;
+  blob.Release();
+  hr = D3DUCompileFromResource(GetModuleHandle(NULL), MAKEINTRESOURCE(ID_SHADER), MAKEINTRESOURCE(RT_SHADER), "PS", "ps_4_0", 0, &blob);
+  if(FAILED(hr) || FAILED(device->CreatePixelShader(blob->GetBufferPointer(), blob->GetBufferSize(), NULL, &ps)))
+    return 1;
+  if(FAILED(cb.Create(device)))
+    return 1;
+  cb.Set(&PsBuffer::color1, color1);
+  cb.Set(&PsBuffer::color2, color2);
+  cb.Update(dc);
+  ID3D11Buffer *psCb = cb.GetBuffer();
+  dc->OMSetRenderTargets(1, &rtv, NULL);
+  dc->RSSetViewports(1, &vp);
+  dc->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+  dc->IASetInputLayout(NULL);
+  dc->VSSetShader(vs, NULL, 0);
+  dc->PSSetShader(ps, NULL, 0);
+  dc->PSSetConstantBuffers(0, 1, &psCb);
+  dc->Draw(3, 0);
+  dc->CopyResource(staging, color);
+  if(FAILED(dc->Map(staging, 0, D3D11_MAP_READ, 0, &mapped)))
+    return 1;
+
+  CMandelbrotRenderer renderer;
+  BYTE *cpu = new BYTE[VALIDATE_SIZE * VALIDATE_SIZE * 4];
+  renderer.Init(0);
+  renderer.Render(cpu, VALIDATE_SIZE * 4, VALIDATE_SIZE, VALIDATE_SIZE, &color1.x, &color2.x);
+  UINT different = 0;
+  INT maxError = 0;
+  for(UINT y = 0; y < VALIDATE_SIZE; ++y)
+  {
+    const BYTE *gpuRow = (const BYTE*)mapped.pData + y * mapped.RowPitch;
+    const BYTE *cpuRow = cpu + y * VALIDATE_SIZE * 4;
+    for(UINT i = 0; i < VALIDATE_SIZE * 4; i += 4)
+    {
+      INT error = 0;
+      for(UINT c = 0; c < 3; ++c)
+      {
+        INT d = abs((INT)gpuRow[i + c] - (INT)cpuRow[i + c]);
+        if(d > error)
+          error = d;
+      }
+      if(error > VALIDATE_TOLERANCE)
+        ++different;
+      if(error > maxError)
+        maxError = error;
+    }
+  }
+  dc->Unmap(staging, 0);
+  delete[] cpu;
+  BOOL passed = different * 1000 <= VALIDATE_MAX_PERMILLE * VALIDATE_SIZE * VALIDATE_SIZE;
+  CHAR text[128];
+  sprintf_s(
+    text,
+    sizeof(text),
+    "%u of %u pixels differ between PS and the CPU renderer, by at most %d.",
+    different,
+    VALIDATE_SIZE * VALIDATE_SIZE,
+    maxError);
+  D3DULogWrite(passed ? D3DU_LOG_INFO : D3DU_LOG_ERROR, text);
+  D3DUFlushLog();
+  return passed ? 0 : 1;
+}
+
+/// Draws the cube offscreen with the animations on a fixed clock, and
+/// compares the last frame and frame times with MandelbrotCube.bmp and
+/// MandelbrotCube.times in `dir', or writes them there when `update' is
+/// set. Results go to stderr; the exit code is 0 when everything matches.
+static INT Check(LPCWSTR dir, BOOL update)
+{
+  std::wstring golden = std::wstring(dir) + L"\\MandelbrotCube.bmp";
+  std::wstring baseline = std::wstring(dir) + L"\\MandelbrotCube.times";
+  D3DU_REGRESSION_DESC desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.GoldenImage = golden.c_str();
+  desc.Baseline = baseline.c_str();
+  desc.Flags = update ? D3DU_REGRESSION_UPDATE : 0;
+  LogToStderr();
+  ComPtr<ComObject<CMandelbrotCube> > sink = new ComObject<CMandelbrotCube>();
+  HRESULT hr = D3DURunRegression(sink, &desc, NULL);
+  D3DUFlushLog();
+  return S_OK == hr ? 0 : 1;
+}
+
+/// `MandelbrotCube --check dir' and `MandelbrotCube --update dir' run
+/// Check, and `MandelbrotCube --validate' runs Validate, instead of
+/// opening a window. Software adapters get the CPU renderer.
 INT WINAPI WinMain(
   HINSTANCE instance,
   HINSTANCE prevInstance,
@@ -352,6 +802,20 @@ INT WINAPI WinMain(
 {
   HRESULT hr;
   ComPtr<ID3DUWindowTarget> target;
+  INT argc;
+  LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if(argv && 3 == argc && (!wcscmp(argv[1], L"--check") || !wcscmp(argv[1], L"--update")))
+  {
+    INT code = Check(argv[2], !wcscmp(argv[1], L"--update"));
+    LocalFree(argv);
+    return code;
+  }
+  if(argv && 2 == argc && !wcscmp(argv[1], L"--validate"))
+  {
+    LocalFree(argv);
+    return Validate();
+  }
+  LocalFree(argv);
   hr = D3DUCreateWindowTarget(
     CW_USEDEFAULT,
     CW_USEDEFAULT,
@@ -369,8 +833,17 @@ INT WINAPI WinMain(
     return 1;
   }
   ComPtr<ComObject<CMandelbrotCube> > sink = new ComObject<CMandelbrotCube>();
+  ComPtr<ID3DUDevice> device;
+  ComPtr<IDXGIAdapter> adapter;
+  DXGI_ADAPTER_DESC ad;
+  target->GetD3DUDevice(&device);
+  // WARP and the reference rasterizer report Microsoft as the vendor.
+  if(SUCCEEDED(device->GetAdapter(&adapter)) && adapter
+    && SUCCEEDED(adapter->GetDesc(&ad)) && 0x1414 == ad.VendorId)
+    sink->SetSoftware(TRUE);
   target->SetFrameSink(sink);
   target->SetKeySink(sink);
+  target->SetMouseSink(sink);
   MSG msg;
   D3DU_WINDOW_STATE state;
   do
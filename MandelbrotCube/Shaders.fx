@@ -20,6 +20,7 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
 // DEALINGS IN THE SOFTWARE.
 
+// Also MANDELBROT_MAX_ITERS in Mandelbrot.hpp.
 #define MAX_ITERS 80
 
 cbuffer VsBuffer : register(b0)
@@ -36,11 +37,44 @@ void VS(float3 pos : POSITION,
     oTex = tex;
 }
 
+// worldViewProj holds view and projection only,
+// each instance brings its world matrix.
+void VSInstanced(float3 pos : POSITION,
+                 float2 tex : TEXCOORD,
+                 float4x4 world : WORLD,
+                 out float4 oPos : SV_POSITION,
+                 out float2 oTex : TEXCOORD)
+{
+    oPos = mul(worldViewProj, mul(float4(pos, 1), world));
+    oTex = tex;
+}
+
+// Covers the viewport with one triangle, texture coordinates running
+// from 0 to 1 across it, for checking PS against CMandelbrotRenderer.
+void VSQuad(uint id : SV_VertexID,
+            out float4 oPos : SV_POSITION,
+            out float2 oTex : TEXCOORD)
+{
+    oTex = float2((id << 1) & 2, id & 2);
+    oPos = float4(oTex * float2(2, -2) + float2(-1, 1), 0, 1);
+}
+
 cbuffer PsBuffer : register(b0)
 {
     float3 color1, color2;
 };
 
+// What CMandelbrotRenderer drew on the CPU.
+Texture2D mandelbrot : register(t0);
+SamplerState linearSampler : register(s0);
+
+float4 PSTexture(float4 pos : SV_POSITION,
+                 float2 tex : TEXCOORD)
+     : SV_TARGET
+{
+    return mandelbrot.Sample(linearSampler, tex);
+}
+
 float4 PS(float4 pos : SV_POSITION,
           float2 tex : TEXCOORD)
      : SV_TARGET
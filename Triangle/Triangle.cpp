@@ -159,6 +159,31 @@ private:
   D3D11_VIEWPORT vp;
 };
 
+/// Draws the triangle offscreen and compares it with Triangle.bmp and
+/// Triangle.times in `dir', or writes them there when `update' is set.
+/// Results go to stderr; the exit code is 0 when everything matches.
+static INT Check(const D3DU_TARGET_DESC *targetDesc, LPCWSTR dir, BOOL update)
+{
+  std::wstring golden = std::wstring(dir) + L"\\Triangle.bmp";
+  std::wstring baseline = std::wstring(dir) + L"\\Triangle.times";
+  ComPtr<ID3DULogSink> log;
+  D3DU_REGRESSION_DESC desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.TargetDesc = targetDesc;
+  desc.GoldenImage = golden.c_str();
+  desc.Baseline = baseline.c_str();
+  desc.Flags = update ? D3DU_REGRESSION_UPDATE : 0;
+  if(SUCCEEDED(D3DUCreateLogSink(D3DU_LOG_SINK_STDERR, NULL, &log)))
+    D3DUAddLogSink(log);
+  D3DUSetLogLevel(D3DU_LOG_INFO);
+  ComPtr< ComObject<CTriangle> > sink = new ComObject<CTriangle>();
+  HRESULT hr = D3DURunRegression(sink, &desc, NULL);
+  D3DUFlushLog();
+  return S_OK == hr ? 0 : 1;
+}
+
+/// `Triangle --check dir' and `Triangle --update dir' run Check
+/// instead of opening a window.
 INT WINAPI wWinMain(
   HINSTANCE instance,
   HINSTANCE prevInstance,
@@ -166,15 +191,40 @@ INT WINAPI wWinMain(
   INT cmdShow)
 {
   HRESULT hr;
+  ComPtr<ID3DUDevice> device;
   ComPtr<ID3DUWindowTarget> target;
-  hr = D3DUCreateWindowTarget(
+  // The triangle needs neither depth nor multisampling.
+  D3DU_TARGET_DESC desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+  desc.DepthFormat = DXGI_FORMAT_UNKNOWN;
+  desc.SampleCount = 1;
+  desc.BufferCount = 1;
+  INT argc;
+  LPWSTR *argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+  if(argv && 3 == argc && (!wcscmp(argv[1], L"--check") || !wcscmp(argv[1], L"--update")))
+  {
+    INT code = Check(&desc, argv[2], !wcscmp(argv[1], L"--update"));
+    LocalFree(argv);
+    return code;
+  }
+  LocalFree(argv);
+  hr = D3DUCreateDevice(D3D_FEATURE_LEVEL_10_0, TRUE, &device);
+  if(FAILED(hr))
+  {
+    std::wstringstream s;
+    s << "Failed to create Device: " << hr;
+    MessageBox(NULL, s.str().c_str(), L"Error", MB_ICONERROR);
+    return 1;
+  }
+  hr = D3DUCreateWindowTargetEx(
+    device,
     CW_USEDEFAULT,
     CW_USEDEFAULT,
     640,
     480,
     NULL,
-    D3D_FEATURE_LEVEL_10_0,
-    TRUE,
+    &desc,
     &target);
   if(FAILED(hr))
   {